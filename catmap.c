@@ -0,0 +1,190 @@
+/* 
+ * Copyright (c) 2019, Exile Heavy Industries
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted (subject to the limitations in the disclaimer
+ * below) provided that the following conditions are met:
+ * 
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ * 
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * 
+ * * Neither the name of the copyright holder nor the names of its contributors may be used
+ *   to endorse or promote products derived from this software without specific
+ *   prior written permission.
+ * 
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY THIS
+ * LICENSE. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#ifndef NOMBRE_H
+#include "nombre.h"
+#endif
+#ifndef NOMBRE_CATMAP_H
+#include "catmap.h"
+#endif
+#ifndef NOMBRE_NOMTRACE_H
+#include "nomtrace.h"
+#endif
+
+extern char *__progname;
+extern bool dbg;
+
+static inline uint64_t cathash(const char * restrict name);
+
+/*
+ * Read the whole categories table into cmdbuf->catmap.
+ * Names are compared without regard to (ASCII) case, matching the
+ * LIKE() comparisons the cache replaces.
+ */
+int
+nom_catload(nomcmd * restrict cmdbuf) {
+	int retc;
+	size_t nslots, namelen, used;
+	nomcat *map;
+	sqlite3_stmt *stmt;
+	struct nomcat_ent *slot;
+	retc = 0; nslots = 0; namelen = 0; used = 0;
+	map = NULL; stmt = NULL; slot = NULL;
+
+	if (cmdbuf == NULL || cmdbuf->dbcon == NULL) {
+		NOMERR("%s\n", "Invalid Parameters!");
+		return(BADARGS);
+	}
+	if (cmdbuf->catmap != NULL) {
+		return(NOM_OK);
+	}
+	/* Size everything up front so the map is built from two allocations */
+	retc = sqlite3_prepare_v2(cmdbuf->dbcon, "SELECT count(*), total(length(name) + 1) FROM categories;", -1, &stmt, NULL);
+	if (retc != SQLITE_OK || sqlite3_step(stmt) != SQLITE_ROW) {
+		NOMERR("Unable to read categories (%s)!\n", sqlite3_errmsg(cmdbuf->dbcon));
+		sqlite3_finalize(stmt);
+		return(NOM_FAIL);
+	}
+	for (nslots = 8; nslots < (size_t)sqlite3_column_int64(stmt, 0) * 2; nslots <<= 1) { ; }
+	namelen = (size_t)sqlite3_column_int64(stmt, 1);
+	sqlite3_finalize(stmt); stmt = NULL;
+
+	if ((map = calloc(1, sizeof(*map))) == NULL ||
+			(map->slots = calloc(nslots, sizeof(*map->slots))) == NULL ||
+			(map->names = malloc(namelen + 1)) == NULL) {
+		NOMERR("%s\n", "Unable to allocate the category map!");
+		retc = NOM_FAIL;
+		goto CATLOAD_EXIT;
+	}
+	map->mask = nslots - 1;
+
+	if ((retc = sqlite3_prepare_v2(cmdbuf->dbcon, "SELECT id, name FROM categories;", -1, &stmt, NULL)) != SQLITE_OK) {
+		NOMERR("Unable to read categories (%s)!\n", sqlite3_errmsg(cmdbuf->dbcon));
+		goto CATLOAD_EXIT;
+	}
+	while ((retc = sqlite3_step(stmt)) == SQLITE_ROW) {
+		const char *name = (const char *)sqlite3_column_text(stmt, 1);
+		size_t len = (size_t)sqlite3_column_bytes(stmt, 1);
+		/* Guard against the table changing between the two queries */
+		if (name == NULL || used + len + 1 > namelen + 1 || map->count * 2 >= nslots) {
+			break;
+		}
+		memcpy(&map->names[used], name, len + 1);
+		for (register size_t i = cathash(name) & map->mask;; i = (i + 1) & map->mask) {
+			if (map->slots[i].hash == 0) {
+				slot = &map->slots[i];
+				break;
+			}
+		}
+		slot->hash = cathash(name);
+		slot->id = sqlite3_column_int64(stmt, 0);
+		slot->name = &map->names[used];
+		used += len + 1;
+		map->count++;
+	}
+	retc = (retc == SQLITE_DONE || retc == SQLITE_ROW) ? NOM_OK : retc;
+
+CATLOAD_EXIT:
+	sqlite3_finalize(stmt);
+	if (retc == NOM_OK) {
+		cmdbuf->catmap = map;
+	} else if (map != NULL) {
+		free(map->slots); free(map->names); free(map);
+	}
+	if (dbg) {
+		NOMDBG("Returning %d to caller with %zu categories in %zu slots\n", retc, (map != NULL && retc == NOM_OK) ? map->count : 0, nslots);
+	}
+	return(retc);
+}
+
+/*
+ * Resolve a category name to its id, loading the map on first use.
+ * Returns NOM_INVALID for names that are not in the table.
+ */
+int
+nom_catid(nomcmd * restrict cmdbuf, const char * restrict name, int64_t * restrict id) {
+	int retc;
+	uint64_t hash;
+	const nomcat *map;
+	retc = NOM_INVALID;
+
+	if (cmdbuf == NULL || name == NULL || id == NULL) {
+		return(BADARGS);
+	}
+	if (cmdbuf->catmap == NULL && (retc = nom_catload(cmdbuf)) != NOM_OK) {
+		return(retc);
+	}
+	map = cmdbuf->catmap;
+	hash = cathash(name);
+	retc = NOM_INVALID;
+	for (register size_t i = hash & map->mask; map->slots[i].hash != 0; i = (i + 1) & map->mask) {
+		if (map->slots[i].hash == hash && strcasecmp(map->slots[i].name, name) == 0) {
+			*id = map->slots[i].id;
+			retc = NOM_OK;
+			break;
+		}
+	}
+	NOMTRACE("id/retc", (retc == NOM_OK) ? *id : -2, retc);
+	return(retc);
+}
+
+void
+nom_catfree(nomcmd * restrict cmdbuf) {
+	if (cmdbuf != NULL && cmdbuf->catmap != NULL) {
+		free(cmdbuf->catmap->slots);
+		free(cmdbuf->catmap->names);
+		free(cmdbuf->catmap);
+		cmdbuf->catmap = NULL;
+	}
+}
+
+/* 
+ * FNV-1a over the upper-cased name, forced nonzero so that
+ * a zero hash can mark an empty slot
+ */
+static inline uint64_t
+cathash(const char * restrict name) {
+	register uint64_t hash = 0xcbf29ce484222325ULL;
+	for (; *name != 0; name++) {
+		hash ^= (uint64_t)(uint8_t)((*name >= 'a' && *name <= 'z') ? *name ^ 0x20 : *name);
+		hash *= 0x100000001b3ULL;
+	}
+	return((hash != 0) ? hash : 1);
+}
@@ -0,0 +1,59 @@
+/* 
+ * Copyright (c) 2019, Exile Heavy Industries
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted (subject to the limitations in the disclaimer
+ * below) provided that the following conditions are met:
+ * 
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ * 
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * 
+ * * Neither the name of the copyright holder nor the names of its contributors may be used
+ *   to endorse or promote products derived from this software without specific
+ *   prior written permission.
+ * 
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY THIS
+ * LICENSE. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+#define NOMBRE_CATMAP_H
+
+#ifndef NOMBRE_H
+#include "nombre.h"
+#endif
+
+/* 
+ * The categories table is tiny and read by nearly every grouped command,
+ * so it is pulled into an open addressed hash table once per connection
+ * and names are resolved to ids in process rather than by subquery.
+ */
+struct nomcat_ent {
+	uint64_t hash; /* FNV-1a of the upper-cased name, 0 marks an empty slot */
+	int64_t id;
+	char *name;
+};
+
+typedef struct nomcat_t {
+	size_t mask; /* Slot count - 1, slot count is always a power of two */
+	size_t count;
+	struct nomcat_ent *slots;
+	char *names; /* Single allocation holding every name */
+} nomcat;
+
+int nom_catload(nomcmd * restrict cmdbuf);
+int nom_catid(nomcmd * restrict cmdbuf, const char * restrict name, int64_t * restrict id);
+void nom_catfree(nomcmd * restrict cmdbuf);
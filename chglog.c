@@ -0,0 +1,455 @@
+/* 
+ * Copyright (c) 2019, Exile Heavy Industries
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted (subject to the limitations in the disclaimer
+ * below) provided that the following conditions are met:
+ * 
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ * 
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * 
+ * * Neither the name of the copyright holder nor the names of its contributors may be used
+ *   to endorse or promote products derived from this software without specific
+ *   prior written permission.
+ * 
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY THIS
+ * LICENSE. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+/*
+ * Delta export, apply and compaction of the change log, see chglog.h
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifndef NOMBRE_H
+#include "nombre.h"
+#endif
+#ifndef NOMBRE_CHGLOG_H
+#include "chglog.h"
+#endif
+#ifndef NOMBRE_EXPORT_H
+#include "export.h"
+#endif
+#ifndef NOMBRE_IMPORT_H
+#include "import.h"
+#endif
+
+/* Most columns any replicated table has */
+#define CHG_MAXCOLS 5
+
+extern char *__progname;
+extern bool dbg;
+
+struct chgtbl {
+	const char *name;
+	const char *select; /* Current state of the changed keys, see chglog.h */
+	const char *upsert;
+	const char *insert; /* Run when upsert is an UPDATE that matched nothing */
+	const char *delete;
+	int nkeys; /* Leading columns that identify a row */
+	int ncols;
+	bool hexkey; /* The first key is a blob, written in hex */
+};
+
+/* In parent to child order, upserts walk it forwards and deletes backwards */
+static const struct chgtbl chgtbls[] = {
+	{ "categories", NOMBRE_CHG_CATS,
+		"INSERT INTO categories (id, name) VALUES (?1, ?2) ON CONFLICT (id) DO UPDATE SET name = excluded.name;", NULL,
+		"DELETE FROM categories WHERE id = ?1;", 1, 2, false },
+	/* Inserting a term that exists files it as an alternate (definitions_altdef), so update first */
+	{ "definitions", NOMBRE_CHG_DEFS,
+		"UPDATE definitions SET meaning = ?2, category = ?3 WHERE term = ?1;",
+		"INSERT INTO definitions (term, meaning, category) VALUES (?1, ?2, ?3);",
+		"DELETE FROM definitions WHERE term = ?1;", 1, 3, false },
+	{ "altdefs", NOMBRE_CHG_ALTS,
+		"INSERT INTO altdefs (termid, defno, altdef, category) SELECT id, ?2, ?3, ?4 FROM definitions WHERE term = ?1"
+		" ON CONFLICT (termid, defno) DO UPDATE SET altdef = excluded.altdef, category = excluded.category;", NULL,
+		"DELETE FROM altdefs WHERE termid = (SELECT id FROM definitions WHERE term = ?1) AND defno = ?2;", 2, 4, false },
+	/* The category column is kept for older deltas, a reference takes its definition's */
+	{ "defrefs", NOMBRE_CHG_REFS,
+		"INSERT INTO defrefs (idhash, defno, termid, source) SELECT ?1, ?2, id, ?5 FROM definitions WHERE term = ?3"
+		" ON CONFLICT (idhash) DO UPDATE SET defno = excluded.defno, termid = excluded.termid, source = excluded.source;", NULL,
+		"DELETE FROM defrefs WHERE idhash = ?1;", 1, 5, true }
+};
+#define CHG_NTBLS (sizeof(chgtbls) / sizeof(chgtbls[0]))
+
+static int chghead(sqlite3 * restrict db, int64_t * restrict head, int64_t * restrict floor);
+static int chgstatus(nomcmd * restrict cmdbuf);
+static int chgexport(nomcmd * restrict cmdbuf);
+static int chgrows(sqlite3 * restrict db, FILE * restrict out, const struct chgtbl * restrict tbl, int64_t since, int present, int64_t * restrict rows);
+static int chgapply(nomcmd * restrict cmdbuf);
+static int chgline(sqlite3 * restrict db, sqlite3_stmt *stmts[][3], char * restrict line, int64_t * restrict ups, int64_t * restrict dels);
+static int chgcompact(nomcmd * restrict cmdbuf);
+static size_t unhex(const char * restrict hex, unsigned char * restrict out);
+
+/*
+ * With -f, write the changes since --since to that file, or apply it with
+ * --apply. --compact trims the log, and with neither the log's position is shown.
+ */
+int
+nomdb_chg(nomcmd * restrict cmdbuf) {
+	if (dbg) {
+		NOMDBG("Entering with cmdbuf = %p, chgop = %u\n", (void *)cmdbuf, (cmdbuf != NULL) ? cmdbuf->chgop : 0);
+	}
+	if (cmdbuf == NULL || cmdbuf->dbcon == NULL) {
+		NOMERR("%s", "Given invalid input!\n");
+		return(BADARGS);
+	}
+	if (cmdbuf->chgop == NOMBRE_CHG_COMPACT) {
+		return(chgcompact(cmdbuf));
+	}
+	if (cmdbuf->filedata[NOMBRE_IOFILE][0] == 0) {
+		if (cmdbuf->chgop == NOMBRE_CHG_APPLY) {
+			NOMERR("%s\n", "Applying a delta needs the file given with -f!");
+			return(BADARGS);
+		}
+		return(chgstatus(cmdbuf));
+	}
+	return((cmdbuf->chgop == NOMBRE_CHG_APPLY) ? chgapply(cmdbuf) : chgexport(cmdbuf));
+}
+
+/* Newest sequence handed out so far, and the oldest a delta may start from */
+static int
+chghead(sqlite3 * restrict db, int64_t * restrict head, int64_t * restrict floor) {
+	int retc;
+	sqlite3_stmt *stmt;
+	stmt = NULL;
+
+	if ((retc = sqlite3_prepare_v2(db, NOMBRE_CHG_HEAD, -1, &stmt, NULL)) == SQLITE_OK &&
+			(retc = sqlite3_step(stmt)) == SQLITE_ROW) {
+		*head = sqlite3_column_int64(stmt, 0);
+		*floor = sqlite3_column_int64(stmt, 1);
+		retc = SQLITE_OK;
+	} else {
+		NOMERR("Unable to read the change log position (%s)!\n", sqlite3_errmsg(db));
+	}
+	sqlite3_finalize(stmt);
+	return(retc);
+}
+
+static int
+chgstatus(nomcmd * restrict cmdbuf) {
+	int retc;
+	int64_t head, floor, count;
+	sqlite3_stmt *stmt;
+	head = floor = count = 0; stmt = NULL;
+
+	if ((retc = chghead(cmdbuf->dbcon, &head, &floor)) != SQLITE_OK) {
+		return(retc);
+	}
+	if ((retc = sqlite3_prepare_v2(cmdbuf->dbcon, NOMBRE_CHG_COUNT, -1, &stmt, NULL)) == SQLITE_OK &&
+			(retc = sqlite3_step(stmt)) == SQLITE_ROW) {
+		count = sqlite3_column_int64(stmt, 0);
+		retc = SQLITE_OK;
+	}
+	sqlite3_finalize(stmt);
+	if (retc == SQLITE_OK) {
+		fprintf(stdout, "Change log at sequence %lld with %lld entries, deltas can start from %lld\n",
+				(long long)head, (long long)count, (long long)floor);
+	}
+	return(retc);
+}
+
+/*
+ * Write the delta from a single read transaction, so the header's upper
+ * sequence matches exactly the changes the file holds
+ */
+static int
+chgexport(nomcmd * restrict cmdbuf) {
+	int retc;
+	int64_t head, floor, rows;
+	FILE *out;
+	head = floor = rows = 0; out = NULL;
+
+	if ((retc = sqlite3_exec(cmdbuf->dbcon, "BEGIN;", NULL, NULL, NULL)) != SQLITE_OK ||
+			(retc = chghead(cmdbuf->dbcon, &head, &floor)) != SQLITE_OK) {
+		goto CHGEXPORT_EXIT;
+	}
+	if (cmdbuf->since < floor) {
+		NOMERR("Changes up to %lld have been compacted away, take a full export instead!\n", (long long)floor);
+		retc = NOM_INVALID;
+		goto CHGEXPORT_EXIT;
+	}
+	if ((out = fopen(cmdbuf->filedata[NOMBRE_IOFILE], "w")) == NULL) {
+		NOMERR("Unable to open %s! (%s)\n", cmdbuf->filedata[NOMBRE_IOFILE], strerror(errno));
+		retc = NOM_FIO_FAIL;
+		goto CHGEXPORT_EXIT;
+	}
+	fprintf(out, "%s\t%lld\t%lld\n", NOMBRE_CHG_MAGIC, (long long)cmdbuf->since, (long long)head);
+	for (size_t i = 0; i < CHG_NTBLS && retc == SQLITE_OK; i++) {
+		retc = chgrows(cmdbuf->dbcon, out, &chgtbls[i], cmdbuf->since, 1, &rows);
+	}
+	for (size_t i = CHG_NTBLS; i > 0 && retc == SQLITE_OK; i--) {
+		retc = chgrows(cmdbuf->dbcon, out, &chgtbls[i - 1], cmdbuf->since, 0, &rows);
+	}
+	if (ferror(out)) {
+		retc = NOM_FIO_FAIL;
+	}
+	if (fclose(out) != 0 && retc == SQLITE_OK) {
+		retc = NOM_FIO_FAIL;
+	}
+	if (retc != SQLITE_OK) {
+		NOMERR("Unable to write %s! (%s)\n", cmdbuf->filedata[NOMBRE_IOFILE], (retc == NOM_FIO_FAIL) ? strerror(errno) : sqlite3_errmsg(cmdbuf->dbcon));
+		unlink(cmdbuf->filedata[NOMBRE_IOFILE]);
+	} else {
+		fprintf(stdout, "Wrote %lld changes (sequence %lld to %lld) to %s\n",
+				(long long)rows, (long long)cmdbuf->since, (long long)head, cmdbuf->filedata[NOMBRE_IOFILE]);
+	}
+
+CHGEXPORT_EXIT:
+	sqlite3_exec(cmdbuf->dbcon, "COMMIT;", NULL, NULL, NULL);
+	return(retc);
+}
+
+/* One table's upserts (present = 1) or deletes (present = 0) */
+static int
+chgrows(sqlite3 * restrict db, FILE * restrict out, const struct chgtbl * restrict tbl, int64_t since, int present, int64_t * restrict rows) {
+	int retc, ncols;
+	const unsigned char *blob;
+	sqlite3_stmt *stmt;
+	ncols = (present != 0) ? tbl->ncols : tbl->nkeys; stmt = NULL;
+
+	if ((retc = sqlite3_prepare_v2(db, tbl->select, -1, &stmt, NULL)) != SQLITE_OK ||
+			(retc = sqlite3_bind_int64(stmt, sqlite3_bind_parameter_index(stmt, ":since"), since)) != SQLITE_OK ||
+			(retc = sqlite3_bind_int(stmt, sqlite3_bind_parameter_index(stmt, ":present"), present)) != SQLITE_OK) {
+		sqlite3_finalize(stmt);
+		return(retc);
+	}
+	while ((retc = sqlite3_step(stmt)) == SQLITE_ROW) {
+		fprintf(out, "%s\t%c", tbl->name, (present != 0) ? 'U' : 'D');
+		for (int i = 0; i < ncols; i++) {
+			putc('\t', out);
+			if (i == 0 && tbl->hexkey) {
+				blob = sqlite3_column_blob(stmt, 0);
+				for (int j = 0; j < sqlite3_column_bytes(stmt, 0); j++) {
+					fprintf(out, "%02x", blob[j]);
+				}
+			} else {
+				nom_tsvput(out, sqlite3_column_text(stmt, i));
+			}
+		}
+		putc('\n', out);
+		(*rows)++;
+	}
+	sqlite3_finalize(stmt);
+	return((retc == SQLITE_DONE) ? SQLITE_OK : retc);
+}
+
+/*
+ * Apply a delta in one transaction, any bad line rolls the whole file back
+ */
+static int
+chgapply(nomcmd * restrict cmdbuf) {
+	int retc;
+	long long since, upto;
+	int64_t ups, dels;
+	unsigned int lineno;
+	size_t cap;
+	ssize_t len;
+	char *line;
+	FILE *in;
+	sqlite3_stmt *stmts[CHG_NTBLS][3];
+	retc = SQLITE_OK; since = upto = 0; ups = dels = 0; lineno = 1; cap = 0;
+	line = NULL; in = NULL;
+	memset(stmts, 0, sizeof(stmts));
+
+	if ((in = fopen(cmdbuf->filedata[NOMBRE_IOFILE], "r")) == NULL) {
+		NOMERR("Unable to open %s! (%s)\n", cmdbuf->filedata[NOMBRE_IOFILE], strerror(errno));
+		return(NOM_FIO_FAIL);
+	}
+	if (getline(&line, &cap, in) < 0 || sscanf(line, NOMBRE_CHG_MAGIC "\t%lld\t%lld", &since, &upto) != 2) {
+		NOMERR("%s is not a delta file!\n", cmdbuf->filedata[NOMBRE_IOFILE]);
+		retc = NOM_INVALID;
+		goto CHGAPPLY_EXIT;
+	}
+	if ((retc = sqlite3_exec(cmdbuf->dbcon, "BEGIN IMMEDIATE;", NULL, NULL, NULL)) != SQLITE_OK) {
+		NOMERR("Unable to lock the database (%s)!\n", sqlite3_errmsg(cmdbuf->dbcon));
+		goto CHGAPPLY_EXIT;
+	}
+	while ((len = getline(&line, &cap, in)) > 0) {
+		lineno++;
+		if (line[len - 1] == '\n') {
+			line[--len] = 0;
+		}
+		if (len > 0 && (retc = chgline(cmdbuf->dbcon, stmts, line, &ups, &dels)) != SQLITE_OK) {
+			NOMERR("Line %u of %s: %s\n", lineno, cmdbuf->filedata[NOMBRE_IOFILE],
+					(retc == NOM_INVALID) ? "malformed record" : sqlite3_errmsg(cmdbuf->dbcon));
+			break;
+		}
+	}
+	if (retc == SQLITE_OK && ferror(in)) {
+		NOMERR("Unable to read %s! (%s)\n", cmdbuf->filedata[NOMBRE_IOFILE], strerror(errno));
+		retc = NOM_FIO_FAIL;
+	}
+	for (size_t i = 0; i < CHG_NTBLS; i++) {
+		for (size_t j = 0; j < 3; j++) {
+			sqlite3_finalize(stmts[i][j]);
+		}
+	}
+	if (retc == SQLITE_OK && (retc = sqlite3_exec(cmdbuf->dbcon, "COMMIT;", NULL, NULL, NULL)) == SQLITE_OK) {
+		fprintf(stdout, "Applied %lld upserts and %lld deletes (sequence %lld to %lld) from %s\n",
+				(long long)ups, (long long)dels, since, upto, cmdbuf->filedata[NOMBRE_IOFILE]);
+	} else {
+		sqlite3_exec(cmdbuf->dbcon, "ROLLBACK;", NULL, NULL, NULL);
+	}
+
+CHGAPPLY_EXIT:
+	free(line);
+	fclose(in);
+	return(retc);
+}
+
+/* Parse and apply one record, preparing each table's statements on first use */
+static int
+chgline(sqlite3 * restrict db, sqlite3_stmt *stmts[][3], char * restrict line, int64_t * restrict ups, int64_t * restrict dels) {
+	int retc, nfields, slot;
+	char *fields[CHG_MAXCOLS + 2], *next;
+	const struct chgtbl *tbl;
+	sqlite3_stmt *stmt;
+	unsigned char *key;
+	size_t t, keylen;
+	retc = SQLITE_OK; nfields = 0; slot = 0; tbl = NULL; stmt = NULL; key = NULL; keylen = 0;
+
+	for (next = line; next != NULL && nfields < CHG_MAXCOLS + 2; nfields++) {
+		fields[nfields] = next;
+		next = nom_tsvfield(next);
+	}
+	for (t = 0; nfields >= 2 && t < CHG_NTBLS && strcmp(fields[0], chgtbls[t].name) != 0; t++);
+	if (next != NULL || nfields < 3 || t == CHG_NTBLS || fields[1][1] != 0 ||
+			(fields[1][0] != 'U' && fields[1][0] != 'D')) {
+		return(NOM_INVALID);
+	}
+	tbl = &chgtbls[t];
+	slot = (fields[1][0] == 'U') ? 0 : 2;
+	if (nfields - 2 != ((slot == 0) ? tbl->ncols : tbl->nkeys)) {
+		return(NOM_INVALID);
+	}
+	if (stmts[t][slot] == NULL && (retc = sqlite3_prepare_v2(db, (slot == 0) ? tbl->upsert : tbl->delete, -1, &stmts[t][slot], NULL)) != SQLITE_OK) {
+		return(retc);
+	}
+	stmt = stmts[t][slot];
+	for (int i = 0; i < nfields - 2 && retc == SQLITE_OK; i++) {
+		if (i == 0 && tbl->hexkey) {
+			keylen = strlen(fields[2]);
+			if ((keylen & 1) != 0 || (key = malloc(keylen / 2 + 1)) == NULL || unhex(fields[2], key) != keylen / 2) {
+				free(key);
+				return(NOM_INVALID);
+			}
+			retc = sqlite3_bind_blob(stmt, 1, key, (int)(keylen / 2), free);
+		} else {
+			/* Column affinity turns numeric text back into integers */
+			retc = sqlite3_bind_text(stmt, i + 1, fields[i + 2], -1, SQLITE_STATIC);
+		}
+	}
+	if (retc == SQLITE_OK && (retc = sqlite3_step(stmt)) == SQLITE_DONE) {
+		retc = SQLITE_OK;
+		if (slot == 0 && tbl->insert != NULL && sqlite3_changes(db) == 0) {
+			/* The row didn't exist yet, insert it with the same values */
+			if (stmts[t][1] == NULL && (retc = sqlite3_prepare_v2(db, tbl->insert, -1, &stmts[t][1], NULL)) != SQLITE_OK) {
+				return(retc);
+			}
+			for (int i = 0; i < nfields - 2 && retc == SQLITE_OK; i++) {
+				retc = sqlite3_bind_text(stmts[t][1], i + 1, fields[i + 2], -1, SQLITE_STATIC);
+			}
+			if (retc == SQLITE_OK && (retc = sqlite3_step(stmts[t][1])) == SQLITE_DONE) {
+				retc = SQLITE_OK;
+			}
+			sqlite3_reset(stmts[t][1]);
+		}
+	}
+	sqlite3_reset(stmt);
+	sqlite3_clear_bindings(stmt);
+	if (retc == SQLITE_OK) {
+		(slot == 0) ? (*ups)++ : (*dels)++;
+	}
+	return(retc);
+}
+
+/*
+ * Drop every entry superseded by a newer one for the same key, which never
+ * changes what a delta contains. --upto N also drops everything up to N, and
+ * deltas starting before N are refused from then on.
+ */
+static int
+chgcompact(nomcmd * restrict cmdbuf) {
+	int retc;
+	int64_t head, floor, before;
+	bool moved;
+	sqlite3_stmt *stmt;
+	head = floor = 0; moved = false; stmt = NULL;
+	before = sqlite3_total_changes64(cmdbuf->dbcon);
+
+	if ((retc = sqlite3_exec(cmdbuf->dbcon, "BEGIN IMMEDIATE;", NULL, NULL, NULL)) != SQLITE_OK ||
+			(retc = chghead(cmdbuf->dbcon, &head, &floor)) != SQLITE_OK) {
+		goto CHGCOMPACT_EXIT;
+	}
+	if (cmdbuf->upto > floor) {
+		floor = (cmdbuf->upto < head) ? cmdbuf->upto : head;
+		if ((retc = sqlite3_prepare_v2(cmdbuf->dbcon, NOMBRE_CHG_TRUNC, -1, &stmt, NULL)) != SQLITE_OK ||
+				(retc = sqlite3_bind_int64(stmt, 1, floor)) != SQLITE_OK ||
+				(retc = sqlite3_step(stmt)) != SQLITE_DONE) {
+			goto CHGCOMPACT_EXIT;
+		}
+		sqlite3_finalize(stmt);
+		stmt = NULL;
+		if ((retc = sqlite3_prepare_v2(cmdbuf->dbcon, "UPDATE changelog_floor SET seq = ?1 WHERE id = 0;", -1, &stmt, NULL)) != SQLITE_OK ||
+				(retc = sqlite3_bind_int64(stmt, 1, floor)) != SQLITE_OK ||
+				(retc = sqlite3_step(stmt)) != SQLITE_DONE) {
+			goto CHGCOMPACT_EXIT;
+		}
+		moved = true;
+	}
+	retc = sqlite3_exec(cmdbuf->dbcon, NOMBRE_CHG_DEDUP, NULL, NULL, NULL);
+
+CHGCOMPACT_EXIT:
+	sqlite3_finalize(stmt);
+	if ((retc == SQLITE_OK || retc == SQLITE_DONE) && (retc = sqlite3_exec(cmdbuf->dbcon, "COMMIT;", NULL, NULL, NULL)) == SQLITE_OK) {
+		/* The floor update is one of the changes */
+		fprintf(stdout, "Removed %lld change log entries, deltas can start from %lld\n",
+				(long long)(sqlite3_total_changes64(cmdbuf->dbcon) - before - (moved ? 1 : 0)), (long long)floor);
+	} else {
+		NOMERR("Unable to compact the change log (%s)!\n", sqlite3_errmsg(cmdbuf->dbcon));
+		sqlite3_exec(cmdbuf->dbcon, "ROLLBACK;", NULL, NULL, NULL);
+	}
+	return(retc);
+}
+
+/* Decode a hex string into out, returning the number of bytes written */
+static size_t
+unhex(const char * restrict hex, unsigned char * restrict out) {
+	size_t n;
+	int hi, lo;
+	n = 0;
+
+	for (; hex[0] != 0 && hex[1] != 0; hex += 2, n++) {
+		hi = (hex[0] >= 'a') ? hex[0] - 'a' + 10 : (hex[0] >= 'A') ? hex[0] - 'A' + 10 : hex[0] - '0';
+		lo = (hex[1] >= 'a') ? hex[1] - 'a' + 10 : (hex[1] >= 'A') ? hex[1] - 'A' + 10 : hex[1] - '0';
+		if (hi < 0 || hi > 15 || lo < 0 || lo > 15) {
+			break;
+		}
+		out[n] = (unsigned char)((hi << 4) | lo);
+	}
+	return(n);
+}
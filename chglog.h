@@ -0,0 +1,86 @@
+/* 
+ * Copyright (c) 2019, Exile Heavy Industries
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted (subject to the limitations in the disclaimer
+ * below) provided that the following conditions are met:
+ * 
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ * 
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * 
+ * * Neither the name of the copyright holder nor the names of its contributors may be used
+ *   to endorse or promote products derived from this software without specific
+ *   prior written permission.
+ * 
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY THIS
+ * LICENSE. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#define NOMBRE_CHGLOG_H
+
+#ifndef NOMBRE_H
+#include "nombre.h"
+#endif
+
+/*
+ * Incremental replication through the changelog table. Triggers log the key
+ * of every row inserted, updated or deleted in definitions, altdefs, defrefs
+ * and categories. A delta file holds the current state of every key changed
+ * since a sequence number: an upsert if the row still exists, a delete if
+ * not. Applying one is idempotent, so a delta can be replayed or two
+ * overlapping ones applied in any order that ends with the newest.
+ *
+ * Delta file layout (TSV, escaped like exports, idhash in hex):
+ *   #nombre-delta	SINCE	UPTO
+ *   TABLE	U	columns...
+ *   TABLE	D	key columns...
+ * Upserts come parents first (categories, definitions, altdefs, defrefs),
+ * deletes children first, so foreign keys hold at every step.
+ */
+#define NOMBRE_CHG_MAGIC "#nombre-delta"
+
+/* cmdbuf->chgop */
+#define NOMBRE_CHG_STATUS 0x00
+#define NOMBRE_CHG_APPLY 0x01
+#define NOMBRE_CHG_COMPACT 0x02
+
+#define NOMBRE_CHG_HEAD "SELECT COALESCE((SELECT seq FROM sqlite_sequence WHERE name = 'changelog'), 0)," \
+	" (SELECT seq FROM changelog_floor WHERE id = 0);"
+#define NOMBRE_CHG_COUNT "SELECT count(*) FROM changelog;"
+/* Current state of every key changed after :since, :present picks upserts (1) or deletes (0) */
+#define NOMBRE_CHG_DEFS "SELECT c.rowkey, d.meaning, d.category FROM" \
+	" (SELECT DISTINCT rowkey FROM changelog WHERE tbl = 'definitions' AND seq > :since) AS c" \
+	" LEFT JOIN definitions AS d ON d.term = c.rowkey WHERE (d.term IS NOT NULL) = :present;"
+#define NOMBRE_CHG_ALTS "SELECT c.rowkey, c.defno, a.altdef, a.category FROM" \
+	" (SELECT DISTINCT rowkey, defno FROM changelog WHERE tbl = 'altdefs' AND seq > :since) AS c" \
+	" LEFT JOIN definitions AS d ON d.term = c.rowkey LEFT JOIN altdefs AS a ON a.termid = d.id AND a.defno = c.defno" \
+	" WHERE (a.termid IS NOT NULL) = :present;"
+/* Rows carry the term and category rather than the local id, which differs between copies */
+#define NOMBRE_CHG_REFS "SELECT c.rowkey, r.defno, d.term," \
+	" COALESCE((SELECT category FROM altdefs WHERE termid = r.termid AND defno = r.defno), d.category), r.source FROM" \
+	" (SELECT DISTINCT rowkey FROM changelog WHERE tbl = 'defrefs' AND seq > :since) AS c" \
+	" LEFT JOIN defrefs AS r ON r.idhash = c.rowkey LEFT JOIN definitions AS d ON d.id = r.termid WHERE (r.idhash IS NOT NULL) = :present;"
+#define NOMBRE_CHG_CATS "SELECT c.rowkey, g.name FROM" \
+	" (SELECT DISTINCT rowkey FROM changelog WHERE tbl = 'categories' AND seq > :since) AS c" \
+	" LEFT JOIN categories AS g ON g.id = c.rowkey WHERE (g.id IS NOT NULL) = :present;"
+/* Only the newest entry per key matters to a delta, older ones are dropped by compaction */
+#define NOMBRE_CHG_DEDUP "DELETE FROM changelog WHERE seq NOT IN" \
+	" (SELECT max(seq) FROM changelog GROUP BY tbl, rowkey, defno);"
+#define NOMBRE_CHG_TRUNC "DELETE FROM changelog WHERE seq <= :upto;"
+
+int nomdb_chg(nomcmd * restrict cmdbuf);
@@ -4,6 +4,12 @@
 ## Uncomment to force a debug build
 #DBG = -g3 -NOMBRE_DEBUG
 
+## Uncomment to count every SQLite allocation and report it with -M
+#MEMCOUNT = -DNOMBRE_MEMCOUNT
+
+## Uncomment to record NOMTRACE() events in a ring dumped on failure, -D, fatal signals and SIGUSR1
+#TRACE = -DNOMBRE_TRACE
+
 ## Set the library and include paths
 INCS = -I/usr/include -I/usr/local/include
 LIBS = -L/usr/lib -L/usr/local/lib
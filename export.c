@@ -0,0 +1,506 @@
+/* 
+ * Copyright (c) 2019, Exile Heavy Industries
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted (subject to the limitations in the disclaimer
+ * below) provided that the following conditions are met:
+ * 
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ * 
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * 
+ * * Neither the name of the copyright holder nor the names of its contributors may be used
+ *   to endorse or promote products derived from this software without specific
+ *   prior written permission.
+ * 
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY THIS
+ * LICENSE. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+/*
+ * Parallel export of the database into tab separated files
+ *
+ * The work is split by category, and large categories are further split into
+ * term ranges, so every partition is one index range scan. Each partition is
+ * written to its own file by whichever worker thread claims it first, each
+ * worker reading through its own read-only connection.
+ *
+ * All workers see the same snapshot: the main connection holds the write lock
+ * while the partitions are planned and every worker opens its read transaction,
+ * so nothing can be committed in between. The lock is released as soon as the
+ * last worker is in, and the export itself runs concurrently with writers.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#ifndef NOMBRE_H
+#include "nombre.h"
+#endif
+#ifndef NOMBRE_INITDB_H
+#include "initdb.h"
+#endif
+#ifndef NOMBRE_EXPORT_H
+#include "export.h"
+#endif
+#ifndef NOMBRE_NOMTRACE_H
+#include "nomtrace.h"
+#endif
+
+extern char *__progname;
+extern bool dbg;
+
+/* A single output file, terms in [lo, hi) of one category */
+struct exppart {
+	int64_t catid;
+	char *name; /* Category name, shared by every part of the category */
+	char *lo, *hi; /* NULL when the range is open on that side */
+	char path[PATHMAX];
+	int64_t rows;
+	int retc;
+};
+
+/* State shared between the coordinator and the workers */
+struct expctx {
+	const char *dbname;
+	struct exppart *parts;
+	size_t nparts;
+	atomic_size_t next; /* Next unclaimed partition */
+	pthread_mutex_t lock;
+	pthread_cond_t ready;
+	unsigned int pending; /* Workers still opening their read transaction */
+	int retc;
+};
+
+static int expplan(nomcmd * restrict cmdbuf, struct expctx * restrict ctx);
+static int expaddpart(struct expctx * restrict ctx, const nomcmd * restrict cmdbuf, int64_t catid, const char *name, int partno);
+static void *expworker(void *arg);
+static int exppart(sqlite3_stmt * restrict stmt, struct exppart * restrict part);
+static int expmerge(const nomcmd * restrict cmdbuf, const struct expctx * restrict ctx);
+
+/*
+ * Export everything into the directory given with -f, one file per partition.
+ * With --merge the partitions are concatenated afterwards, in category and term
+ * order, into a single NOMBRE_EXP_MERGED file.
+ */
+int
+nomdb_expt(nomcmd * restrict cmdbuf) {
+	int retc;
+	long ncpu;
+	unsigned int nthreads, started;
+	int64_t rows;
+	pthread_t *threads;
+	struct expctx ctx;
+	retc = 0; nthreads = 0; started = 0; rows = 0;
+	threads = NULL;
+	memset(&ctx, 0, sizeof(ctx));
+
+	if (dbg) {
+		NOMDBG("Entering with cmdbuf = %p\n", (void *)cmdbuf);
+	}
+	if (cmdbuf == NULL || cmdbuf->dbcon == NULL) {
+		NOMERR("%s", "Given invalid input!\n");
+		return(BADARGS);
+	}
+	if (cmdbuf->filedata[NOMBRE_IOFILE][0] == 0) {
+		NOMERR("%s\n", "Exports need an output directory given with -f!");
+		return(BADARGS);
+	}
+	if (sqlite3_threadsafe() == 0) {
+		NOMERR("%s\n", "The SQLite3 library was built without thread support!");
+		return(NOM_FAIL);
+	}
+	if (mkdir(cmdbuf->filedata[NOMBRE_IOFILE], 0750) != 0 && errno != EEXIST) {
+		NOMERR("Unable to create %s! (%s)\n", cmdbuf->filedata[NOMBRE_IOFILE], strerror(errno));
+		return(NOM_FIO_FAIL);
+	}
+
+	/* Nothing may commit from here until every worker holds its snapshot */
+	if ((retc = sqlite3_exec(cmdbuf->dbcon, "BEGIN IMMEDIATE;", NULL, NULL, NULL)) != SQLITE_OK) {
+		NOMERR("Unable to lock the database (%s)!\n", sqlite3_errmsg(cmdbuf->dbcon));
+		return(retc);
+	}
+	if ((retc = expplan(cmdbuf, &ctx)) != NOM_OK || ctx.nparts == 0) {
+		sqlite3_exec(cmdbuf->dbcon, "ROLLBACK;", NULL, NULL, NULL);
+		if (retc == NOM_OK) {
+			fprintf(stdout, "%s\n", "Nothing to export");
+		}
+		goto EXPT_EXIT;
+	}
+
+	ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	nthreads = (cmdbuf->jobs > 0) ? cmdbuf->jobs : (ncpu > 0) ? (unsigned int)ncpu : 1;
+	nthreads = (nthreads > ctx.nparts) ? (unsigned int)ctx.nparts : nthreads;
+	if ((threads = calloc(nthreads, sizeof(pthread_t))) == NULL) {
+		sqlite3_exec(cmdbuf->dbcon, "ROLLBACK;", NULL, NULL, NULL);
+		retc = NOM_FAIL;
+		goto EXPT_EXIT;
+	}
+	ctx.dbname = cmdbuf->filedata[NOMBRE_DBFILE];
+	atomic_init(&ctx.next, 0);
+	pthread_mutex_init(&ctx.lock, NULL);
+	pthread_cond_init(&ctx.ready, NULL);
+
+	pthread_mutex_lock(&ctx.lock);
+	for (; started < nthreads; started++) {
+		if ((retc = pthread_create(&threads[started], NULL, expworker, &ctx)) != 0) {
+			NOMERR("Unable to start worker #%u (%s)\n", started, strerror(retc));
+			break;
+		}
+		ctx.pending++;
+	}
+	while (ctx.pending > 0) {
+		pthread_cond_wait(&ctx.ready, &ctx.lock);
+	}
+	pthread_mutex_unlock(&ctx.lock);
+	/* Nothing was written, the transaction only ever held the lock */
+	sqlite3_exec(cmdbuf->dbcon, "ROLLBACK;", NULL, NULL, NULL);
+
+	for (unsigned int i = 0; i < started; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	pthread_cond_destroy(&ctx.ready);
+	pthread_mutex_destroy(&ctx.lock);
+
+	/* A partition left unclaimed by failed workers still carries NOM_INCOMPLETE */
+	retc = (started > 0) ? ctx.retc : NOM_FAIL;
+	for (size_t i = 0; i < ctx.nparts; i++) {
+		rows += ctx.parts[i].rows;
+		if (ctx.parts[i].retc != NOM_OK) {
+			NOMERR("Export of %s failed!\n", ctx.parts[i].path);
+			retc = NOM_FAIL;
+		}
+	}
+	if (retc == NOM_OK && cmdbuf->merge) {
+		retc = expmerge(cmdbuf, &ctx);
+	}
+	if (retc == NOM_OK) {
+		fprintf(stdout, "Exported %lld entries in %zu partitions to %s (%u threads)\n",
+				(long long)rows, ctx.nparts, cmdbuf->filedata[NOMBRE_IOFILE], started);
+	}
+
+EXPT_EXIT:
+	for (size_t i = 0; i < ctx.nparts; i++) {
+		/* Only the first part of a category owns the name */
+		if (i == 0 || ctx.parts[i].name != ctx.parts[i - 1].name) {
+			free(ctx.parts[i].name);
+		}
+		free(ctx.parts[i].lo);
+	}
+	free(ctx.parts);
+	free(threads);
+	if (dbg) {
+		NOMDBG("Returning %d to caller\n", retc);
+	}
+	return(retc);
+}
+
+/*
+ * Split the export into partitions, at most NOMBRE_EXP_SPLIT primaries each.
+ * Must run inside the coordinator's transaction, so the plan matches what the
+ * workers will see.
+ */
+static int
+expplan(nomcmd * restrict cmdbuf, struct expctx * restrict ctx) {
+	int retc;
+	int64_t catid, count;
+	size_t first;
+	char *name;
+	sqlite3_stmt *plan, *bounds;
+	plan = bounds = NULL;
+
+	if ((retc = sqlite3_prepare_v2(cmdbuf->dbcon, NOMBRE_EXP_PLAN, -1, &plan, NULL)) != SQLITE_OK ||
+			(retc = sqlite3_prepare_v2(cmdbuf->dbcon, NOMBRE_EXP_BOUNDS, -1, &bounds, NULL)) != SQLITE_OK) {
+		NOMERR("Error planning export (%s)!\n", sqlite3_errmsg(cmdbuf->dbcon));
+		goto PLAN_EXIT;
+	}
+	sqlite3_bind_int64(bounds, sqlite3_bind_parameter_index(bounds, ":chunk"), NOMBRE_EXP_SPLIT);
+
+	while ((retc = sqlite3_step(plan)) == SQLITE_ROW) {
+		catid = sqlite3_column_int64(plan, 0);
+		if ((count = sqlite3_column_int64(plan, 2)) == 0) {
+			continue;
+		}
+		if ((name = strdup((const char *)sqlite3_column_text(plan, 1))) == NULL ||
+				(retc = expaddpart(ctx, cmdbuf, catid, name, (count > NOMBRE_EXP_SPLIT) ? 0 : -1)) != NOM_OK) {
+			free(name);
+			retc = NOM_FAIL;
+			goto PLAN_EXIT;
+		}
+		if (count <= NOMBRE_EXP_SPLIT) {
+			continue;
+		}
+		/* Each boundary closes the previous part and opens the next one */
+		first = ctx->nparts - 1;
+		sqlite3_bind_int64(bounds, sqlite3_bind_parameter_index(bounds, ":catid"), catid);
+		sqlite3_bind_text(bounds, sqlite3_bind_parameter_index(bounds, ":lo"), "", -1, SQLITE_STATIC);
+		while ((retc = sqlite3_step(bounds)) == SQLITE_ROW) {
+			if ((retc = expaddpart(ctx, cmdbuf, catid, name, (int)(ctx->nparts - first))) != NOM_OK ||
+					(ctx->parts[ctx->nparts - 1].lo = strdup((const char *)sqlite3_column_text(bounds, 0))) == NULL) {
+				retc = NOM_FAIL;
+				goto PLAN_EXIT;
+			}
+			ctx->parts[ctx->nparts - 2].hi = ctx->parts[ctx->nparts - 1].lo;
+			sqlite3_reset(bounds);
+			sqlite3_bind_text(bounds, sqlite3_bind_parameter_index(bounds, ":lo"), ctx->parts[ctx->nparts - 1].lo, -1, SQLITE_STATIC);
+		}
+		sqlite3_reset(bounds);
+		if (retc != SQLITE_DONE) {
+			NOMERR("Error splitting category %s (%s)!\n", name, sqlite3_errmsg(cmdbuf->dbcon));
+			goto PLAN_EXIT;
+		}
+	}
+	retc = (retc == SQLITE_DONE) ? NOM_OK : retc;
+	if (dbg) {
+		NOMDBG("Planned %zu partitions\n", ctx->nparts);
+	}
+
+PLAN_EXIT:
+	sqlite3_finalize(plan);
+	sqlite3_finalize(bounds);
+	return(retc);
+}
+
+/*
+ * Append an open ended partition for the given category. A category that
+ * fits in one partition is named after it, a split one (partno >= 0) gets the
+ * part number appended.
+ */
+static int
+expaddpart(struct expctx * restrict ctx, const nomcmd * restrict cmdbuf, int64_t catid, const char *name, int partno) {
+	int len;
+	struct exppart *parts, *part;
+	char *sep;
+
+	if ((ctx->nparts & (ctx->nparts - 1)) == 0) {
+		/* Grow whenever the count reaches a power of two */
+		if ((parts = realloc(ctx->parts, ((ctx->nparts > 0) ? ctx->nparts * 2 : 8) * sizeof(*parts))) == NULL) {
+			return(NOM_FAIL);
+		}
+		ctx->parts = parts;
+	}
+	part = &ctx->parts[ctx->nparts];
+	memset(part, 0, sizeof(*part));
+	part->catid = catid;
+	part->name = (char *)name;
+	part->retc = NOM_INCOMPLETE;
+	if (partno >= 0) {
+		len = snprintf(part->path, (size_t)PATHMAX, "%s%c%s.%02d.tsv", cmdbuf->filedata[NOMBRE_IOFILE], DIRSEP, name, partno);
+	} else {
+		len = snprintf(part->path, (size_t)PATHMAX, "%s%c%s.tsv", cmdbuf->filedata[NOMBRE_IOFILE], DIRSEP, name);
+	}
+	ctx->nparts++;
+	/* A cut short path could land on another partition's file, so this one fails instead of being written */
+	if (len < 0 || len >= PATHMAX) {
+		NOMERR("The path for category %s in %s is too long!\n", name, cmdbuf->filedata[NOMBRE_IOFILE]);
+		part->retc = NOM_FIO_FAIL;
+		return(NOM_OK);
+	}
+	/* Category names are free text, keep them from reaching outside the directory */
+	for (sep = part->path + strlen(cmdbuf->filedata[NOMBRE_IOFILE]) + 1; (sep = strchr(sep, DIRSEP)) != NULL; sep++) {
+		*sep = '_';
+	}
+	return(NOM_OK);
+}
+
+/*
+ * Open a read-only connection, pin the snapshot and let the coordinator know,
+ * then keep claiming partitions until there are none left.
+ */
+static void *
+expworker(void *arg) {
+	int retc;
+	size_t i;
+	sqlite3 *db;
+	sqlite3_stmt *stmt;
+	struct expctx *ctx;
+	ctx = arg;
+	db = NULL; stmt = NULL;
+
+	/* The read transaction only starts once something is actually read */
+	if ((retc = nom_dbconn_ro(ctx->dbname, &db)) == SQLITE_OK &&
+			(retc = sqlite3_exec(db, "BEGIN; SELECT 1 FROM categories LIMIT 1;", NULL, NULL, NULL)) == SQLITE_OK) {
+		retc = sqlite3_prepare_v2(db, NOMBRE_EXP_PART, -1, &stmt, NULL);
+	}
+	pthread_mutex_lock(&ctx->lock);
+	if (retc != SQLITE_OK) {
+		NOMERR("Worker failed to start (%s)!\n", (db != NULL) ? sqlite3_errmsg(db) : sqlite3_errstr(retc));
+		ctx->retc = NOM_FAIL;
+	}
+	if (--ctx->pending == 0) {
+		pthread_cond_signal(&ctx->ready);
+	}
+	pthread_mutex_unlock(&ctx->lock);
+
+	while (retc == SQLITE_OK && (i = atomic_fetch_add(&ctx->next, 1)) < ctx->nparts) {
+		/* Planned as failed, its path did not fit */
+		if (ctx->parts[i].retc == NOM_FIO_FAIL) {
+			continue;
+		}
+		retc = ctx->parts[i].retc = exppart(stmt, &ctx->parts[i]);
+		NOMTRACE("part/rows", i, ctx->parts[i].rows);
+	}
+
+	sqlite3_finalize(stmt);
+	if (db != NULL) {
+		sqlite3_exec(db, "COMMIT;", NULL, NULL, NULL);
+		sqlite3_close_v2(db);
+	}
+	return(NULL);
+}
+
+/*
+ * Write one partition as tab separated records of term, category and meaning.
+ * Alternates follow their primary definition, so importing the file again
+ * files them as alternates in the same order.
+ */
+static int
+exppart(sqlite3_stmt * restrict stmt, struct exppart * restrict part) {
+	int retc;
+	sqlite3_int64 prev;
+	FILE *out;
+	const unsigned char *term;
+	prev = 0;
+
+	if ((out = fopen(part->path, "w")) == NULL) {
+		NOMERR("Unable to open %s! (%s)\n", part->path, strerror(errno));
+		return(NOM_FIO_FAIL);
+	}
+	setvbuf(out, NULL, _IOFBF, (size_t)NOMBRE_EXP_BUFSIZE);
+
+	sqlite3_bind_int64(stmt, sqlite3_bind_parameter_index(stmt, ":catid"), part->catid);
+	sqlite3_bind_text(stmt, sqlite3_bind_parameter_index(stmt, ":lo"), (part->lo != NULL) ? part->lo : "", -1, SQLITE_STATIC);
+	/* Every TEXT value sorts below every BLOB, so an empty blob leaves the range open */
+	if (part->hi != NULL) {
+		sqlite3_bind_text(stmt, sqlite3_bind_parameter_index(stmt, ":hi"), part->hi, -1, SQLITE_STATIC);
+	} else {
+		sqlite3_bind_zeroblob(stmt, sqlite3_bind_parameter_index(stmt, ":hi"), 0);
+	}
+
+	while ((retc = sqlite3_step(stmt)) == SQLITE_ROW) {
+		term = sqlite3_column_text(stmt, 1);
+		if (sqlite3_column_int64(stmt, 0) != prev || part->rows == 0) {
+			prev = sqlite3_column_int64(stmt, 0);
+			nom_tsvput(out, term); putc('\t', out);
+			nom_tsvput(out, (const unsigned char *)part->name); putc('\t', out);
+			nom_tsvput(out, sqlite3_column_text(stmt, 2)); putc('\n', out);
+			part->rows++;
+		}
+		if (sqlite3_column_type(stmt, 3) != SQLITE_NULL) {
+			nom_tsvput(out, term); putc('\t', out);
+			nom_tsvput(out, sqlite3_column_text(stmt, 4)); putc('\t', out);
+			nom_tsvput(out, sqlite3_column_text(stmt, 5)); putc('\n', out);
+			part->rows++;
+		}
+	}
+	if (retc != SQLITE_DONE) {
+		NOMERR("Error exporting %s (%s)!\n", part->path, sqlite3_errmsg(sqlite3_db_handle(stmt)));
+	} else {
+		retc = NOM_OK;
+	}
+	sqlite3_reset(stmt);
+	sqlite3_clear_bindings(stmt);
+	retc = (ferror(out) != 0 && retc == NOM_OK) ? NOM_FIO_FAIL : retc;
+	if (fclose(out) != 0 || retc == NOM_FIO_FAIL) {
+		NOMERR("Unable to write %s!\n", part->path);
+		retc = NOM_FIO_FAIL;
+	}
+	return(retc);
+}
+
+/*
+ * Concatenate the partitions, in plan order, into NOMBRE_EXP_MERGED and remove
+ * them once the merged file is safely written.
+ */
+static int
+expmerge(const nomcmd * restrict cmdbuf, const struct expctx * restrict ctx) {
+	int retc;
+	size_t len;
+	char path[PATHMAX], *buf;
+	FILE *out, *in;
+	retc = NOM_OK;
+
+	if (snprintf(path, (size_t)PATHMAX, "%s%c%s", cmdbuf->filedata[NOMBRE_IOFILE], DIRSEP, NOMBRE_EXP_MERGED) >= PATHMAX) {
+		NOMERR("The merged file path in %s is too long!\n", cmdbuf->filedata[NOMBRE_IOFILE]);
+		return(NOM_FIO_FAIL);
+	}
+	if ((buf = malloc((size_t)NOMBRE_EXP_BUFSIZE)) == NULL) {
+		return(NOM_FAIL);
+	}
+	if ((out = fopen(path, "w")) == NULL) {
+		NOMERR("Unable to open %s! (%s)\n", path, strerror(errno));
+		free(buf);
+		return(NOM_FIO_FAIL);
+	}
+	for (size_t i = 0; i < ctx->nparts && retc == NOM_OK; i++) {
+		if ((in = fopen(ctx->parts[i].path, "r")) == NULL) {
+			NOMERR("Unable to open %s! (%s)\n", ctx->parts[i].path, strerror(errno));
+			retc = NOM_FIO_FAIL;
+			break;
+		}
+		while ((len = fread(buf, 1, (size_t)NOMBRE_EXP_BUFSIZE, in)) > 0) {
+			if (fwrite(buf, 1, len, out) != len) {
+				retc = NOM_FIO_FAIL;
+				break;
+			}
+		}
+		retc = (ferror(in) != 0) ? NOM_FIO_FAIL : retc;
+		fclose(in);
+	}
+	if (fclose(out) != 0 || retc != NOM_OK) {
+		NOMERR("Unable to write %s! (%s)\n", path, strerror(errno));
+		retc = NOM_FIO_FAIL;
+	} else {
+		for (size_t i = 0; i < ctx->nparts; i++) {
+			unlink(ctx->parts[i].path);
+		}
+	}
+	free(buf);
+	return(retc);
+}
+
+/*
+ * Write one field, escaping the characters that would break the record
+ * structure as \\, \t, \n and \r. Most fields need none of it.
+ */
+int
+nom_tsvput(FILE * restrict out, const unsigned char * restrict str) {
+	const unsigned char *run;
+
+	if (str == NULL) {
+		return(0);
+	}
+	for (run = str; *str != 0; str++) {
+		if (*str != '\\' && *str != '\t' && *str != '\n' && *str != '\r') {
+			continue;
+		}
+		fwrite(run, 1, (size_t)(str - run), out);
+		putc('\\', out);
+		putc((*str == '\t') ? 't' : (*str == '\n') ? 'n' : (*str == '\r') ? 'r' : '\\', out);
+		run = str + 1;
+	}
+	return((fwrite(run, 1, (size_t)(str - run), out) == (size_t)(str - run)) ? 0 : EOF);
+}
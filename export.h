@@ -0,0 +1,65 @@
+/* 
+ * Copyright (c) 2019, Exile Heavy Industries
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted (subject to the limitations in the disclaimer
+ * below) provided that the following conditions are met:
+ * 
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ * 
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * 
+ * * Neither the name of the copyright holder nor the names of its contributors may be used
+ *   to endorse or promote products derived from this software without specific
+ *   prior written permission.
+ * 
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY THIS
+ * LICENSE. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#define NOMBRE_EXPORT_H
+
+#include <stdio.h>
+
+#ifndef NOMBRE_H
+#include "nombre.h"
+#endif
+
+/* Categories with more rows than this are split into several term ranges */
+#define NOMBRE_EXP_SPLIT 100000
+/* Output buffer for each partition file */
+#define NOMBRE_EXP_BUFSIZE (BUFSIZE * 16)
+/* File the partitions are concatenated into by --merge */
+#define NOMBRE_EXP_MERGED "nombre.tsv"
+
+/* Every category along with how many primary definitions it holds */
+#define NOMBRE_EXP_PLAN "SELECT id, name, (SELECT count(*) FROM definitions WHERE category = categories.id)" \
+	" FROM categories ORDER BY id;"
+/* The term :chunk entries past :lo, skipped over on the covering defcat_idx */
+#define NOMBRE_EXP_BOUNDS "SELECT term FROM definitions WHERE category = :catid AND term >= :lo" \
+	" ORDER BY term LIMIT 1 OFFSET :chunk;"
+/*
+ * One partition: the primaries of a category within [lo, hi), each followed
+ * by its alternates. The alternates keep their own category, so a re-import
+ * lands every row where it came from.
+ */
+#define NOMBRE_EXP_PART "SELECT d.id, d.term, d.meaning, a.defno, (SELECT name FROM categories WHERE id = a.category), a.altdef" \
+	" FROM definitions AS d LEFT JOIN altdefs AS a ON a.termid = d.id" \
+	" WHERE d.category = :catid AND d.term >= :lo AND d.term < :hi ORDER BY d.term, a.defno;"
+
+int nomdb_expt(nomcmd * restrict cmdbuf);
+int nom_tsvput(FILE * restrict out, const unsigned char * restrict str);
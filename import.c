@@ -0,0 +1,472 @@
+/* 
+ * Copyright (c) 2019, Exile Heavy Industries
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted (subject to the limitations in the disclaimer
+ * below) provided that the following conditions are met:
+ * 
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ * 
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * 
+ * * Neither the name of the copyright holder nor the names of its contributors may be used
+ *   to endorse or promote products derived from this software without specific
+ *   prior written permission.
+ * 
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY THIS
+ * LICENSE. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+/*
+ * Pipelined import of the tab separated files written by exp
+ *
+ * The -f file is mapped privately and cut into slices at line boundaries.
+ * Each slice gets a parser thread that splits records in place (terminating
+ * fields, unescaping and normalizing terms right in the mapping) and hands
+ * them to the writer through its own single-producer/single-consumer ring.
+ * The writer, the calling thread, owns the connection and drains the rings
+ * in slice order so records are inserted in file order, which keeps every
+ * alternate behind its primary definition.
+ *
+ * The whole file goes in as one transaction: a bad record anywhere leaves
+ * the database untouched, so a fixed file can simply be imported again.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#ifndef NOMBRE_H
+#include "nombre.h"
+#endif
+#ifndef NOMBRE_CATMAP_H
+#include "catmap.h"
+#endif
+#ifndef NOMBRE_IMPORT_H
+#include "import.h"
+#endif
+#ifndef NOMBRE_NOMNORM_H
+#include "nomnorm.h"
+#endif
+#ifndef NOMBRE_NOMSTATS_H
+#include "nomstats.h"
+#endif
+#ifndef NOMBRE_NOMTRACE_H
+#include "nomtrace.h"
+#endif
+
+extern char *__progname;
+extern bool dbg;
+
+/* One preparsed row, pointing into the mapping */
+struct imprec {
+	const char *term;
+	const char *defn;
+	int64_t catid;
+};
+
+/*
+ * Lock-free SPSC ring: only the parser moves head and only the writer moves
+ * tail, so each side needs nothing more than acquire/release on the other's
+ * index. They are kept on separate cache lines to avoid false sharing.
+ */
+struct impring {
+	_Alignas(64) atomic_size_t head;
+	_Alignas(64) atomic_size_t tail;
+	_Alignas(64) struct imprec recs[NOMBRE_IMP_RING];
+};
+
+struct impparser {
+	pthread_t thread;
+	struct impctx *ctx;
+	char *start, *end; /* Whole lines of the mapping */
+	char *tail; /* Copy of a last line that has no newline to terminate in place */
+	struct impring *ring;
+	atomic_bool done; /* Set once head will not move again */
+	int retc;
+	uint64_t total, wait; /* Nanoseconds alive, and spent on a full ring */
+};
+
+struct impctx {
+	nomcmd *cmdbuf;
+	const char *base; /* Start of the mapping, for error offsets */
+	atomic_bool abort; /* The writer gave up, stop parsing */
+};
+
+static void *impparse(void *arg);
+static bool ringpush(struct impparser * restrict parser, const struct imprec * restrict rec);
+static int impwrite(struct impctx * restrict ctx, struct impparser * restrict parsers, unsigned int nparsers,
+		int64_t * restrict added, int64_t * restrict alts, uint64_t * restrict wait);
+static char *impslice(char *pos, char *end);
+static inline uint64_t nsnow(void);
+
+/*
+ * Import the -f file, reporting how busy each stage of the pipeline was so
+ * it's clear whether parsing or inserting is the bottleneck.
+ */
+int
+nomdb_impt(nomcmd * restrict cmdbuf) {
+	int retc, fd;
+	long ncpu;
+	unsigned int nparsers, started;
+	int64_t added, alts;
+	uint64_t begin, total, pbusy, ptotal, pwait, wwait;
+	char *map, *pos;
+	struct stat st;
+	struct impctx ctx;
+	struct impparser *parsers;
+	retc = 0; started = 0; added = 0; alts = 0; pbusy = 0; ptotal = 0; pwait = 0; wwait = 0;
+	map = NULL; parsers = NULL;
+
+	if (dbg) {
+		NOMDBG("Entering with cmdbuf = %p\n", (void *)cmdbuf);
+	}
+	if (cmdbuf == NULL || cmdbuf->dbcon == NULL) {
+		NOMERR("%s", "Given invalid input!\n");
+		return(BADARGS);
+	}
+	if (cmdbuf->filedata[NOMBRE_IOFILE][0] == 0) {
+		NOMERR("%s\n", "Imports need an input file given with -f!");
+		return(BADARGS);
+	}
+	if ((fd = open(cmdbuf->filedata[NOMBRE_IOFILE], O_RDONLY)) < 0 || fstat(fd, &st) != 0) {
+		NOMERR("Unable to open %s! (%s)\n", cmdbuf->filedata[NOMBRE_IOFILE], strerror(errno));
+		if (fd >= 0) {
+			close(fd);
+		}
+		return(NOM_FIO_FAIL);
+	}
+	if (st.st_size == 0) {
+		fprintf(stdout, "%s is empty, nothing to import\n", cmdbuf->filedata[NOMBRE_IOFILE]);
+		close(fd);
+		return(NOM_OK);
+	}
+	/* Private and writable, fields are split in place without touching the file */
+	map = mmap(NULL, (size_t)st.st_size, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		NOMERR("Unable to map %s! (%s)\n", cmdbuf->filedata[NOMBRE_IOFILE], strerror(errno));
+		return(NOM_FIO_FAIL);
+	}
+	madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+
+	/* Parsers only ever read the category map, so it has to be loaded up front */
+	if ((retc = nom_catload(cmdbuf)) != NOM_OK) {
+		goto IMPT_EXIT;
+	}
+	ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	nparsers = (cmdbuf->jobs > 0) ? cmdbuf->jobs : (ncpu > 2) ? (unsigned int)(ncpu - 1) : 1;
+	if ((size_t)st.st_size / NOMBRE_IMP_SLICE + 1 < nparsers) {
+		nparsers = (unsigned int)((size_t)st.st_size / NOMBRE_IMP_SLICE + 1);
+	}
+	if ((parsers = calloc(nparsers, sizeof(*parsers))) == NULL) {
+		retc = NOM_FAIL;
+		goto IMPT_EXIT;
+	}
+	ctx.cmdbuf = cmdbuf;
+	ctx.base = map;
+	atomic_init(&ctx.abort, false);
+
+	begin = nsnow();
+	for (pos = map; started < nparsers; started++) {
+		parsers[started].ctx = &ctx;
+		parsers[started].start = pos;
+		/* A long line may already have carried the previous slice past this one's nominal start */
+		if (started + 1 < nparsers && pos < map + ((size_t)st.st_size / nparsers) * (started + 1)) {
+			pos = impslice(map + ((size_t)st.st_size / nparsers) * (started + 1), map + st.st_size);
+		} else if (started + 1 >= nparsers) {
+			pos = map + st.st_size;
+		}
+		parsers[started].end = pos;
+		atomic_init(&parsers[started].done, false);
+		if ((parsers[started].ring = aligned_alloc(64, sizeof(struct impring))) == NULL) {
+			NOMERR("%s\n", "Unable to allocate the import rings!");
+			retc = NOM_FAIL;
+			break;
+		}
+		atomic_init(&parsers[started].ring->head, 0);
+		atomic_init(&parsers[started].ring->tail, 0);
+		if ((retc = pthread_create(&parsers[started].thread, NULL, impparse, &parsers[started])) != 0) {
+			NOMERR("Unable to start parser #%u (%s)\n", started, strerror(retc));
+			free(parsers[started].ring);
+			retc = NOM_FAIL;
+			break;
+		}
+	}
+
+	if (retc == NOM_OK) {
+		retc = impwrite(&ctx, parsers, nparsers, &added, &alts, &wwait);
+	} else {
+		atomic_store(&ctx.abort, true);
+	}
+	for (unsigned int i = 0; i < started; i++) {
+		pthread_join(parsers[i].thread, NULL);
+		ptotal += parsers[i].total;
+		pwait += parsers[i].wait;
+		free(parsers[i].ring);
+		free(parsers[i].tail);
+	}
+	total = nsnow() - begin;
+	pbusy = ptotal - pwait;
+
+	if (retc == NOM_OK) {
+		fprintf(stdout, "Imported %lld entries from %s in %.2fs (%lld new terms, %lld alternates)\n",
+				(long long)(added + alts), cmdbuf->filedata[NOMBRE_IOFILE], (double)total / 1e9, (long long)added, (long long)alts);
+		fprintf(stdout, "  parse: %u threads, %.0f%% busy, %.0f%% waiting on a full ring\n", nparsers,
+				(ptotal > 0) ? 100.0 * (double)pbusy / (double)ptotal : 0.0, (ptotal > 0) ? 100.0 * (double)pwait / (double)ptotal : 0.0);
+		fprintf(stdout, "  write: 1 thread, %.0f%% busy, %.0f%% waiting on an empty ring\n",
+				(total > 0) ? 100.0 * (double)(total - wwait) / (double)total : 0.0, (total > 0) ? 100.0 * (double)wwait / (double)total : 0.0);
+	} else {
+		NOMERR("Nothing was imported from %s\n", cmdbuf->filedata[NOMBRE_IOFILE]);
+	}
+
+IMPT_EXIT:
+	free(parsers);
+	munmap(map, (size_t)st.st_size);
+	if (dbg) {
+		NOMDBG("Returning %d to caller\n", retc);
+	}
+	return(retc);
+}
+
+/*
+ * Writer stage: insert everything inside one transaction, taking records off
+ * each ring in batches and moving to the next ring once a parser is finished.
+ */
+static int
+impwrite(struct impctx * restrict ctx, struct impparser * restrict parsers, unsigned int nparsers,
+		int64_t * restrict added, int64_t * restrict alts, uint64_t * restrict wait) {
+	int retc, iterm, idefn, icat;
+	size_t head, tail, n;
+	uint64_t since;
+	bool alt;
+	struct nomsums sums;
+	sqlite3 *db;
+	sqlite3_stmt *stmt;
+	struct impring *ring;
+	const struct imprec *rec;
+	db = ctx->cmdbuf->dbcon;
+	stmt = NULL;
+	memset(&sums, 0, sizeof(sums));
+
+	if ((retc = sqlite3_prepare_v2(db, NOMBRE_IMP_INSERT, -1, &stmt, NULL)) != SQLITE_OK ||
+			(retc = sqlite3_exec(db, "BEGIN IMMEDIATE;", NULL, NULL, NULL)) != SQLITE_OK) {
+		NOMERR("Error preparing import (%s)!\n", sqlite3_errmsg(db));
+		sqlite3_finalize(stmt);
+		atomic_store(&ctx->abort, true);
+		return(retc);
+	}
+	/* Category counts are tallied here and added once at the end instead of by a trigger per record */
+	retc = nom_sumhold(db);
+	iterm = sqlite3_bind_parameter_index(stmt, ":term");
+	idefn = sqlite3_bind_parameter_index(stmt, ":defn");
+	icat = sqlite3_bind_parameter_index(stmt, ":catid");
+
+	for (unsigned int i = 0; i < nparsers && retc == SQLITE_OK; i++) {
+		ring = parsers[i].ring;
+		tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+		for (since = 0; retc == SQLITE_OK; ) {
+			if ((head = atomic_load_explicit(&ring->head, memory_order_acquire)) == tail) {
+				/* done is published after the final head, so head has to be read again */
+				if (atomic_load_explicit(&parsers[i].done, memory_order_acquire) &&
+						atomic_load_explicit(&ring->head, memory_order_acquire) == tail) {
+					retc = parsers[i].retc;
+					break;
+				}
+				since = (since == 0) ? nsnow() : since;
+				sched_yield();
+				continue;
+			}
+			if (since != 0) {
+				NOMTRACE("parser/waitns", i, nsnow() - since);
+				*wait += nsnow() - since;
+				since = 0;
+			}
+			for (n = ((head - tail) < NOMBRE_IMP_BATCH) ? head - tail : NOMBRE_IMP_BATCH; n > 0; n--, tail++) {
+				rec = &ring->recs[tail & (NOMBRE_IMP_RING - 1)];
+				sqlite3_bind_text(stmt, iterm, rec->term, -1, SQLITE_STATIC);
+				sqlite3_bind_text(stmt, idefn, rec->defn, -1, SQLITE_STATIC);
+				sqlite3_bind_int64(stmt, icat, rec->catid);
+				if ((retc = sqlite3_step(stmt)) != SQLITE_DONE) {
+					NOMERR("Error importing %s (%s)!\n", rec->term, sqlite3_errmsg(db));
+					break;
+				}
+				/* The trigger swallows the row when it becomes an alternate */
+				alt = (sqlite3_changes(db) == 0);
+				*((alt) ? alts : added) += 1;
+				sqlite3_reset(stmt);
+				if ((retc = nom_sumcount(&sums, rec->catid, alt)) != SQLITE_OK) {
+					break;
+				}
+			}
+			atomic_store_explicit(&ring->tail, tail, memory_order_release);
+		}
+	}
+	sqlite3_finalize(stmt);
+
+	if (retc == SQLITE_OK) {
+		retc = nom_sumrelease(db, &sums);
+	} else {
+		free(sums.cats);
+	}
+	if (retc == SQLITE_OK && (retc = sqlite3_exec(db, "COMMIT;", NULL, NULL, NULL)) == SQLITE_OK) {
+		return(NOM_OK);
+	}
+	atomic_store(&ctx->abort, true);
+	sqlite3_exec(db, "ROLLBACK;", NULL, NULL, NULL);
+	return((retc != NOM_OK) ? retc : NOM_FAIL);
+}
+
+/*
+ * Parser stage: split every line of the slice into a record and push it.
+ * Records are "term<TAB>category<TAB>meaning", blank lines and lines starting
+ * with '#' are skipped, and an empty category means uncategorized (-1).
+ */
+static void *
+impparse(void *arg) {
+	size_t len;
+	ptrdiff_t off;
+	char *line, *next, *eol, *catg, *defn;
+	struct imprec rec;
+	struct impparser *parser;
+	parser = arg;
+	parser->total = nsnow();
+	parser->retc = NOM_OK;
+
+	for (line = parser->start; line < parser->end && parser->retc == NOM_OK; line = next) {
+		off = line - parser->ctx->base;
+		if ((eol = memchr(line, '\n', (size_t)(parser->end - line))) != NULL) {
+			*eol = 0;
+			next = eol + 1;
+		} else {
+			/* Nothing past the end of the mapping to put the terminator in */
+			len = (size_t)(parser->end - line);
+			if ((parser->tail = malloc(len + 1)) == NULL) {
+				parser->retc = NOM_FAIL;
+				break;
+			}
+			memcpy(parser->tail, line, len);
+			parser->tail[len] = 0;
+			eol = parser->tail + len;
+			next = parser->end;
+			line = parser->tail;
+		}
+		if (eol > line && *(eol - 1) == '\r') {
+			*(eol - 1) = 0;
+		}
+		if (*line == '#' || *line == 0) {
+			continue;
+		}
+
+		if ((catg = nom_tsvfield(line)) == NULL || (defn = nom_tsvfield(catg)) == NULL || nom_tsvfield(defn) != NULL ||
+				*line == 0 || *defn == 0) {
+			NOMERR("%s: malformed record at byte %td!\n", parser->ctx->cmdbuf->filedata[NOMBRE_IOFILE], off);
+			parser->retc = NOM_INVALID;
+			break;
+		}
+		nom_normterm(line);
+		rec.term = line;
+		rec.defn = defn;
+		rec.catid = -1;
+		if (*catg != 0 && nom_catid(parser->ctx->cmdbuf, catg, &rec.catid) != NOM_OK) {
+			NOMERR("%s: unknown category \"%s\" for %s!\n", parser->ctx->cmdbuf->filedata[NOMBRE_IOFILE], catg, rec.term);
+			parser->retc = NOM_INVALID;
+			break;
+		}
+		if (! ringpush(parser, &rec)) {
+			break;
+		}
+	}
+	parser->total = nsnow() - parser->total;
+	atomic_store_explicit(&parser->done, true, memory_order_release);
+	return(NULL);
+}
+
+/* Queue one record, yielding while the ring is full. False if the writer gave up. */
+static bool
+ringpush(struct impparser * restrict parser, const struct imprec * restrict rec) {
+	size_t head;
+	uint64_t since;
+	struct impring *ring;
+	ring = parser->ring;
+	head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+
+	if (head - atomic_load_explicit(&ring->tail, memory_order_acquire) == NOMBRE_IMP_RING) {
+		since = nsnow();
+		while (head - atomic_load_explicit(&ring->tail, memory_order_acquire) == NOMBRE_IMP_RING) {
+			if (atomic_load_explicit(&parser->ctx->abort, memory_order_relaxed)) {
+				return(false);
+			}
+			sched_yield();
+		}
+		parser->wait += nsnow() - since;
+	}
+	ring->recs[head & (NOMBRE_IMP_RING - 1)] = *rec;
+	atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+	return(true);
+}
+
+/* Move a slice boundary forward to the start of the next line */
+static char *
+impslice(char *pos, char *end) {
+	char *eol;
+	return(((eol = memchr(pos, '\n', (size_t)(end - pos))) != NULL) ? eol + 1 : end);
+}
+
+/*
+ * Terminate the field at the next tab and undo the escaping done by the
+ * exporter (\\, \t, \n and \r), returning the start of the next field or
+ * NULL if this was the last one.
+ */
+char *
+nom_tsvfield(char * restrict field) {
+	char *out, *next;
+	next = NULL;
+
+	for (out = field; *field != 0; field++) {
+		if (*field == '\t') {
+			next = field + 1;
+			break;
+		} else if (*field == '\\' && *(field + 1) != 0) {
+			field++;
+			*out++ = (*field == 't') ? '\t' : (*field == 'n') ? '\n' : (*field == 'r') ? '\r' : *field;
+		} else {
+			*out++ = *field;
+		}
+	}
+	*out = 0;
+	return(next);
+}
+
+static inline uint64_t
+nsnow(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return((uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec);
+}
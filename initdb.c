@@ -53,6 +53,21 @@
 #ifndef NOMBRE_INITDB_H
 #include "initdb.h"
 #endif
+#ifndef NOMBRE_NOMNORM_H
+#include "nomnorm.h"
+#endif
+#ifndef NOMBRE_NOMMEM_H
+#include "nommem.h"
+#endif
+#ifndef NOMBRE_NOMREGEX_H
+#include "nomregex.h"
+#endif
+#ifndef NOMBRE_NOMSTATS_H
+#include "nomstats.h"
+#endif
+#ifndef NOMBRE_NOMCONF_H
+#include "nomconf.h"
+#endif
 
 /* Because apparently Linux doesn't have these options through GLIBC or musl */
 #if defined (__linux__)
@@ -65,6 +80,244 @@ extern char *__progname;
 extern char **environ;
 extern bool dbg;
 
+/* Per-category counters, created by 7 -> 8 and again after 8 -> 9 rebuilds the tables they sit on */
+#define NOM_SUM_TRIGGERS \
+	"CREATE TRIGGER IF NOT EXISTS definitions_sum_ins AFTER INSERT ON definitions BEGIN INSERT INTO category_stats (category, terms, modified)" \
+	" VALUES (NEW.category, 1, CAST(strftime('%s', 'now') AS INTEGER)) ON CONFLICT (category) DO UPDATE SET terms = terms + 1, modified = excluded.modified; END;" \
+	"CREATE TRIGGER IF NOT EXISTS definitions_sum_upd AFTER UPDATE ON definitions BEGIN UPDATE category_stats SET terms = terms - 1," \
+	" modified = CAST(strftime('%s', 'now') AS INTEGER) WHERE category = OLD.category AND OLD.category IS NOT NEW.category;" \
+	" INSERT INTO category_stats (category, terms, modified) VALUES (NEW.category, OLD.category IS NOT NEW.category, CAST(strftime('%s', 'now') AS INTEGER))" \
+	" ON CONFLICT (category) DO UPDATE SET terms = terms + excluded.terms, modified = excluded.modified; END;" \
+	"CREATE TRIGGER IF NOT EXISTS definitions_sum_del AFTER DELETE ON definitions BEGIN UPDATE category_stats SET terms = terms - 1," \
+	" modified = CAST(strftime('%s', 'now') AS INTEGER) WHERE category = OLD.category; END;" \
+	"CREATE TRIGGER IF NOT EXISTS altdefs_sum_ins AFTER INSERT ON altdefs BEGIN INSERT INTO category_stats (category, alts, modified)" \
+	" VALUES (NEW.category, 1, CAST(strftime('%s', 'now') AS INTEGER)) ON CONFLICT (category) DO UPDATE SET alts = alts + 1, modified = excluded.modified; END;" \
+	"CREATE TRIGGER IF NOT EXISTS altdefs_sum_upd AFTER UPDATE ON altdefs BEGIN UPDATE category_stats SET alts = alts - 1," \
+	" modified = CAST(strftime('%s', 'now') AS INTEGER) WHERE category = OLD.category AND OLD.category IS NOT NEW.category;" \
+	" INSERT INTO category_stats (category, alts, modified) VALUES (NEW.category, OLD.category IS NOT NEW.category, CAST(strftime('%s', 'now') AS INTEGER))" \
+	" ON CONFLICT (category) DO UPDATE SET alts = alts + excluded.alts, modified = excluded.modified; END;" \
+	"CREATE TRIGGER IF NOT EXISTS altdefs_sum_del AFTER DELETE ON altdefs BEGIN UPDATE category_stats SET alts = alts - 1," \
+	" modified = CAST(strftime('%s', 'now') AS INTEGER) WHERE category = OLD.category; END;"
+
+/* 
+ * Schema upgrades, indexed by the user_version they start from.
+ * Each entry is run as a single transaction and must finish by 
+ * setting user_version to the next revision. Long ones are split
+ * into parts run in order, unused parts are left NULL.
+ */
+#define NOM_UPGRADE_PARTS 4
+static const char *nom_upgrades[NOMBRE_SCHEMA_VERSION][NOM_UPGRADE_PARTS] = {
+	/* 0 -> 1: file duplicate definitions as alternates from a single INSERT */
+	{
+		"BEGIN IMMEDIATE;"
+		"DROP INDEX IF EXISTS altdata_idx;"
+		"CREATE UNIQUE INDEX IF NOT EXISTS altdata_idx ON altdefs (term, defno);"
+		"CREATE TRIGGER IF NOT EXISTS definitions_altdef BEFORE INSERT ON definitions "
+		"WHEN EXISTS (SELECT 1 FROM definitions WHERE term = NEW.term) "
+		"BEGIN "
+			"INSERT INTO altdefs VALUES (NEW.term, "
+			"COALESCE((SELECT MAX(defno) FROM altdefs WHERE term = NEW.term), 0) + 1, "
+			"NEW.meaning, NEW.category);"
+			"SELECT RAISE(IGNORE);"
+		"END;"
+		"PRAGMA user_version=1;"
+		"COMMIT;"
+	},
+	/* 1 -> 2: grouped queries seek by category instead of scanning definitions */
+	{
+		"BEGIN IMMEDIATE;"
+		"CREATE INDEX IF NOT EXISTS defcat_idx ON definitions (category, term);"
+		"PRAGMA user_version=2;"
+		"COMMIT;"
+	},
+	/* 2 -> 3: foreign key checks on definitions seek defrefs instead of scanning it */
+	{
+		"BEGIN IMMEDIATE;"
+		"CREATE INDEX IF NOT EXISTS defrefs_term_idx ON defrefs (term);"
+		"PRAGMA user_version=3;"
+		"COMMIT;"
+	},
+	/*
+	 * 3 -> 4: terms are normalized by nomnorm() instead of only upper-casing ASCII.
+	 * Lookups normalize their input, so a term left in its old spelling could never
+	 * be reached again. Where several spellings normalize alike, the term already
+	 * in normal form, else the oldest, is renamed and the others are folded into
+	 * it: each of their meanings, primary first, becomes its next alternate, their
+	 * references follow, and their rows go.
+	 */
+	{
+		"BEGIN IMMEDIATE;"
+		"CREATE TEMP TABLE nom_fold AS SELECT rowid AS rid, term AS old, nomnorm(term) AS new, 0 AS folded FROM definitions"
+		" WHERE term GLOB '*[^ -~]*' AND nomnorm(term) IS NOT term;"
+		"UPDATE nom_fold SET folded = 1 WHERE EXISTS (SELECT 1 FROM definitions WHERE term = nom_fold.new)"
+		" OR EXISTS (SELECT 1 FROM nom_fold AS g WHERE g.new = nom_fold.new AND g.rid < nom_fold.rid);"
+		"UPDATE altdefs SET term = (SELECT new FROM nom_fold WHERE old = altdefs.term) WHERE term IN (SELECT old FROM nom_fold WHERE folded = 0);"
+		"UPDATE defrefs SET term = (SELECT new FROM nom_fold WHERE old = defrefs.term) WHERE term IN (SELECT old FROM nom_fold WHERE folded = 0);"
+		"UPDATE definitions SET term = (SELECT new FROM nom_fold WHERE rid = definitions.rowid) WHERE rowid IN (SELECT rid FROM nom_fold WHERE folded = 0);"
+		"CREATE TEMP TABLE nom_moved AS SELECT f.old, m.defno AS olddefno, f.new, m.meaning, m.category,"
+		" (SELECT COALESCE(MAX(defno), 0) FROM altdefs WHERE term = f.new) + row_number() OVER (PARTITION BY f.new ORDER BY f.rid, m.defno) AS newdefno"
+		" FROM nom_fold AS f JOIN (SELECT term, 0 AS defno, meaning, category FROM definitions UNION ALL SELECT term, defno, altdef, category FROM altdefs) AS m"
+		" ON m.term = f.old WHERE f.folded = 1;"
+		"UPDATE defrefs SET defno = (SELECT newdefno FROM nom_moved WHERE old = defrefs.term AND olddefno = MAX(defrefs.defno, 0)),"
+		" term = (SELECT new FROM nom_fold WHERE old = defrefs.term) WHERE term IN (SELECT old FROM nom_fold WHERE folded = 1);"
+		"DELETE FROM altdefs WHERE term IN (SELECT old FROM nom_fold WHERE folded = 1);"
+		"INSERT INTO altdefs (term, defno, altdef, category) SELECT new, newdefno, meaning, category FROM nom_moved ORDER BY new, newdefno;"
+		"DELETE FROM definitions WHERE rowid IN (SELECT rid FROM nom_fold WHERE folded = 1);"
+		/* Alternates and references of no definition at all only need the new spelling */
+		"UPDATE OR IGNORE altdefs SET term = nomnorm(term) WHERE term GLOB '*[^ -~]*' AND NOT EXISTS (SELECT 1 FROM definitions WHERE term = altdefs.term);"
+		"UPDATE defrefs SET term = nomnorm(term) WHERE term GLOB '*[^ -~]*' AND NOT EXISTS (SELECT 1 FROM definitions WHERE term = defrefs.term);"
+		"DROP TABLE nom_moved; DROP TABLE nom_fold;"
+		"PRAGMA user_version=4;"
+		"COMMIT;"
+	},
+	/* 4 -> 5: lookup counters for the top listing */
+	{
+		"BEGIN IMMEDIATE;"
+		"CREATE TABLE IF NOT EXISTS term_stats (term text PRIMARY KEY NOT NULL, hits integer NOT NULL DEFAULT 0, lasthit integer) WITHOUT ROWID;"
+		"CREATE INDEX IF NOT EXISTS term_stats_hits_idx ON term_stats (hits DESC, term);"
+		"CREATE TRIGGER IF NOT EXISTS definitions_stats AFTER DELETE ON definitions "
+		"BEGIN DELETE FROM term_stats WHERE term = OLD.term; END;"
+		"PRAGMA user_version=5;"
+		"COMMIT;"
+	},
+	/* 5 -> 6: change log for delta exports, existing rows are covered by a full export */
+	{
+		"BEGIN IMMEDIATE;"
+		"CREATE TABLE IF NOT EXISTS changelog (seq integer PRIMARY KEY AUTOINCREMENT, tbl text NOT NULL, rowkey NOT NULL, defno integer);"
+		"CREATE TABLE IF NOT EXISTS changelog_floor (id integer PRIMARY KEY CHECK (id = 0), seq integer NOT NULL);"
+		"INSERT OR IGNORE INTO changelog_floor VALUES (0, 0);"
+		"CREATE TRIGGER IF NOT EXISTS definitions_log_ins AFTER INSERT ON definitions BEGIN INSERT INTO changelog (tbl, rowkey) VALUES ('definitions', NEW.term); END;"
+		"CREATE TRIGGER IF NOT EXISTS definitions_log_upd AFTER UPDATE ON definitions BEGIN INSERT INTO changelog (tbl, rowkey) SELECT 'definitions', OLD.term WHERE OLD.term IS NOT NEW.term; INSERT INTO changelog (tbl, rowkey) VALUES ('definitions', NEW.term); END;"
+		"CREATE TRIGGER IF NOT EXISTS definitions_log_del AFTER DELETE ON definitions BEGIN INSERT INTO changelog (tbl, rowkey) VALUES ('definitions', OLD.term); END;"
+		"CREATE TRIGGER IF NOT EXISTS altdefs_log_ins AFTER INSERT ON altdefs BEGIN INSERT INTO changelog (tbl, rowkey, defno) VALUES ('altdefs', NEW.term, NEW.defno); END;"
+		"CREATE TRIGGER IF NOT EXISTS altdefs_log_upd AFTER UPDATE ON altdefs BEGIN INSERT INTO changelog (tbl, rowkey, defno) SELECT 'altdefs', OLD.term, OLD.defno WHERE OLD.term IS NOT NEW.term OR OLD.defno IS NOT NEW.defno; INSERT INTO changelog (tbl, rowkey, defno) VALUES ('altdefs', NEW.term, NEW.defno); END;"
+		"CREATE TRIGGER IF NOT EXISTS altdefs_log_del AFTER DELETE ON altdefs BEGIN INSERT INTO changelog (tbl, rowkey, defno) VALUES ('altdefs', OLD.term, OLD.defno); END;"
+		"CREATE TRIGGER IF NOT EXISTS defrefs_log_ins AFTER INSERT ON defrefs BEGIN INSERT INTO changelog (tbl, rowkey) VALUES ('defrefs', NEW.idhash); END;"
+		"CREATE TRIGGER IF NOT EXISTS defrefs_log_upd AFTER UPDATE ON defrefs BEGIN INSERT INTO changelog (tbl, rowkey) SELECT 'defrefs', OLD.idhash WHERE OLD.idhash IS NOT NEW.idhash; INSERT INTO changelog (tbl, rowkey) VALUES ('defrefs', NEW.idhash); END;"
+		"CREATE TRIGGER IF NOT EXISTS defrefs_log_del AFTER DELETE ON defrefs BEGIN INSERT INTO changelog (tbl, rowkey) VALUES ('defrefs', OLD.idhash); END;"
+		"CREATE TRIGGER IF NOT EXISTS categories_log_ins AFTER INSERT ON categories BEGIN INSERT INTO changelog (tbl, rowkey) VALUES ('categories', NEW.id); END;"
+		"CREATE TRIGGER IF NOT EXISTS categories_log_upd AFTER UPDATE ON categories BEGIN INSERT INTO changelog (tbl, rowkey) SELECT 'categories', OLD.id WHERE OLD.id IS NOT NEW.id; INSERT INTO changelog (tbl, rowkey) VALUES ('categories', NEW.id); END;"
+		"CREATE TRIGGER IF NOT EXISTS categories_log_del AFTER DELETE ON categories BEGIN INSERT INTO changelog (tbl, rowkey) VALUES ('categories', OLD.id); END;"
+		"PRAGMA user_version=6;"
+		"COMMIT;"
+	},
+	/* 6 -> 7: multi-category tags, every category's bitmap is built on first use */
+	{
+		"BEGIN IMMEDIATE;"
+		"CREATE TABLE IF NOT EXISTS term_tags (term text NOT NULL, category integer NOT NULL, PRIMARY KEY (term, category),"
+		" FOREIGN KEY (term) REFERENCES definitions(term), FOREIGN KEY (category) REFERENCES categories(id)) WITHOUT ROWID;"
+		"CREATE INDEX IF NOT EXISTS tagcat_idx ON term_tags (category, term);"
+		"CREATE TABLE IF NOT EXISTS tag_bitmaps (category integer NOT NULL, chunk integer NOT NULL, card integer NOT NULL,"
+		" bits blob NOT NULL, PRIMARY KEY (category, chunk)) WITHOUT ROWID;"
+		"CREATE TABLE IF NOT EXISTS tag_stale (category integer PRIMARY KEY NOT NULL);"
+		"INSERT OR IGNORE INTO tag_stale SELECT id FROM categories;"
+		"CREATE TRIGGER IF NOT EXISTS definitions_tag_ins AFTER INSERT ON definitions BEGIN INSERT OR IGNORE INTO tag_stale VALUES (NEW.category); END;"
+		"CREATE TRIGGER IF NOT EXISTS definitions_tag_upd AFTER UPDATE OF term, category ON definitions WHEN OLD.term IS NOT NEW.term OR OLD.category IS NOT NEW.category"
+		" BEGIN UPDATE term_tags SET term = NEW.term WHERE term = OLD.term AND OLD.term IS NOT NEW.term; INSERT OR IGNORE INTO tag_stale VALUES (OLD.category), (NEW.category); END;"
+		"CREATE TRIGGER IF NOT EXISTS definitions_tag_del AFTER DELETE ON definitions"
+		" BEGIN DELETE FROM term_tags WHERE term = OLD.term; INSERT OR IGNORE INTO tag_stale VALUES (OLD.category); END;"
+		"CREATE TRIGGER IF NOT EXISTS term_tags_ins AFTER INSERT ON term_tags BEGIN INSERT OR IGNORE INTO tag_stale VALUES (NEW.category); END;"
+		"CREATE TRIGGER IF NOT EXISTS term_tags_del AFTER DELETE ON term_tags BEGIN INSERT OR IGNORE INTO tag_stale VALUES (OLD.category); END;"
+		"PRAGMA user_version=7;"
+		"COMMIT;"
+	},
+	/* 7 -> 8: per-category counts for summaries, recounted from the existing rows */
+	{
+		"BEGIN IMMEDIATE;"
+		"CREATE TABLE IF NOT EXISTS category_stats (category integer PRIMARY KEY NOT NULL, terms integer NOT NULL DEFAULT 0,"
+		" alts integer NOT NULL DEFAULT 0, modified integer);"
+		NOMBRE_SUM_TERMS("NULL")
+		NOMBRE_SUM_ALTS("NULL")
+		NOM_SUM_TRIGGERS
+		"PRAGMA user_version=8;"
+		"COMMIT;"
+	},
+	/*
+	 * 8 -> 9: terms get an integer id that altdefs, defrefs and term_tags refer to
+	 * instead of repeating the term. definitions is rebuilt with its rowids as the
+	 * ids, which VACUUM can no longer renumber, and every bitmap is rebuilt in case
+	 * one already had. Rows whose term has no primary definition are dropped
+	 * since nothing could reach them by id.
+	 * Dropping the old tables takes their triggers along, so all of those are recreated.
+	 */
+	{
+		"BEGIN IMMEDIATE;"
+		"CREATE TABLE definitions_v9 (id integer PRIMARY KEY, term text UNIQUE NOT NULL, meaning text NOT NULL,"
+		" category integer NOT NULL DEFAULT -1, CHECK (category > -2), FOREIGN KEY (category) REFERENCES categories(id));"
+		"INSERT INTO definitions_v9 (id, term, meaning, category) SELECT rowid, term, meaning, category FROM definitions;"
+		"CREATE TABLE altdefs_v9 (termid integer NOT NULL, defno integer NOT NULL DEFAULT 0, altdef text NOT NULL, category integer NOT NULL DEFAULT -1,"
+		" FOREIGN KEY (termid) REFERENCES definitions(id), FOREIGN KEY (category) REFERENCES categories(id));"
+		"INSERT INTO altdefs_v9 (termid, defno, altdef, category) SELECT d.id, a.defno, a.altdef, a.category"
+		" FROM altdefs AS a CROSS JOIN definitions_v9 AS d ON d.term = a.term ORDER BY a.rowid;"
+		"CREATE TABLE defrefs_v9 (idhash blob UNIQUE NOT NULL, defno integer NOT NULL, termid integer NOT NULL, source text NOT NULL,"
+		" PRIMARY KEY (idhash), FOREIGN KEY (termid) REFERENCES definitions(id));"
+		"INSERT INTO defrefs_v9 (idhash, defno, termid, source) SELECT r.idhash, r.defno, d.id, r.source"
+		" FROM defrefs AS r CROSS JOIN definitions_v9 AS d ON d.term = r.term;"
+		"CREATE TABLE term_tags_v9 (termid integer NOT NULL, category integer NOT NULL, PRIMARY KEY (termid, category),"
+		" FOREIGN KEY (termid) REFERENCES definitions(id), FOREIGN KEY (category) REFERENCES categories(id)) WITHOUT ROWID;"
+		"INSERT INTO term_tags_v9 (termid, category) SELECT d.id, t.category FROM term_tags AS t CROSS JOIN definitions_v9 AS d ON d.term = t.term;"
+		"DROP TABLE term_tags; DROP TABLE defrefs; DROP TABLE altdefs; DROP TABLE definitions;",
+		"ALTER TABLE definitions_v9 RENAME TO definitions;"
+		"ALTER TABLE altdefs_v9 RENAME TO altdefs;"
+		"ALTER TABLE defrefs_v9 RENAME TO defrefs;"
+		"ALTER TABLE term_tags_v9 RENAME TO term_tags;"
+		"CREATE UNIQUE INDEX IF NOT EXISTS altdata_idx ON altdefs (termid, defno);"
+		"CREATE INDEX IF NOT EXISTS defcat_idx ON definitions (category, term);"
+		"CREATE INDEX IF NOT EXISTS defrefs_term_idx ON defrefs (termid);"
+		"CREATE INDEX IF NOT EXISTS tagcat_idx ON term_tags (category, termid);"
+		"INSERT OR IGNORE INTO tag_stale SELECT id FROM categories;",
+		"CREATE TRIGGER IF NOT EXISTS definitions_altdef BEFORE INSERT ON definitions WHEN EXISTS (SELECT 1 FROM definitions WHERE term = NEW.term)"
+		" BEGIN INSERT INTO altdefs (termid, defno, altdef, category) SELECT id, COALESCE((SELECT MAX(defno) FROM altdefs WHERE termid = definitions.id), 0) + 1,"
+		" NEW.meaning, NEW.category FROM definitions WHERE term = NEW.term; SELECT RAISE(IGNORE); END;"
+		"CREATE TRIGGER IF NOT EXISTS definitions_children BEFORE DELETE ON definitions"
+		" BEGIN DELETE FROM altdefs WHERE termid = OLD.id; DELETE FROM defrefs WHERE termid = OLD.id; END;"
+		"CREATE TRIGGER IF NOT EXISTS definitions_stats AFTER DELETE ON definitions BEGIN DELETE FROM term_stats WHERE term = OLD.term; END;"
+		"CREATE TRIGGER IF NOT EXISTS definitions_log_ins AFTER INSERT ON definitions BEGIN INSERT INTO changelog (tbl, rowkey) VALUES ('definitions', NEW.term); END;"
+		"CREATE TRIGGER IF NOT EXISTS definitions_log_upd AFTER UPDATE ON definitions BEGIN INSERT INTO changelog (tbl, rowkey) SELECT 'definitions', OLD.term WHERE OLD.term IS NOT NEW.term; INSERT INTO changelog (tbl, rowkey) VALUES ('definitions', NEW.term); END;"
+		"CREATE TRIGGER IF NOT EXISTS definitions_log_del AFTER DELETE ON definitions BEGIN INSERT INTO changelog (tbl, rowkey) VALUES ('definitions', OLD.term); END;"
+		"CREATE TRIGGER IF NOT EXISTS altdefs_log_ins AFTER INSERT ON altdefs BEGIN INSERT INTO changelog (tbl, rowkey, defno) SELECT 'altdefs', term, NEW.defno FROM definitions WHERE id = NEW.termid; END;"
+		"CREATE TRIGGER IF NOT EXISTS altdefs_log_upd AFTER UPDATE ON altdefs BEGIN INSERT INTO changelog (tbl, rowkey, defno) SELECT 'altdefs', term, OLD.defno FROM definitions"
+		" WHERE id = OLD.termid AND (OLD.termid IS NOT NEW.termid OR OLD.defno IS NOT NEW.defno);"
+		" INSERT INTO changelog (tbl, rowkey, defno) SELECT 'altdefs', term, NEW.defno FROM definitions WHERE id = NEW.termid; END;"
+		"CREATE TRIGGER IF NOT EXISTS altdefs_log_del AFTER DELETE ON altdefs BEGIN INSERT INTO changelog (tbl, rowkey, defno) SELECT 'altdefs', term, OLD.defno FROM definitions WHERE id = OLD.termid; END;"
+		"CREATE TRIGGER IF NOT EXISTS defrefs_log_ins AFTER INSERT ON defrefs BEGIN INSERT INTO changelog (tbl, rowkey) VALUES ('defrefs', NEW.idhash); END;"
+		"CREATE TRIGGER IF NOT EXISTS defrefs_log_upd AFTER UPDATE ON defrefs BEGIN INSERT INTO changelog (tbl, rowkey) SELECT 'defrefs', OLD.idhash WHERE OLD.idhash IS NOT NEW.idhash; INSERT INTO changelog (tbl, rowkey) VALUES ('defrefs', NEW.idhash); END;"
+		"CREATE TRIGGER IF NOT EXISTS defrefs_log_del AFTER DELETE ON defrefs BEGIN INSERT INTO changelog (tbl, rowkey) VALUES ('defrefs', OLD.idhash); END;",
+		"CREATE TRIGGER IF NOT EXISTS definitions_tag_ins AFTER INSERT ON definitions BEGIN INSERT OR IGNORE INTO tag_stale VALUES (NEW.category); END;"
+		"CREATE TRIGGER IF NOT EXISTS definitions_tag_upd AFTER UPDATE OF category ON definitions WHEN OLD.category IS NOT NEW.category"
+		" BEGIN INSERT OR IGNORE INTO tag_stale VALUES (OLD.category), (NEW.category); END;"
+		"CREATE TRIGGER IF NOT EXISTS definitions_tag_del AFTER DELETE ON definitions"
+		" BEGIN DELETE FROM term_tags WHERE termid = OLD.id; INSERT OR IGNORE INTO tag_stale VALUES (OLD.category); END;"
+		"CREATE TRIGGER IF NOT EXISTS term_tags_ins AFTER INSERT ON term_tags BEGIN INSERT OR IGNORE INTO tag_stale VALUES (NEW.category); END;"
+		"CREATE TRIGGER IF NOT EXISTS term_tags_del AFTER DELETE ON term_tags BEGIN INSERT OR IGNORE INTO tag_stale VALUES (OLD.category); END;"
+		NOM_SUM_TRIGGERS
+		"PRAGMA user_version=9;"
+		"COMMIT;"
+	},
+	/* 9 -> 10: how far into each followed file imp --follow has read */
+	{
+		"BEGIN IMMEDIATE;"
+		"CREATE TABLE IF NOT EXISTS ingest_offsets (path text PRIMARY KEY NOT NULL, inode integer NOT NULL, pos integer NOT NULL,"
+		" modified integer) WITHOUT ROWID;"
+		"PRAGMA user_version=10;"
+		"COMMIT;"
+	},
+	/* 10 -> 11: imports hold the counting insert triggers off with a row instead of dropping them */
+	{
+		"BEGIN IMMEDIATE;"
+		"CREATE TABLE IF NOT EXISTS category_stats_hold (id integer PRIMARY KEY CHECK (id = 0));"
+		"DROP TRIGGER IF EXISTS definitions_sum_ins; DROP TRIGGER IF EXISTS altdefs_sum_ins;"
+		"CREATE TRIGGER IF NOT EXISTS definitions_sum_ins AFTER INSERT ON definitions WHEN NOT EXISTS (SELECT 1 FROM category_stats_hold)"
+		" BEGIN INSERT INTO category_stats (category, terms, modified) VALUES (NEW.category, 1, CAST(strftime('%s', 'now') AS INTEGER))"
+		" ON CONFLICT (category) DO UPDATE SET terms = terms + 1, modified = excluded.modified; END;"
+		"CREATE TRIGGER IF NOT EXISTS altdefs_sum_ins AFTER INSERT ON altdefs WHEN NOT EXISTS (SELECT 1 FROM category_stats_hold)"
+		" BEGIN INSERT INTO category_stats (category, alts, modified) VALUES (NEW.category, 1, CAST(strftime('%s', 'now') AS INTEGER))"
+		" ON CONFLICT (category) DO UPDATE SET alts = alts + 1, modified = excluded.modified; END;"
+		"PRAGMA user_version=11;"
+		"COMMIT;"
+	}
+};
+
 /* 
  * nom_getdbn()
  * If the buffer is not already full, attempt to find the name
@@ -134,7 +387,7 @@ nom_initdb(const char * restrict dbname, const char * restrict initsql, nomcmd *
 			return(retc);
 		}
 		retc = sqlite3_open_v2(dbname, &cmdbuf->dbcon, SQLITE_OPEN_READWRITE|SQLITE_OPEN_CREATE|SQLITE_OPEN_FULLMUTEX|SQLITE_OPEN_PRIVATECACHE, NULL);
-		if (retc == SQLITE_OK) {
+		if (retc == SQLITE_OK && (retc = nom_confdb(cmdbuf->dbcon)) == SQLITE_OK) {
 			/* Run the initialization SQL script */
 			retc = run_initsql(cmdbuf);
 		} else {
@@ -352,8 +605,12 @@ nom_dbconn(nomcmd *cmdbuf) {
 			/* Something has gone wrong */
 			cmdbuf->dbcon = NULL;
 			NOMERR("Could not connect to database \"%s\" (%s)!\n", cmdbuf->filedata[NOMBRE_DBFILE], sqlite3_errstr(retc));
-		} else {
-			retc ^= retc;
+		} else if ((retc = nom_normreg(cmdbuf->dbcon)) == SQLITE_OK && (retc = nom_regexreg(cmdbuf->dbcon)) == SQLITE_OK &&
+				(retc = nom_confdb(cmdbuf->dbcon)) == SQLITE_OK && (retc = nom_memdb(cmdbuf->dbcon)) == SQLITE_OK) {
+			/* Another command may be between chunks of a delete, wait for it like the readers do */
+			sqlite3_busy_timeout(cmdbuf->dbcon, NOMBRE_BUSY_MS);
+			/* Registered first, migrations may need it */
+			retc = nom_migrate(cmdbuf);
 		}
 	}
 	if (dbg) {
@@ -361,3 +618,89 @@ nom_dbconn(nomcmd *cmdbuf) {
 	}
 	return(retc);
 }
+
+/*
+ * nom_dbconn_ro()
+ * Open an extra read-only connection to an existing database, for worker
+ * threads that each need their own. The schema is assumed to already be
+ * current, as the caller's main connection went through nom_migrate().
+ */
+int
+nom_dbconn_ro(const char * restrict dbname, sqlite3 ** restrict dbcon) {
+	int retc;
+
+	if (dbg) {
+		NOMDBG("Entering with dbname = %s\n", dbname);
+	}
+	if (dbname == NULL || dbcon == NULL) {
+		NOMERR("%s\n", "Invalid Parameters!");
+		return(BADARGS);
+	}
+	if ((retc = sqlite3_open_v2(dbname, dbcon, SQLITE_OPEN_READONLY|SQLITE_OPEN_NOMUTEX|SQLITE_OPEN_PRIVATECACHE, NULL)) != SQLITE_OK) {
+		NOMERR("Could not connect to database \"%s\" (%s)!\n", dbname, sqlite3_errstr(retc));
+		sqlite3_close_v2(*dbcon);
+		*dbcon = NULL;
+	} else {
+		/* Ride out a writer briefly holding the lock rather than failing outright */
+		sqlite3_busy_timeout(*dbcon, NOMBRE_BUSY_MS);
+		if ((retc = nom_normreg(*dbcon)) == SQLITE_OK && (retc = nom_confdb(*dbcon)) == SQLITE_OK) {
+			retc = nom_memdb(*dbcon);
+		}
+	}
+	return(retc);
+}
+
+/*
+ * nom_migrate()
+ * Bring the schema of an already open database up to NOMBRE_SCHEMA_VERSION,
+ * one revision at a time. Databases from a newer build are left untouched.
+ */
+int
+nom_migrate(nomcmd *cmdbuf) {
+	int retc, version;
+	char *errmsg;
+	sqlite3_stmt *stmt;
+	retc = 0; version = 0;
+	errmsg = NULL; stmt = NULL;
+
+	if (dbg) {
+		NOMDBG("Entering with cmdbuf = %p\n", (void *)cmdbuf);
+	}
+	if (cmdbuf == NULL || cmdbuf->dbcon == NULL) {
+		NOMERR("%s\n", "Invalid Parameters!");
+		return(BADARGS);
+	}
+
+	if ((retc = sqlite3_prepare_v2(cmdbuf->dbcon, "PRAGMA user_version;", -1, &stmt, NULL)) != SQLITE_OK) {
+		NOMERR("Unable to read schema version (%s)!\n", sqlite3_errmsg(cmdbuf->dbcon));
+		return(retc);
+	}
+	if (sqlite3_step(stmt) == SQLITE_ROW) {
+		version = sqlite3_column_int(stmt, 0);
+	}
+	sqlite3_finalize(stmt);
+
+	if (version > NOMBRE_SCHEMA_VERSION) {
+		NOMWRN("Database schema is revision %d, this build only knows up to %d\n", version, NOMBRE_SCHEMA_VERSION);
+		return(NOM_OK);
+	}
+	for (; version < NOMBRE_SCHEMA_VERSION; version++) {
+		if (dbg) {
+			NOMDBG("Upgrading schema from revision %d to %d\n", version, version + 1);
+		}
+		for (int part = 0; part < NOM_UPGRADE_PARTS && nom_upgrades[version][part] != NULL && retc == SQLITE_OK; part++) {
+			retc = sqlite3_exec(cmdbuf->dbcon, nom_upgrades[version][part], NULL, NULL, &errmsg);
+		}
+		if (retc != SQLITE_OK) {
+			NOMERR("Schema upgrade to revision %d failed (%s)!\n", version + 1, errmsg);
+			sqlite3_free(errmsg);
+			sqlite3_exec(cmdbuf->dbcon, "ROLLBACK;", NULL, NULL, NULL);
+			break;
+		}
+	}
+
+	if (dbg) {
+		NOMDBG("Returning %d to caller at schema revision %d\n", retc, version);
+	}
+	return(retc);
+}
@@ -51,14 +51,18 @@
 #define UMODE  (S_IRWXU|S_IFDIR)
 /* OK to foll on group permissions if we have RWX */
 #define GMODE  (S_IRWXG|S_IFDIR)
+/* How long extra connections wait on a locked database */
+#define NOMBRE_BUSY_MS 5000
 /* Two possible success conditions */
 #define UDIR_OK (UID_OK|URW_OK)
 #define GDIR_OK (GID_OK|GRW_OK)
 
 int nom_getdbn(char * restrict dbnamebuf);
 int nom_dbconn(nomcmd *cmdbuf);
+int nom_dbconn_ro(const char * restrict dbname, sqlite3 ** restrict dbcon);
 int nom_testdbpath(const char * restrict dbname);
 int nom_initdb(const char * restrict dbname, const char * restrict initsql, nomcmd *cmdbuf);
 int nom_dirtest(const char * restrict dbname, const size_t dbanmelen);
 int nom_mkdirs(const char * restrict dbname, const size_t diroffset);
 int run_initsql(const nomcmd * cmdbuf);
+int nom_migrate(nomcmd *cmdbuf);
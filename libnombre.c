@@ -0,0 +1,367 @@
+/* 
+ * Copyright (c) 2019, Exile Heavy Industries
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted (subject to the limitations in the disclaimer
+ * below) provided that the following conditions are met:
+ * 
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ * 
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * 
+ * * Neither the name of the copyright holder nor the names of its contributors may be used
+ *   to endorse or promote products derived from this software without specific
+ *   prior written permission.
+ * 
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY THIS
+ * LICENSE. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+/*
+ * libnombre, see libnombre.h
+ *
+ * Every pooled connection is a command buffer of its own, so calls go
+ * through the same statement builders as the nombre(1) subcommands and
+ * behave exactly like them. Each buffer keeps its connection and category
+ * cache between calls, everything else is cleared when it is lent out.
+ */
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef NOMBRE_H
+#include "nombre.h"
+#endif
+#ifndef NOMBRE_LIBNOMBRE_H
+#include "libnombre.h"
+#endif
+#ifndef NOMBRE_INITDB_H
+#include "initdb.h"
+#endif
+#ifndef NOMBRE_PARSECMD_H
+#include "parsecmd.h"
+#endif
+#ifndef NOMBRE_SUBNOM_H
+#include "subnom.h"
+#endif
+#ifndef NOMBRE_CATMAP_H
+#include "catmap.h"
+#endif
+#ifndef NOMBRE_NOMTRACE_H
+#include "nomtrace.h"
+#endif
+
+extern char *__progname;
+
+/* Defined here rather than in nombre.c, as every module in the library reads it */
+#ifdef NOMBRE_DEBUG
+bool dbg = true;
+#else
+bool dbg = false;
+#endif
+
+struct nomlib_t {
+	pthread_mutex_t lock;
+	pthread_cond_t idle; /* Signalled whenever a connection is handed back */
+	unsigned int size;
+	unsigned int nidle;
+	nomcmd **idlecmds; /* Stack of the connections not lent out */
+	nomcmd *cmds;
+};
+
+/* How the columns of each kind of statement map onto the callback */
+#define LIB_LOOKUP 0x01 /* meaning, defno */
+#define LIB_SEARCH 0x02 /* term, meaning */
+#define LIB_LIST 0x03 /* category, term, meaning */
+
+static nomcmd *libborrow(nomlib * restrict lib);
+static void libreturn(nomlib * restrict lib, nomcmd * restrict cmdbuf);
+static inline bool liblong(const char * restrict str);
+static int libcatg(nomcmd * restrict cmdbuf, const char * restrict catg);
+static int librows(nomcmd * restrict cmdbuf, int shape, nomlib_row fn, void *arg);
+
+/*
+ * Open poolsize connections (NOMLIB_POOL for 0) to dbname, or to the
+ * database nombre(1) would use when dbname is NULL. The database has to
+ * exist already, its schema is brought up to date as it is opened.
+ */
+int
+nomlib_open(const char *dbname, unsigned int poolsize, nomlib **lib) {
+	int retc;
+	nomlib *pool;
+	retc = NOM_OK;
+
+	if (dbg) {
+		NOMDBG("Entering with dbname = %s, poolsize = %u\n", (dbname != NULL) ? dbname : "(default)", poolsize);
+	}
+	if (lib == NULL || (dbname != NULL && strlen(dbname) >= PATHMAX)) {
+		NOMERR("%s\n", "Invalid Parameters!");
+		return(BADARGS);
+	}
+	*lib = NULL;
+	if (sqlite3_threadsafe() == 0) {
+		NOMERR("%s\n", "The SQLite3 library was built without thread support!");
+		return(NOM_FAIL);
+	}
+	poolsize = (poolsize > 0) ? poolsize : NOMLIB_POOL;
+	if ((pool = calloc(1, sizeof(nomlib))) == NULL) {
+		return(NOM_FAIL);
+	}
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->idle, NULL);
+	if ((pool->cmds = calloc(poolsize, sizeof(nomcmd))) == NULL || (pool->idlecmds = calloc(poolsize, sizeof(nomcmd *))) == NULL) {
+		nomlib_close(pool);
+		return(NOM_FAIL);
+	}
+	pool->size = poolsize;
+
+	/* Opened one after another, so only the first can find a migration to run */
+	for (unsigned int i = 0; i < poolsize && retc == NOM_OK; i++) {
+		if (dbname != NULL) {
+			memccpy(pool->cmds[i].filedata[NOMBRE_DBFILE], dbname, 0, (size_t)PATHMAX);
+		}
+		if ((retc = nom_getdbn(pool->cmds[i].filedata[NOMBRE_DBFILE])) == NOM_OK && (retc = nom_dbconn(&pool->cmds[i])) == SQLITE_OK) {
+			/* Writers on other connections of the pool are waited out rather than failed on */
+			sqlite3_busy_timeout(pool->cmds[i].dbcon, NOMBRE_BUSY_MS);
+			pool->idlecmds[pool->nidle++] = &pool->cmds[i];
+		}
+	}
+	if (retc != NOM_OK) {
+		nomlib_close(pool);
+		return(retc);
+	}
+	*lib = pool;
+	return(NOM_OK);
+}
+
+/* Close every connection in the pool, once no call is using it any more */
+void
+nomlib_close(nomlib *lib) {
+	if (lib == NULL) {
+		return;
+	}
+	for (unsigned int i = 0; lib->cmds != NULL && i < lib->size; i++) {
+		nom_catfree(&lib->cmds[i]);
+		sqlite3_close_v2(lib->cmds[i].dbcon);
+	}
+	pthread_cond_destroy(&lib->idle);
+	pthread_mutex_destroy(&lib->lock);
+	free(lib->idlecmds);
+	free(lib->cmds);
+	free(lib);
+}
+
+/* Every definition of term, the primary first and then its alternates, as def */
+int
+nomlib_lookup(nomlib *lib, const char *catg, const char *term, nomlib_row fn, void *arg) {
+	int retc;
+	nomcmd *cmdbuf;
+	const char *args[3] = { catg, term, NULL };
+
+	if (lib == NULL || term == NULL || fn == NULL || liblong(catg) || liblong(term)) {
+		return(BADARGS);
+	}
+	cmdbuf = libborrow(lib);
+	cmdbuf->command = (catg != NULL) ? lookup|grpcmd : lookup;
+	if ((retc = libcatg(cmdbuf, catg)) == NOM_OK && (retc = nombre_lookup(cmdbuf, (catg != NULL) ? args : &args[1])) == NOM_OK) {
+		retc = librows(cmdbuf, LIB_LOOKUP, fn, arg);
+	}
+	libreturn(lib, cmdbuf);
+	return(retc);
+}
+
+/* Definitions whose meaning holds keyword (or matches it with NOMLIB_REGEX), as key */
+int
+nomlib_search(nomlib *lib, const char *catg, const char *keyword, unsigned int flags, nomlib_row fn, void *arg) {
+	int retc;
+	nomcmd *cmdbuf;
+	const char *args[3] = { catg, keyword, NULL };
+
+	if (lib == NULL || keyword == NULL || fn == NULL || liblong(catg) || liblong(keyword)) {
+		return(BADARGS);
+	}
+	cmdbuf = libborrow(lib);
+	cmdbuf->command = (catg != NULL) ? search|grpcmd : search;
+	cmdbuf->regex = (flags & NOMLIB_REGEX) ? 1 : 0;
+	if ((retc = libcatg(cmdbuf, catg)) == NOM_OK && (retc = nombre_ksearch(cmdbuf, (catg != NULL) ? args : &args[1])) == NOM_OK) {
+		retc = librows(cmdbuf, LIB_SEARCH, fn, arg);
+	}
+	libreturn(lib, cmdbuf);
+	return(retc);
+}
+
+/* Add a definition, filed as the next alternate if term already has one, as add */
+int
+nomlib_add(nomlib *lib, const char *catg, const char *term, const char *meaning) {
+	int retc;
+	nomcmd *cmdbuf;
+	sqlite3_stmt *stmt;
+	const char *args[4] = { catg, term, meaning, NULL };
+	stmt = NULL;
+
+	if (lib == NULL || term == NULL || meaning == NULL || liblong(catg) || liblong(term) || liblong(meaning)) {
+		return(BADARGS);
+	}
+	cmdbuf = libborrow(lib);
+	cmdbuf->command = (catg != NULL) ? define|grpcmd : define;
+	if ((retc = libcatg(cmdbuf, catg)) == NOM_OK && (retc = nombre_newdef(cmdbuf, (catg != NULL) ? args : &args[1])) == NOM_OK) {
+		if ((retc = sqlite3_prepare_v2(cmdbuf->dbcon, cmdbuf->gensql, -1, &stmt, NULL)) == SQLITE_OK &&
+				(retc = bindcmd(cmdbuf, stmt)) == SQLITE_OK) {
+			/* The new primary term comes back as a row, an alternate returns nothing */
+			while ((retc = sqlite3_step(stmt)) == SQLITE_ROW) { ; }
+		}
+		if (retc != SQLITE_DONE) {
+			NOMERR("Error adding definition for %s (%s)!\n", cmdbuf->defdata[NOMBRE_DBTERM], sqlite3_errmsg(cmdbuf->dbcon));
+		} else {
+			retc = NOM_OK;
+		}
+		sqlite3_finalize(stmt);
+	}
+	libreturn(lib, cmdbuf);
+	return(retc);
+}
+
+/*
+ * Every definition in term order, optionally only those of one category,
+ * starting just past after and stopping after limit rows (0 for all), as lst
+ */
+int
+nomlib_iterate(nomlib *lib, const char *catg, const char *after, int64_t limit, nomlib_row fn, void *arg) {
+	int retc;
+	nomcmd *cmdbuf;
+	const char *args[2] = { catg, NULL };
+
+	if (lib == NULL || fn == NULL || liblong(catg) || liblong(after)) {
+		return(BADARGS);
+	}
+	cmdbuf = libborrow(lib);
+	cmdbuf->command = (catg != NULL) ? dumpdb|grpcmd : dumpdb;
+	cmdbuf->limit = limit;
+	if (after != NULL) {
+		memccpy(cmdbuf->defdata[NOMBRE_DBTERM], after, 0, (size_t)DEFLEN);
+	}
+	if ((retc = libcatg(cmdbuf, catg)) == NOM_OK && (retc = nombre_dbdump(cmdbuf, args)) == NOM_OK) {
+		retc = librows(cmdbuf, LIB_LIST, fn, arg);
+	}
+	libreturn(lib, cmdbuf);
+	return(retc);
+}
+
+/* Wait for an idle connection and clear out what the last call left in its buffer */
+static nomcmd *
+libborrow(nomlib * restrict lib) {
+	unsigned int waits;
+	nomcmd *cmdbuf;
+
+	pthread_mutex_lock(&lib->lock);
+	for (waits = 0; lib->nidle == 0; waits++) {
+		pthread_cond_wait(&lib->idle, &lib->lock);
+	}
+	cmdbuf = lib->idlecmds[--lib->nidle];
+	NOMTRACE("idle/waits", lib->nidle, waits);
+	pthread_mutex_unlock(&lib->lock);
+
+	cmdbuf->command = unknown;
+	memset(cmdbuf->defdata, 0, sizeof(cmdbuf->defdata));
+	cmdbuf->gensql[0] = 0;
+	cmdbuf->defno = 0;
+	cmdbuf->catid = 0;
+	cmdbuf->limit = 0;
+	cmdbuf->regex = 0;
+	return(cmdbuf);
+}
+
+static void
+libreturn(nomlib * restrict lib, nomcmd * restrict cmdbuf) {
+	pthread_mutex_lock(&lib->lock);
+	lib->idlecmds[lib->nidle++] = cmdbuf;
+	pthread_cond_signal(&lib->idle);
+	pthread_mutex_unlock(&lib->lock);
+}
+
+/* Arguments are copied into DEFLEN buffers, anything that doesn't fit along with its terminator is refused */
+static inline bool
+liblong(const char * restrict str) {
+	return(str != NULL && strlen(str) >= DEFLEN);
+}
+
+/*
+ * A connection's category cache lives as long as the pool does, so a
+ * category some other connection created since is only found once the
+ * cache is reloaded. Done up front, the builders then resolve from it.
+ */
+static int
+libcatg(nomcmd * restrict cmdbuf, const char * restrict catg) {
+	int retc;
+	int64_t id;
+
+	if (catg == NULL) {
+		return(NOM_OK);
+	}
+	if ((retc = nom_catid(cmdbuf, catg, &id)) == NOM_INVALID) {
+		nom_catfree(cmdbuf);
+		retc = nom_catid(cmdbuf, catg, &id);
+	}
+	if (retc == NOM_INVALID) {
+		NOMERR("Unknown category \"%s\"!\n", catg);
+	}
+	return(retc);
+}
+
+/* Run the built statement, handing each row to fn until it runs out or fn asks to stop */
+static int
+librows(nomcmd * restrict cmdbuf, int shape, nomlib_row fn, void *arg) {
+	int retc, stop;
+	sqlite3_stmt *stmt;
+	const char *catg;
+	stmt = NULL; stop = 0;
+	catg = (cmdbuf->command & grpcmd) ? cmdbuf->defdata[NOMBRE_DBCATG] : NULL;
+
+	if ((retc = sqlite3_prepare_v2(cmdbuf->dbcon, cmdbuf->gensql, -1, &stmt, NULL)) != SQLITE_OK ||
+			(retc = bindcmd(cmdbuf, stmt)) != SQLITE_OK) {
+		NOMERR("Error preparing statement (%s)!\n", sqlite3_errmsg(cmdbuf->dbcon));
+		sqlite3_finalize(stmt);
+		return(retc);
+	}
+	while (stop == 0 && (retc = sqlite3_step(stmt)) == SQLITE_ROW) {
+		switch (shape) {
+			case (LIB_LOOKUP):
+				/* The primary sorts first with -1 in place of a number */
+				stop = fn(arg, catg, cmdbuf->defdata[NOMBRE_DBTERM], (const char *)sqlite3_column_text(stmt, 0),
+						(sqlite3_column_int64(stmt, 1) > 0) ? sqlite3_column_int64(stmt, 1) : 0);
+				break;
+			case (LIB_SEARCH):
+				stop = fn(arg, catg, (const char *)sqlite3_column_text(stmt, 0), (const char *)sqlite3_column_text(stmt, 1), 0);
+				break;
+			default:
+				stop = fn(arg, (const char *)sqlite3_column_text(stmt, 0), (const char *)sqlite3_column_text(stmt, 1),
+						(const char *)sqlite3_column_text(stmt, 2), 0);
+				break;
+		}
+	}
+	if (retc != SQLITE_ROW && retc != SQLITE_DONE) {
+		NOMERR("Error processing command! (%s)\n", sqlite3_errmsg(cmdbuf->dbcon));
+	} else {
+		retc = NOM_OK;
+	}
+	sqlite3_finalize(stmt);
+	return(retc);
+}
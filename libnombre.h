@@ -0,0 +1,75 @@
+/* 
+ * Copyright (c) 2019, Exile Heavy Industries
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted (subject to the limitations in the disclaimer
+ * below) provided that the following conditions are met:
+ * 
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ * 
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * 
+ * * Neither the name of the copyright holder nor the names of its contributors may be used
+ *   to endorse or promote products derived from this software without specific
+ *   prior written permission.
+ * 
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY THIS
+ * LICENSE. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#define NOMBRE_LIBNOMBRE_H
+
+#include <stdint.h>
+
+/*
+ * libnombre, the definition database for programs that would otherwise run
+ * nombre(1) once per query. Link with -lnombre -lsqlite3 -lpthread.
+ *
+ * A handle holds a fixed pool of connections to one database. Every call
+ * borrows a connection for its duration, waiting for one to come free if
+ * all are in use, so a handle may be shared between any number of threads
+ * and at most poolsize calls run at once. Results are handed to a callback
+ * one row at a time, in the same order nombre prints them. The strings
+ * passed to it are only valid until it returns, and returning non-zero
+ * from it stops the call early without that being an error.
+ *
+ * Calls return NOM_OK (0) or one of the nombre error codes: BADARGS (-1)
+ * for missing arguments or strings of DEFLEN (PATHMAX for dbname) bytes or
+ * more, NOM_INVALID (-4) for an unknown category, or an SQLite result code.
+ * Diagnostics are written to stderr as nombre does.
+ */
+typedef struct nomlib_t nomlib;
+
+/*
+ * catg is the category name, NULL for lookups and searches across all of
+ * them. defno is 0 for a primary definition and the alternate's number
+ * otherwise.
+ */
+typedef int (*nomlib_row)(void *arg, const char *catg, const char *term, const char *meaning, int64_t defno);
+
+/* nomlib_search() flags */
+#define NOMLIB_REGEX 0x01 /* keyword is a POSIX extended regular expression, as key --regex */
+
+/* Connections in a pool when none is asked for */
+#define NOMLIB_POOL 4
+
+int nomlib_open(const char *dbname, unsigned int poolsize, nomlib **lib);
+void nomlib_close(nomlib *lib);
+int nomlib_lookup(nomlib *lib, const char *catg, const char *term, nomlib_row fn, void *arg);
+int nomlib_search(nomlib *lib, const char *catg, const char *keyword, unsigned int flags, nomlib_row fn, void *arg);
+int nomlib_add(nomlib *lib, const char *catg, const char *term, const char *meaning);
+int nomlib_iterate(nomlib *lib, const char *catg, const char *after, int64_t limit, nomlib_row fn, void *arg);
@@ -0,0 +1,310 @@
+/* 
+ * Copyright (c) 2019, Exile Heavy Industries
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted (subject to the limitations in the disclaimer
+ * below) provided that the following conditions are met:
+ * 
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ * 
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * 
+ * * Neither the name of the copyright holder nor the names of its contributors may be used
+ *   to endorse or promote products derived from this software without specific
+ *   prior written permission.
+ * 
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY THIS
+ * LICENSE. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+/*
+ * Streamed definitions, see nomblob.h
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#ifndef NOMBRE_H
+#include "nombre.h"
+#endif
+#ifndef NOMBRE_NOMBLOB_H
+#include "nomblob.h"
+#endif
+#ifndef NOMBRE_SUBNOM_H
+#include "subnom.h"
+#endif
+#ifndef NOMBRE_NOMHITS_H
+#include "nomhits.h"
+#endif
+
+extern char *__progname;
+extern bool dbg;
+
+/* Table and column behind NOMBRE_BLOB_DEFN and NOMBRE_BLOB_ALTDEF */
+static const char *const blobcols[2][2] = {
+	{ "definitions", "meaning" },
+	{ "altdefs", "altdef" }
+};
+
+static FILE *blobsrc(const nomcmd * restrict cmdbuf, sqlite3_int64 * restrict size);
+static int blobfill(sqlite3 * restrict db, int tbl, sqlite3_int64 rowid, FILE * restrict src, sqlite3_int64 size);
+static int blobout(sqlite3 * restrict db, sqlite3_blob ** restrict blob, int tbl, sqlite3_int64 rowid, FILE * restrict out);
+
+/*
+ * Add the definition read from -f or stdin for the term nombre_newdef()
+ * parsed. The row, its alternate filing and the body are one transaction,
+ * so a short read never leaves a zero filled entry behind.
+ */
+int
+nomdb_blobadd(nomcmd * restrict cmdbuf) {
+	int retc, tbl;
+	sqlite3_int64 size, rowid;
+	FILE *src;
+	sqlite3_stmt *stmt;
+	retc = NOM_OK; tbl = NOMBRE_BLOB_DEFN; rowid = 0;
+	stmt = NULL;
+
+	if (dbg) {
+		NOMDBG("Entering with cmdbuf = %p\n", (void *)cmdbuf);
+	}
+	if (cmdbuf == NULL || cmdbuf->dbcon == NULL) {
+		NOMERR("%s", "Given invalid input!\n");
+		return(BADARGS);
+	}
+	/* The "-" standing for stdin is not part of the definition */
+	if (strcmp(cmdbuf->defdata[NOMBRE_DBDEFN], "-") == 0) {
+		cmdbuf->defdata[NOMBRE_DBDEFN][0] = 0;
+	} else if (cmdbuf->filedata[NOMBRE_IOFILE][0] != 0 && cmdbuf->defdata[NOMBRE_DBDEFN][0] != 0) {
+		NOMERR("Definition for %s given both inline and with -f!\n", cmdbuf->defdata[NOMBRE_DBTERM]);
+		return(BADARGS);
+	}
+	if ((src = blobsrc(cmdbuf, &size)) == NULL) {
+		return(NOM_FIO_FAIL);
+	}
+
+	if ((retc = sqlite3_exec(cmdbuf->dbcon, "BEGIN IMMEDIATE;", NULL, NULL, NULL)) != SQLITE_OK ||
+			(retc = sqlite3_prepare_v2(cmdbuf->dbcon, NOMBRE_BLOB_INSERT, -1, &stmt, NULL)) != SQLITE_OK ||
+			(retc = bindcmd(cmdbuf, stmt)) != SQLITE_OK ||
+			(retc = sqlite3_bind_int64(stmt, sqlite3_bind_parameter_index(stmt, ":size"), size)) != SQLITE_OK) {
+		NOMERR("Error preparing definition for %s (%s)!\n", cmdbuf->defdata[NOMBRE_DBTERM], sqlite3_errmsg(cmdbuf->dbcon));
+		goto BLOBADD_EXIT;
+	}
+	if ((retc = sqlite3_step(stmt)) == SQLITE_ROW) {
+		rowid = sqlite3_column_int64(stmt, 0);
+		retc = sqlite3_step(stmt);
+	} else if (retc == SQLITE_DONE) {
+		/* Filed as the next alternate, which is the highest numbered one for the term */
+		tbl = NOMBRE_BLOB_ALTDEF;
+		sqlite3_finalize(stmt);
+		if ((retc = sqlite3_prepare_v2(cmdbuf->dbcon, NOMBRE_BLOB_LASTALT, -1, &stmt, NULL)) == SQLITE_OK &&
+				(retc = bindcmd(cmdbuf, stmt)) == SQLITE_OK && (retc = sqlite3_step(stmt)) == SQLITE_ROW) {
+			rowid = sqlite3_column_int64(stmt, 0);
+			retc = sqlite3_step(stmt);
+		}
+	}
+	if (retc != SQLITE_DONE) {
+		NOMERR("Error adding definition for %s (%s)!\n", cmdbuf->defdata[NOMBRE_DBTERM], sqlite3_errmsg(cmdbuf->dbcon));
+		goto BLOBADD_EXIT;
+	}
+	sqlite3_finalize(stmt);
+	stmt = NULL;
+
+	if ((retc = blobfill(cmdbuf->dbcon, tbl, rowid, src, size)) == SQLITE_OK) {
+		retc = sqlite3_exec(cmdbuf->dbcon, "COMMIT;", NULL, NULL, NULL);
+	}
+	if (retc == SQLITE_OK) {
+		if (tbl == NOMBRE_BLOB_ALTDEF) {
+			fprintf(stdout, "Added new alternative definition for %s (%lld bytes)\n", cmdbuf->defdata[NOMBRE_DBTERM], (long long)size);
+		} else if ((cmdbuf->command & grpcmd) == grpcmd) {
+			fprintf(stdout, "Added definition for %s/%s (%lld bytes)\n", cmdbuf->defdata[NOMBRE_DBCATG], cmdbuf->defdata[NOMBRE_DBTERM], (long long)size);
+		} else {
+			fprintf(stdout, "Added definition for %s (%lld bytes)\n", cmdbuf->defdata[NOMBRE_DBTERM], (long long)size);
+		}
+	}
+
+BLOBADD_EXIT:
+	sqlite3_finalize(stmt);
+	if (retc != SQLITE_OK && sqlite3_get_autocommit(cmdbuf->dbcon) == 0) {
+		sqlite3_exec(cmdbuf->dbcon, "ROLLBACK;", NULL, NULL, NULL);
+	}
+	if (src != stdin) {
+		fclose(src);
+	}
+	if (dbg) {
+		NOMDBG("Returning %d to caller\n", retc);
+	}
+	return(retc);
+}
+
+/*
+ * Print every definition of the term nombre_lookup() parsed, the primary
+ * first and then its numbered alternates, reading each one back through
+ * an incremental BLOB handle rather than as a column of the result row.
+ */
+int
+nomdb_blobdef(nomcmd * restrict cmdbuf) {
+	int retc, tbl;
+	unsigned int i;
+	sqlite3_stmt *stmt;
+	sqlite3_blob *blob[2];
+	stmt = NULL; blob[0] = blob[1] = NULL;
+
+	if (dbg) {
+		NOMDBG("Entering with cmdbuf = %p\n", (void *)cmdbuf);
+	}
+	if (cmdbuf == NULL || cmdbuf->dbcon == NULL) {
+		NOMERR("%s", "Given invalid input!\n");
+		return(BADARGS);
+	}
+	if ((retc = sqlite3_prepare_v2(cmdbuf->dbcon, ((cmdbuf->command & grpcmd) == grpcmd) ? NOMBRE_BLOB_GRPLOOKUP : NOMBRE_BLOB_LOOKUP,
+					-1, &stmt, NULL)) != SQLITE_OK || (retc = bindcmd(cmdbuf, stmt)) != SQLITE_OK) {
+		NOMERR("Error compiling SQL (%s)!\n", sqlite3_errmsg(cmdbuf->dbcon));
+		sqlite3_finalize(stmt);
+		return(retc);
+	}
+
+	for (i = 1; (retc = sqlite3_step(stmt)) == SQLITE_ROW; i++) {
+		if (i > 1) {
+			fprintf(stdout, "  #%u: ", i);
+		} else {
+			fprintf(stdout, "%s: ", cmdbuf->defdata[NOMBRE_DBTERM]);
+		}
+		tbl = (sqlite3_column_int(stmt, 0) == NOMBRE_BLOB_ALTDEF) ? NOMBRE_BLOB_ALTDEF : NOMBRE_BLOB_DEFN;
+		if ((retc = blobout(cmdbuf->dbcon, &blob[tbl], tbl, sqlite3_column_int64(stmt, 1), stdout)) != SQLITE_OK) {
+			break;
+		}
+		putc('\n', stdout);
+	}
+	if (retc == SQLITE_DONE) {
+		if (i == 1) {
+			fprintf(stdout, "%s: unknown\n", cmdbuf->defdata[NOMBRE_DBTERM]);
+		} else {
+			/* Only lookups that found something count towards the top listing */
+			nom_hitlog(cmdbuf);
+		}
+		retc = NOM_OK;
+	} else {
+		NOMERR("Error reading definitions for %s (%s)!\n", cmdbuf->defdata[NOMBRE_DBTERM], sqlite3_errmsg(cmdbuf->dbcon));
+	}
+	sqlite3_blob_close(blob[NOMBRE_BLOB_DEFN]);
+	sqlite3_blob_close(blob[NOMBRE_BLOB_ALTDEF]);
+	sqlite3_finalize(stmt);
+	if (dbg) {
+		NOMDBG("Returning %d to caller\n", retc);
+	}
+	return(retc);
+}
+
+/*
+ * Open the -f file, or stdin, at its start and report how many bytes it
+ * holds. Anything that can't be sized up front is spooled to a temporary file.
+ */
+static FILE *
+blobsrc(const nomcmd * restrict cmdbuf, sqlite3_int64 * restrict size) {
+	size_t len;
+	off_t at;
+	struct stat st;
+	FILE *src, *spool;
+	char buf[NOMBRE_BLOB_CHUNK];
+	src = stdin; spool = NULL;
+
+	if (cmdbuf->filedata[NOMBRE_IOFILE][0] != 0 && (src = fopen(cmdbuf->filedata[NOMBRE_IOFILE], "r")) == NULL) {
+		NOMERR("Unable to open %s! (%s)\n", cmdbuf->filedata[NOMBRE_IOFILE], strerror(errno));
+		return(NULL);
+	}
+	if (fstat(fileno(src), &st) == 0 && S_ISREG(st.st_mode) && (at = ftello(src)) >= 0) {
+		*size = (sqlite3_int64)(st.st_size - at);
+		return(src);
+	}
+
+	if ((spool = tmpfile()) == NULL) {
+		NOMERR("Unable to create a spool file! (%s)\n", strerror(errno));
+	} else {
+		while ((len = fread(buf, 1, sizeof(buf), src)) > 0) {
+			if (fwrite(buf, 1, len, spool) != len) {
+				break;
+			}
+		}
+		if (ferror(src) != 0 || ferror(spool) != 0 || fflush(spool) != 0 || (at = ftello(spool)) < 0) {
+			NOMERR("Unable to spool the definition! (%s)\n", strerror(errno));
+			fclose(spool);
+			spool = NULL;
+		} else {
+			*size = (sqlite3_int64)at;
+			rewind(spool);
+		}
+	}
+	if (src != stdin) {
+		fclose(src);
+	}
+	return(spool);
+}
+
+/* Copy exactly size bytes of src into the zeroblob reserved for the row */
+static int
+blobfill(sqlite3 * restrict db, int tbl, sqlite3_int64 rowid, FILE * restrict src, sqlite3_int64 size) {
+	int retc;
+	size_t len;
+	sqlite3_int64 off;
+	sqlite3_blob *blob;
+	char buf[NOMBRE_BLOB_CHUNK];
+	off = 0; blob = NULL;
+
+	if ((retc = sqlite3_blob_open(db, "main", blobcols[tbl][0], blobcols[tbl][1], rowid, 1, &blob)) != SQLITE_OK) {
+		NOMERR("Unable to open %s row %lld (%s)!\n", blobcols[tbl][0], (long long)rowid, sqlite3_errmsg(db));
+		return(retc);
+	}
+	while (retc == SQLITE_OK && off < size && (len = fread(buf, 1, sizeof(buf), src)) > 0) {
+		/* A file that grew since it was sized is cut off where it was sized */
+		len = ((sqlite3_int64)len > size - off) ? (size_t)(size - off) : len;
+		retc = sqlite3_blob_write(blob, buf, (int)len, (int)off);
+		off += (sqlite3_int64)len;
+	}
+	if (retc == SQLITE_OK && off != size) {
+		NOMERR("Definition ended after %lld of %lld bytes!\n", (long long)off, (long long)size);
+		retc = NOM_FIO_FAIL;
+	} else if (retc != SQLITE_OK) {
+		NOMERR("Error writing %s row %lld (%s)!\n", blobcols[tbl][0], (long long)rowid, sqlite3_errmsg(db));
+	}
+	sqlite3_blob_close(blob);
+	return(retc);
+}
+
+/* Copy one meaning to out, moving the table's handle to the row if it's already open */
+static int
+blobout(sqlite3 * restrict db, sqlite3_blob ** restrict blob, int tbl, sqlite3_int64 rowid, FILE * restrict out) {
+	int retc, len, size;
+	char buf[NOMBRE_BLOB_CHUNK];
+
+	retc = (*blob != NULL) ? sqlite3_blob_reopen(*blob, rowid) : sqlite3_blob_open(db, "main", blobcols[tbl][0], blobcols[tbl][1], rowid, 0, blob);
+	if (retc != SQLITE_OK) {
+		return(retc);
+	}
+	size = sqlite3_blob_bytes(*blob);
+	for (int off = 0; retc == SQLITE_OK && off < size; off += len) {
+		len = (size - off > (int)sizeof(buf)) ? (int)sizeof(buf) : size - off;
+		if ((retc = sqlite3_blob_read(*blob, buf, len, off)) == SQLITE_OK && fwrite(buf, 1, (size_t)len, out) != (size_t)len) {
+			retc = NOM_FIO_FAIL;
+		}
+	}
+	return(retc);
+}
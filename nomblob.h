@@ -0,0 +1,66 @@
+/* 
+ * Copyright (c) 2019, Exile Heavy Industries
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted (subject to the limitations in the disclaimer
+ * below) provided that the following conditions are met:
+ * 
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ * 
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * 
+ * * Neither the name of the copyright holder nor the names of its contributors may be used
+ *   to endorse or promote products derived from this software without specific
+ *   prior written permission.
+ * 
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY THIS
+ * LICENSE. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#define NOMBRE_NOMBLOB_H
+
+#ifndef NOMBRE_H
+#include "nombre.h"
+#endif
+
+/*
+ * Definitions too long for the command line are read from -f, or from stdin
+ * when the definition is given as "-", and written into a zeroblob() of the
+ * right size through sqlite3_blob_write() one NOMBRE_BLOB_CHUNK at a time.
+ * A pipe is spooled to a temporary file first, since the size has to be
+ * known before the row is inserted. Lookups go through the same incremental
+ * I/O in the other direction, so printing an entry takes the same memory
+ * whatever its size. Such entries are stored with BLOB affinity, which
+ * LIKE, REGEXP, export and compare all read back as the same text.
+ */
+#define NOMBRE_BLOB_CHUNK BUFSIZE
+/* Index into the table and column a row locator refers to */
+#define NOMBRE_BLOB_DEFN 0x00
+#define NOMBRE_BLOB_ALTDEF 0x01
+
+/* An existing term is filed as an alternate by the definitions_altdef trigger, and returns nothing */
+#define NOMBRE_BLOB_INSERT "INSERT INTO definitions (term, meaning, category) VALUES (:term, zeroblob(:size), COALESCE(:catid, -1)) RETURNING id;"
+#define NOMBRE_BLOB_LASTALT "SELECT a.rowid FROM definitions AS d CROSS JOIN altdefs AS a ON a.termid = d.id WHERE d.term = :term ORDER BY a.defno DESC LIMIT 1;"
+/* Row locators instead of the meanings themselves, in the order nombre_lookup() returns them */
+#define NOMBRE_BLOB_LOOKUP "SELECT 0, id, -1 FROM definitions WHERE term = nomnorm(:term)" \
+	" UNION ALL SELECT 1, a.rowid, a.defno FROM definitions AS d CROSS JOIN altdefs AS a ON a.termid = d.id WHERE d.term = nomnorm(:term) ORDER BY 3;"
+#define NOMBRE_BLOB_GRPLOOKUP "SELECT 0, id, -1 FROM definitions WHERE term = nomnorm(:term) AND category = :catid" \
+	" UNION ALL SELECT 1, a.rowid, a.defno FROM definitions AS d CROSS JOIN altdefs AS a ON a.termid = d.id" \
+	" WHERE d.term = nomnorm(:term) AND a.category = :catid ORDER BY 3;"
+
+int nomdb_blobadd(nomcmd * restrict cmdbuf);
+int nomdb_blobdef(nomcmd * restrict cmdbuf);
@@ -0,0 +1,307 @@
+/* 
+ * Copyright (c) 2019, Exile Heavy Industries
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted (subject to the limitations in the disclaimer
+ * below) provided that the following conditions are met:
+ * 
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ * 
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * 
+ * * Neither the name of the copyright holder nor the names of its contributors may be used
+ *   to endorse or promote products derived from this software without specific
+ *   prior written permission.
+ * 
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY THIS
+ * LICENSE. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+/*
+ * Bloom filter for negative lookups, see nombloom.h
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifndef NOMBRE_H
+#include "nombre.h"
+#endif
+#ifndef NOMBRE_NOMBLOOM_H
+#include "nombloom.h"
+#endif
+#ifndef NOMBRE_NOMNORM_H
+#include "nomnorm.h"
+#endif
+#ifndef NOMBRE_NOMTRACE_H
+#include "nomtrace.h"
+#endif
+
+extern char *__progname;
+extern bool dbg;
+
+static int bloomstamp(const char * restrict dbname, uint32_t * restrict stamp);
+
+/* FNV-1a finished with the MurmurHash3 mixer, both probe strides come from it */
+static inline uint64_t
+bloomhash(const unsigned char * restrict term, size_t len) {
+	uint64_t h;
+	h = 0xcbf29ce484222325ULL;
+
+	for (size_t i = 0; i < len; i++) {
+		h = (h ^ term[i]) * 0x100000001b3ULL;
+	}
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+	return(h);
+}
+
+static inline uint64_t
+bloombit(uint64_t h, uint32_t probe, uint64_t nbits) {
+	return(((h & 0xFFFFFFFFULL) + (uint64_t)probe * ((h >> 32) | 1)) % nbits);
+}
+
+/*
+ * Check the term against the filter before the database is opened. Sets
+ * cmdbuf->bloom, and remembers the change counter it was checked against
+ * for nom_bloomnote(). Anything short of a current filter saying no is
+ * left for the database to answer.
+ */
+int
+nom_bloomprobe(nomcmd * restrict cmdbuf, const char * restrict term) {
+	int fd;
+	size_t len;
+	uint64_t h, bit;
+	unsigned char bits;
+	struct nombloom_hdr hdr;
+	char path[PATHMAX + sizeof(NOMBRE_BLOOM_SUFFIX)];
+	char norm[DEFLEN + 1];
+	cmdbuf->bloom = NOMBRE_BLOOM_STALE;
+
+	if (bloomstamp(cmdbuf->filedata[NOMBRE_DBFILE], &cmdbuf->bloomstamp) != NOM_OK) {
+		return(NOM_OK);
+	}
+	snprintf(path, sizeof(path), "%s%s", cmdbuf->filedata[NOMBRE_DBFILE], NOMBRE_BLOOM_SUFFIX);
+	if ((fd = open(path, O_RDONLY)) < 0) {
+		return(NOM_OK);
+	}
+	if (pread(fd, &hdr, sizeof(hdr), 0) != (ssize_t)sizeof(hdr) || memcmp(hdr.magic, NOMBRE_BLOOM_MAGIC, sizeof(hdr.magic)) != 0 ||
+			hdr.stamp != cmdbuf->bloomstamp || hdr.nbits == 0) {
+		close(fd);
+		return(NOM_OK);
+	}
+	cmdbuf->bloom = NOMBRE_BLOOM_CURRENT;
+	if (term != NULL) {
+		memccpy(norm, term, 0, (size_t)DEFLEN);
+		norm[DEFLEN - 1] = 0;
+		len = nom_normterm(norm);
+		h = bloomhash((const unsigned char *)norm, len);
+		for (uint32_t i = 0; i < hdr.probes; i++) {
+			bit = bloombit(h, i, hdr.nbits);
+			if (pread(fd, &bits, 1, (off_t)(sizeof(hdr) + bit / 8)) != 1) {
+				cmdbuf->bloom = NOMBRE_BLOOM_STALE;
+				break;
+			}
+			if ((bits & (1 << (bit % 8))) == 0) {
+				cmdbuf->bloom = NOMBRE_BLOOM_ABSENT;
+				break;
+			}
+		}
+	}
+	close(fd);
+	NOMTRACE("state/stamp", cmdbuf->bloom, cmdbuf->bloomstamp);
+	return(NOM_OK);
+}
+
+/*
+ * Write a fresh filter from one read transaction, so the stamp matches the
+ * terms it was built from, and swap it in with a rename
+ */
+int
+nom_bloombuild(nomcmd * restrict cmdbuf) {
+	int retc, fd;
+	uint64_t h, bit;
+	unsigned char *bits;
+	struct nombloom_hdr hdr;
+	sqlite3_stmt *stmt;
+	char path[PATHMAX + sizeof(NOMBRE_BLOOM_SUFFIX)];
+	char tmp[PATHMAX + sizeof(NOMBRE_BLOOM_SUFFIX) + 4];
+	bits = NULL; stmt = NULL;
+	memset(&hdr, 0, sizeof(hdr));
+
+	if ((retc = sqlite3_exec(cmdbuf->dbcon, "BEGIN;", NULL, NULL, NULL)) != SQLITE_OK ||
+			(retc = sqlite3_prepare_v2(cmdbuf->dbcon, NOMBRE_BLOOM_COUNT, -1, &stmt, NULL)) != SQLITE_OK ||
+			(retc = sqlite3_step(stmt)) != SQLITE_ROW) {
+		goto BLOOMBUILD_EXIT;
+	}
+	/* The read lock is held from here on, so no writer can move the counter */
+	hdr.nterms = (uint64_t)sqlite3_column_int64(stmt, 0);
+	sqlite3_finalize(stmt);
+	stmt = NULL;
+	if ((retc = bloomstamp(cmdbuf->filedata[NOMBRE_DBFILE], &hdr.stamp)) != NOM_OK) {
+		goto BLOOMBUILD_EXIT;
+	}
+	memcpy(hdr.magic, NOMBRE_BLOOM_MAGIC, sizeof(hdr.magic));
+	hdr.probes = NOMBRE_BLOOM_PROBES;
+	hdr.nbits = hdr.nterms * NOMBRE_BLOOM_BITS;
+	hdr.nbits = (hdr.nbits < NOMBRE_BLOOM_MINBITS) ? NOMBRE_BLOOM_MINBITS : (hdr.nbits + 7) & ~7ULL;
+	if ((bits = calloc(1, (size_t)(hdr.nbits / 8))) == NULL) {
+		retc = SQLITE_NOMEM;
+		goto BLOOMBUILD_EXIT;
+	}
+	if ((retc = sqlite3_prepare_v2(cmdbuf->dbcon, NOMBRE_BLOOM_TERMS, -1, &stmt, NULL)) != SQLITE_OK) {
+		goto BLOOMBUILD_EXIT;
+	}
+	while ((retc = sqlite3_step(stmt)) == SQLITE_ROW) {
+		h = bloomhash(sqlite3_column_text(stmt, 0), (size_t)sqlite3_column_bytes(stmt, 0));
+		for (uint32_t i = 0; i < hdr.probes; i++) {
+			bit = bloombit(h, i, hdr.nbits);
+			bits[bit / 8] |= (unsigned char)(1 << (bit % 8));
+		}
+	}
+	if (retc != SQLITE_DONE) {
+		goto BLOOMBUILD_EXIT;
+	}
+	snprintf(path, sizeof(path), "%s%s", cmdbuf->filedata[NOMBRE_DBFILE], NOMBRE_BLOOM_SUFFIX);
+	snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+	if ((fd = open(tmp, O_WRONLY|O_CREAT|O_TRUNC, 0644)) < 0) {
+		retc = NOM_FIO_FAIL;
+	} else {
+		retc = (write(fd, &hdr, sizeof(hdr)) == (ssize_t)sizeof(hdr) &&
+				write(fd, bits, (size_t)(hdr.nbits / 8)) == (ssize_t)(hdr.nbits / 8)) ? SQLITE_OK : NOM_FIO_FAIL;
+		if (close(fd) != 0 || (retc == SQLITE_OK && rename(tmp, path) != 0)) {
+			retc = NOM_FIO_FAIL;
+		}
+		if (retc != SQLITE_OK) {
+			unlink(tmp);
+		}
+	}
+	/* Only lookups that might have skipped the database lose out, so this is never an error */
+	if (retc != SQLITE_OK && dbg) {
+		NOMDBG("Could not write %s (%s)\n", path, strerror(errno));
+	}
+
+BLOOMBUILD_EXIT:
+	sqlite3_finalize(stmt);
+	sqlite3_exec(cmdbuf->dbcon, "COMMIT;", NULL, NULL, NULL);
+	free(bits);
+	if (dbg) {
+		NOMDBG("Built a %llu bit filter of %llu terms at stamp %u, returning %d\n",
+				(unsigned long long)hdr.nbits, (unsigned long long)hdr.nterms, hdr.stamp, retc);
+	}
+	return(retc);
+}
+
+/*
+ * After a def, del or upd, bring a filter that was current before it up to
+ * date: add the new term's bits (term is NULL when nothing was added), then
+ * restamp. Removed terms stay in the filter as false positives. Only done
+ * when this command's transaction is the one change since the probe, any
+ * other writer leaves the filter stale for the next lookup to rebuild.
+ * The new stamp is kept, so a command committing in several transactions
+ * can note each one in turn.
+ */
+int
+nom_bloomnote(nomcmd * restrict cmdbuf, const char * restrict term) {
+	const char *one;
+	one = term;
+	return(nom_bloomnotev(cmdbuf, &one, (term != NULL) ? 1 : 0));
+}
+
+/* The same for a transaction that added nterms terms */
+int
+nom_bloomnotev(nomcmd * restrict cmdbuf, const char ** restrict terms, size_t nterms) {
+	int fd, retc;
+	size_t len;
+	uint32_t stamp;
+	uint64_t h, bit;
+	unsigned char bits;
+	struct nombloom_hdr hdr;
+	char path[PATHMAX + sizeof(NOMBRE_BLOOM_SUFFIX)];
+	char norm[DEFLEN + 1];
+	retc = NOM_OK;
+
+	if (cmdbuf->bloom != NOMBRE_BLOOM_CURRENT || bloomstamp(cmdbuf->filedata[NOMBRE_DBFILE], &stamp) != NOM_OK ||
+			stamp == cmdbuf->bloomstamp) {
+		return(NOM_OK);
+	}
+	snprintf(path, sizeof(path), "%s%s", cmdbuf->filedata[NOMBRE_DBFILE], NOMBRE_BLOOM_SUFFIX);
+	if (stamp != cmdbuf->bloomstamp + 1 || (fd = open(path, O_RDWR)) < 0) {
+		return(NOM_OK);
+	}
+	if (pread(fd, &hdr, sizeof(hdr), 0) != (ssize_t)sizeof(hdr) || hdr.stamp != cmdbuf->bloomstamp || hdr.nbits == 0) {
+		close(fd);
+		return(NOM_OK);
+	}
+	for (size_t t = 0; t < nterms && retc == NOM_OK; t++) {
+		memccpy(norm, terms[t], 0, (size_t)DEFLEN);
+		norm[DEFLEN - 1] = 0;
+		len = nom_normterm(norm);
+		h = bloomhash((const unsigned char *)norm, len);
+		for (uint32_t i = 0; i < hdr.probes && retc == NOM_OK; i++) {
+			bit = bloombit(h, i, hdr.nbits);
+			if (pread(fd, &bits, 1, (off_t)(sizeof(hdr) + bit / 8)) != 1) {
+				retc = NOM_FIO_FAIL;
+				break;
+			}
+			bits |= (unsigned char)(1 << (bit % 8));
+			if (pwrite(fd, &bits, 1, (off_t)(sizeof(hdr) + bit / 8)) != 1) {
+				retc = NOM_FIO_FAIL;
+			}
+		}
+	}
+	/* The bits go in first, so a reader never trusts a stamp ahead of them */
+	hdr.stamp = stamp;
+	if (retc == NOM_OK && pwrite(fd, &hdr, sizeof(hdr), 0) != (ssize_t)sizeof(hdr)) {
+		retc = NOM_FIO_FAIL;
+	}
+	close(fd);
+	if (retc == NOM_OK) {
+		cmdbuf->bloomstamp = stamp;
+	}
+	if (dbg) {
+		NOMDBG("Restamped the filter to %u, returning %d\n", stamp, retc);
+	}
+	return(retc);
+}
+
+/* The big-endian file change counter from the database header */
+static int
+bloomstamp(const char * restrict dbname, uint32_t * restrict stamp) {
+	int fd;
+	unsigned char buf[4];
+
+	if ((fd = open(dbname, O_RDONLY)) < 0) {
+		return(NOM_FIO_FAIL);
+	}
+	if (pread(fd, buf, sizeof(buf), NOMBRE_BLOOM_COUNTER) != (ssize_t)sizeof(buf)) {
+		close(fd);
+		return(NOM_FIO_FAIL);
+	}
+	close(fd);
+	*stamp = ((uint32_t)buf[0] << 24) | ((uint32_t)buf[1] << 16) | ((uint32_t)buf[2] << 8) | buf[3];
+	return(NOM_OK);
+}
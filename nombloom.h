@@ -0,0 +1,80 @@
+/* 
+ * Copyright (c) 2019, Exile Heavy Industries
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted (subject to the limitations in the disclaimer
+ * below) provided that the following conditions are met:
+ * 
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ * 
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * 
+ * * Neither the name of the copyright holder nor the names of its contributors may be used
+ *   to endorse or promote products derived from this software without specific
+ *   prior written permission.
+ * 
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY THIS
+ * LICENSE. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#define NOMBRE_NOMBLOOM_H
+
+#ifndef NOMBRE_H
+#include "nombre.h"
+#endif
+
+/*
+ * A Bloom filter of every term, kept in a file next to the database so a
+ * def for an unknown term is answered without opening SQLite at all. The
+ * filter is stamped with the file change counter from the database header
+ * (offset 24), which every committed write moves, so a filter is only
+ * trusted while the database is exactly as it was when the filter was made.
+ * A lookup that finds the filter stale or missing rebuilds it afterwards,
+ * and def, del, upd and imp --follow keep a current filter current themselves.
+ *
+ * File layout: struct nombloom_hdr, then nbits / 8 bytes of filter.
+ */
+#define NOMBRE_BLOOM_SUFFIX "-bloom"
+#define NOMBRE_BLOOM_MAGIC "NOMBLOOM"
+/* About 1% false positives at 10 bits per term with 7 probes */
+#define NOMBRE_BLOOM_BITS 10
+#define NOMBRE_BLOOM_PROBES 7
+#define NOMBRE_BLOOM_MINBITS 4096
+/* Where SQLite keeps the file change counter in the database header */
+#define NOMBRE_BLOOM_COUNTER 24
+
+/* Alternates always share a term with definitions, so it alone is read */
+#define NOMBRE_BLOOM_COUNT "SELECT count(*) FROM definitions;"
+#define NOMBRE_BLOOM_TERMS "SELECT term FROM definitions;"
+
+/* cmdbuf->bloom */
+#define NOMBRE_BLOOM_STALE 0x00 /* Missing, unreadable or older than the database */
+#define NOMBRE_BLOOM_CURRENT 0x01
+#define NOMBRE_BLOOM_ABSENT 0x02 /* Current, and the term is certainly not in the database */
+
+struct nombloom_hdr {
+	char magic[8];
+	uint32_t stamp; /* Database change counter when the filter was made */
+	uint32_t probes;
+	uint64_t nbits;
+	uint64_t nterms;
+};
+
+int nom_bloomprobe(nomcmd * restrict cmdbuf, const char * restrict term);
+int nom_bloombuild(nomcmd * restrict cmdbuf);
+int nom_bloomnote(nomcmd * restrict cmdbuf, const char * restrict term);
+int nom_bloomnotev(nomcmd * restrict cmdbuf, const char ** restrict terms, size_t nterms);
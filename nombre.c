@@ -60,6 +60,18 @@
 #ifndef NOMBRE_PARSECMD_H
 #include "parsecmd.h"
 #endif
+#ifndef NOMBRE_CATMAP_H
+#include "catmap.h"
+#endif
+#ifndef NOMBRE_NOMMEM_H
+#include "nommem.h"
+#endif
+#ifndef NOMBRE_NOMTRACE_H
+#include "nomtrace.h"
+#endif
+#ifndef NOMBRE_NOMCONF_H
+#include "nomconf.h"
+#endif
 /* Define mneonics for the flag values */
 #define HELPME 0x01
 #define DBINIT 0x02
@@ -76,11 +88,6 @@ extern bool dbg;
 int cook(uint8_t * restrict flags, nomcmd * restrict cmdbuf, const char ** restrict argstr);
 inline static void usage(void);
 
-#ifdef NOMBRE_DEBUG
-bool dbg = true;
-#else 
-bool dbg = false;
-#endif 
 /* 
  * The layout for uint8_t flags is as follows:
  * 0 0 0 0 0 0 0 0
@@ -99,20 +106,25 @@ int
 main(int ac, char **av) {
 	int retc, ch;
 	uint8_t flags;
+	bool memstat;
+	sqlite3_int64 budget;
+	const char *membuf;
 	/* Ensure all pointer members are initialized as NULL */
 	nomcmd cmd = { .dbcon = NULL };
 	ch = retc = 0;
 	flags = 0;
+	memstat = false;
+	budget = 0;
+	membuf = getenv(NOMBRE_MEM_ENV);
 
 	/* Bail early if no arguments are given */
 	if (ac == 0) {
 		usage();
 		return(ac);
 	}
-	/* Initialize the SQLite3 library */
-	sqlite3_initialize();
 	opterr ^= opterr;
-	while ((ch = getopt(ac, av, "d:i:f:vDIh")) != -1) {
+	/* Stop at the subcommand, anything after it (including --options) belongs to it */
+	while ((ch = getopt(ac, av, "+d:i:f:m:vDIMh")) != -1) {
 		switch (ch) {
 			case 'h':
 				flags |= HELPME;
@@ -137,6 +149,12 @@ main(int ac, char **av) {
 			case 'D':
 				dbg = true;
 				break;
+			case 'm':
+				membuf = optarg;
+				break;
+			case 'M':
+				memstat = true;
+				break;
 
 			/* This may need to be redone later */
 			case '?':
@@ -151,37 +169,65 @@ main(int ac, char **av) {
 	ac -= optind;
 	av += optind;
 
+	/* The memory budget has to be in place before the SQLite3 library is initialized */
+	if ((membuf != NULL && membuf[0] != 0 && nom_memparse(membuf, &budget) != NOM_OK) ||
+			nom_memconf(budget) != SQLITE_OK) {
+		return(NOM_FAIL);
+	}
+	sqlite3_initialize();
+	nom_traceinit();
+
 	if (dbg) {
 		NOMDBG("Size of cmd: %lu, passing off to cook()\n", sizeof(cmd));
 	}
 	retc = cook(&flags, &cmd, (const char **)av);
+	if (retc != NOM_OK || dbg) {
+		nom_tracedump(STDERR_FILENO);
+	}
+	if (memstat) {
+		nom_memstat(cmd.dbcon);
+	}
 	if (cmd.dbcon != NULL) {
+		nom_catfree(&cmd);
 		sqlite3_close_v2(cmd.dbcon);
 	}
 	/* All SQLite3 objects should be deallocated before this point */
 	sqlite3_shutdown();
+	nom_memfree();
 	return(retc);
 }
 
 inline static void 
 usage(void) {
 	fprintf(stdout,"%s: A simple, local definition database\n", __progname);
-	fprintf(stdout,"\t%s [-DIv] -d database -i initfile -f I/O file [subcommand] term...\n"
-			"\t  -D Enable run-time debug printouts\n"
+	fprintf(stdout,"\t%s [-DIMv] -d database -i initfile -f I/O file -m budget [subcommand] term...\n"
+			"\t  -D Enable run-time debug printouts, including the settings from $%s\n"
 			"\t  -I Initialize the database\n"
+			"\t  -M Report SQLite memory usage on stderr at exit\n"
 			"\t  -v Perform a verification test on the database\n"
 			"\t  -i Initialization SQL script to use (only useful with -I)\n"
 			"\t  -d The location of the nombre database (default: %s%s%s)\n"
-			"\t  -f Use the given file for import/export operations\n\n"
+			"\t  -f Use the given file for import/export operations\n"
+			"\t  -m Cap SQLite memory use, e.g. 16M (default: $%s, else unlimited)\n\n"
 			"Subcommands:\n"
 			"\t(def)ine: Look up a definition\n"
-			"\t(add)def: Add a new definition to the database\n"
-			"\t(key)word: Perform a keyword search on saved entries\n"
-			"\t(del)ete: Delete a term or group from the database\n"
-			"\tlist (lst): List the contents of the database\n"
+			"\t(add)def: Add a new definition to the database (read from -f, or from stdin with -)\n"
+			"\t(key)word: Perform a keyword search on saved entries (--jobs N scan threads, --regex)\n"
+			"\t(del)ete: Delete a term and its alternates, or every term matching --like/--glob PATTERN (--chunk N per transaction)\n"
+			"\t(upd)ate: Correct a definition in place (--alt N for alternates, -f for a batch file)\n"
+			"\tlist (lst): List the contents of the database (--limit N, --after TERM to page)\n"
+			"\t(imp)ort: Import a TSV file written by export from -f (--jobs N parser threads, --follow to keep taking in lines appended to it)\n"
+			"\t(exp)ort: Export the database as TSV files into the -f directory (--jobs N, --merge)\n"
+			"\t(top)hits: List the most looked up terms (--limit N, default 10)\n"
+			"\t(chg)ange: Show the change log, write a delta to -f (--since N), apply one (--apply) or --compact (--upto N)\n"
+			"\t(cmp)are: Compare with the database or digest file in -f (--pull to take its differing terms, --digest to write one)\n"
+			"\t(tag)set: Add a term to more categories, or drop it from them with -CATEGORY\n"
+			"\t(sum)mary: Count the terms and alternates in every category (--rebuild to recount them)\n"
 			"Groups:\n"
 			"\t(grp)cmd: Modify the command to operate on groups instead of just terms\n"
-			,__progname, "~", NOMBRE_DB_DIRECT, NOMBRE_DB_NAME);
+			"\t  grp del: Retire a category, moving its terms and alternates to UNCAT\n"
+			"\t  grp tag: List the terms in every category given, A,B for either and -C for not in C\n"
+			,__progname, NOMBRE_CONF_ENV, "~", NOMBRE_DB_DIRECT, NOMBRE_DB_NAME, NOMBRE_MEM_ENV);
 
 	return; /* Gracefully return to caller */
 }
@@ -96,10 +96,15 @@ typedef enum subcom_t {
   vquery = (0x01 << 10), /* Lookup with sources */
   /* XXX: Replace with more useful meaning */
   catscn = (0x01 << 11), /* Dump the definitions for the given category to stdout */
-  grpcmd = (0x01 << 13)  /* Operating on a group */
+  tophit = (0x01 << 12), /* List the most looked up terms */
+  chglog = (0x01 << 13), /* Delta export, apply and compaction of the change log */
+  dbcomp = (0x01 << 14), /* Compare against another database or a digest file */
+  tagcmd = (0x01 << 15), /* Tag a term with more categories, or list terms by category as a group command */
+  catsum = (0x01 << 16), /* Summarize term and alternate counts per category */
+  grpcmd = (0x01 << 30)  /* Operating on a group, kept clear of the subcommand bits */
 } subcom;
 
-#define CMDCOUNT 13
+#define CMDCOUNT 18
 
 /* 
  * Define data structure for command parsing 
@@ -110,12 +115,29 @@ typedef struct nombre_cmd_t {
   subcom command;
   char filedata[3][PATHMAX]; /* File argument array holder */
   /* assume we're using ASCII for now, full UTF-8 will be a stretch goal */
-  char defdata[2][DEFLEN]; /* Fold term/category into single 2D member */
+  char defdata[3][DEFLEN]; /* Fold term/category/definition into single 2D member */
   char gensql[PATHMAX]; /* Generated SQL statement, capped at 1/4 PAGE_SIZE assuming 4k pages */
+  int64_t defno; /* Alternate definition number, 0 for the primary definition */
+  int64_t catid; /* Category id resolved from defdata[NOMBRE_DBCATG] */
+  int64_t limit; /* Row limit for listings (--limit), 0 for no limit */
+  unsigned int jobs; /* Worker threads for exports and key scans (--jobs), 0 for one per core */
+  unsigned int merge; /* Concatenate export partitions into one file (--merge) */
+  unsigned int regex; /* key takes a POSIX extended regular expression (--regex), see nomregex.h */
+  int64_t since; /* Change log sequence a delta starts after (--since) */
+  int64_t upto; /* Drop change log entries up to this sequence (--upto) */
+  unsigned int chgop; /* NOMBRE_CHG_* operation for the change log, see chglog.h */
+  unsigned int cmpop; /* NOMBRE_CMP_* operation for comparisons, see nomcmp.h */
+  unsigned int sumop; /* NOMBRE_SUM_* operation for category summaries, see nomstats.h */
+  unsigned int delop; /* NOMBRE_DEL_* match for del, see nomdel.h */
+  unsigned int impop; /* NOMBRE_IMP_* mode for imp, see nomfollow.h */
+  int64_t chunk; /* Rows per transaction for del (--chunk), 0 for NOMBRE_DEL_CHUNK */
+  unsigned int bloom; /* NOMBRE_BLOOM_* state of the term filter, see nombloom.h */
+  uint32_t bloomstamp; /* Database change counter the filter was checked against */
   char **args; /* Arguments provided */
   size_t nargs; /* Argument count */
   size_t nqueries; /* How many queries need to be run */
   sqlite3 *dbcon; /* database connection */
+  struct nomcat_t *catmap; /* Category name to id cache for dbcon, see catmap.h */
 } nomcmd;
 
 /*
@@ -126,3 +148,11 @@ typedef struct nombre_cmd_t {
 #define NOMBRE_IOFILE 0x02
 #define NOMBRE_DBTERM 0x00
 #define NOMBRE_DBCATG 0x01
+#define NOMBRE_DBDEFN 0x02
+
+/*
+ * Schema revision this build expects, stored in PRAGMA user_version.
+ * nombre.sql must always create a database at this revision, older
+ * databases are brought forward by nom_migrate() on connection.
+ */
+#define NOMBRE_SCHEMA_VERSION 11
@@ -1,13 +1,13 @@
 -- SQL script to build the nombre database
 
 -- These commands only work with SQLite3, primarily used for integrity checking
-PRAGMA cell_size_check=true;
+-- cell_size_check, secure_delete and the other per-connection tuning come from the config file, see nomconf.h
 PRAGMA case_sensitive_like=true; -- Most searches will explicitly use 'ilike' anyway
-PRAGMA secure_delete=true;
 PRAGMA foreign_keys=0; -- Just in case it's not enforced by default
 
 -- These pragma commands set version info
-PRAGMA user_version=0;
+-- user_version must match NOMBRE_SCHEMA_VERSION in nombre.h
+PRAGMA user_version=11;
 -- Add up N+O+M == 78 + 79 + 77
 PRAGMA application_id=234;
 
@@ -60,46 +60,82 @@ PRAGMA foreign_keys=1;
 
 -- Primary definition table
 CREATE TABLE IF NOT EXISTS definitions (
-	term text UNIQUE NOT NULL, -- Primary key in this table, if already exists, create altdef
+	id integer PRIMARY KEY, -- Compact identity of the term, every other table refers to the term by it
+	term text UNIQUE NOT NULL, -- If already exists, create altdef
 	meaning text NOT NULL, -- Cannot guarantee this will be unique
 	category integer NOT NULL DEFAULT -1, -- Default everything to "uncategorized" if not specified
 	CHECK (category > -2), -- -1 is the only valid value under 0
-	PRIMARY KEY (term),
 	FOREIGN KEY (category) REFERENCES categories(id)
 );
 
 -- Secondary table if a term has multiple meanings
 CREATE TABLE IF NOT EXISTS altdefs (
-	term text NOT NULL, -- Refers to an entry in the definitions table
+	termid integer NOT NULL, -- Refers to an entry in the definitions table
 	defno integer NOT NULL DEFAULT 0, -- Should be incremented for each new alternate definition
 	altdef text NOT NULL, -- The actual alternative definition
 	category integer NOT NULL DEFAULT -1, -- same as definitions table
-	FOREIGN KEY (term) REFERENCES definitions(term),
+	FOREIGN KEY (termid) REFERENCES definitions(id),
 	FOREIGN KEY (category) REFERENCES categories(id)
 );
 
 -- Allow storage of reference links/notes 
--- using the hash of the term and category as a primary key
--- while still maintaining the term and category as columns
--- for easier manual querying and use of the search functionality
+-- using the hash of the term and category as a primary key.
+-- The category is the one of the definition referred to, so it isn't repeated here
 CREATE TABLE IF NOT EXISTS defrefs (
 	idhash blob UNIQUE NOT NULL, -- Hashed combination of the term + category + definition number, used to build a B-tree index
 	defno integer NOT NULL, -- -1 signifies main definition
-	term text NOT NULL, 
-	category integer NOT NULL,
+	termid integer NOT NULL, -- Refers to an entry in the definitions table
 	source text NOT NULL,
 	PRIMARY KEY (idhash),
-	FOREIGN KEY (term) REFERENCES definitions(term),
-	FOREIGN KEY (category) REFERENCES categories(id)
+	FOREIGN KEY (termid) REFERENCES definitions(id)
 );
 
+-- How often each term has been looked up, folded in from the -hits side log
+CREATE TABLE IF NOT EXISTS term_stats (
+	term text PRIMARY KEY NOT NULL, -- Normalized term, as stored in definitions
+	hits integer NOT NULL DEFAULT 0, -- Lookups that found the term
+	lasthit integer -- Unix time of the last fold that counted a hit
+) WITHOUT ROWID;
 
 -- Define some indices for quicker lookups on certain values expected to be common
-CREATE INDEX IF NOT EXISTS altdata_idx ON altdefs (term, defno);
+-- Also lets MAX(defno) for a term resolve with a single index seek
+CREATE UNIQUE INDEX IF NOT EXISTS altdata_idx ON altdefs (termid, defno);
+-- Grouped listings and lookups only touch the rows of one category
+CREATE INDEX IF NOT EXISTS defcat_idx ON definitions (category, term);
+-- Foreign key checks on definitions would otherwise scan defrefs
+CREATE INDEX IF NOT EXISTS defrefs_term_idx ON defrefs (termid);
+-- The top listing walks this instead of sorting every counter
+CREATE INDEX IF NOT EXISTS term_stats_hits_idx ON term_stats (hits DESC, term);
+
+-- Adding a term that already exists files the new meaning as the next alternate,
+-- so a single INSERT handles both cases. RETURNING only yields a row for a new
+-- primary definition, since RAISE(IGNORE) drops the original insert.
+CREATE TRIGGER IF NOT EXISTS definitions_altdef BEFORE INSERT ON definitions
+WHEN EXISTS (SELECT 1 FROM definitions WHERE term = NEW.term)
+BEGIN
+	INSERT INTO altdefs (termid, defno, altdef, category) SELECT id,
+		COALESCE((SELECT MAX(defno) FROM altdefs WHERE termid = definitions.id), 0) + 1,
+		NEW.meaning, NEW.category FROM definitions WHERE term = NEW.term;
+	SELECT RAISE(IGNORE);
+END;
+
+-- A reused id would otherwise hand a deleted term's alternates and references to a new one.
+-- BEFORE, so their changelog triggers can still read the term they belonged to
+CREATE TRIGGER IF NOT EXISTS definitions_children BEFORE DELETE ON definitions
+BEGIN
+	DELETE FROM altdefs WHERE termid = OLD.id;
+	DELETE FROM defrefs WHERE termid = OLD.id;
+END;
+
+-- Counters for a deleted term would otherwise linger in the top listing
+CREATE TRIGGER IF NOT EXISTS definitions_stats AFTER DELETE ON definitions
+BEGIN
+	DELETE FROM term_stats WHERE term = OLD.term;
+END;
 
 -- Provide some baseline data for the database to have available
 BEGIN;
-	INSERT INTO definitions VALUES
+	INSERT INTO definitions (term, meaning, category) VALUES
 	('SSL', 'Secure Sockets Layer', 1),
 	('TLS', 'Transport Layer Security', 1),
 	('TCP', 'Transmission Control Protocol', 1),
@@ -112,5 +148,186 @@ BEGIN;
 	;
 COMMIT;
 
+-- Every change to the replicated tables, so a delta only has to carry what changed.
+-- Only the key is logged, a delta export reads the current row (or its absence).
+CREATE TABLE IF NOT EXISTS changelog (
+	seq integer PRIMARY KEY AUTOINCREMENT, -- Never reused, even after compaction
+	tbl text NOT NULL, -- Table the change was made to
+	rowkey NOT NULL, -- term, idhash or category id of the changed row
+	defno integer -- Alternate number, only set for altdefs
+);
+-- No index beyond seq: a delta reads one seq range per table, and a second index tripled import time
+
+-- Deltas can't start before this sequence once compaction has dropped older entries
+CREATE TABLE IF NOT EXISTS changelog_floor (
+	id integer PRIMARY KEY CHECK (id = 0),
+	seq integer NOT NULL
+);
+INSERT OR IGNORE INTO changelog_floor VALUES (0, 0);
+
+-- Created after the baseline data, which every database starts out with anyway
+CREATE TRIGGER IF NOT EXISTS definitions_log_ins AFTER INSERT ON definitions
+BEGIN
+	INSERT INTO changelog (tbl, rowkey) VALUES ('definitions', NEW.term);
+END;
+CREATE TRIGGER IF NOT EXISTS definitions_log_upd AFTER UPDATE ON definitions
+BEGIN
+	INSERT INTO changelog (tbl, rowkey) SELECT 'definitions', OLD.term WHERE OLD.term IS NOT NEW.term;
+	INSERT INTO changelog (tbl, rowkey) VALUES ('definitions', NEW.term);
+END;
+CREATE TRIGGER IF NOT EXISTS definitions_log_del AFTER DELETE ON definitions
+BEGIN
+	INSERT INTO changelog (tbl, rowkey) VALUES ('definitions', OLD.term);
+END;
+-- Alternates are logged under their term rather than the local id, so a delta applies to any copy
+CREATE TRIGGER IF NOT EXISTS altdefs_log_ins AFTER INSERT ON altdefs
+BEGIN
+	INSERT INTO changelog (tbl, rowkey, defno) SELECT 'altdefs', term, NEW.defno FROM definitions WHERE id = NEW.termid;
+END;
+CREATE TRIGGER IF NOT EXISTS altdefs_log_upd AFTER UPDATE ON altdefs
+BEGIN
+	INSERT INTO changelog (tbl, rowkey, defno) SELECT 'altdefs', term, OLD.defno FROM definitions
+		WHERE id = OLD.termid AND (OLD.termid IS NOT NEW.termid OR OLD.defno IS NOT NEW.defno);
+	INSERT INTO changelog (tbl, rowkey, defno) SELECT 'altdefs', term, NEW.defno FROM definitions WHERE id = NEW.termid;
+END;
+CREATE TRIGGER IF NOT EXISTS altdefs_log_del AFTER DELETE ON altdefs
+BEGIN
+	INSERT INTO changelog (tbl, rowkey, defno) SELECT 'altdefs', term, OLD.defno FROM definitions WHERE id = OLD.termid;
+END;
+CREATE TRIGGER IF NOT EXISTS defrefs_log_ins AFTER INSERT ON defrefs
+BEGIN
+	INSERT INTO changelog (tbl, rowkey) VALUES ('defrefs', NEW.idhash);
+END;
+CREATE TRIGGER IF NOT EXISTS defrefs_log_upd AFTER UPDATE ON defrefs
+BEGIN
+	INSERT INTO changelog (tbl, rowkey) SELECT 'defrefs', OLD.idhash WHERE OLD.idhash IS NOT NEW.idhash;
+	INSERT INTO changelog (tbl, rowkey) VALUES ('defrefs', NEW.idhash);
+END;
+CREATE TRIGGER IF NOT EXISTS defrefs_log_del AFTER DELETE ON defrefs
+BEGIN
+	INSERT INTO changelog (tbl, rowkey) VALUES ('defrefs', OLD.idhash);
+END;
+CREATE TRIGGER IF NOT EXISTS categories_log_ins AFTER INSERT ON categories
+BEGIN
+	INSERT INTO changelog (tbl, rowkey) VALUES ('categories', NEW.id);
+END;
+CREATE TRIGGER IF NOT EXISTS categories_log_upd AFTER UPDATE ON categories
+BEGIN
+	INSERT INTO changelog (tbl, rowkey) SELECT 'categories', OLD.id WHERE OLD.id IS NOT NEW.id;
+	INSERT INTO changelog (tbl, rowkey) VALUES ('categories', NEW.id);
+END;
+CREATE TRIGGER IF NOT EXISTS categories_log_del AFTER DELETE ON categories
+BEGIN
+	INSERT INTO changelog (tbl, rowkey) VALUES ('categories', OLD.id);
+END;
+
+-- Categories a term belongs to besides its own, see nomtags.h
+CREATE TABLE IF NOT EXISTS term_tags (
+	termid integer NOT NULL, -- Refers to an entry in the definitions table
+	category integer NOT NULL,
+	PRIMARY KEY (termid, category),
+	FOREIGN KEY (termid) REFERENCES definitions(id),
+	FOREIGN KEY (category) REFERENCES categories(id)
+) WITHOUT ROWID;
+-- Bitmap rebuilds read the terms tagged with one category
+CREATE INDEX IF NOT EXISTS tagcat_idx ON term_tags (category, termid);
+
+-- Every member of a category, its own terms and tagged ones, as roaring containers of definitions ids
+CREATE TABLE IF NOT EXISTS tag_bitmaps (
+	category integer NOT NULL,
+	chunk integer NOT NULL, -- Upper bits of the ids held, id >> 16
+	card integer NOT NULL, -- Members in this container
+	bits blob NOT NULL, -- Sorted 16 bit values up to 4096 members, an 8K bitmap past that
+	PRIMARY KEY (category, chunk)
+) WITHOUT ROWID;
+
+-- Categories whose bitmaps no longer match, rebuilt by the next query that reads them
+CREATE TABLE IF NOT EXISTS tag_stale (
+	category integer PRIMARY KEY NOT NULL
+);
+INSERT OR IGNORE INTO tag_stale SELECT id FROM categories;
+
+CREATE TRIGGER IF NOT EXISTS definitions_tag_ins AFTER INSERT ON definitions
+BEGIN
+	INSERT OR IGNORE INTO tag_stale VALUES (NEW.category);
+END;
+-- Renaming a term keeps its id, so its tags and bitmap bits already follow it
+CREATE TRIGGER IF NOT EXISTS definitions_tag_upd AFTER UPDATE OF category ON definitions
+WHEN OLD.category IS NOT NEW.category
+BEGIN
+	INSERT OR IGNORE INTO tag_stale VALUES (OLD.category), (NEW.category);
+END;
+-- The tags of a deleted term go with it, which marks their categories as well
+CREATE TRIGGER IF NOT EXISTS definitions_tag_del AFTER DELETE ON definitions
+BEGIN
+	DELETE FROM term_tags WHERE termid = OLD.id;
+	INSERT OR IGNORE INTO tag_stale VALUES (OLD.category);
+END;
+CREATE TRIGGER IF NOT EXISTS term_tags_ins AFTER INSERT ON term_tags
+BEGIN
+	INSERT OR IGNORE INTO tag_stale VALUES (NEW.category);
+END;
+CREATE TRIGGER IF NOT EXISTS term_tags_del AFTER DELETE ON term_tags
+BEGIN
+	INSERT OR IGNORE INTO tag_stale VALUES (OLD.category);
+END;
+
+-- Running counts per category, so a summary reads one row per category instead of grouping definitions
+CREATE TABLE IF NOT EXISTS category_stats (
+	category integer PRIMARY KEY NOT NULL,
+	terms integer NOT NULL DEFAULT 0, -- Primary definitions filed under the category
+	alts integer NOT NULL DEFAULT 0, -- Alternate definitions filed under the category
+	modified integer -- Unix time of the last change, NULL if only ever counted by a rebuild
+);
+INSERT OR IGNORE INTO category_stats (category, terms) SELECT category, count(*) FROM definitions WHERE true GROUP BY category;
+-- Only ever holds a row inside an import's transaction, which counts what it adds itself
+CREATE TABLE IF NOT EXISTS category_stats_hold (
+	id integer PRIMARY KEY CHECK (id = 0)
+);
+
+CREATE TRIGGER IF NOT EXISTS definitions_sum_ins AFTER INSERT ON definitions
+WHEN NOT EXISTS (SELECT 1 FROM category_stats_hold)
+BEGIN
+	INSERT INTO category_stats (category, terms, modified) VALUES (NEW.category, 1, CAST(strftime('%s', 'now') AS INTEGER))
+		ON CONFLICT (category) DO UPDATE SET terms = terms + 1, modified = excluded.modified;
+END;
+-- A changed meaning only touches the time, a move counts the term over to its new category
+CREATE TRIGGER IF NOT EXISTS definitions_sum_upd AFTER UPDATE ON definitions
+BEGIN
+	UPDATE category_stats SET terms = terms - 1, modified = CAST(strftime('%s', 'now') AS INTEGER)
+		WHERE category = OLD.category AND OLD.category IS NOT NEW.category;
+	INSERT INTO category_stats (category, terms, modified) VALUES (NEW.category, OLD.category IS NOT NEW.category, CAST(strftime('%s', 'now') AS INTEGER))
+		ON CONFLICT (category) DO UPDATE SET terms = terms + excluded.terms, modified = excluded.modified;
+END;
+CREATE TRIGGER IF NOT EXISTS definitions_sum_del AFTER DELETE ON definitions
+BEGIN
+	UPDATE category_stats SET terms = terms - 1, modified = CAST(strftime('%s', 'now') AS INTEGER) WHERE category = OLD.category;
+END;
+CREATE TRIGGER IF NOT EXISTS altdefs_sum_ins AFTER INSERT ON altdefs
+WHEN NOT EXISTS (SELECT 1 FROM category_stats_hold)
+BEGIN
+	INSERT INTO category_stats (category, alts, modified) VALUES (NEW.category, 1, CAST(strftime('%s', 'now') AS INTEGER))
+		ON CONFLICT (category) DO UPDATE SET alts = alts + 1, modified = excluded.modified;
+END;
+CREATE TRIGGER IF NOT EXISTS altdefs_sum_upd AFTER UPDATE ON altdefs
+BEGIN
+	UPDATE category_stats SET alts = alts - 1, modified = CAST(strftime('%s', 'now') AS INTEGER)
+		WHERE category = OLD.category AND OLD.category IS NOT NEW.category;
+	INSERT INTO category_stats (category, alts, modified) VALUES (NEW.category, OLD.category IS NOT NEW.category, CAST(strftime('%s', 'now') AS INTEGER))
+		ON CONFLICT (category) DO UPDATE SET alts = alts + excluded.alts, modified = excluded.modified;
+END;
+CREATE TRIGGER IF NOT EXISTS altdefs_sum_del AFTER DELETE ON altdefs
+BEGIN
+	UPDATE category_stats SET alts = alts - 1, modified = CAST(strftime('%s', 'now') AS INTEGER) WHERE category = OLD.category;
+END;
+
+-- Where imp --follow left off in each file it follows, moved in the same transaction as the rows read
+CREATE TABLE IF NOT EXISTS ingest_offsets (
+	path text PRIMARY KEY NOT NULL, -- Absolute path of the followed file
+	inode integer NOT NULL, -- A different inode at the path means the file was replaced, start over
+	pos integer NOT NULL, -- Byte just past the last whole line taken in
+	modified integer -- Unix time of the last batch
+) WITHOUT ROWID;
+
 -- Last line of executed code, run an optimization pass
 PRAGMA optimize;
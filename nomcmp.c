@@ -0,0 +1,860 @@
+/* 
+ * Copyright (c) 2019, Exile Heavy Industries
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted (subject to the limitations in the disclaimer
+ * below) provided that the following conditions are met:
+ * 
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ * 
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * 
+ * * Neither the name of the copyright holder nor the names of its contributors may be used
+ *   to endorse or promote products derived from this software without specific
+ *   prior written permission.
+ * 
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY THIS
+ * LICENSE. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+/*
+ * Digest comparison of two databases, or a database and a digest file, see nomcmp.h
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifndef NOMBRE_H
+#include "nombre.h"
+#endif
+#ifndef NOMBRE_NOMCMP_H
+#include "nomcmp.h"
+#endif
+#ifndef NOMBRE_INITDB_H
+#include "initdb.h"
+#endif
+
+extern char *__progname;
+extern bool dbg;
+
+struct cmpnode {
+	uint64_t digest;
+	int64_t count;
+};
+
+struct cmpcat {
+	int64_t catid;
+	struct cmpnode kids[NOMBRE_CMP_FANOUT];
+};
+
+/* A node's child as read from a digest file */
+struct cmpline {
+	int64_t catid;
+	unsigned char prefix[NOMBRE_CMP_DEPTH];
+	uint8_t plen;
+	uint16_t slot;
+	struct cmpnode node;
+};
+
+struct cmpterm {
+	char *term;
+	uint64_t digest;
+};
+
+struct cmpside {
+	bool file;
+	sqlite3_stmt *defs, *alts; /* Range scans, NOMBRE_CMP_DEFS and NOMBRE_CMP_ALTS */
+	struct cmpcat *cats; /* Category roots */
+	size_t ncats;
+	struct cmpline *lines; /* Digest file only */
+	size_t nlines;
+};
+
+/* The other database's root pass, run on its own connection */
+struct cmptopjob {
+	const char *dbname;
+	struct cmpside *side;
+	int retc;
+};
+
+struct cmpctx {
+	nomcmd *cmdbuf;
+	struct cmpside here, there;
+	int64_t onlyhere, onlythere, changed, ranges;
+	char **pulls; /* Terms to take from the other database with --pull */
+	size_t npulls, pullcap;
+};
+
+static int cmpdb(struct cmpctx * restrict ctx);
+static int cmpdigest(struct cmpctx * restrict ctx);
+static int cmpwrite(struct cmpctx * restrict ctx);
+static int cmpprep(sqlite3 * restrict db, struct cmpside * restrict side, const char * restrict defs, const char * restrict alts);
+static void *cmptopworker(void *arg);
+static int cmptop(sqlite3 * restrict db, struct cmpside * restrict side, const char * restrict topdefs, const char * restrict topalts);
+static struct cmpcat *cmpcat(struct cmpside * restrict side, int64_t catid, bool add);
+static int cmpkids(struct cmpside * restrict side, int64_t catid, const unsigned char * restrict prefix, size_t plen, struct cmpnode * restrict kids);
+static int cmpterms(struct cmpside * restrict side, int64_t catid, const unsigned char * restrict prefix, size_t plen, struct cmpterm **terms, size_t * restrict nterms);
+static int cmpwalk(struct cmpctx * restrict ctx, int64_t catid, unsigned char * restrict prefix, size_t plen, const struct cmpnode *here, const struct cmpnode *there);
+static int cmpleaf(struct cmpctx * restrict ctx, int64_t catid, const unsigned char * restrict prefix, size_t plen);
+static int cmpmark(struct cmpctx * restrict ctx, char mark, const char * restrict term, size_t len);
+static int cmppull(struct cmpctx * restrict ctx);
+static int cmpwnode(FILE * restrict out, struct cmpside * restrict side, int64_t catid, unsigned char * restrict prefix, size_t plen, const struct cmpnode * restrict kids);
+static bool cmpfkids(const struct cmpside * restrict side, int64_t catid, const unsigned char * restrict prefix, size_t plen, struct cmpnode * restrict kids);
+static int cmprange(sqlite3_stmt * restrict stmt, int64_t catid, const unsigned char * restrict prefix, size_t plen);
+static void cmpfree(struct cmpctx * restrict ctx);
+static int linecmp(const void *a, const void *b);
+static int termcmp(const void *a, const void *b);
+static int strpcmp(const void *a, const void *b);
+
+/* FNV-1a over the fields, finished with the MurmurHash3 mixer so sums don't cancel out */
+static inline uint64_t
+cmphash(const unsigned char * restrict term, int64_t defno, const unsigned char * restrict text) {
+	uint64_t h;
+	h = 0xcbf29ce484222325ULL;
+
+	for (; term != NULL && *term != 0; term++) {
+		h = (h ^ *term) * 0x100000001b3ULL;
+	}
+	for (int i = 0; i < 8; i++) {
+		h = (h ^ (((uint64_t)defno >> (i * 8)) & 0xFF)) * 0x100000001b3ULL;
+	}
+	for (; text != NULL && *text != 0; text++) {
+		h = (h ^ *text) * 0x100000001b3ULL;
+	}
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+	return(h);
+}
+
+static inline bool
+cmpsame(const struct cmpnode * restrict a, const struct cmpnode * restrict b) {
+	return(a->count == b->count && a->digest == b->digest);
+}
+
+/*
+ * -f names the other side: a database is attached and compared, a digest
+ * file is compared against, and with --digest this database's digest is
+ * written there instead.
+ */
+int
+nomdb_cmp(nomcmd * restrict cmdbuf) {
+	int retc;
+	size_t len;
+	char magic[16];
+	FILE *in;
+	struct cmpctx ctx;
+	memset(&ctx, 0, sizeof(ctx));
+	memset(magic, 0, sizeof(magic));
+
+	if (dbg) {
+		NOMDBG("Entering with cmdbuf = %p, cmpop = %u\n", (void *)cmdbuf, (cmdbuf != NULL) ? cmdbuf->cmpop : 0);
+	}
+	if (cmdbuf == NULL || cmdbuf->dbcon == NULL) {
+		NOMERR("%s", "Given invalid input!\n");
+		return(BADARGS);
+	}
+	if (cmdbuf->filedata[NOMBRE_IOFILE][0] == 0) {
+		NOMERR("%s\n", "Comparing needs the other database or digest file given with -f!");
+		return(BADARGS);
+	}
+	ctx.cmdbuf = cmdbuf;
+	if (cmdbuf->cmpop == NOMBRE_CMP_DIGEST) {
+		retc = cmpwrite(&ctx);
+	} else if ((in = fopen(cmdbuf->filedata[NOMBRE_IOFILE], "r")) == NULL) {
+		NOMERR("Unable to open %s! (%s)\n", cmdbuf->filedata[NOMBRE_IOFILE], strerror(errno));
+		retc = NOM_FIO_FAIL;
+	} else {
+		len = fread(magic, 1, sizeof(magic) - 1, in);
+		fclose(in);
+		if (len == 0) {
+			NOMERR("%s is empty!\n", cmdbuf->filedata[NOMBRE_IOFILE]);
+			retc = NOM_INVALID;
+		} else if (strncmp(magic, "SQLite format 3", sizeof(magic) - 1) == 0) {
+			retc = cmpdb(&ctx);
+		} else if (strncmp(magic, NOMBRE_CMP_MAGIC, sizeof(NOMBRE_CMP_MAGIC) - 1) == 0 && cmdbuf->cmpop != NOMBRE_CMP_PULL) {
+			retc = cmpdigest(&ctx);
+		} else {
+			NOMERR("%s is not a database%s!\n", cmdbuf->filedata[NOMBRE_IOFILE], (cmdbuf->cmpop != NOMBRE_CMP_PULL) ? " or digest file" : "");
+			retc = NOM_INVALID;
+		}
+	}
+	cmpfree(&ctx);
+	return(retc);
+}
+
+/* Both databases are read in one transaction, so neither moves under the walk */
+static int
+cmpdb(struct cmpctx * restrict ctx) {
+	int retc, threaded;
+	pthread_t worker;
+	struct cmptopjob job;
+	sqlite3 *db;
+	sqlite3_stmt *stmt;
+	struct cmpcat *there;
+	struct cmpnode none[NOMBRE_CMP_FANOUT];
+	unsigned char prefix[DEFLEN + 1];
+	db = ctx->cmdbuf->dbcon; stmt = NULL;
+	memset(none, 0, sizeof(none));
+
+	if ((retc = sqlite3_prepare_v2(db, NOMBRE_CMP_ATTACH, -1, &stmt, NULL)) != SQLITE_OK ||
+			(retc = sqlite3_bind_text(stmt, 1, ctx->cmdbuf->filedata[NOMBRE_IOFILE], -1, SQLITE_STATIC)) != SQLITE_OK ||
+			(retc = sqlite3_step(stmt)) != SQLITE_DONE) {
+		NOMERR("Unable to attach %s (%s)!\n", ctx->cmdbuf->filedata[NOMBRE_IOFILE], sqlite3_errmsg(db));
+		sqlite3_finalize(stmt);
+		return(retc);
+	}
+	sqlite3_finalize(stmt);
+	stmt = NULL;
+	if (sqlite3_prepare_v2(db, NOMBRE_CMP_VERSION, -1, &stmt, NULL) == SQLITE_OK && sqlite3_step(stmt) == SQLITE_ROW &&
+			sqlite3_column_int(stmt, 0) != NOMBRE_SCHEMA_VERSION) {
+		NOMERR("%s is schema revision %d, open it with this build first to upgrade it to %d!\n",
+				ctx->cmdbuf->filedata[NOMBRE_IOFILE], sqlite3_column_int(stmt, 0), NOMBRE_SCHEMA_VERSION);
+		sqlite3_finalize(stmt);
+		sqlite3_exec(db, NOMBRE_CMP_DETACH, NULL, NULL, NULL);
+		return(NOM_INVALID);
+	}
+	sqlite3_finalize(stmt);
+	if ((retc = sqlite3_exec(db, (ctx->cmdbuf->cmpop == NOMBRE_CMP_PULL) ? "BEGIN IMMEDIATE;" : "BEGIN;", NULL, NULL, NULL)) != SQLITE_OK ||
+			(retc = cmpprep(db, &ctx->here, NOMBRE_CMP_DEFS("main"), NOMBRE_CMP_ALTS("main"))) != SQLITE_OK ||
+			(retc = cmpprep(db, &ctx->there, NOMBRE_CMP_DEFS(NOMBRE_CMP_SCHEMA), NOMBRE_CMP_ALTS(NOMBRE_CMP_SCHEMA))) != SQLITE_OK) {
+		goto CMPDB_EXIT;
+	}
+	/*
+	 * The two root passes are the bulk of the work, so the other database's
+	 * runs alongside on a connection of its own. A write landing there in
+	 * between only shows up as a difference the walk then finds is none.
+	 */
+	job.dbname = ctx->cmdbuf->filedata[NOMBRE_IOFILE];
+	job.side = &ctx->there;
+	job.retc = SQLITE_OK;
+	if ((threaded = pthread_create(&worker, NULL, cmptopworker, &job)) != 0) {
+		cmptopworker(&job);
+	}
+	retc = cmptop(db, &ctx->here, NOMBRE_CMP_TOPDEFS("main"), NOMBRE_CMP_TOPALTS("main"));
+	if (threaded == 0) {
+		pthread_join(worker, NULL);
+	}
+	if (retc != SQLITE_OK || (retc = job.retc) != SQLITE_OK) {
+		goto CMPDB_EXIT;
+	}
+	for (size_t i = 0; i < ctx->here.ncats && retc == SQLITE_OK; i++) {
+		there = cmpcat(&ctx->there, ctx->here.cats[i].catid, false);
+		retc = cmpwalk(ctx, ctx->here.cats[i].catid, prefix, 0, ctx->here.cats[i].kids, (there != NULL) ? there->kids : none);
+	}
+	for (size_t j = 0; j < ctx->there.ncats && retc == SQLITE_OK; j++) {
+		if (cmpcat(&ctx->here, ctx->there.cats[j].catid, false) == NULL) {
+			retc = cmpwalk(ctx, ctx->there.cats[j].catid, prefix, 0, none, ctx->there.cats[j].kids);
+		}
+	}
+	if (retc == SQLITE_OK && ctx->cmdbuf->cmpop == NOMBRE_CMP_PULL) {
+		retc = cmppull(ctx);
+	}
+
+CMPDB_EXIT:
+	if (retc == SQLITE_OK) {
+		retc = sqlite3_exec(db, "COMMIT;", NULL, NULL, NULL);
+	} else {
+		NOMERR("Unable to compare with %s (%s)!\n", ctx->cmdbuf->filedata[NOMBRE_IOFILE], sqlite3_errmsg(db));
+		sqlite3_exec(db, "ROLLBACK;", NULL, NULL, NULL);
+	}
+	if (retc == SQLITE_OK) {
+		fprintf(stdout, "%lld only here, %lld only in %s, %lld changed\n",
+				(long long)ctx->onlyhere, (long long)ctx->onlythere, ctx->cmdbuf->filedata[NOMBRE_IOFILE], (long long)ctx->changed);
+		if (ctx->npulls > 0) {
+			fprintf(stdout, "Pulled %zu terms from %s\n", ctx->npulls, ctx->cmdbuf->filedata[NOMBRE_IOFILE]);
+		}
+	}
+	/* The statements hold the attached schema open */
+	sqlite3_finalize(ctx->here.defs);
+	sqlite3_finalize(ctx->here.alts);
+	sqlite3_finalize(ctx->there.defs);
+	sqlite3_finalize(ctx->there.alts);
+	ctx->here.defs = ctx->here.alts = ctx->there.defs = ctx->there.alts = NULL;
+	sqlite3_exec(db, NOMBRE_CMP_DETACH, NULL, NULL, NULL);
+	return(retc);
+}
+
+/* Compare against a digest file written by --digest */
+static int
+cmpdigest(struct cmpctx * restrict ctx) {
+	int retc, slot, depth;
+	long long catid, count;
+	unsigned long long digest;
+	size_t cap, plen;
+	char *line, hex[16];
+	FILE *in;
+	struct cmpline *grow;
+	struct cmpcat *cat;
+	struct cmpnode none[NOMBRE_CMP_FANOUT];
+	unsigned char prefix[DEFLEN + 1];
+	sqlite3 *db;
+	retc = SQLITE_OK; cap = 0; line = NULL; db = ctx->cmdbuf->dbcon;
+	memset(none, 0, sizeof(none));
+
+	if ((in = fopen(ctx->cmdbuf->filedata[NOMBRE_IOFILE], "r")) == NULL) {
+		NOMERR("Unable to open %s! (%s)\n", ctx->cmdbuf->filedata[NOMBRE_IOFILE], strerror(errno));
+		return(NOM_FIO_FAIL);
+	}
+	if (getline(&line, &cap, in) < 0 || sscanf(line, NOMBRE_CMP_MAGIC "\t%d", &depth) != 1 || depth != NOMBRE_CMP_DEPTH) {
+		NOMERR("%s is not a digest file of depth %d!\n", ctx->cmdbuf->filedata[NOMBRE_IOFILE], NOMBRE_CMP_DEPTH);
+		retc = NOM_INVALID;
+	}
+	ctx->there.file = true;
+	while (retc == SQLITE_OK && getline(&line, &cap, in) > 0) {
+		if (sscanf(line, "%lld\t%15s\t%d\t%lld\t%llx", &catid, hex, &slot, &count, &digest) != 5 ||
+				slot < 0 || slot >= NOMBRE_CMP_FANOUT || (plen = (hex[0] == '-') ? 0 : strlen(hex) / 2) > NOMBRE_CMP_DEPTH) {
+			NOMERR("Malformed line in %s: %s", ctx->cmdbuf->filedata[NOMBRE_IOFILE], line);
+			retc = NOM_INVALID;
+			break;
+		}
+		if (ctx->there.nlines % 1024 == 0) {
+			if ((grow = realloc(ctx->there.lines, (ctx->there.nlines + 1024) * sizeof(*grow))) == NULL) {
+				retc = SQLITE_NOMEM;
+				break;
+			}
+			ctx->there.lines = grow;
+		}
+		grow = &ctx->there.lines[ctx->there.nlines++];
+		memset(grow, 0, sizeof(*grow));
+		grow->catid = catid;
+		grow->plen = (uint8_t)plen;
+		grow->slot = (uint16_t)slot;
+		grow->node.count = count;
+		grow->node.digest = digest;
+		for (size_t i = 0; i < plen; i++) {
+			sscanf(&hex[i * 2], "%2hhx", &grow->prefix[i]);
+		}
+		if (plen == 0 && (cat = cmpcat(&ctx->there, catid, true)) != NULL) {
+			cat->kids[slot] = grow->node;
+		}
+	}
+	free(line);
+	fclose(in);
+	if (retc != SQLITE_OK) {
+		return(retc);
+	}
+	qsort(ctx->there.lines, ctx->there.nlines, sizeof(*ctx->there.lines), linecmp);
+
+	if ((retc = sqlite3_exec(db, "BEGIN;", NULL, NULL, NULL)) != SQLITE_OK ||
+			(retc = cmpprep(db, &ctx->here, NOMBRE_CMP_DEFS("main"), NOMBRE_CMP_ALTS("main"))) != SQLITE_OK ||
+			(retc = cmptop(db, &ctx->here, NOMBRE_CMP_TOPDEFS("main"), NOMBRE_CMP_TOPALTS("main"))) != SQLITE_OK) {
+		goto CMPDIGEST_EXIT;
+	}
+	for (size_t i = 0; i < ctx->here.ncats && retc == SQLITE_OK; i++) {
+		cat = cmpcat(&ctx->there, ctx->here.cats[i].catid, false);
+		retc = cmpwalk(ctx, ctx->here.cats[i].catid, prefix, 0, ctx->here.cats[i].kids, (cat != NULL) ? cat->kids : none);
+	}
+	for (size_t j = 0; j < ctx->there.ncats && retc == SQLITE_OK; j++) {
+		if (cmpcat(&ctx->here, ctx->there.cats[j].catid, false) == NULL) {
+			retc = cmpwalk(ctx, ctx->there.cats[j].catid, prefix, 0, none, ctx->there.cats[j].kids);
+		}
+	}
+
+CMPDIGEST_EXIT:
+	sqlite3_exec(db, "COMMIT;", NULL, NULL, NULL);
+	if (retc == SQLITE_OK) {
+		fprintf(stdout, "%lld only here, %lld only in %s, %lld changed, %lld ranges differ\n",
+				(long long)ctx->onlyhere, (long long)ctx->onlythere, ctx->cmdbuf->filedata[NOMBRE_IOFILE],
+				(long long)ctx->changed, (long long)ctx->ranges);
+	} else {
+		NOMERR("Unable to compare with %s (%s)!\n", ctx->cmdbuf->filedata[NOMBRE_IOFILE], sqlite3_errmsg(db));
+	}
+	return(retc);
+}
+
+/* Write every node down to NOMBRE_CMP_DEPTH that holds more than a leaf's worth of rows */
+static int
+cmpwrite(struct cmpctx * restrict ctx) {
+	int retc;
+	FILE *out;
+	unsigned char prefix[NOMBRE_CMP_DEPTH + 1];
+	sqlite3 *db;
+	db = ctx->cmdbuf->dbcon;
+
+	if ((retc = sqlite3_exec(db, "BEGIN;", NULL, NULL, NULL)) != SQLITE_OK ||
+			(retc = cmpprep(db, &ctx->here, NOMBRE_CMP_DEFS("main"), NOMBRE_CMP_ALTS("main"))) != SQLITE_OK ||
+			(retc = cmptop(db, &ctx->here, NOMBRE_CMP_TOPDEFS("main"), NOMBRE_CMP_TOPALTS("main"))) != SQLITE_OK) {
+		NOMERR("Unable to read the database (%s)!\n", sqlite3_errmsg(db));
+		sqlite3_exec(db, "COMMIT;", NULL, NULL, NULL);
+		return(retc);
+	}
+	if ((out = fopen(ctx->cmdbuf->filedata[NOMBRE_IOFILE], "w")) == NULL) {
+		NOMERR("Unable to open %s! (%s)\n", ctx->cmdbuf->filedata[NOMBRE_IOFILE], strerror(errno));
+		sqlite3_exec(db, "COMMIT;", NULL, NULL, NULL);
+		return(NOM_FIO_FAIL);
+	}
+	fprintf(out, "%s\t%d\n", NOMBRE_CMP_MAGIC, NOMBRE_CMP_DEPTH);
+	for (size_t i = 0; i < ctx->here.ncats && retc == SQLITE_OK; i++) {
+		retc = cmpwnode(out, &ctx->here, ctx->here.cats[i].catid, prefix, 0, ctx->here.cats[i].kids);
+	}
+	sqlite3_exec(db, "COMMIT;", NULL, NULL, NULL);
+	if (ferror(out)) {
+		retc = NOM_FIO_FAIL;
+	}
+	if (fclose(out) != 0 && retc == SQLITE_OK) {
+		retc = NOM_FIO_FAIL;
+	}
+	if (retc != SQLITE_OK) {
+		NOMERR("Unable to write %s! (%s)\n", ctx->cmdbuf->filedata[NOMBRE_IOFILE], (retc == NOM_FIO_FAIL) ? strerror(errno) : sqlite3_errmsg(db));
+		unlink(ctx->cmdbuf->filedata[NOMBRE_IOFILE]);
+	} else {
+		fprintf(stdout, "Wrote the digest of %zu categories to %s\n", ctx->here.ncats, ctx->cmdbuf->filedata[NOMBRE_IOFILE]);
+	}
+	return(retc);
+}
+
+static int
+cmpwnode(FILE * restrict out, struct cmpside * restrict side, int64_t catid, unsigned char * restrict prefix, size_t plen, const struct cmpnode * restrict kids) {
+	int retc;
+	struct cmpnode *sub;
+	retc = SQLITE_OK; sub = NULL;
+
+	for (int slot = 0; slot < NOMBRE_CMP_FANOUT; slot++) {
+		if (kids[slot].count == 0) {
+			continue;
+		}
+		fprintf(out, "%lld\t", (long long)catid);
+		for (size_t i = 0; i < plen; i++) {
+			fprintf(out, "%02x", prefix[i]);
+		}
+		fprintf(out, "%s\t%d\t%lld\t%016" PRIx64 "\n", (plen == 0) ? "-" : "", slot, (long long)kids[slot].count, kids[slot].digest);
+	}
+	for (int slot = 1; slot < NOMBRE_CMP_FANOUT && plen < NOMBRE_CMP_DEPTH && retc == SQLITE_OK; slot++) {
+		if (kids[slot].count <= NOMBRE_CMP_LEAF) {
+			continue;
+		}
+		if (sub == NULL && (sub = malloc(sizeof(*sub) * NOMBRE_CMP_FANOUT)) == NULL) {
+			return(SQLITE_NOMEM);
+		}
+		prefix[plen] = (unsigned char)(slot - 1);
+		if ((retc = cmpkids(side, catid, prefix, plen + 1, sub)) == SQLITE_OK) {
+			retc = cmpwnode(out, side, catid, prefix, plen + 1, sub);
+		}
+	}
+	free(sub);
+	return(retc);
+}
+
+static int
+cmpprep(sqlite3 * restrict db, struct cmpside * restrict side, const char * restrict defs, const char * restrict alts) {
+	int retc;
+
+	if ((retc = sqlite3_prepare_v2(db, defs, -1, &side->defs, NULL)) == SQLITE_OK) {
+		retc = sqlite3_prepare_v2(db, alts, -1, &side->alts, NULL);
+	}
+	return(retc);
+}
+
+static void *
+cmptopworker(void *arg) {
+	sqlite3 *db;
+	struct cmptopjob *job;
+	job = arg; db = NULL;
+
+	if ((job->retc = nom_dbconn_ro(job->dbname, &db)) == SQLITE_OK) {
+		job->retc = cmptop(db, job->side, NOMBRE_CMP_TOPDEFS("main"), NOMBRE_CMP_TOPALTS("main"));
+	}
+	sqlite3_close_v2(db);
+	return(NULL);
+}
+
+/* One pass over both tables builds every category's root */
+static int
+cmptop(sqlite3 * restrict db, struct cmpside * restrict side, const char * restrict topdefs, const char * restrict topalts) {
+	int retc, slot;
+	bool alts;
+	const unsigned char *term;
+	struct cmpcat *cat;
+	sqlite3_stmt *stmt;
+	retc = SQLITE_OK; cat = NULL; stmt = NULL;
+
+	for (int pass = 0; pass < 2 && retc == SQLITE_OK; pass++) {
+		alts = (pass == 1);
+		if ((retc = sqlite3_prepare_v2(db, alts ? topalts : topdefs, -1, &stmt, NULL)) != SQLITE_OK) {
+			break;
+		}
+		while ((retc = sqlite3_step(stmt)) == SQLITE_ROW) {
+			/* Rows mostly arrive grouped by category, so the last one found is a good guess */
+			if (cat == NULL || cat->catid != sqlite3_column_int64(stmt, 0)) {
+				if ((cat = cmpcat(side, sqlite3_column_int64(stmt, 0), true)) == NULL) {
+					retc = SQLITE_NOMEM;
+					break;
+				}
+			}
+			term = sqlite3_column_text(stmt, 1);
+			slot = (term == NULL || *term == 0) ? 0 : *term + 1;
+			cat->kids[slot].digest += cmphash(term, alts ? sqlite3_column_int64(stmt, 2) : -1, sqlite3_column_text(stmt, alts ? 3 : 2));
+			cat->kids[slot].count++;
+		}
+		sqlite3_finalize(stmt);
+		retc = (retc == SQLITE_DONE) ? SQLITE_OK : retc;
+	}
+	return(retc);
+}
+
+/* Find a category's root, making an empty one if add is set and the side has none yet */
+static struct cmpcat *
+cmpcat(struct cmpside * restrict side, int64_t catid, bool add) {
+	struct cmpcat *grow;
+
+	for (size_t i = 0; i < side->ncats; i++) {
+		if (side->cats[i].catid == catid) {
+			return(&side->cats[i]);
+		}
+	}
+	if (! add || (grow = realloc(side->cats, (side->ncats + 1) * sizeof(*grow))) == NULL) {
+		return(NULL);
+	}
+	side->cats = grow;
+	grow = &side->cats[side->ncats++];
+	memset(grow, 0, sizeof(*grow));
+	grow->catid = catid;
+	return(grow);
+}
+
+/* The children of a prefix, read with one index range scan per table */
+static int
+cmpkids(struct cmpside * restrict side, int64_t catid, const unsigned char * restrict prefix, size_t plen, struct cmpnode * restrict kids) {
+	int retc, slot;
+	const unsigned char *term;
+	sqlite3_stmt *stmt;
+	retc = SQLITE_OK;
+	memset(kids, 0, sizeof(*kids) * NOMBRE_CMP_FANOUT);
+
+	for (int pass = 0; pass < 2 && retc == SQLITE_OK; pass++) {
+		stmt = (pass == 0) ? side->defs : side->alts;
+		if ((retc = cmprange(stmt, catid, prefix, plen)) != SQLITE_OK) {
+			break;
+		}
+		while ((retc = sqlite3_step(stmt)) == SQLITE_ROW) {
+			term = sqlite3_column_text(stmt, 0);
+			slot = ((size_t)sqlite3_column_bytes(stmt, 0) == plen) ? 0 : term[plen] + 1;
+			kids[slot].digest += cmphash(term, (pass == 0) ? -1 : sqlite3_column_int64(stmt, 1), sqlite3_column_text(stmt, (pass == 0) ? 1 : 2));
+			kids[slot].count++;
+		}
+		sqlite3_reset(stmt);
+		retc = (retc == SQLITE_DONE) ? SQLITE_OK : retc;
+	}
+	return(retc);
+}
+
+/* Every term under a prefix with its rows' digest, sorted by term */
+static int
+cmpterms(struct cmpside * restrict side, int64_t catid, const unsigned char * restrict prefix, size_t plen, struct cmpterm **terms, size_t * restrict nterms) {
+	int retc;
+	size_t n, cap;
+	const unsigned char *term;
+	struct cmpterm *grow;
+	sqlite3_stmt *stmt;
+	retc = SQLITE_OK; n = cap = 0; *terms = NULL;
+
+	for (int pass = 0; pass < 2 && retc == SQLITE_OK; pass++) {
+		stmt = (pass == 0) ? side->defs : side->alts;
+		if ((retc = cmprange(stmt, catid, prefix, plen)) != SQLITE_OK) {
+			break;
+		}
+		while ((retc = sqlite3_step(stmt)) == SQLITE_ROW) {
+			if (n == cap) {
+				cap = (cap == 0) ? NOMBRE_CMP_LEAF : cap * 2;
+				if ((grow = realloc(*terms, cap * sizeof(*grow))) == NULL) {
+					retc = SQLITE_NOMEM;
+					break;
+				}
+				*terms = grow;
+			}
+			term = sqlite3_column_text(stmt, 0);
+			if (((*terms)[n].term = strdup((const char *)term)) == NULL) {
+				retc = SQLITE_NOMEM;
+				break;
+			}
+			(*terms)[n++].digest = cmphash(term, (pass == 0) ? -1 : sqlite3_column_int64(stmt, 1), sqlite3_column_text(stmt, (pass == 0) ? 1 : 2));
+		}
+		sqlite3_reset(stmt);
+		retc = (retc == SQLITE_DONE) ? SQLITE_OK : retc;
+	}
+	if (n > 0) {
+		/* Fold a term's definition and alternates into one entry */
+		qsort(*terms, n, sizeof(**terms), termcmp);
+		for (size_t i = 1, j = 0; i <= n; i++) {
+			if (i == n) {
+				n = j + 1;
+			} else if (strcmp((*terms)[i].term, (*terms)[j].term) == 0) {
+				(*terms)[j].digest += (*terms)[i].digest;
+				free((*terms)[i].term);
+			} else {
+				(*terms)[++j] = (*terms)[i];
+			}
+		}
+	}
+	*nterms = n;
+	return(retc);
+}
+
+/*
+ * Descend into every child that differs, which ends in terms for small
+ * children, or in ranges when the other side is a digest that stops short
+ */
+static int
+cmpwalk(struct cmpctx * restrict ctx, int64_t catid, unsigned char * restrict prefix, size_t plen, const struct cmpnode *here, const struct cmpnode *there) {
+	int retc;
+	struct cmpnode *sub;
+	retc = SQLITE_OK; sub = NULL;
+
+	for (int slot = 0; slot < NOMBRE_CMP_FANOUT && retc == SQLITE_OK; slot++) {
+		if (cmpsame(&here[slot], &there[slot])) {
+			continue;
+		}
+		if (slot == 0) {
+			/* The prefix itself is a term */
+			retc = cmpmark(ctx, (here[0].count == 0) ? '>' : (there[0].count == 0) ? '<' : '!', (const char *)prefix, plen);
+			continue;
+		}
+		if (sub == NULL && (sub = malloc(sizeof(*sub) * NOMBRE_CMP_FANOUT * 2)) == NULL) {
+			retc = SQLITE_NOMEM;
+			break;
+		}
+		prefix[plen] = (unsigned char)(slot - 1);
+		if (ctx->there.file) {
+			if (plen < NOMBRE_CMP_DEPTH && cmpfkids(&ctx->there, catid, prefix, plen + 1, &sub[NOMBRE_CMP_FANOUT]) &&
+					(retc = cmpkids(&ctx->here, catid, prefix, plen + 1, sub)) == SQLITE_OK) {
+				retc = cmpwalk(ctx, catid, prefix, plen + 1, sub, &sub[NOMBRE_CMP_FANOUT]);
+			} else if (retc == SQLITE_OK) {
+				fprintf(stdout, "~ category %lld, terms starting with \"%.*s\" (%lld here, %lld in the digest)\n",
+						(long long)catid, (int)(plen + 1), (const char *)prefix, (long long)here[slot].count, (long long)there[slot].count);
+				ctx->ranges++;
+			}
+		} else if ((here[slot].count <= NOMBRE_CMP_LEAF && there[slot].count <= NOMBRE_CMP_LEAF) || plen + 1 >= DEFLEN) {
+			retc = cmpleaf(ctx, catid, prefix, plen + 1);
+		} else if ((retc = cmpkids(&ctx->here, catid, prefix, plen + 1, sub)) == SQLITE_OK &&
+				(retc = cmpkids(&ctx->there, catid, prefix, plen + 1, &sub[NOMBRE_CMP_FANOUT])) == SQLITE_OK) {
+			retc = cmpwalk(ctx, catid, prefix, plen + 1, sub, &sub[NOMBRE_CMP_FANOUT]);
+		}
+	}
+	free(sub);
+	return(retc);
+}
+
+/* Merge the sorted terms under a small prefix from both databases */
+static int
+cmpleaf(struct cmpctx * restrict ctx, int64_t catid, const unsigned char * restrict prefix, size_t plen) {
+	int retc, order;
+	size_t nhere, nthere, i, j;
+	struct cmpterm *here, *there;
+	nhere = nthere = 0; here = there = NULL;
+
+	if ((retc = cmpterms(&ctx->here, catid, prefix, plen, &here, &nhere)) == SQLITE_OK &&
+			(retc = cmpterms(&ctx->there, catid, prefix, plen, &there, &nthere)) == SQLITE_OK) {
+		for (i = j = 0; (i < nhere || j < nthere) && retc == SQLITE_OK; ) {
+			order = (i == nhere) ? 1 : (j == nthere) ? -1 : strcmp(here[i].term, there[j].term);
+			if (order < 0) {
+				retc = cmpmark(ctx, '<', here[i].term, strlen(here[i].term));
+				i++;
+			} else if (order > 0) {
+				retc = cmpmark(ctx, '>', there[j].term, strlen(there[j].term));
+				j++;
+			} else {
+				if (here[i].digest != there[j].digest) {
+					retc = cmpmark(ctx, '!', here[i].term, strlen(here[i].term));
+				}
+				i++; j++;
+			}
+		}
+	}
+	for (i = 0; i < nhere; i++) {
+		free(here[i].term);
+	}
+	for (j = 0; j < nthere; j++) {
+		free(there[j].term);
+	}
+	free(here);
+	free(there);
+	return(retc);
+}
+
+/* Report a term, and queue it for --pull if the other database has it */
+static int
+cmpmark(struct cmpctx * restrict ctx, char mark, const char * restrict term, size_t len) {
+	char **grow;
+
+	fprintf(stdout, "%c %.*s\n", mark, (int)len, term);
+	if (mark == '<') {
+		ctx->onlyhere++;
+		return(SQLITE_OK);
+	}
+	(mark == '>') ? ctx->onlythere++ : ctx->changed++;
+	if (ctx->cmdbuf->cmpop != NOMBRE_CMP_PULL) {
+		return(SQLITE_OK);
+	}
+	if (ctx->npulls == ctx->pullcap) {
+		ctx->pullcap = (ctx->pullcap == 0) ? NOMBRE_CMP_LEAF : ctx->pullcap * 2;
+		if ((grow = realloc(ctx->pulls, ctx->pullcap * sizeof(*grow))) == NULL) {
+			return(SQLITE_NOMEM);
+		}
+		ctx->pulls = grow;
+	}
+	if ((ctx->pulls[ctx->npulls] = strndup(term, len)) == NULL) {
+		return(SQLITE_NOMEM);
+	}
+	ctx->npulls++;
+	return(SQLITE_OK);
+}
+
+/*
+ * Take every queued term's rows from the other database, inside the walk's
+ * transaction. A term that moved category is queued once per category.
+ * Terms only found here are left alone.
+ */
+static int
+cmppull(struct cmpctx * restrict ctx) {
+	int retc;
+	size_t n;
+	sqlite3_stmt *stmts[4];
+	const char *sql[4] = { NOMBRE_CMP_PULLUPD, NOMBRE_CMP_PULLINS, NOMBRE_CMP_PULLDEL, NOMBRE_CMP_PULLALT };
+	retc = SQLITE_OK; n = 0;
+	memset(stmts, 0, sizeof(stmts));
+
+	if (ctx->npulls > 0) {
+		qsort(ctx->pulls, ctx->npulls, sizeof(*ctx->pulls), strpcmp);
+		for (size_t i = 1; i < ctx->npulls; i++) {
+			if (strcmp(ctx->pulls[i], ctx->pulls[n]) == 0) {
+				free(ctx->pulls[i]);
+			} else {
+				ctx->pulls[++n] = ctx->pulls[i];
+			}
+		}
+		ctx->npulls = n + 1;
+	}
+	for (size_t i = 0; i < 4 && retc == SQLITE_OK; i++) {
+		retc = sqlite3_prepare_v2(ctx->cmdbuf->dbcon, sql[i], -1, &stmts[i], NULL);
+	}
+	for (size_t i = 0; i < ctx->npulls && retc == SQLITE_OK; i++) {
+		for (size_t j = 0; j < 4 && retc == SQLITE_OK; j++) {
+			if ((retc = sqlite3_bind_text(stmts[j], 1, ctx->pulls[i], -1, SQLITE_STATIC)) == SQLITE_OK &&
+					(retc = sqlite3_step(stmts[j])) == SQLITE_DONE) {
+				retc = SQLITE_OK;
+			}
+			sqlite3_reset(stmts[j]);
+		}
+	}
+	for (size_t i = 0; i < 4; i++) {
+		sqlite3_finalize(stmts[i]);
+	}
+	return(retc);
+}
+
+/* A digest file node's children, false if the file stops above it */
+static bool
+cmpfkids(const struct cmpside * restrict side, int64_t catid, const unsigned char * restrict prefix, size_t plen, struct cmpnode * restrict kids) {
+	size_t lo, hi, mid;
+	struct cmpline key;
+	memset(&key, 0, sizeof(key));
+	memset(kids, 0, sizeof(*kids) * NOMBRE_CMP_FANOUT);
+	key.catid = catid;
+	key.plen = (uint8_t)plen;
+	memcpy(key.prefix, prefix, plen);
+
+	/* First line of the node, the slot is left at 0 so it sorts first */
+	for (lo = 0, hi = side->nlines; lo < hi; ) {
+		mid = lo + (hi - lo) / 2;
+		if (linecmp(&side->lines[mid], &key) < 0) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	for (hi = lo; hi < side->nlines && side->lines[hi].catid == catid && side->lines[hi].plen == plen &&
+			memcmp(side->lines[hi].prefix, prefix, plen) == 0; hi++) {
+		kids[side->lines[hi].slot] = side->lines[hi].node;
+	}
+	return(hi > lo);
+}
+
+/*
+ * Bind the category and the range [prefix, next prefix). A prefix of only
+ * 0xFF bytes (or none) has no next text value, and any blob sorts after text.
+ */
+static int
+cmprange(sqlite3_stmt * restrict stmt, int64_t catid, const unsigned char * restrict prefix, size_t plen) {
+	int retc;
+	size_t n;
+	unsigned char hi[DEFLEN + 1];
+
+	memcpy(hi, prefix, plen);
+	for (n = plen; n > 0 && hi[n - 1] == 0xFF; n--);
+	if (n > 0) {
+		hi[n - 1]++;
+	}
+	if ((retc = sqlite3_bind_int64(stmt, 1, catid)) == SQLITE_OK &&
+			(retc = sqlite3_bind_text(stmt, 2, (const char *)prefix, (int)plen, SQLITE_TRANSIENT)) == SQLITE_OK) {
+		retc = (n > 0) ? sqlite3_bind_text(stmt, 3, (const char *)hi, (int)n, SQLITE_TRANSIENT) : sqlite3_bind_blob(stmt, 3, "\xff", 1, SQLITE_STATIC);
+	}
+	return(retc);
+}
+
+static void
+cmpfree(struct cmpctx * restrict ctx) {
+	struct cmpside *sides[2] = { &ctx->here, &ctx->there };
+
+	for (size_t i = 0; i < 2; i++) {
+		sqlite3_finalize(sides[i]->defs);
+		sqlite3_finalize(sides[i]->alts);
+		free(sides[i]->cats);
+		free(sides[i]->lines);
+	}
+	for (size_t i = 0; i < ctx->npulls; i++) {
+		free(ctx->pulls[i]);
+	}
+	free(ctx->pulls);
+}
+
+static int
+linecmp(const void *a, const void *b) {
+	const struct cmpline *la, *lb;
+	int order;
+	la = a; lb = b;
+
+	if (la->catid != lb->catid) {
+		return((la->catid < lb->catid) ? -1 : 1);
+	}
+	if (la->plen != lb->plen) {
+		return((la->plen < lb->plen) ? -1 : 1);
+	}
+	if ((order = memcmp(la->prefix, lb->prefix, la->plen)) != 0) {
+		return(order);
+	}
+	return((int)la->slot - (int)lb->slot);
+}
+
+static int
+termcmp(const void *a, const void *b) {
+	return(strcmp(((const struct cmpterm *)a)->term, ((const struct cmpterm *)b)->term));
+}
+
+static int
+strpcmp(const void *a, const void *b) {
+	return(strcmp(*(char * const *)a, *(char * const *)b));
+}
@@ -0,0 +1,92 @@
+/* 
+ * Copyright (c) 2019, Exile Heavy Industries
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted (subject to the limitations in the disclaimer
+ * below) provided that the following conditions are met:
+ * 
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ * 
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * 
+ * * Neither the name of the copyright holder nor the names of its contributors may be used
+ *   to endorse or promote products derived from this software without specific
+ *   prior written permission.
+ * 
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY THIS
+ * LICENSE. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#define NOMBRE_NOMCMP_H
+
+#ifndef NOMBRE_H
+#include "nombre.h"
+#endif
+
+/*
+ * Reconcile two nombre databases without walking either end to end twice.
+ * Every row hashes to 64 bits and a node's digest is the sum of the hashes
+ * below it, so one pass builds the per-category roots in any row order.
+ * Below a category, a node is a term prefix whose children are split on the
+ * next byte, which maps each child onto an index range of definitions and
+ * altdefs. Only children whose digests disagree are expanded, so two large
+ * databases differing in a few rows cost one scan each plus a few narrow
+ * range scans, down to NOMBRE_CMP_LEAF rows where terms are compared directly.
+ *
+ * The other side is either a database, attached as NOMBRE_CMP_SCHEMA, or a
+ * digest file written by --digest holding the nodes down to NOMBRE_CMP_DEPTH:
+ *   #nombre-digest	DEPTH
+ *   CATID	PREFIX (hex, - for the root)	SLOT	COUNT	DIGEST
+ * Against a digest, differences below what the file holds are reported as
+ * term ranges instead of terms.
+ */
+#define NOMBRE_CMP_MAGIC "#nombre-digest"
+#define NOMBRE_CMP_SCHEMA "nomcmp"
+/* Slot 0 is the term equal to the prefix, 1 + next byte for longer ones */
+#define NOMBRE_CMP_FANOUT 257
+#define NOMBRE_CMP_LEAF 64
+#define NOMBRE_CMP_DEPTH 3
+
+/* cmdbuf->cmpop */
+#define NOMBRE_CMP_REPORT 0x00
+#define NOMBRE_CMP_PULL 0x01
+#define NOMBRE_CMP_DIGEST 0x02
+
+#define NOMBRE_CMP_ATTACH "ATTACH DATABASE ?1 AS " NOMBRE_CMP_SCHEMA ";"
+#define NOMBRE_CMP_DETACH "DETACH DATABASE " NOMBRE_CMP_SCHEMA ";"
+/* Term ids are local to each database, so both sides have to be on the same schema to be joined through them */
+#define NOMBRE_CMP_VERSION "PRAGMA " NOMBRE_CMP_SCHEMA ".user_version;"
+/* s is the schema, "main" or NOMBRE_CMP_SCHEMA */
+#define NOMBRE_CMP_TOPDEFS(s) "SELECT category, term, meaning FROM " s ".definitions;"
+#define NOMBRE_CMP_TOPALTS(s) "SELECT a.category, d.term, a.defno, a.altdef FROM " s ".altdefs AS a CROSS JOIN " s ".definitions AS d ON d.id = a.termid;"
+/* ?2 and ?3 bound the prefix, see cmprange() */
+#define NOMBRE_CMP_DEFS(s) "SELECT term, meaning FROM " s ".definitions WHERE category = ?1 AND term >= ?2 AND term < ?3;"
+#define NOMBRE_CMP_ALTS(s) "SELECT d.term, a.defno, a.altdef FROM " s ".definitions AS d CROSS JOIN " s ".altdefs AS a ON a.termid = d.id" \
+	" WHERE d.term >= ?2 AND d.term < ?3 AND a.category = ?1;"
+/* Pulling replaces a term's definition and alternates with the other database's */
+#define NOMBRE_CMP_PULLUPD "UPDATE main.definitions SET (meaning, category) =" \
+	" (SELECT meaning, category FROM " NOMBRE_CMP_SCHEMA ".definitions WHERE term = ?1)" \
+	" WHERE term = ?1 AND EXISTS (SELECT 1 FROM " NOMBRE_CMP_SCHEMA ".definitions WHERE term = ?1);"
+#define NOMBRE_CMP_PULLINS "INSERT INTO main.definitions (term, meaning, category)" \
+	" SELECT term, meaning, category FROM " NOMBRE_CMP_SCHEMA ".definitions" \
+	" WHERE term = ?1 AND NOT EXISTS (SELECT 1 FROM main.definitions WHERE term = ?1);"
+#define NOMBRE_CMP_PULLDEL "DELETE FROM main.altdefs WHERE termid = (SELECT id FROM main.definitions WHERE term = ?1);"
+#define NOMBRE_CMP_PULLALT "INSERT INTO main.altdefs (termid, defno, altdef, category)" \
+	" SELECT m.id, a.defno, a.altdef, a.category FROM main.definitions AS m, " NOMBRE_CMP_SCHEMA ".definitions AS o" \
+	" CROSS JOIN " NOMBRE_CMP_SCHEMA ".altdefs AS a ON a.termid = o.id WHERE m.term = ?1 AND o.term = ?1;"
+
+int nomdb_cmp(nomcmd * restrict cmdbuf);
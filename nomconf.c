@@ -0,0 +1,275 @@
+/* 
+ * Copyright (c) 2019, Exile Heavy Industries
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted (subject to the limitations in the disclaimer
+ * below) provided that the following conditions are met:
+ * 
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ * 
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * 
+ * * Neither the name of the copyright holder nor the names of its contributors may be used
+ *   to endorse or promote products derived from this software without specific
+ *   prior written permission.
+ * 
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY THIS
+ * LICENSE. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+/*
+ * Connection tuning from the config file, see nomconf.h
+ */
+
+#include <ctype.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#ifndef NOMBRE_H
+#include "nombre.h"
+#endif
+#ifndef NOMBRE_NOMCONF_H
+#include "nomconf.h"
+#endif
+#ifndef NOMBRE_NOMMEM_H
+#include "nommem.h"
+#endif
+
+extern char *__progname;
+extern bool dbg;
+
+/* The values a setting takes by name, numbered in order */
+static const char *const confonoff[] = { "off", "on", NULL };
+static const char *const confsync[] = { "off", "normal", "full", "extra", NULL };
+static const char *const conftemp[] = { "default", "file", "memory", NULL };
+
+/* Indexed by NOMBRE_CONF_*, each key is also the name of its pragma */
+static const struct {
+	const char *key;
+	const char *const *names; /* NULL for a size in bytes */
+	int64_t least; /* Smallest size taken */
+} confkeys[NOMBRE_CONF_COUNT] = {
+	{ "cache_size", NULL, 0 },
+	{ "mmap_size", NULL, 0 },
+	{ "journal_size_limit", NULL, -1 },
+	{ "synchronous", confsync, 0 },
+	{ "temp_store", conftemp, 0 },
+	{ "secure_delete", confonoff, 0 },
+	{ "cell_size_check", confonoff, 0 }
+};
+
+static const struct {
+	const char *name;
+	int64_t values[NOMBRE_CONF_COUNT];
+} confprofiles[] = {
+	/* Every page checked, every step synced and deleted content overwritten, as the init script used to ask for */
+	{ "safe", { 2 << 20, 0, -1, 3, 0, 1, 1 } },
+	/* Reads straight from mapped pages, synced at the critical points only and nothing overwritten or checked */
+	{ "fast", { 8 << 20, 256 << 20, -1, 1, 0, 0, 0 } },
+	/*
+	 * For loads that can be run again from their source: nothing synced, and
+	 * no mapping, as pages changed in a mapped file have to be copied out first.
+	 * Temporaries stay in files, statement journals in memory cost imports a third more.
+	 */
+	{ "bulkload", { 256 << 20, 0, -1, 0, 0, 0, 0 } }
+};
+
+/* Filled in once by confload() */
+static pthread_once_t confonce = PTHREAD_ONCE_INIT;
+static int confretc = NOM_OK;
+static bool confread = false;
+static bool confset[NOMBRE_CONF_COUNT];
+static int64_t confval[NOMBRE_CONF_COUNT];
+static const char *confprofile = NULL;
+static char confpath[PATHMAX];
+
+static void confload(void);
+static int confvalue(int key, const char * restrict str, int64_t * restrict value);
+static void confshow(sqlite3 * restrict db);
+
+/*
+ * Apply the configured settings to a new connection, reading the file the
+ * first time through. A bad file fails every connection until it is fixed.
+ */
+int
+nom_confdb(sqlite3 * restrict db) {
+	int retc;
+	char pragma[64];
+	retc = SQLITE_OK;
+	pragma[0] = 0;
+
+	pthread_once(&confonce, confload);
+	if (confretc != NOM_OK || db == NULL) {
+		return((confretc != NOM_OK) ? confretc : BADARGS);
+	}
+	for (register int i = 0; i < NOMBRE_CONF_COUNT && retc == SQLITE_OK; i++) {
+		if (confset[i]) {
+			/* A negative cache_size is in KiB rather than pages */
+			snprintf(pragma, sizeof(pragma), "PRAGMA %s=%lld;", confkeys[i].key,
+					(long long)((i == NOMBRE_CONF_CACHE) ? -(confval[i] / 1024) : confval[i]));
+			retc = sqlite3_exec(db, pragma, NULL, NULL, NULL);
+		}
+	}
+	if (retc != SQLITE_OK) {
+		NOMERR("Unable to apply %s (%s)!\n", pragma, sqlite3_errmsg(db));
+	} else if (dbg) {
+		confshow(db);
+	}
+	return(retc);
+}
+
+/* Find and parse the config file, a missing one is only an error when named in the environment */
+static void
+confload(void) {
+	int prof;
+	unsigned int lineno;
+	bool named, fileset[NOMBRE_CONF_COUNT];
+	int64_t fileval[NOMBRE_CONF_COUNT];
+	char line[BUFSIZE], *key, *val, *end;
+	const char *env;
+	FILE *conf;
+	prof = -1; lineno = 0;
+	named = false;
+	memset(fileset, 0, sizeof(fileset));
+
+	if ((env = getenv(NOMBRE_CONF_ENV)) != NULL && env[0] != 0) {
+		snprintf(confpath, sizeof(confpath), "%s", env);
+		named = true;
+	} else if ((env = getenv(NOMBRE_CONF_XDG)) != NULL && env[0] != 0) {
+		snprintf(confpath, sizeof(confpath), "%s%s", env, NOMBRE_CONF_NAME);
+	} else if ((env = NOMBRE_DB_PREFIX()) != NULL) {
+		snprintf(confpath, sizeof(confpath), "%s%s%s", env, NOMBRE_CONF_DIRECT, NOMBRE_CONF_NAME);
+	}
+	if (confpath[0] == 0 || (conf = fopen(confpath, "r")) == NULL) {
+		if (named || (confpath[0] != 0 && errno != ENOENT)) {
+			NOMERR("Unable to read %s (%s)!\n", confpath, strerror(errno));
+			confretc = NOM_FIO_FAIL;
+		}
+		return;
+	}
+	confread = true;
+
+	while (confretc == NOM_OK && fgets(line, sizeof(line), conf) != NULL) {
+		lineno++;
+		line[strcspn(line, "#\n")] = 0;
+		key = line;
+		while (isspace((unsigned char)*key)) {
+			key++;
+		}
+		if (*key == 0) {
+			continue;
+		}
+		/* Split at the '=', trimming the blanks around either side */
+		if ((val = strchr(key, '=')) != NULL) {
+			end = val++;
+			while (end > key && isspace((unsigned char)*(end - 1))) {
+				end--;
+			}
+			*end = 0;
+			while (isspace((unsigned char)*val)) {
+				val++;
+			}
+			end = val + strlen(val);
+			while (end > val && isspace((unsigned char)*(end - 1))) {
+				*--end = 0;
+			}
+		}
+		confretc = NOM_INVALID;
+		if (val == NULL) {
+			/* Not a setting at all */
+		} else if (strcmp(key, "profile") == 0) {
+			for (register int i = 0; i < (int)(sizeof(confprofiles) / sizeof(confprofiles[0])); i++) {
+				if (strcasecmp(val, confprofiles[i].name) == 0) {
+					prof = i;
+					confretc = NOM_OK;
+				}
+			}
+		} else {
+			for (register int i = 0; i < NOMBRE_CONF_COUNT && confretc != NOM_OK; i++) {
+				if (strcmp(key, confkeys[i].key) == 0 && (confretc = confvalue(i, val, &fileval[i])) == NOM_OK) {
+					fileset[i] = true;
+				}
+			}
+		}
+		if (confretc != NOM_OK) {
+			NOMERR("%s:%u: bad setting \"%s\"%s%s!\n", confpath, lineno, key, (val != NULL) ? " = " : "", (val != NULL) ? val : "");
+		}
+	}
+	fclose(conf);
+
+	/* The profile goes in first, so the keys given with it win */
+	if (confretc == NOM_OK && prof >= 0) {
+		confprofile = confprofiles[prof].name;
+		for (register int i = 0; i < NOMBRE_CONF_COUNT; i++) {
+			confset[i] = true;
+			confval[i] = confprofiles[prof].values[i];
+		}
+	}
+	for (register int i = 0; i < NOMBRE_CONF_COUNT && confretc == NOM_OK; i++) {
+		if (fileset[i]) {
+			confset[i] = true;
+			confval[i] = fileval[i];
+		}
+	}
+}
+
+/* A named value by its number, or a byte count with an optional K, M or G suffix */
+static int
+confvalue(int key, const char * restrict str, int64_t * restrict value) {
+	sqlite3_int64 val;
+	val = 0;
+
+	if (confkeys[key].names != NULL) {
+		for (register int i = 0; confkeys[key].names[i] != NULL; i++) {
+			if (strcasecmp(str, confkeys[key].names[i]) == 0) {
+				*value = i;
+				return(NOM_OK);
+			}
+		}
+		return(NOM_INVALID);
+	}
+	if (nom_sizeparse(str, &val) != NOM_OK || val < confkeys[key].least) {
+		return(NOM_INVALID);
+	}
+	*value = val;
+	return(NOM_OK);
+}
+
+/* Read the settings back from the connection for -D, whether set here or left at SQLite's defaults */
+static void
+confshow(sqlite3 * restrict db) {
+	int len;
+	char shown[BUFSIZE], pragma[64];
+	sqlite3_stmt *stmt;
+	len = 0; shown[0] = 0;
+
+	for (register int i = 0; i < NOMBRE_CONF_COUNT && len >= 0 && (size_t)len < sizeof(shown); i++) {
+		stmt = NULL;
+		snprintf(pragma, sizeof(pragma), "PRAGMA %s;", confkeys[i].key);
+		if (sqlite3_prepare_v2(db, pragma, -1, &stmt, NULL) == SQLITE_OK && sqlite3_step(stmt) == SQLITE_ROW) {
+			len += snprintf(&shown[len], sizeof(shown) - (size_t)len, " %s=%lld", confkeys[i].key, (long long)sqlite3_column_int64(stmt, 0));
+		}
+		sqlite3_finalize(stmt);
+	}
+	NOMDBG("Settings (%s, profile %s):%s\n", (confread) ? confpath : "no config file", (confprofile != NULL) ? confprofile : "none", shown);
+}
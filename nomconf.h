@@ -0,0 +1,75 @@
+/* 
+ * Copyright (c) 2019, Exile Heavy Industries
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted (subject to the limitations in the disclaimer
+ * below) provided that the following conditions are met:
+ * 
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ * 
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * 
+ * * Neither the name of the copyright holder nor the names of its contributors may be used
+ *   to endorse or promote products derived from this software without specific
+ *   prior written permission.
+ * 
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY THIS
+ * LICENSE. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#define NOMBRE_NOMCONF_H
+
+#ifndef NOMBRE_H
+#include "nombre.h"
+#endif
+
+/*
+ * Connection tuning, read once from the file named by $NOMBRECONF, else
+ * $XDG_CONFIG_HOME/nombre/nombre.conf or ~/.config/nombre/nombre.conf, and
+ * applied by nom_confdb() to every connection that is opened. Without a
+ * file SQLite's own defaults are left alone. Lines hold "key = value" and
+ * '#' starts a comment. A profile is applied first, whatever line it is on,
+ * and the other keys override it:
+ *
+ *   profile = fast            # safe, fast or bulkload
+ *   cache_size = 64M          # bytes, with an optional K, M or G suffix
+ *   mmap_size = 256M
+ *   journal_size_limit = -1   # only for kept journals, -1 for no limit
+ *   synchronous = normal      # off, normal, full or extra
+ *   temp_store = memory       # default, file or memory
+ *   secure_delete = off       # off or on
+ *   cell_size_check = off
+ *
+ * A memory budget (-m) still caps the cache to its page cache pool, but
+ * memory mapped pages are not part of the budget.
+ */
+#define NOMBRE_CONF_ENV "NOMBRECONF"
+#define NOMBRE_CONF_XDG "XDG_CONFIG_HOME"
+#define NOMBRE_CONF_DIRECT "/.config"
+#define NOMBRE_CONF_NAME "/nombre/nombre.conf"
+
+/* Indexes of the settings, in the order they are applied */
+#define NOMBRE_CONF_CACHE 0
+#define NOMBRE_CONF_MMAP 1
+#define NOMBRE_CONF_JOURNAL 2
+#define NOMBRE_CONF_SYNC 3
+#define NOMBRE_CONF_TEMP 4
+#define NOMBRE_CONF_SECDEL 5
+#define NOMBRE_CONF_CELLCHK 6
+#define NOMBRE_CONF_COUNT 7
+
+int nom_confdb(sqlite3 * restrict db);
@@ -0,0 +1,249 @@
+/* 
+ * Copyright (c) 2019, Exile Heavy Industries
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted (subject to the limitations in the disclaimer
+ * below) provided that the following conditions are met:
+ * 
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ * 
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * 
+ * * Neither the name of the copyright holder nor the names of its contributors may be used
+ *   to endorse or promote products derived from this software without specific
+ *   prior written permission.
+ * 
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY THIS
+ * LICENSE. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+/*
+ * Chunked deletes, see nomdel.h
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifndef NOMBRE_H
+#include "nombre.h"
+#endif
+#ifndef NOMBRE_NOMDEL_H
+#include "nomdel.h"
+#endif
+#ifndef NOMBRE_SUBNOM_H
+#include "subnom.h"
+#endif
+#ifndef NOMBRE_NOMBLOOM_H
+#include "nombloom.h"
+#endif
+
+extern char *__progname;
+extern bool dbg;
+
+/* One pass over the rows to change, chunk by chunk */
+struct delstep {
+	const char *pick; /* Last key and size of the next chunk */
+	const char *apply[3]; /* Run over each chunk in order, NULL past the last */
+	const char *what; /* What the pick counts, for the progress line */
+	bool rowids; /* Keyed on a rowid or term id rather than the term */
+};
+
+/* Indexed by NOMBRE_DEL_TERM, _LIKE and _GLOB */
+static const struct delstep delterms[3] = {
+	{ NOMBRE_DEL_PICK(NOMBRE_DEL_EXACT),
+		{ NOMBRE_DEL_ALTS(NOMBRE_DEL_EXACT), NOMBRE_DEL_REFS(NOMBRE_DEL_EXACT), NOMBRE_DEL_DEFS(NOMBRE_DEL_EXACT) }, "terms", false },
+	{ NOMBRE_DEL_PICK(NOMBRE_DEL_LIKES),
+		{ NOMBRE_DEL_ALTS(NOMBRE_DEL_LIKES), NOMBRE_DEL_REFS(NOMBRE_DEL_LIKES), NOMBRE_DEL_DEFS(NOMBRE_DEL_LIKES) }, "terms", false },
+	{ NOMBRE_DEL_PICK(NOMBRE_DEL_GLOBS),
+		{ NOMBRE_DEL_ALTS(NOMBRE_DEL_GLOBS), NOMBRE_DEL_REFS(NOMBRE_DEL_GLOBS), NOMBRE_DEL_DEFS(NOMBRE_DEL_GLOBS) }, "terms", false }
+};
+
+static const struct delstep delcat[3] = {
+	{ NOMBRE_DEL_CATPICK, { NOMBRE_DEL_CATMOVE, NULL, NULL }, "terms", false },
+	{ NOMBRE_DEL_ALTPICK, { NOMBRE_DEL_ALTMOVE, NULL, NULL }, "alternates", true },
+	{ NOMBRE_DEL_TAGPICK, { NOMBRE_DEL_TAGDROP, NULL, NULL }, "tags", true }
+};
+
+static int delchunks(nomcmd * restrict cmdbuf, const struct delstep * restrict step, int64_t * restrict counts);
+static int delcatdrop(nomcmd * restrict cmdbuf);
+
+/* Delete the matching terms, or retire the category for grp del */
+int
+nomdb_del(nomcmd * restrict cmdbuf) {
+	int retc;
+	int64_t counts[3][4];
+	retc = SQLITE_OK;
+	memset(counts, 0, sizeof(counts));
+
+	if (dbg) {
+		NOMDBG("Entering with cmdbuf = %p, delop = %u\n", (void *)cmdbuf, (cmdbuf != NULL) ? cmdbuf->delop : 0);
+	}
+	if (cmdbuf == NULL || cmdbuf->dbcon == NULL || cmdbuf->delop > NOMBRE_DEL_GLOB) {
+		NOMERR("%s", "Given invalid input!\n");
+		return(BADARGS);
+	}
+	if ((cmdbuf->command & grpcmd) == grpcmd) {
+		for (register int i = 0; i < 3 && retc == SQLITE_OK; i++) {
+			retc = delchunks(cmdbuf, &delcat[i], counts[i]);
+		}
+		if (retc == SQLITE_OK && (retc = delcatdrop(cmdbuf)) == SQLITE_OK) {
+			fprintf(stdout, "Moved %lld terms and %lld alternates from %s to UNCAT, dropped %lld tags and the category\n",
+					(long long)counts[0][0], (long long)counts[1][0], cmdbuf->defdata[NOMBRE_DBCATG], (long long)counts[2][0]);
+		}
+	} else if ((retc = delchunks(cmdbuf, &delterms[cmdbuf->delop], counts[0])) == SQLITE_OK) {
+		if (cmdbuf->delop != NOMBRE_DEL_TERM) {
+			fprintf(stdout, "Deleted %lld terms matching %s (%lld alternates, %lld references)\n", (long long)counts[0][0],
+					cmdbuf->defdata[NOMBRE_DBTERM], (long long)counts[0][1], (long long)counts[0][2]);
+		} else if (counts[0][0] > 0) {
+			fprintf(stdout, "Deleted %s (%lld alternates, %lld references)\n", cmdbuf->defdata[NOMBRE_DBTERM],
+					(long long)counts[0][1], (long long)counts[0][2]);
+		} else {
+			NOMERR("No entry for %s!\n", cmdbuf->defdata[NOMBRE_DBTERM]);
+			retc = NOM_FAIL;
+		}
+	}
+	if (dbg) {
+		NOMDBG("Returning %d to caller\n", retc);
+	}
+	return(retc);
+}
+
+/*
+ * Run step until its pick comes back empty, committing after every chunk.
+ * counts[0] adds up the rows picked, counts[1..3] the rows each apply changed.
+ * A failed chunk is rolled back, the chunks before it stay done.
+ */
+static int
+delchunks(nomcmd * restrict cmdbuf, const struct delstep * restrict step, int64_t * restrict counts) {
+	int retc, idx, nstmt;
+	int64_t picked;
+	sqlite3_value *upto;
+	sqlite3_stmt *stmt[4];
+	retc = SQLITE_OK; nstmt = 0; picked = 0;
+	upto = NULL;
+	memset(stmt, 0, sizeof(stmt));
+
+	/* The pick goes first, followed by the applies */
+	for (const char *sql = step->pick; sql != NULL && retc == SQLITE_OK; sql = (nstmt < 4) ? step->apply[nstmt - 1] : NULL) {
+		if ((retc = sqlite3_prepare_v2(cmdbuf->dbcon, sql, -1, &stmt[nstmt], NULL)) == SQLITE_OK &&
+				(retc = bindcmd(cmdbuf, stmt[nstmt])) == SQLITE_OK) {
+			if ((idx = sqlite3_bind_parameter_index(stmt[nstmt], ":chunk")) > 0) {
+				retc = sqlite3_bind_int64(stmt[nstmt], idx, (cmdbuf->chunk > 0) ? cmdbuf->chunk : NOMBRE_DEL_CHUNK);
+			}
+			/* Every key sorts after these */
+			if (retc == SQLITE_OK && (idx = sqlite3_bind_parameter_index(stmt[nstmt], ":last")) > 0) {
+				retc = (step->rowids) ? sqlite3_bind_int64(stmt[nstmt], idx, 0) : sqlite3_bind_text(stmt[nstmt], idx, "", 0, SQLITE_STATIC);
+			}
+		}
+		nstmt++;
+	}
+	if (retc != SQLITE_OK) {
+		NOMERR("Error compiling SQL (%s)!\n", sqlite3_errmsg(cmdbuf->dbcon));
+		goto DELCHUNKS_EXIT;
+	}
+
+	while (retc == SQLITE_OK) {
+		if ((retc = sqlite3_exec(cmdbuf->dbcon, "BEGIN IMMEDIATE;", NULL, NULL, NULL)) != SQLITE_OK) {
+			NOMERR("Unable to start a chunk (%s)!\n", sqlite3_errmsg(cmdbuf->dbcon));
+			break;
+		}
+		if ((retc = sqlite3_step(stmt[0])) == SQLITE_ROW && (picked = sqlite3_column_int64(stmt[0], 1)) > 0) {
+			if ((upto = sqlite3_value_dup(sqlite3_column_value(stmt[0], 0))) == NULL) {
+				retc = SQLITE_NOMEM;
+			} else {
+				retc = SQLITE_OK;
+			}
+			for (register int i = 1; i < nstmt && retc == SQLITE_OK; i++) {
+				if ((retc = sqlite3_bind_value(stmt[i], sqlite3_bind_parameter_index(stmt[i], ":upto"), upto)) == SQLITE_OK &&
+						(retc = sqlite3_step(stmt[i])) == SQLITE_DONE) {
+					counts[i] += sqlite3_changes(cmdbuf->dbcon);
+					retc = SQLITE_OK;
+				}
+				sqlite3_reset(stmt[i]);
+			}
+		} else if (retc == SQLITE_ROW) {
+			/* Nothing left past :last */
+			retc = SQLITE_DONE;
+		}
+		sqlite3_reset(stmt[0]);
+		if (retc == SQLITE_OK && (retc = sqlite3_exec(cmdbuf->dbcon, "COMMIT;", NULL, NULL, NULL)) == SQLITE_OK) {
+			counts[0] += picked;
+			/* The next chunk starts after this one */
+			for (register int i = 0; i < nstmt && retc == SQLITE_OK; i++) {
+				retc = sqlite3_bind_value(stmt[i], sqlite3_bind_parameter_index(stmt[i], ":last"), upto);
+			}
+			nom_bloomnote(cmdbuf, NULL);
+			if (isatty(STDERR_FILENO)) {
+				fprintf(stderr, "\r%s: %lld %s", __progname, (long long)counts[0], step->what);
+			}
+			if (dbg) {
+				NOMDBG("Committed a chunk of %lld %s, %lld so far\n", (long long)picked, step->what, (long long)counts[0]);
+			}
+		} else {
+			if (retc != SQLITE_DONE) {
+				NOMERR("Error deleting a chunk of %s (%s)!\n", step->what, sqlite3_errmsg(cmdbuf->dbcon));
+			}
+			sqlite3_exec(cmdbuf->dbcon, "ROLLBACK;", NULL, NULL, NULL);
+		}
+		sqlite3_value_free(upto);
+		upto = NULL;
+	}
+	if (counts[0] > 0 && isatty(STDERR_FILENO)) {
+		fputc('\n', stderr);
+	}
+	retc = (retc == SQLITE_DONE) ? SQLITE_OK : retc;
+
+DELCHUNKS_EXIT:
+	for (register int i = 0; i < nstmt; i++) {
+		sqlite3_finalize(stmt[i]);
+	}
+	return(retc);
+}
+
+/* With its rows moved away, remove the category itself in one last transaction */
+static int
+delcatdrop(nomcmd * restrict cmdbuf) {
+	int retc;
+	const char *sql;
+	sqlite3_stmt *stmt;
+	sql = NOMBRE_DEL_CATDROP;
+	stmt = NULL;
+
+	if ((retc = sqlite3_exec(cmdbuf->dbcon, "BEGIN IMMEDIATE;", NULL, NULL, NULL)) != SQLITE_OK) {
+		NOMERR("Unable to drop %s (%s)!\n", cmdbuf->defdata[NOMBRE_DBCATG], sqlite3_errmsg(cmdbuf->dbcon));
+		return(retc);
+	}
+	while (retc == SQLITE_OK && *sql != 0) {
+		if ((retc = sqlite3_prepare_v2(cmdbuf->dbcon, sql, -1, &stmt, &sql)) == SQLITE_OK && stmt != NULL &&
+				(retc = bindcmd(cmdbuf, stmt)) == SQLITE_OK && (retc = sqlite3_step(stmt)) == SQLITE_DONE) {
+			retc = SQLITE_OK;
+		}
+		sqlite3_finalize(stmt);
+		stmt = NULL;
+	}
+	if (retc == SQLITE_OK && (retc = sqlite3_exec(cmdbuf->dbcon, "COMMIT;", NULL, NULL, NULL)) == SQLITE_OK) {
+		nom_bloomnote(cmdbuf, NULL);
+	} else {
+		NOMERR("Unable to drop %s (%s)!\n", cmdbuf->defdata[NOMBRE_DBCATG], sqlite3_errmsg(cmdbuf->dbcon));
+		sqlite3_exec(cmdbuf->dbcon, "ROLLBACK;", NULL, NULL, NULL);
+	}
+	return(retc);
+}
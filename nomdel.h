@@ -0,0 +1,80 @@
+/* 
+ * Copyright (c) 2019, Exile Heavy Industries
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted (subject to the limitations in the disclaimer
+ * below) provided that the following conditions are met:
+ * 
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ * 
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * 
+ * * Neither the name of the copyright holder nor the names of its contributors may be used
+ *   to endorse or promote products derived from this software without specific
+ *   prior written permission.
+ * 
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY THIS
+ * LICENSE. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#define NOMBRE_NOMDEL_H
+
+#ifndef NOMBRE_H
+#include "nombre.h"
+#endif
+
+/*
+ * del removes a term along with its alternates and references, or every
+ * term matching a --like or --glob pattern, and grp del retires a whole
+ * category by moving its terms and alternates to UNCAT. Either way the
+ * rows go in chunks of --chunk at a time, each chunk its own transaction,
+ * so the write lock is only held for one chunk and lookups carry on in
+ * between. Chunks walk the term (or id) index from where the last one
+ * stopped: each pick reads the last key of the next chunk, then the
+ * changes are applied to the range up to it.
+ *
+ * Patterns are normalized like terms, so "tmp%" matches what was stored as
+ * "TMP...". Every statement binds :term as the term or pattern, :last and
+ * :upto as the bounds of the chunk, and :chunk as its size.
+ */
+#define NOMBRE_DEL_TERM 0x00
+#define NOMBRE_DEL_LIKE 0x01
+#define NOMBRE_DEL_GLOB 0x02
+#define NOMBRE_DEL_CHUNK 1000
+
+#define NOMBRE_DEL_EXACT "term = :term"
+#define NOMBRE_DEL_LIKES "term LIKE :term"
+#define NOMBRE_DEL_GLOBS "term GLOB :term"
+/* m is one of the matches above */
+#define NOMBRE_DEL_PICK(m) "SELECT max(term), count(*) FROM (SELECT term FROM definitions WHERE term > :last AND " m " ORDER BY term LIMIT :chunk);"
+#define NOMBRE_DEL_ALTS(m) "DELETE FROM altdefs WHERE termid IN (SELECT id FROM definitions WHERE term > :last AND term <= :upto AND " m ");"
+#define NOMBRE_DEL_REFS(m) "DELETE FROM defrefs WHERE termid IN (SELECT id FROM definitions WHERE term > :last AND term <= :upto AND " m ");"
+#define NOMBRE_DEL_DEFS(m) "DELETE FROM definitions WHERE term > :last AND term <= :upto AND " m ";"
+
+/* Retiring a category, in the order it is done */
+#define NOMBRE_DEL_CATPICK "SELECT max(term), count(*) FROM (SELECT term FROM definitions WHERE category = :catid AND term > :last ORDER BY term LIMIT :chunk);"
+#define NOMBRE_DEL_CATMOVE "UPDATE definitions SET category = -1 WHERE category = :catid AND term > :last AND term <= :upto;"
+#define NOMBRE_DEL_ALTPICK "SELECT max(rowid), count(*) FROM (SELECT rowid FROM altdefs WHERE rowid > :last AND category = :catid ORDER BY rowid LIMIT :chunk);"
+#define NOMBRE_DEL_ALTMOVE "UPDATE altdefs SET category = -1 WHERE rowid > :last AND rowid <= :upto AND category = :catid;"
+#define NOMBRE_DEL_TAGPICK "SELECT max(termid), count(*) FROM (SELECT termid FROM term_tags WHERE category = :catid AND termid > :last ORDER BY termid LIMIT :chunk);"
+#define NOMBRE_DEL_TAGDROP "DELETE FROM term_tags WHERE category = :catid AND termid > :last AND termid <= :upto;"
+/* References carry no category of their own, they follow their definitions to UNCAT */
+#define NOMBRE_DEL_CATDROP "DELETE FROM tag_bitmaps WHERE category = :catid; DELETE FROM tag_stale WHERE category = :catid;" \
+	" DELETE FROM category_stats WHERE category = :catid; DELETE FROM category_verbose WHERE id = :catid;" \
+	" DELETE FROM categories WHERE id = :catid;"
+
+int nomdb_del(nomcmd * restrict cmdbuf);
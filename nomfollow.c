@@ -0,0 +1,467 @@
+/* 
+ * Copyright (c) 2019, Exile Heavy Industries
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted (subject to the limitations in the disclaimer
+ * below) provided that the following conditions are met:
+ * 
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ * 
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * 
+ * * Neither the name of the copyright holder nor the names of its contributors may be used
+ *   to endorse or promote products derived from this software without specific
+ *   prior written permission.
+ * 
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY THIS
+ * LICENSE. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+/*
+ * Incremental import of a growing file, see nomfollow.h
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#if defined(__linux__)
+#include <sys/inotify.h>
+#endif
+
+#ifndef NOMBRE_H
+#include "nombre.h"
+#endif
+#ifndef NOMBRE_CATMAP_H
+#include "catmap.h"
+#endif
+#ifndef NOMBRE_IMPORT_H
+#include "import.h"
+#endif
+#ifndef NOMBRE_NOMBLOOM_H
+#include "nombloom.h"
+#endif
+#ifndef NOMBRE_NOMFOLLOW_H
+#include "nomfollow.h"
+#endif
+#ifndef NOMBRE_NOMNORM_H
+#include "nomnorm.h"
+#endif
+
+extern char *__progname;
+extern bool dbg;
+
+struct follower {
+	nomcmd *cmdbuf;
+	char *path; /* Resolved once, the key in ingest_offsets */
+	int fd;
+	ino_t inode;
+	off_t pos; /* File offset of buf[0], everything before it is in */
+	char *buf; /* Bytes read past pos, ending in a partial line if any */
+	size_t len, cap;
+	size_t nrecs; /* Records in the open transaction */
+	const char **terms; /* The new terms among them, for the filter */
+	size_t nterms;
+	bool intxn;
+	sqlite3_stmt *ins, *save;
+	int iterm, idefn, icat;
+	int64_t added, alts, skipped;
+};
+
+static volatile sig_atomic_t stopping;
+
+static int followopen(struct follower * restrict fol);
+static int followdrain(struct follower * restrict fol);
+static int followlines(struct follower * restrict fol);
+static int followrec(struct follower * restrict fol, char * restrict line, off_t off);
+static int followcommit(struct follower * restrict fol, off_t upto);
+static void followwait(int ifd);
+static void followsig(int sig);
+
+/*
+ * Follow the -f file until signalled, taking in whatever is appended to it.
+ */
+int
+nomdb_follow(nomcmd * restrict cmdbuf) {
+	int retc, ifd, wd;
+	struct stat st, cur;
+	struct follower fol;
+	struct sigaction sa, oldint, oldterm;
+	retc = NOM_OK; ifd = -1; wd = -1;
+	memset(&fol, 0, sizeof(fol));
+	fol.cmdbuf = cmdbuf;
+	fol.fd = -1;
+
+	if (dbg) {
+		NOMDBG("Entering with cmdbuf = %p\n", (void *)cmdbuf);
+	}
+	if (cmdbuf == NULL || cmdbuf->dbcon == NULL) {
+		NOMERR("%s", "Given invalid input!\n");
+		return(BADARGS);
+	}
+	if (cmdbuf->filedata[NOMBRE_IOFILE][0] == 0) {
+		NOMERR("%s\n", "Imports need an input file given with -f!");
+		return(BADARGS);
+	}
+	if ((fol.path = realpath(cmdbuf->filedata[NOMBRE_IOFILE], NULL)) == NULL) {
+		NOMERR("Unable to open %s! (%s)\n", cmdbuf->filedata[NOMBRE_IOFILE], strerror(errno));
+		return(NOM_FIO_FAIL);
+	}
+	fol.cap = NOMBRE_FOLLOW_READ;
+	if ((fol.buf = malloc(fol.cap)) == NULL || (fol.terms = calloc(NOMBRE_FOLLOW_BATCH, sizeof(*fol.terms))) == NULL) {
+		retc = NOM_FAIL;
+		goto FOLLOW_EXIT;
+	}
+	if ((retc = nom_catload(cmdbuf)) != NOM_OK) {
+		goto FOLLOW_EXIT;
+	}
+	if ((retc = sqlite3_prepare_v2(cmdbuf->dbcon, NOMBRE_IMP_INSERT, -1, &fol.ins, NULL)) != SQLITE_OK ||
+			(retc = sqlite3_prepare_v2(cmdbuf->dbcon, NOMBRE_FOLLOW_SAVE, -1, &fol.save, NULL)) != SQLITE_OK) {
+		NOMERR("Error compiling SQL (%s)!\n", sqlite3_errmsg(cmdbuf->dbcon));
+		goto FOLLOW_EXIT;
+	}
+	fol.iterm = sqlite3_bind_parameter_index(fol.ins, ":term");
+	fol.idefn = sqlite3_bind_parameter_index(fol.ins, ":defn");
+	fol.icat = sqlite3_bind_parameter_index(fol.ins, ":catid");
+	if ((retc = followopen(&fol)) != NOM_OK) {
+		goto FOLLOW_EXIT;
+	}
+	fprintf(stdout, "Following %s from byte %lld\n", fol.path, (long long)fol.pos);
+	fflush(stdout);
+
+#if defined(__linux__)
+	/* Without inotify the size is simply polled */
+	if ((ifd = inotify_init1(IN_NONBLOCK|IN_CLOEXEC)) >= 0 &&
+			(wd = inotify_add_watch(ifd, fol.path, IN_MODIFY|IN_ATTRIB|IN_MOVE_SELF|IN_DELETE_SELF)) < 0) {
+		close(ifd);
+		ifd = -1;
+	}
+#endif
+	/* No SA_RESTART, a signal has to cut the wait short */
+	stopping = 0;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = followsig;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGINT, &sa, &oldint);
+	sigaction(SIGTERM, &sa, &oldterm);
+
+	while (retc == NOM_OK && ! stopping) {
+		if ((retc = followdrain(&fol)) != NOM_OK || stopping) {
+			break;
+		}
+		if (fstat(fol.fd, &st) == 0 && st.st_size < fol.pos + (off_t)fol.len) {
+			NOMWRN("%s was truncated, following it again from the start\n", fol.path);
+			fol.pos = 0;
+			fol.len = 0;
+			continue;
+		}
+		/* Renamed away or unlinked and drained to the end, move on to whatever is at the path now */
+		if (stat(fol.path, &cur) == 0 && cur.st_ino != fol.inode) {
+			if (fol.len > 0) {
+				NOMWRN("%s was replaced, dropping %zu bytes of an unfinished last line\n", fol.path, fol.len);
+			}
+			close(fol.fd);
+			fol.fd = -1;
+			if ((retc = followopen(&fol)) != NOM_OK) {
+				break;
+			}
+#if defined(__linux__)
+			if (ifd >= 0) {
+				inotify_rm_watch(ifd, wd);
+				wd = inotify_add_watch(ifd, fol.path, IN_MODIFY|IN_ATTRIB|IN_MOVE_SELF|IN_DELETE_SELF);
+			}
+#endif
+			continue;
+		}
+		followwait(ifd);
+	}
+	sigaction(SIGINT, &oldint, NULL);
+	sigaction(SIGTERM, &oldterm, NULL);
+
+	fprintf(stdout, "Took in %lld entries from %s (%lld new terms, %lld alternates, %lld skipped), stopped at byte %lld\n",
+			(long long)(fol.added + fol.alts), fol.path, (long long)fol.added, (long long)fol.alts, (long long)fol.skipped, (long long)fol.pos);
+
+FOLLOW_EXIT:
+	if (ifd >= 0) {
+		close(ifd);
+	}
+	if (fol.fd >= 0) {
+		close(fol.fd);
+	}
+	sqlite3_finalize(fol.ins);
+	sqlite3_finalize(fol.save);
+	free(fol.terms);
+	free(fol.buf);
+	free(fol.path);
+	if (dbg) {
+		NOMDBG("Returning %d to caller\n", retc);
+	}
+	return(retc);
+}
+
+/*
+ * Open the file at the path and pick up where ingest_offsets says the last
+ * follower left it, unless that was another file or a longer one.
+ */
+static int
+followopen(struct follower * restrict fol) {
+	int retc;
+	struct stat st;
+	sqlite3_stmt *stmt;
+	stmt = NULL;
+	fol->pos = 0;
+	fol->len = 0;
+
+	if ((fol->fd = open(fol->path, O_RDONLY|O_CLOEXEC)) < 0 || fstat(fol->fd, &st) != 0) {
+		NOMERR("Unable to open %s! (%s)\n", fol->path, strerror(errno));
+		return(NOM_FIO_FAIL);
+	}
+	fol->inode = st.st_ino;
+	if ((retc = sqlite3_prepare_v2(fol->cmdbuf->dbcon, NOMBRE_FOLLOW_LOAD, -1, &stmt, NULL)) != SQLITE_OK ||
+			(retc = sqlite3_bind_text(stmt, sqlite3_bind_parameter_index(stmt, ":path"), fol->path, -1, SQLITE_STATIC)) != SQLITE_OK) {
+		NOMERR("Error reading the saved offset (%s)!\n", sqlite3_errmsg(fol->cmdbuf->dbcon));
+		sqlite3_finalize(stmt);
+		return(retc);
+	}
+	if ((retc = sqlite3_step(stmt)) == SQLITE_ROW) {
+		if ((ino_t)sqlite3_column_int64(stmt, 0) == st.st_ino && sqlite3_column_int64(stmt, 1) <= (int64_t)st.st_size) {
+			fol->pos = (off_t)sqlite3_column_int64(stmt, 1);
+		} else {
+			NOMWRN("%s is not the file last followed there, reading it from the start\n", fol->path);
+		}
+		retc = SQLITE_OK;
+	} else if (retc == SQLITE_DONE) {
+		retc = SQLITE_OK;
+	} else {
+		NOMERR("Error reading the saved offset (%s)!\n", sqlite3_errmsg(fol->cmdbuf->dbcon));
+	}
+	sqlite3_finalize(stmt);
+	if (dbg) {
+		NOMDBG("Opened %s (inode %llu) at byte %lld\n", fol->path, (unsigned long long)fol->inode, (long long)fol->pos);
+	}
+	return(retc);
+}
+
+/* Read to the end of the file, taking in every whole line on the way */
+static int
+followdrain(struct follower * restrict fol) {
+	int retc;
+	ssize_t got;
+	char *grown;
+	retc = NOM_OK;
+
+	while (retc == NOM_OK && ! stopping) {
+		/* A full buffer holds one unfinished line */
+		if (fol->len == fol->cap) {
+			if ((grown = realloc(fol->buf, fol->cap * 2)) == NULL) {
+				NOMERR("Unable to hold a %zu byte line from %s!\n", fol->len, fol->path);
+				return(NOM_FAIL);
+			}
+			fol->buf = grown;
+			fol->cap *= 2;
+		}
+		if ((got = pread(fol->fd, fol->buf + fol->len, fol->cap - fol->len, fol->pos + (off_t)fol->len)) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			NOMERR("Unable to read %s! (%s)\n", fol->path, strerror(errno));
+			return(NOM_FIO_FAIL);
+		} else if (got == 0) {
+			break;
+		}
+		fol->len += (size_t)got;
+		retc = followlines(fol);
+	}
+	return(retc);
+}
+
+/*
+ * Take in the whole lines in the buffer, committing every batch along with
+ * the offset past its last line, then keep the unfinished one for next time.
+ */
+static int
+followlines(struct follower * restrict fol) {
+	int retc;
+	char *line, *eol, *end;
+	retc = NOM_OK;
+	end = fol->buf + fol->len;
+
+	for (line = fol->buf; retc == NOM_OK && (eol = memchr(line, '\n', (size_t)(end - line))) != NULL; line = eol + 1) {
+		if (! fol->intxn) {
+			if ((retc = sqlite3_exec(fol->cmdbuf->dbcon, "BEGIN IMMEDIATE;", NULL, NULL, NULL)) != SQLITE_OK) {
+				NOMERR("Unable to start a batch (%s)!\n", sqlite3_errmsg(fol->cmdbuf->dbcon));
+				break;
+			}
+			fol->intxn = true;
+			/* Holding the write lock, so this transaction is the one change the filter has to follow */
+			nom_bloomprobe(fol->cmdbuf, NULL);
+		}
+		*eol = 0;
+		if (eol > line && *(eol - 1) == '\r') {
+			*(eol - 1) = 0;
+		}
+		if ((retc = followrec(fol, line, fol->pos + (line - fol->buf))) == NOM_OK && fol->nrecs == NOMBRE_FOLLOW_BATCH) {
+			retc = followcommit(fol, fol->pos + (eol + 1 - fol->buf));
+		}
+	}
+	if (retc == NOM_OK && fol->intxn) {
+		retc = followcommit(fol, fol->pos + (line - fol->buf));
+	}
+	if (retc != NOM_OK) {
+		if (fol->intxn) {
+			sqlite3_exec(fol->cmdbuf->dbcon, "ROLLBACK;", NULL, NULL, NULL);
+			fol->intxn = false;
+		}
+		fol->nrecs = 0;
+		fol->nterms = 0;
+		return(retc);
+	}
+	/* Everything before line is in, the saved offset says so */
+	fol->len = (size_t)(end - line);
+	fol->pos += line - fol->buf;
+	memmove(fol->buf, line, fol->len);
+	return(NOM_OK);
+}
+
+/*
+ * One record, split like import.c does. A bad one is reported and skipped,
+ * only a failing insert stops the follower.
+ */
+static int
+followrec(struct follower * restrict fol, char * restrict line, off_t off) {
+	int retc;
+	int64_t catid;
+	char *catg, *defn;
+	sqlite3 *db;
+	db = fol->cmdbuf->dbcon;
+	catid = -1;
+	retc = NOM_OK;
+
+	if (*line == '#' || *line == 0) {
+		return(NOM_OK);
+	}
+	if ((catg = nom_tsvfield(line)) == NULL || (defn = nom_tsvfield(catg)) == NULL || nom_tsvfield(defn) != NULL ||
+			*line == 0 || *defn == 0) {
+		NOMERR("%s: malformed record at byte %lld, skipped!\n", fol->path, (long long)off);
+		fol->skipped++;
+		return(NOM_OK);
+	}
+	nom_normterm(line);
+	/* The map was loaded when following began, a category created since is only found by reloading it */
+	if (*catg != 0 && (retc = nom_catid(fol->cmdbuf, catg, &catid)) == NOM_INVALID) {
+		nom_catfree(fol->cmdbuf);
+		retc = nom_catid(fol->cmdbuf, catg, &catid);
+	}
+	if (retc != NOM_OK && retc != NOM_INVALID) {
+		NOMERR("Unable to load the categories (%s)!\n", sqlite3_errmsg(db));
+		return(retc);
+	} else if (retc == NOM_INVALID) {
+		NOMERR("%s: unknown category \"%s\" for %s, skipped!\n", fol->path, catg, line);
+		fol->skipped++;
+		return(NOM_OK);
+	}
+	sqlite3_bind_text(fol->ins, fol->iterm, line, -1, SQLITE_STATIC);
+	sqlite3_bind_text(fol->ins, fol->idefn, defn, -1, SQLITE_STATIC);
+	sqlite3_bind_int64(fol->ins, fol->icat, catid);
+	if ((retc = sqlite3_step(fol->ins)) != SQLITE_DONE) {
+		NOMERR("Error importing %s (%s)!\n", line, sqlite3_errmsg(db));
+		sqlite3_reset(fol->ins);
+		return(retc);
+	}
+	sqlite3_reset(fol->ins);
+	fol->nrecs++;
+	/* The trigger swallows the row when it becomes an alternate */
+	if (sqlite3_changes(db) > 0) {
+		fol->terms[fol->nterms++] = line;
+		fol->added++;
+	} else {
+		fol->alts++;
+	}
+	return(NOM_OK);
+}
+
+/* Move the saved offset past the batch inside its transaction, commit, then note its new terms in the filter */
+static int
+followcommit(struct follower * restrict fol, off_t upto) {
+	int retc;
+	sqlite3 *db;
+	db = fol->cmdbuf->dbcon;
+
+	if ((retc = sqlite3_bind_text(fol->save, sqlite3_bind_parameter_index(fol->save, ":path"), fol->path, -1, SQLITE_STATIC)) == SQLITE_OK &&
+			(retc = sqlite3_bind_int64(fol->save, sqlite3_bind_parameter_index(fol->save, ":inode"), (sqlite3_int64)fol->inode)) == SQLITE_OK &&
+			(retc = sqlite3_bind_int64(fol->save, sqlite3_bind_parameter_index(fol->save, ":pos"), (sqlite3_int64)upto)) == SQLITE_OK &&
+			(retc = sqlite3_step(fol->save)) == SQLITE_DONE) {
+		retc = sqlite3_exec(db, "COMMIT;", NULL, NULL, NULL);
+	}
+	sqlite3_reset(fol->save);
+	if (retc != SQLITE_OK) {
+		NOMERR("Unable to commit a batch from %s (%s)!\n", fol->path, sqlite3_errmsg(db));
+		return(retc);
+	}
+	fol->intxn = false;
+	nom_bloomnotev(fol->cmdbuf, fol->terms, fol->nterms);
+	if (dbg) {
+		NOMDBG("Committed %zu new terms, %s is in up to byte %lld\n", fol->nterms, fol->path, (long long)upto);
+	}
+	fol->nrecs = 0;
+	fol->nterms = 0;
+	return(NOM_OK);
+}
+
+/* Sleep until the file changes, or for a while if there is no telling */
+static void
+followwait(int ifd) {
+	struct pollfd pfd;
+	struct timespec ts;
+#if defined(__linux__)
+	_Alignas(struct inotify_event) char events[BUFSIZE];
+#endif
+
+	if (ifd < 0) {
+		ts.tv_sec = NOMBRE_FOLLOW_POLL / 1000;
+		ts.tv_nsec = (NOMBRE_FOLLOW_POLL % 1000) * 1000000L;
+		nanosleep(&ts, NULL);
+		return;
+	}
+	pfd.fd = ifd;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+	if (poll(&pfd, 1, NOMBRE_FOLLOW_IDLE) > 0) {
+#if defined(__linux__)
+		/* What changed doesn't matter, the file is read to its end either way */
+		while (read(ifd, events, sizeof(events)) > 0) {
+			continue;
+		}
+#endif
+	}
+}
+
+static void
+followsig(int sig) {
+	(void)sig;
+	stopping = 1;
+}
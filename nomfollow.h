@@ -0,0 +1,72 @@
+/* 
+ * Copyright (c) 2019, Exile Heavy Industries
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted (subject to the limitations in the disclaimer
+ * below) provided that the following conditions are met:
+ * 
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ * 
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * 
+ * * Neither the name of the copyright holder nor the names of its contributors may be used
+ *   to endorse or promote products derived from this software without specific
+ *   prior written permission.
+ * 
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY THIS
+ * LICENSE. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#define NOMBRE_NOMFOLLOW_H
+
+#ifndef NOMBRE_H
+#include "nombre.h"
+#endif
+
+/*
+ * imp --follow keeps reading the -f file as it grows, taking in each
+ * whole line appended to it (in the import format, see import.c) in
+ * small transactions of up to NOMBRE_FOLLOW_BATCH records. Every
+ * transaction also moves the file's entry in ingest_offsets past the
+ * lines it read, so after a restart, or a crash, following picks up at
+ * the first line that never made it in without rescanning the rest.
+ * A partial last line waits for its newline.
+ *
+ * On Linux the follower sleeps in inotify until the file changes,
+ * elsewhere it checks the size every NOMBRE_FOLLOW_POLL milliseconds.
+ * A file replaced at the same path (a different inode), or truncated,
+ * is followed again from its first byte. Malformed records are reported
+ * and skipped rather than stopping the feed. SIGINT or SIGTERM finish
+ * the batch in hand and stop.
+ */
+#define NOMBRE_IMP_ONCE 0x00
+#define NOMBRE_IMP_FOLLOW 0x01
+
+/* Records per transaction, bounding how long the write lock is held */
+#define NOMBRE_FOLLOW_BATCH 500
+/* Starting size of the read buffer, doubled for any longer line */
+#define NOMBRE_FOLLOW_READ (BUFSIZE * 16)
+/* Size checks without inotify, in milliseconds */
+#define NOMBRE_FOLLOW_POLL 200
+/* Longest inotify sleep before the path is checked for a new file anyway */
+#define NOMBRE_FOLLOW_IDLE 1000
+
+#define NOMBRE_FOLLOW_LOAD "SELECT inode, pos FROM ingest_offsets WHERE path = :path;"
+#define NOMBRE_FOLLOW_SAVE "INSERT INTO ingest_offsets (path, inode, pos, modified) VALUES (:path, :inode, :pos, CAST(strftime('%s', 'now') AS INTEGER))" \
+	" ON CONFLICT (path) DO UPDATE SET inode = excluded.inode, pos = excluded.pos, modified = excluded.modified;"
+
+int nomdb_follow(nomcmd * restrict cmdbuf);
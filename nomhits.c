@@ -0,0 +1,217 @@
+/* 
+ * Copyright (c) 2019, Exile Heavy Industries
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted (subject to the limitations in the disclaimer
+ * below) provided that the following conditions are met:
+ * 
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ * 
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * 
+ * * Neither the name of the copyright holder nor the names of its contributors may be used
+ *   to endorse or promote products derived from this software without specific
+ *   prior written permission.
+ * 
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY THIS
+ * LICENSE. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifndef NOMBRE_H
+#include "nombre.h"
+#endif
+#ifndef NOMBRE_NOMHITS_H
+#include "nomhits.h"
+#endif
+#ifndef NOMBRE_NOMNORM_H
+#include "nomnorm.h"
+#endif
+
+extern char *__progname;
+extern bool dbg;
+
+static int hitcmp(const void *a, const void *b);
+
+/*
+ * Append the looked up term to the side log, folding the log into the
+ * database when it has grown large enough. A log that can't be written
+ * (read-only directory, full disk) only costs the hit, never the lookup.
+ */
+int
+nom_hitlog(nomcmd * restrict cmdbuf) {
+	int retc, fd;
+	bool fold;
+	size_t len;
+	struct stat st;
+	char path[PATHMAX + sizeof(NOMBRE_HITS_SUFFIX)];
+	char term[DEFLEN + 1];
+	retc = NOM_OK; fd = -1; fold = false;
+
+	memccpy(term, cmdbuf->defdata[NOMBRE_DBTERM], 0, (size_t)DEFLEN);
+	term[DEFLEN - 1] = 0;
+	/* One term per line, so a term with a newline in it can't be counted */
+	if ((len = nom_normterm(term)) == 0 || memchr(term, '\n', len) != NULL) {
+		return(retc);
+	}
+	term[len++] = '\n';
+	snprintf(path, sizeof(path), "%s%s", cmdbuf->filedata[NOMBRE_DBFILE], NOMBRE_HITS_SUFFIX);
+
+	/* A single O_APPEND write keeps lines from concurrent lookups whole */
+	if ((fd = open(path, O_WRONLY|O_APPEND|O_CREAT|O_CLOEXEC, 0600)) < 0 || write(fd, term, len) != (ssize_t)len) {
+		if (dbg) {
+			NOMDBG("Could not log the hit in %s (%s)\n", path, strerror(errno));
+		}
+		retc = NOM_FIO_FAIL;
+	} else {
+		fold = (fstat(fd, &st) == 0 && st.st_size >= NOMBRE_HITS_FOLD);
+	}
+	if (fd >= 0) {
+		close(fd);
+	}
+	if (fold) {
+		retc = nom_hitfold(cmdbuf);
+	}
+	return(retc);
+}
+
+/*
+ * Fold the side log into term_stats, one upsert per distinct term, all in
+ * a single transaction. The log is renamed out of the way under the write
+ * lock and only removed right before the commit, so a claim left behind by
+ * a fold that failed is simply folded again by the next one.
+ */
+int
+nom_hitfold(nomcmd * restrict cmdbuf) {
+	int retc, idx;
+	size_t len, nterms, i, run;
+	char *buf, *cur, **terms;
+	struct stat st;
+	FILE *in;
+	sqlite3_stmt *stmt;
+	char path[PATHMAX + sizeof(NOMBRE_HITS_SUFFIX)];
+	char claim[PATHMAX + sizeof(NOMBRE_HITS_SUFFIX) + sizeof(NOMBRE_HITS_CLAIM)];
+	retc = NOM_OK; idx = 0; len = nterms = i = run = 0;
+	buf = cur = NULL; terms = NULL; in = NULL; stmt = NULL;
+
+	if (dbg) {
+		NOMDBG("Entering with cmdbuf = %p\n", (void *)cmdbuf);
+	}
+	if (cmdbuf == NULL || cmdbuf->dbcon == NULL) {
+		NOMERR("%s\n", "Invalid Arguments!");
+		return(BADARGS);
+	}
+	snprintf(path, sizeof(path), "%s%s", cmdbuf->filedata[NOMBRE_DBFILE], NOMBRE_HITS_SUFFIX);
+	snprintf(claim, sizeof(claim), "%s%s", path, NOMBRE_HITS_CLAIM);
+
+	if ((retc = sqlite3_exec(cmdbuf->dbcon, "BEGIN IMMEDIATE;", NULL, NULL, NULL)) != SQLITE_OK) {
+		NOMWRN("Could not fold lookup hits (%s), they will be folded next time\n", sqlite3_errmsg(cmdbuf->dbcon));
+		return(retc);
+	}
+	if (access(claim, F_OK) != 0 && rename(path, claim) != 0) {
+		/* No log at all just means no lookups since the last fold */
+		if (errno != ENOENT) {
+			NOMERR("Could not claim %s (%s)\n", path, strerror(errno));
+			retc = NOM_FIO_FAIL;
+		}
+		goto HITFOLD_EXIT;
+	}
+	if ((in = fopen(claim, "r")) == NULL || fstat(fileno(in), &st) != 0 ||
+			(buf = malloc((size_t)st.st_size + 1)) == NULL ||
+			(len = fread(buf, 1, (size_t)st.st_size, in)) != (size_t)st.st_size) {
+		NOMERR("Could not read %s (%s)\n", claim, strerror(errno));
+		retc = NOM_FIO_FAIL;
+		goto HITFOLD_EXIT;
+	}
+	buf[len] = 0;
+
+	/* Split into lines in place, then sort so every distinct term is one run */
+	for (cur = buf; (cur = memchr(cur, '\n', len - (size_t)(cur - buf))) != NULL; cur++) {
+		nterms++;
+	}
+	if (nterms == 0 || (terms = calloc(nterms, sizeof(*terms))) == NULL) {
+		retc = (nterms == 0) ? NOM_OK : NOM_FAIL;
+		goto HITFOLD_CLEAN;
+	}
+	for (cur = buf, i = 0; i < nterms; i++) {
+		terms[i] = cur;
+		cur = memchr(cur, '\n', len - (size_t)(cur - buf));
+		*cur++ = 0;
+	}
+	qsort(terms, nterms, sizeof(*terms), hitcmp);
+
+	if ((retc = sqlite3_prepare_v2(cmdbuf->dbcon, NOMBRE_HITS_UPSERT, -1, &stmt, NULL)) != SQLITE_OK) {
+		NOMERR("Error compiling SQL (%s)!\n", sqlite3_errmsg(cmdbuf->dbcon));
+		goto HITFOLD_EXIT;
+	}
+	idx = sqlite3_bind_parameter_index(stmt, ":hits");
+	for (i = 0; i < nterms && retc == SQLITE_OK; i += run) {
+		for (run = 1; i + run < nterms && strcmp(terms[i], terms[i + run]) == 0; run++);
+		if (terms[i][0] == 0) {
+			continue;
+		}
+		if ((retc = sqlite3_bind_text(stmt, sqlite3_bind_parameter_index(stmt, ":term"), terms[i], -1, SQLITE_STATIC)) == SQLITE_OK &&
+				(retc = sqlite3_bind_int64(stmt, idx, (sqlite3_int64)run)) == SQLITE_OK &&
+				(retc = sqlite3_step(stmt)) == SQLITE_DONE) {
+			retc = sqlite3_reset(stmt);
+		}
+	}
+	if (retc != SQLITE_OK) {
+		NOMERR("Error folding lookup hits (%s)!\n", sqlite3_errmsg(cmdbuf->dbcon));
+		goto HITFOLD_EXIT;
+	}
+
+HITFOLD_CLEAN:
+	/* Losing the counts beats counting them twice if the commit then fails */
+	if (retc == NOM_OK && unlink(claim) != 0) {
+		NOMERR("Could not remove %s (%s)\n", claim, strerror(errno));
+		retc = NOM_FIO_FAIL;
+	}
+
+HITFOLD_EXIT:
+	sqlite3_finalize(stmt);
+	if (retc == NOM_OK) {
+		if ((retc = sqlite3_exec(cmdbuf->dbcon, "COMMIT;", NULL, NULL, NULL)) != SQLITE_OK) {
+			NOMERR("Error committing lookup hits (%s)!\n", sqlite3_errmsg(cmdbuf->dbcon));
+		}
+	}
+	if (retc != NOM_OK) {
+		sqlite3_exec(cmdbuf->dbcon, "ROLLBACK;", NULL, NULL, NULL);
+	}
+	if (in != NULL) {
+		fclose(in);
+	}
+	free(terms);
+	free(buf);
+	if (dbg) {
+		NOMDBG("Returning %d to caller after folding %zu hits\n", retc, nterms);
+	}
+	return(retc);
+}
+
+static int
+hitcmp(const void *a, const void *b) {
+	return(strcmp(*(char * const *)a, *(char * const *)b));
+}
@@ -0,0 +1,60 @@
+/* 
+ * Copyright (c) 2019, Exile Heavy Industries
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted (subject to the limitations in the disclaimer
+ * below) provided that the following conditions are met:
+ * 
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ * 
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * 
+ * * Neither the name of the copyright holder nor the names of its contributors may be used
+ *   to endorse or promote products derived from this software without specific
+ *   prior written permission.
+ * 
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY THIS
+ * LICENSE. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#define NOMBRE_NOMHITS_H
+
+#ifndef NOMBRE_H
+#include "nombre.h"
+#endif
+
+/*
+ * Lookup hits are appended to a side log next to the database instead of
+ * being written to it, so a def stays a read-only transaction. The log is
+ * folded into term_stats in one batched transaction once it grows past
+ * NOMBRE_HITS_FOLD bytes, and always right before a top listing. Counts
+ * are best effort: a hit appended while a fold is reading the log, or a
+ * fold that dies between removing the log and committing, is lost rather
+ * than counted twice.
+ */
+#define NOMBRE_HITS_SUFFIX "-hits"
+#define NOMBRE_HITS_CLAIM ".fold"
+#define NOMBRE_HITS_FOLD (64 * 1024)
+/* Rows shown by top without a --limit */
+#define NOMBRE_HITS_TOP 10
+/* Hits on a term deleted since it was looked up are dropped */
+#define NOMBRE_HITS_UPSERT "INSERT INTO term_stats (term, hits, lasthit) SELECT :term, :hits, CAST(strftime('%s', 'now') AS INTEGER)" \
+	" WHERE EXISTS (SELECT 1 FROM definitions WHERE term = :term)" \
+	" ON CONFLICT (term) DO UPDATE SET hits = hits + excluded.hits, lasthit = excluded.lasthit;"
+
+int nom_hitlog(nomcmd * restrict cmdbuf);
+int nom_hitfold(nomcmd * restrict cmdbuf);
@@ -0,0 +1,471 @@
+/* 
+ * Copyright (c) 2019, Exile Heavy Industries
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted (subject to the limitations in the disclaimer
+ * below) provided that the following conditions are met:
+ * 
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ * 
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * 
+ * * Neither the name of the copyright holder nor the names of its contributors may be used
+ *   to endorse or promote products derived from this software without specific
+ *   prior written permission.
+ * 
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY THIS
+ * LICENSE. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef NOMBRE_H
+#include "nombre.h"
+#endif
+#ifndef NOMBRE_NOMMEM_H
+#include "nommem.h"
+#endif
+
+extern char *__progname;
+extern bool dbg;
+
+/* Settings chosen by nom_memconf(), kept for nom_memdb() and the report */
+static sqlite3_int64 membudget;
+static sqlite3_int64 memheap;
+static void *mempool;
+static int poolslot;
+static int poolcount;
+
+/*
+ * Every block starts with an 8 byte header holding its class, or for blocks
+ * from malloc(3) ARENA_BIG and the usable size shifted above it. Classes are
+ * multiples of 16 bytes, so the pointer after the header is always 8 byte
+ * aligned as SQLite requires.
+ */
+#define ARENA_HDR 8
+#define ARENA_BIG 0xFF
+
+struct arenafree {
+	struct arenafree *next;
+};
+
+static struct nomarena_t {
+	pthread_mutex_t lock;
+	char *base;
+	size_t size;
+	size_t next; /* Bump offset for blocks never handed out before */
+	struct arenafree *free[NOMBRE_ARENA_CLASSES];
+	struct nomarena_count_t count;
+} arena = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+static void *arenamalloc(int n);
+static void arenafree(void *p);
+static void *arenarealloc(void *p, int n);
+static int arenasize(void *p);
+static int arenaroundup(int n);
+static int arenainit(void *ctx);
+static void arenashutdown(void *ctx);
+static inline unsigned int arenaclass(size_t n);
+
+static const sqlite3_mem_methods arenamethods = {
+	arenamalloc, arenafree, arenarealloc, arenasize, arenaroundup, arenainit, arenashutdown, NULL
+};
+
+/*
+ * Parse a byte count with an optional K, M or G suffix (powers of 1024) up
+ * to NOMBRE_MEM_MAX. The bound is checked before the suffix is applied, so
+ * nothing can overflow, and only a bare number may be negative.
+ */
+int
+nom_sizeparse(const char * restrict str, sqlite3_int64 * restrict bytes) {
+	int shift;
+	char *end;
+	long long val;
+	shift = 0; end = NULL;
+
+	errno = 0;
+	val = strtoll(str, &end, 10);
+	if (end == str || errno != 0) {
+		return(NOM_INVALID);
+	}
+	switch (*end) {
+		case 'g': case 'G':
+			shift += 10;
+			/* FALLTHROUGH */
+		case 'm': case 'M':
+			shift += 10;
+			/* FALLTHROUGH */
+		case 'k': case 'K':
+			shift += 10;
+			end++;
+			break;
+		default:
+			break;
+	}
+	if (*end != 0 || (shift != 0 && val < 0) || val > (NOMBRE_MEM_MAX >> shift)) {
+		return(NOM_INVALID);
+	}
+	*bytes = (sqlite3_int64)val << shift;
+	return(NOM_OK);
+}
+
+/*
+ * Parse the memory budget given with -m or NOMBREMEM
+ */
+int
+nom_memparse(const char * restrict str, sqlite3_int64 * restrict bytes) {
+	sqlite3_int64 val;
+	val = 0;
+
+	if (str == NULL || bytes == NULL) {
+		NOMERR("%s\n", "Invalid Arguments!");
+		return(BADARGS);
+	}
+	if (nom_sizeparse(str, &val) != NOM_OK || val < NOMBRE_MEM_MIN) {
+		NOMERR("Memory budget \"%s\" must be a size from %dK up to 1T (K, M or G suffix)\n", str, NOMBRE_MEM_MIN / 1024);
+		return(BADARGS);
+	}
+	*bytes = val;
+	return(NOM_OK);
+}
+
+/*
+ * Install the arena and apply the budget, must be called before
+ * sqlite3_initialize(). A budget of 0 gets a NOMBRE_ARENA_SIZE arena and
+ * leaves the page cache, lookaside and heap limits at the library defaults.
+ */
+int
+nom_memconf(sqlite3_int64 budget) {
+	int retc, hdrsz, lacnt;
+	sqlite3_int64 pool;
+	retc = SQLITE_OK; hdrsz = 0; lacnt = NOMBRE_MEM_LACNT; pool = 0;
+
+	if ((retc = sqlite3_config(SQLITE_CONFIG_MEMSTATUS, 1)) != SQLITE_OK) {
+		return(retc);
+	}
+	if (budget == 0) {
+		return(nom_arenaconf(NOMBRE_ARENA_SIZE));
+	}
+	/* Slots have to fit a default sized page plus the cache's own header */
+	if ((retc = sqlite3_config(SQLITE_CONFIG_PCACHE_HDRSZ, &hdrsz)) != SQLITE_OK) {
+		return(retc);
+	}
+	poolslot = (BUFSIZE + hdrsz + 7) & ~7;
+	pool = budget / 4;
+	poolcount = (int)(pool / poolslot);
+	if ((mempool = malloc((size_t)poolslot * (size_t)poolcount)) == NULL) {
+		NOMERR("Could not preallocate a %lld byte page cache\n", (long long)pool);
+		return(SQLITE_NOMEM);
+	}
+	/* Lookaside comes out of the heap, keep it to 1/64th of the budget per connection */
+	if ((sqlite3_int64)NOMBRE_MEM_LASZ * lacnt > budget / 64) {
+		lacnt = (int)(budget / 64 / NOMBRE_MEM_LASZ);
+	}
+	if ((retc = sqlite3_config(SQLITE_CONFIG_PAGECACHE, mempool, poolslot, poolcount)) != SQLITE_OK ||
+			(retc = sqlite3_config(SQLITE_CONFIG_LOOKASIDE, NOMBRE_MEM_LASZ, lacnt)) != SQLITE_OK) {
+		NOMERR("Could not configure the memory budget (%s)\n", sqlite3_errstr(retc));
+		/* Don't leave the library pointing at the pool */
+		sqlite3_config(SQLITE_CONFIG_PAGECACHE, NULL, 0, 0);
+		nom_memfree();
+		return(retc);
+	}
+	membudget = budget;
+	memheap = budget - (sqlite3_int64)poolslot * poolcount;
+	/* What's left after the page cache is the arena */
+	if ((retc = nom_arenaconf((size_t)memheap)) != SQLITE_OK) {
+		sqlite3_config(SQLITE_CONFIG_PAGECACHE, NULL, 0, 0);
+		nom_memfree();
+		return(retc);
+	}
+	/* These initialize the library, so they have to come after every sqlite3_config() */
+	sqlite3_hard_heap_limit64(memheap);
+	sqlite3_soft_heap_limit64(memheap - memheap / 4);
+
+	if (dbg) {
+		NOMDBG("Budget %lld: %d page cache slots of %d bytes, heap limit %lld, %d lookaside slots\n",
+				(long long)budget, poolcount, poolslot, (long long)memheap, lacnt);
+	}
+	return(retc);
+}
+
+/*
+ * Cap the page cache of a new connection to the preallocated pool so it
+ * never has to spill into the heap
+ */
+int
+nom_memdb(sqlite3 * restrict db) {
+	int retc;
+	char pragma[64];
+	retc = SQLITE_OK;
+
+	if (db != NULL && membudget > 0) {
+		snprintf(pragma, sizeof(pragma), "PRAGMA cache_size=%d;", poolcount);
+		retc = sqlite3_exec(db, pragma, NULL, NULL, NULL);
+	}
+	return(retc);
+}
+
+/*
+ * Report library wide and (if db is given) per-connection memory use on stderr
+ */
+void
+nom_memstat(sqlite3 * restrict db) {
+	sqlite3_int64 cur, hi, mcnt, mcnthi, mlast, msize, pcur, phi, ocur, ohi;
+	int dcur, dhi, lahit, lamsz, lamfull, chit, cmiss, cspill, schema, stmt;
+	struct nomarena_count_t count;
+	cur = hi = mcnt = mcnthi = mlast = msize = pcur = phi = ocur = ohi = 0;
+	dcur = dhi = lahit = lamsz = lamfull = chit = cmiss = cspill = schema = stmt = 0;
+
+	sqlite3_status64(SQLITE_STATUS_MEMORY_USED, &cur, &hi, 0);
+	sqlite3_status64(SQLITE_STATUS_MALLOC_COUNT, &mcnt, &mcnthi, 0);
+	sqlite3_status64(SQLITE_STATUS_MALLOC_SIZE, &mlast, &msize, 0);
+	sqlite3_status64(SQLITE_STATUS_PAGECACHE_USED, &pcur, &phi, 0);
+	sqlite3_status64(SQLITE_STATUS_PAGECACHE_OVERFLOW, &ocur, &ohi, 0);
+
+	if (membudget > 0) {
+		fprintf(stderr, "memory: budget %lld, heap limit %lld (soft %lld), page cache pool %d x %d bytes\n",
+				(long long)membudget, (long long)memheap, (long long)sqlite3_soft_heap_limit64(-1), poolcount, poolslot);
+	}
+	fprintf(stderr, "memory: heap %lld in use, highwater %lld, largest request %lld, %lld allocations outstanding (peak %lld)\n",
+			(long long)cur, (long long)sqlite3_memory_highwater(0), (long long)msize, (long long)mcnt, (long long)mcnthi);
+	fprintf(stderr, "memory: page cache %lld slots in use (peak %lld), overflow %lld bytes (peak %lld)\n",
+			(long long)pcur, (long long)phi, (long long)ocur, (long long)ohi);
+	nom_arenacount(&count);
+	fprintf(stderr, "memory: arena %zu of %zu bytes carved, %llu blocks live\n",
+			(size_t)count.used, arena.size, (unsigned long long)count.live);
+#ifdef NOMBRE_MEMCOUNT
+	fprintf(stderr, "memory: %llu allocation requests, %llu served by malloc(3) (arena included)\n",
+			(unsigned long long)count.requests, (unsigned long long)count.sysallocs);
+#endif /* NOMBRE_MEMCOUNT */
+	if (db == NULL) {
+		return;
+	}
+	if (sqlite3_compileoption_used("OMIT_LOOKASIDE")) {
+		fprintf(stderr, "%s\n", "connection: lookaside is not compiled into this SQLite");
+	} else {
+		/* The lookaside hit and miss counters are only kept in the highwater slot */
+		sqlite3_db_status(db, SQLITE_DBSTATUS_LOOKASIDE_HIT, &dcur, &lahit, 0);
+		sqlite3_db_status(db, SQLITE_DBSTATUS_LOOKASIDE_MISS_SIZE, &dcur, &lamsz, 0);
+		sqlite3_db_status(db, SQLITE_DBSTATUS_LOOKASIDE_MISS_FULL, &dcur, &lamfull, 0);
+		sqlite3_db_status(db, SQLITE_DBSTATUS_LOOKASIDE_USED, &dcur, &dhi, 0);
+		fprintf(stderr, "connection: lookaside %d slots in use (peak %d), %d hits, %d misses on size, %d on a full pool\n",
+				dcur, dhi, lahit, lamsz, lamfull);
+	}
+	sqlite3_db_status(db, SQLITE_DBSTATUS_CACHE_USED, &dcur, &dhi, 0);
+	sqlite3_db_status(db, SQLITE_DBSTATUS_CACHE_HIT, &chit, &dhi, 0);
+	sqlite3_db_status(db, SQLITE_DBSTATUS_CACHE_MISS, &cmiss, &dhi, 0);
+	sqlite3_db_status(db, SQLITE_DBSTATUS_CACHE_SPILL, &cspill, &dhi, 0);
+	sqlite3_db_status(db, SQLITE_DBSTATUS_SCHEMA_USED, &schema, &dhi, 0);
+	sqlite3_db_status(db, SQLITE_DBSTATUS_STMT_USED, &stmt, &dhi, 0);
+	fprintf(stderr, "connection: page cache %d bytes, %d hits, %d misses, %d spills; schema %d bytes, statements %d bytes\n",
+			dcur, chit, cmiss, cspill, schema, stmt);
+	return;
+}
+
+/* Release the page cache pool, only valid after sqlite3_shutdown() */
+void
+nom_memfree(void) {
+	free(mempool);
+	mempool = NULL;
+	membudget = memheap = 0;
+	poolslot = poolcount = 0;
+	return;
+}
+
+/*
+ * Install the arena as SQLite's allocator, must be called before
+ * sqlite3_initialize(). The arena itself is only allocated by xInit.
+ */
+int
+nom_arenaconf(size_t size) {
+	int retc;
+	retc = SQLITE_OK;
+
+	if (arena.base != NULL) {
+		NOMERR("%s\n", "The arena can't be resized while SQLite is initialized!");
+		return(SQLITE_MISUSE);
+	}
+	arena.size = size & ~(size_t)15;
+	if ((retc = sqlite3_config(SQLITE_CONFIG_MALLOC, &arenamethods)) != SQLITE_OK) {
+		NOMERR("Could not install the arena allocator (%s)\n", sqlite3_errstr(retc));
+	}
+	return(retc);
+}
+
+void
+nom_arenacount(struct nomarena_count_t * restrict count) {
+	pthread_mutex_lock(&arena.lock);
+	memcpy(count, &arena.count, sizeof(*count));
+	pthread_mutex_unlock(&arena.lock);
+	return;
+}
+
+/* Smallest class whose blocks hold n bytes plus the header */
+static inline unsigned int
+arenaclass(size_t n) {
+	unsigned int cls = 0;
+
+	n = (n + ARENA_HDR - 1) >> NOMBRE_ARENA_MINSHIFT;
+	while (n > 0) {
+		cls++;
+		n >>= 1;
+	}
+	return(cls);
+}
+
+static void *
+arenamalloc(int n) {
+	uint64_t *blk;
+	unsigned int cls;
+	size_t len;
+	blk = NULL; cls = arenaclass((size_t)n);
+
+	pthread_mutex_lock(&arena.lock);
+#ifdef NOMBRE_MEMCOUNT
+	arena.count.requests++;
+#endif /* NOMBRE_MEMCOUNT */
+	if (cls < NOMBRE_ARENA_CLASSES) {
+		len = (size_t)1 << (cls + NOMBRE_ARENA_MINSHIFT);
+		if (arena.free[cls] != NULL) {
+			blk = (uint64_t *)(void *)arena.free[cls];
+			arena.free[cls] = arena.free[cls]->next;
+		} else if (arena.base != NULL && arena.next + len <= arena.size) {
+			blk = (uint64_t *)(void *)(arena.base + arena.next);
+			arena.next += len;
+			arena.count.used = arena.next;
+		}
+	}
+	if (blk != NULL) {
+		*blk = cls;
+		arena.count.live++;
+	}
+	pthread_mutex_unlock(&arena.lock);
+	if (blk != NULL) {
+		return(blk + 1);
+	}
+
+	/* Too big for any class, or the arena has run dry */
+	if ((blk = malloc((size_t)n + ARENA_HDR)) == NULL) {
+		return(NULL);
+	}
+	*blk = ((uint64_t)n << 8) | ARENA_BIG;
+	pthread_mutex_lock(&arena.lock);
+#ifdef NOMBRE_MEMCOUNT
+	arena.count.sysallocs++;
+#endif /* NOMBRE_MEMCOUNT */
+	arena.count.live++;
+	pthread_mutex_unlock(&arena.lock);
+	return(blk + 1);
+}
+
+static void
+arenafree(void *p) {
+	uint64_t *blk;
+	unsigned int cls;
+	blk = (uint64_t *)p - 1; cls = (unsigned int)(*blk & 0xFF);
+
+	if (cls == ARENA_BIG) {
+		free(blk);
+		pthread_mutex_lock(&arena.lock);
+		arena.count.live--;
+		pthread_mutex_unlock(&arena.lock);
+		return;
+	}
+	pthread_mutex_lock(&arena.lock);
+	((struct arenafree *)(void *)blk)->next = arena.free[cls];
+	arena.free[cls] = (struct arenafree *)(void *)blk;
+	arena.count.live--;
+	pthread_mutex_unlock(&arena.lock);
+	return;
+}
+
+static void *
+arenarealloc(void *p, int n) {
+	void *out;
+	int have;
+	out = NULL; have = arenasize(p);
+
+	/* Shrinking, or growing within the slack of the class, keeps the block */
+	if (n <= have && ((*((uint64_t *)p - 1) & 0xFF) == ARENA_BIG || n > have / 2)) {
+		return(p);
+	}
+	if ((out = arenamalloc(n)) != NULL) {
+		memcpy(out, p, (size_t)((n < have) ? n : have));
+		arenafree(p);
+	}
+	return(out);
+}
+
+static int
+arenasize(void *p) {
+	uint64_t hdr;
+
+	if (p == NULL) {
+		return(0);
+	}
+	hdr = *((uint64_t *)p - 1);
+	if ((hdr & 0xFF) == ARENA_BIG) {
+		return((int)(hdr >> 8));
+	}
+	return((int)(((size_t)1 << ((hdr & 0xFF) + NOMBRE_ARENA_MINSHIFT)) - ARENA_HDR));
+}
+
+static int
+arenaroundup(int n) {
+	unsigned int cls;
+	cls = arenaclass((size_t)n);
+
+	if (cls < NOMBRE_ARENA_CLASSES) {
+		return((int)(((size_t)1 << (cls + NOMBRE_ARENA_MINSHIFT)) - ARENA_HDR));
+	}
+	return((n + 7) & ~7);
+}
+
+/* One allocation for the whole arena, touched lazily by the kernel */
+static int
+arenainit(void *ctx) {
+	(void)ctx;
+
+	if (arena.size > 0 && (arena.base = malloc(arena.size)) == NULL) {
+		/* Not fatal, every request just goes to malloc(3) */
+		NOMWRN("Could not allocate a %zu byte arena\n", arena.size);
+	}
+#ifdef NOMBRE_MEMCOUNT
+	arena.count.sysallocs += (arena.base != NULL) ? 1 : 0;
+#endif /* NOMBRE_MEMCOUNT */
+	arena.next = 0;
+	memset(arena.free, 0, sizeof(arena.free));
+	return(SQLITE_OK);
+}
+
+/* Everything carved out of the arena goes back in one free(3) */
+static void
+arenashutdown(void *ctx) {
+	(void)ctx;
+
+	free(arena.base);
+	arena.base = NULL;
+	arena.next = 0;
+	arena.count.used = 0;
+	memset(arena.free, 0, sizeof(arena.free));
+	return;
+}
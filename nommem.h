@@ -0,0 +1,84 @@
+/* 
+ * Copyright (c) 2019, Exile Heavy Industries
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted (subject to the limitations in the disclaimer
+ * below) provided that the following conditions are met:
+ * 
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ * 
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * 
+ * * Neither the name of the copyright holder nor the names of its contributors may be used
+ *   to endorse or promote products derived from this software without specific
+ *   prior written permission.
+ * 
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY THIS
+ * LICENSE. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#define NOMBRE_NOMMEM_H
+
+#ifndef NOMBRE_H
+#include "nombre.h"
+#endif
+
+/*
+ * Memory budget for SQLite, set with -m or the NOMBREMEM environment
+ * variable as a byte count with an optional K, M or G suffix. A quarter of
+ * the budget is preallocated as a shared page cache pool, the rest is the
+ * hard heap limit, and the soft limit sits a quarter below that so SQLite
+ * starts giving cache pages back well before allocations begin to fail.
+ */
+#define NOMBRE_MEM_ENV "NOMBREMEM"
+/* Anything smaller can't hold the schema and a few pages of each index */
+#define NOMBRE_MEM_MIN (512 * 1024)
+/* Largest size nom_sizeparse() takes, the budget and the config file sizes alike */
+#define NOMBRE_MEM_MAX ((sqlite3_int64)1 << 40)
+/* Default lookaside slot size and per-connection slot count */
+#define NOMBRE_MEM_LASZ 1200
+#define NOMBRE_MEM_LACNT 40
+
+/*
+ * SQLite allocates through a single preallocated arena carved into power of
+ * two size classes, each with its own free list. Requests larger than the
+ * biggest class, or made once the arena is used up, fall through to
+ * malloc(3). Freed blocks go back on the free list of their class, and
+ * the arena is handed back in one piece at sqlite3_shutdown(). Build with
+ * -DNOMBRE_MEMCOUNT (MEMCOUNT in config.mk) to count every request and
+ * every trip to the system allocator.
+ */
+#define NOMBRE_ARENA_SIZE (1024 * 1024)
+/* Classes run from 16 bytes (2^4) to 128K (2^17), headers included */
+#define NOMBRE_ARENA_MINSHIFT 4
+#define NOMBRE_ARENA_CLASSES 14
+
+struct nomarena_count_t {
+	uint64_t requests; /* xMalloc and xRealloc calls made by SQLite */
+	uint64_t sysallocs; /* malloc/realloc calls the arena had to make itself */
+	uint64_t live; /* Blocks currently handed out */
+	uint64_t used; /* Arena bytes handed out by the bump pointer so far */
+};
+
+int nom_arenaconf(size_t size);
+void nom_arenacount(struct nomarena_count_t * restrict count);
+int nom_sizeparse(const char * restrict str, sqlite3_int64 * restrict bytes);
+int nom_memparse(const char * restrict str, sqlite3_int64 * restrict bytes);
+int nom_memconf(sqlite3_int64 budget);
+int nom_memdb(sqlite3 * restrict db);
+void nom_memstat(sqlite3 * restrict db);
+void nom_memfree(void);
@@ -0,0 +1,380 @@
+/* 
+ * Copyright (c) 2019, Exile Heavy Industries
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted (subject to the limitations in the disclaimer
+ * below) provided that the following conditions are met:
+ * 
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ * 
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * 
+ * * Neither the name of the copyright holder nor the names of its contributors may be used
+ *   to endorse or promote products derived from this software without specific
+ *   prior written permission.
+ * 
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY THIS
+ * LICENSE. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+/*
+ * Term normalization, see nomnorm.h
+ *
+ * Nearly every term is plain ASCII, so the whole string is first run through
+ * a vectorized pass that upper-cases 16 (SSE2) or 32 (AVX2) bytes at a time
+ * and stops at the first byte with the high bit set. Only from there on is the
+ * string decoded and mapped one code point at a time.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define NOMBRE_NORM_X86
+#include <immintrin.h>
+#endif
+
+#ifndef NOMBRE_H
+#include "nombre.h"
+#endif
+#ifndef NOMBRE_NOMNORM_H
+#include "nomnorm.h"
+#endif
+
+extern char *__progname;
+extern bool dbg;
+
+/* A base letter and combining mark, and the precomposed (upper-case) letter they make */
+struct normcomp {
+	uint16_t base, mark, comp;
+};
+
+/* Sorted by mark, then base */
+static const struct normcomp comptab[] = {
+	{ 'A', 0x300, 0xC0 }, { 'E', 0x300, 0xC8 }, { 'I', 0x300, 0xCC }, { 'O', 0x300, 0xD2 }, { 'U', 0x300, 0xD9 },
+	{ 'A', 0x301, 0xC1 }, { 'C', 0x301, 0x106 }, { 'E', 0x301, 0xC9 }, { 'I', 0x301, 0xCD }, { 'L', 0x301, 0x139 },
+	{ 'N', 0x301, 0x143 }, { 'O', 0x301, 0xD3 }, { 'R', 0x301, 0x154 }, { 'S', 0x301, 0x15A }, { 'U', 0x301, 0xDA },
+	{ 'Y', 0x301, 0xDD }, { 'Z', 0x301, 0x179 },
+	{ 'A', 0x302, 0xC2 }, { 'C', 0x302, 0x108 }, { 'E', 0x302, 0xCA }, { 'G', 0x302, 0x11C }, { 'H', 0x302, 0x124 },
+	{ 'I', 0x302, 0xCE }, { 'J', 0x302, 0x134 }, { 'O', 0x302, 0xD4 }, { 'S', 0x302, 0x15C }, { 'U', 0x302, 0xDB },
+	{ 'W', 0x302, 0x174 }, { 'Y', 0x302, 0x176 },
+	{ 'A', 0x303, 0xC3 }, { 'I', 0x303, 0x128 }, { 'N', 0x303, 0xD1 }, { 'O', 0x303, 0xD5 }, { 'U', 0x303, 0x168 },
+	{ 'A', 0x304, 0x100 }, { 'E', 0x304, 0x112 }, { 'I', 0x304, 0x12A }, { 'O', 0x304, 0x14C }, { 'U', 0x304, 0x16A },
+	{ 'A', 0x306, 0x102 }, { 'E', 0x306, 0x114 }, { 'G', 0x306, 0x11E }, { 'I', 0x306, 0x12C }, { 'O', 0x306, 0x14E },
+	{ 'U', 0x306, 0x16C },
+	{ 'C', 0x307, 0x10A }, { 'E', 0x307, 0x116 }, { 'G', 0x307, 0x120 }, { 'I', 0x307, 0x130 }, { 'Z', 0x307, 0x17B },
+	{ 'A', 0x308, 0xC4 }, { 'E', 0x308, 0xCB }, { 'I', 0x308, 0xCF }, { 'O', 0x308, 0xD6 }, { 'U', 0x308, 0xDC },
+	{ 'Y', 0x308, 0x178 },
+	{ 'A', 0x30A, 0xC5 }, { 'U', 0x30A, 0x16E },
+	{ 'O', 0x30B, 0x150 }, { 'U', 0x30B, 0x170 },
+	{ 'C', 0x30C, 0x10C }, { 'D', 0x30C, 0x10E }, { 'E', 0x30C, 0x11A }, { 'L', 0x30C, 0x13D }, { 'N', 0x30C, 0x147 },
+	{ 'R', 0x30C, 0x158 }, { 'S', 0x30C, 0x160 }, { 'T', 0x30C, 0x164 }, { 'Z', 0x30C, 0x17D },
+	{ 'C', 0x327, 0xC7 }, { 'G', 0x327, 0x122 }, { 'K', 0x327, 0x136 }, { 'L', 0x327, 0x13B }, { 'N', 0x327, 0x145 },
+	{ 'R', 0x327, 0x156 }, { 'S', 0x327, 0x15E }, { 'T', 0x327, 0x162 },
+	{ 'A', 0x328, 0x104 }, { 'E', 0x328, 0x118 }, { 'I', 0x328, 0x12E }, { 'U', 0x328, 0x172 }
+};
+
+static size_t normutf8(char * restrict str, size_t len);
+static inline uint32_t upcp(uint32_t cp);
+static inline uint32_t compose(uint32_t base, uint32_t mark);
+static inline size_t utf8dec(const unsigned char * restrict str, size_t len, uint32_t * restrict cp);
+static inline size_t utf8enc(char * restrict out, uint32_t cp);
+static void normfunc(sqlite3_context *ctx, int argc, sqlite3_value **argv);
+#ifdef NOMBRE_NORM_X86
+static size_t asciisse2(char * restrict str, size_t len);
+__attribute__((target("avx2"))) static size_t asciiavx2(char * restrict str, size_t len);
+#endif
+
+/*
+ * Normalize a NUL terminated term in place, returning its new length
+ */
+size_t
+nom_normterm(char * restrict str) {
+	size_t len, done;
+
+	if (str == NULL) {
+		return(0);
+	}
+	len = strlen(str);
+	if ((done = nom_normascii(str, len)) == len) {
+		return(len);
+	}
+	/* Restart on the last ASCII byte, a combining mark may compose with it */
+	done -= (done > 0) ? 1 : 0;
+	len = done + normutf8(str + done, len - done);
+	str[len] = 0;
+	return(len);
+}
+
+/*
+ * Upper-case the leading ASCII run of str, returning how many bytes were
+ * handled before the first non-ASCII byte (len if there were none)
+ */
+size_t
+nom_normascii(char * restrict str, size_t len) {
+	size_t i;
+	i = 0;
+
+#ifdef NOMBRE_NORM_X86
+	if (len >= 32 && __builtin_cpu_supports("avx2")) {
+		i = asciiavx2(str, len);
+	} else if (len >= 16) {
+		i = asciisse2(str, len);
+	}
+#endif
+	for (; i < len && (unsigned char)str[i] < 0x80; i++) {
+		str[i] = (str[i] >= 'a' && str[i] <= 'z') ? str[i] ^ 0x20 : str[i];
+	}
+	return(i);
+}
+
+/*
+ * Register nomnorm(text) on a connection, so statements can compare
+ * against normalized input without the caller touching it
+ */
+int
+nom_normreg(sqlite3 * restrict db) {
+	return(sqlite3_create_function_v2(db, NOMBRE_NORM_FUNC, 1, SQLITE_UTF8|SQLITE_DETERMINISTIC|SQLITE_INNOCUOUS,
+				NULL, normfunc, NULL, NULL, NULL));
+}
+
+#ifdef NOMBRE_NORM_X86
+/*
+ * Bytes 'a'..'z' are found with a single signed compare by shifting them down
+ * to the bottom of the signed range first. Stops at the first block holding a
+ * non-ASCII byte, leaving it and anything shorter than a block to the caller.
+ */
+static size_t
+asciisse2(char * restrict str, size_t len) {
+	size_t i;
+	__m128i v, low;
+	const __m128i shift = _mm_set1_epi8((char)(0x80 - 'a'));
+	const __m128i range = _mm_set1_epi8((char)(0x80 + 26));
+	const __m128i flip = _mm_set1_epi8(0x20);
+
+	for (i = 0; i + 16 <= len; i += 16) {
+		v = _mm_loadu_si128((const __m128i *)(str + i));
+		if (_mm_movemask_epi8(v) != 0) {
+			break;
+		}
+		low = _mm_cmplt_epi8(_mm_add_epi8(v, shift), range);
+		_mm_storeu_si128((__m128i *)(str + i), _mm_xor_si128(v, _mm_and_si128(low, flip)));
+	}
+	return(i);
+}
+
+__attribute__((target("avx2"))) static size_t
+asciiavx2(char * restrict str, size_t len) {
+	size_t i;
+	__m256i v, low;
+	const __m256i shift = _mm256_set1_epi8((char)(0x80 - 'a'));
+	const __m256i range = _mm256_set1_epi8((char)(0x80 + 26));
+	const __m256i flip = _mm256_set1_epi8(0x20);
+
+	for (i = 0; i + 32 <= len; i += 32) {
+		v = _mm256_loadu_si256((const __m256i *)(str + i));
+		if (_mm256_movemask_epi8(v) != 0) {
+			break;
+		}
+		/* There is only a greater-than compare, so the operands are swapped */
+		low = _mm256_cmpgt_epi8(range, _mm256_add_epi8(v, shift));
+		_mm256_storeu_si256((__m256i *)(str + i), _mm256_xor_si256(v, _mm256_and_si256(low, flip)));
+	}
+	return(i);
+}
+#endif /* NOMBRE_NORM_X86 */
+
+/*
+ * The slow path: decode, map and recompose one code point at a time.
+ * The output never outruns the input, so it is written over the input.
+ */
+static size_t
+normutf8(char * restrict str, size_t len) {
+	size_t in, out, step, base;
+	uint32_t cp, comp;
+	in = 0; out = 0;
+	base = SIZE_MAX; /* Offset of the ASCII letter just written, if any */
+
+	while (in < len) {
+		if ((unsigned char)str[in] < 0x80) {
+			str[out] = (str[in] >= 'a' && str[in] <= 'z') ? str[in] ^ 0x20 : str[in];
+			base = out++;
+			in++;
+			continue;
+		}
+		if ((step = utf8dec((const unsigned char *)&str[in], len - in, &cp)) == 0) {
+			/* Not valid UTF-8, keep the byte and move on */
+			str[out++] = str[in++];
+			base = SIZE_MAX;
+			continue;
+		}
+		in += step;
+		/* A combining mark right after a letter it composes with replaces that letter */
+		if (base != SIZE_MAX && cp >= 0x300 && cp <= 0x36F && (comp = compose((unsigned char)str[base], cp)) != 0) {
+			out = base + utf8enc(&str[base], comp);
+		} else if (cp == 0xDF) {
+			/* The one full case mapping kept, sharp s becomes SS in the same two bytes */
+			str[out++] = 'S';
+			str[out++] = 'S';
+		} else {
+			out += utf8enc(&str[out], upcp(cp));
+		}
+		base = SIZE_MAX;
+	}
+	return(out);
+}
+
+/* Simple upper-case mapping, see nomnorm.h for the covered blocks */
+static inline uint32_t
+upcp(uint32_t cp) {
+	if (cp < 0x80) {
+		return((cp >= 'a' && cp <= 'z') ? cp ^ 0x20 : cp);
+	} else if (cp < 0x100) {
+		if (cp == 0xB5) {
+			return(0x39C);
+		} else if (cp == 0xFF) {
+			return(0x178);
+		}
+		return((cp >= 0xE0 && cp != 0xF7) ? cp - 0x20 : cp);
+	} else if (cp < 0x180) {
+		if (cp == 0x131) {
+			return('I');
+		} else if (cp == 0x17F) {
+			return('S');
+		} else if ((cp >= 0x139 && cp <= 0x148) || (cp >= 0x179 && cp <= 0x17E)) {
+			return(((cp & 1) == 0) ? cp - 1 : cp);
+		} else if (cp < 0x138 || (cp >= 0x14A && cp <= 0x177)) {
+			return(((cp & 1) == 1 && cp != 0x131) ? cp - 1 : cp);
+		}
+	} else if (cp >= 0x370 && cp < 0x400) {
+		if (cp == 0x3C2) {
+			return(0x3A3);
+		} else if (cp == 0x3AC) {
+			return(0x386);
+		} else if (cp >= 0x3AD && cp <= 0x3AF) {
+			return(cp - 0x25);
+		} else if (cp == 0x3CC) {
+			return(0x38C);
+		} else if (cp == 0x3CD || cp == 0x3CE) {
+			return(cp - 0x3F);
+		} else if (cp >= 0x3D8 && cp <= 0x3EF) {
+			return(((cp & 1) == 1) ? cp - 1 : cp);
+		}
+		return((cp >= 0x3B1 && cp <= 0x3CB) ? cp - 0x20 : cp);
+	} else if (cp >= 0x400 && cp < 0x530) {
+		if (cp >= 0x430 && cp <= 0x44F) {
+			return(cp - 0x20);
+		} else if (cp >= 0x450 && cp <= 0x45F) {
+			return(cp - 0x50);
+		} else if (cp == 0x4CF) {
+			return(0x4C0);
+		} else if (cp >= 0x4C1 && cp <= 0x4CE) {
+			return(((cp & 1) == 0) ? cp - 1 : cp);
+		} else if ((cp >= 0x460 && cp <= 0x481) || cp >= 0x48A) {
+			return(((cp & 1) == 1) ? cp - 1 : cp);
+		}
+	} else if (cp >= 0x561 && cp <= 0x586) {
+		return(cp - 0x30);
+	} else if ((cp >= 0x1E00 && cp <= 0x1E95) || (cp >= 0x1EA0 && cp <= 0x1EFF)) {
+		return(((cp & 1) == 1) ? cp - 1 : cp);
+	} else if (cp >= 0xFF41 && cp <= 0xFF5A) {
+		return(cp - 0x20);
+	}
+	return(cp);
+}
+
+static inline uint32_t
+compose(uint32_t base, uint32_t mark) {
+	for (size_t i = 0; i < sizeof(comptab) / sizeof(comptab[0]) && comptab[i].mark <= mark; i++) {
+		if (comptab[i].mark == mark && comptab[i].base == base) {
+			return(comptab[i].comp);
+		}
+	}
+	return(0);
+}
+
+/* Decode one multi-byte sequence, returning its length or 0 if it is malformed */
+static inline size_t
+utf8dec(const unsigned char * restrict str, size_t len, uint32_t * restrict cp) {
+	size_t n;
+	uint32_t min;
+
+	if (str[0] >= 0xC2 && str[0] <= 0xDF) {
+		n = 2; min = 0x80; *cp = str[0] & 0x1F;
+	} else if (str[0] >= 0xE0 && str[0] <= 0xEF) {
+		n = 3; min = 0x800; *cp = str[0] & 0x0F;
+	} else if (str[0] >= 0xF0 && str[0] <= 0xF4) {
+		n = 4; min = 0x10000; *cp = str[0] & 0x07;
+	} else {
+		return(0);
+	}
+	if (n > len) {
+		return(0);
+	}
+	for (size_t i = 1; i < n; i++) {
+		if ((str[i] & 0xC0) != 0x80) {
+			return(0);
+		}
+		*cp = (*cp << 6) | (str[i] & 0x3F);
+	}
+	/* Overlong forms, surrogates and anything past U+10FFFF */
+	return((*cp < min || (*cp >= 0xD800 && *cp <= 0xDFFF) || *cp > 0x10FFFF) ? 0 : n);
+}
+
+static inline size_t
+utf8enc(char * restrict out, uint32_t cp) {
+	if (cp < 0x80) {
+		out[0] = (char)cp;
+		return(1);
+	} else if (cp < 0x800) {
+		out[0] = (char)(0xC0 | (cp >> 6));
+		out[1] = (char)(0x80 | (cp & 0x3F));
+		return(2);
+	} else if (cp < 0x10000) {
+		out[0] = (char)(0xE0 | (cp >> 12));
+		out[1] = (char)(0x80 | ((cp >> 6) & 0x3F));
+		out[2] = (char)(0x80 | (cp & 0x3F));
+		return(3);
+	}
+	out[0] = (char)(0xF0 | (cp >> 18));
+	out[1] = (char)(0x80 | ((cp >> 12) & 0x3F));
+	out[2] = (char)(0x80 | ((cp >> 6) & 0x3F));
+	out[3] = (char)(0x80 | (cp & 0x3F));
+	return(4);
+}
+
+/* nomnorm(text): NULL stays NULL, everything else is normalized as text */
+static void
+normfunc(sqlite3_context *ctx, int argc, sqlite3_value **argv) {
+	int len;
+	char *buf;
+	(void)argc;
+
+	if (sqlite3_value_type(argv[0]) == SQLITE_NULL) {
+		sqlite3_result_null(ctx);
+		return;
+	}
+	len = sqlite3_value_bytes(argv[0]);
+	if ((buf = sqlite3_malloc(len + 1)) == NULL) {
+		sqlite3_result_error_nomem(ctx);
+		return;
+	}
+	memcpy(buf, sqlite3_value_text(argv[0]), (size_t)len + 1);
+	sqlite3_result_text(ctx, buf, (int)nom_normterm(buf), sqlite3_free);
+}
@@ -0,0 +1,70 @@
+/* 
+ * Copyright (c) 2019, Exile Heavy Industries
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted (subject to the limitations in the disclaimer
+ * below) provided that the following conditions are met:
+ * 
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ * 
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * 
+ * * Neither the name of the copyright holder nor the names of its contributors may be used
+ *   to endorse or promote products derived from this software without specific
+ *   prior written permission.
+ * 
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY THIS
+ * LICENSE. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#define NOMBRE_NOMNORM_H
+
+#include <stddef.h>
+
+#ifndef NOMBRE_H
+#include "nombre.h"
+#endif
+
+/*
+ * Terms are stored in one normal form, and every path that writes or looks
+ * up a term has to go through the same normalization:
+ *  - letters are upper-cased with the simple Unicode case mappings of the
+ *    Latin, Greek, Cyrillic and Armenian blocks, plus the fullwidth forms,
+ *    from a built-in table so the result never depends on the locale
+ *  - a Latin letter followed by a combining accent is composed into the
+ *    precomposed letter (NFC) where one exists
+ * Code points outside those tables, and malformed UTF-8, pass through as is.
+ * No mapping produces more bytes than it consumes, so strings are always
+ * normalized in place.
+ *
+ * This is a subset of Unicode case folding and NFC, not the full algorithms:
+ *  - only one mark is composed, onto an ASCII letter, so a letter carrying
+ *    stacked marks (Vietnamese, polytonic Greek) keeps the rest decomposed
+ *  - combining marks are never put in canonical order
+ *  - other scripts (Georgian, Cherokee, Deseret, ...) keep their case, and
+ *    the only full (multi-letter) mapping applied is sharp s to SS
+ * Spellings that differ only in one of those ways are stored and looked up
+ * as different terms, the same text typed precomposed and decomposed, or in
+ * another case of an uncovered script, will not match.
+ */
+
+/* Name of the SQL function registered by nom_normreg() */
+#define NOMBRE_NORM_FUNC "nomnorm"
+
+size_t nom_normterm(char * restrict str);
+size_t nom_normascii(char * restrict str, size_t len);
+int nom_normreg(sqlite3 * restrict db);
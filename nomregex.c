@@ -0,0 +1,134 @@
+/* 
+ * Copyright (c) 2019, Exile Heavy Industries
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted (subject to the limitations in the disclaimer
+ * below) provided that the following conditions are met:
+ * 
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ * 
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * 
+ * * Neither the name of the copyright holder nor the names of its contributors may be used
+ *   to endorse or promote products derived from this software without specific
+ *   prior written permission.
+ * 
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY THIS
+ * LICENSE. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+/*
+ * REGEXP for key --regex, see nomregex.h
+ */
+
+#include <regex.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifndef NOMBRE_H
+#include "nombre.h"
+#endif
+#ifndef NOMBRE_NOMREGEX_H
+#include "nomregex.h"
+#endif
+
+extern char *__progname;
+extern bool dbg;
+
+static void regexfunc(sqlite3_context *ctx, int argc, sqlite3_value **argv);
+static void regexfree(void *re);
+
+/*
+ * Register regexp(pattern, string) on a connection, making REGEXP usable
+ * in its statements
+ */
+int
+nom_regexreg(sqlite3 * restrict db) {
+	return(sqlite3_create_function_v2(db, NOMBRE_REGEX_FUNC, 2, SQLITE_UTF8|SQLITE_DETERMINISTIC|SQLITE_INNOCUOUS,
+				NULL, regexfunc, NULL, NULL, NULL));
+}
+
+/*
+ * Compile a pattern up front so a bad one is reported before any statement
+ * runs, rather than as an error out of the middle of a scan
+ */
+int
+nom_regexcheck(const char * restrict pattern) {
+	int retc;
+	regex_t re;
+	char errbuf[256];
+
+	if (pattern == NULL) {
+		return(BADARGS);
+	}
+	if ((retc = regcomp(&re, pattern, NOMBRE_REGEX_FLAGS)) != 0) {
+		regerror(retc, &re, errbuf, sizeof(errbuf));
+		NOMERR("Invalid regular expression \"%s\" (%s)!\n", pattern, errbuf);
+		return(BADARGS);
+	}
+	regfree(&re);
+	return(NOM_OK);
+}
+
+/* regexp(pattern, string), NULL when either is, as for LIKE */
+static void
+regexfunc(sqlite3_context *ctx, int argc, sqlite3_value **argv) {
+	int retc;
+	const char *pattern, *str;
+	regex_t *re;
+	char errbuf[256];
+	bool fresh;
+	(void)argc;
+	fresh = false;
+
+	if (sqlite3_value_type(argv[0]) == SQLITE_NULL || sqlite3_value_type(argv[1]) == SQLITE_NULL) {
+		sqlite3_result_null(ctx);
+		return;
+	}
+	if ((re = sqlite3_get_auxdata(ctx, 0)) == NULL) {
+		if ((pattern = (const char *)sqlite3_value_text(argv[0])) == NULL || (re = sqlite3_malloc(sizeof(regex_t))) == NULL) {
+			sqlite3_result_error_nomem(ctx);
+			return;
+		}
+		if ((retc = regcomp(re, pattern, NOMBRE_REGEX_FLAGS)) != 0) {
+			regerror(retc, re, errbuf, sizeof(errbuf));
+			sqlite3_result_error(ctx, errbuf, -1);
+			sqlite3_free(re);
+			return;
+		}
+		if (dbg) {
+			NOMDBG("Compiled \"%s\" into %p\n", pattern, (void *)re);
+		}
+		fresh = true;
+	}
+	if ((str = (const char *)sqlite3_value_text(argv[1])) == NULL) {
+		sqlite3_result_error_nomem(ctx);
+	} else {
+		sqlite3_result_int(ctx, regexec(re, str, 0, NULL, 0) == 0);
+	}
+	/* Handed over last, SQLite may free it straight away */
+	if (fresh) {
+		sqlite3_set_auxdata(ctx, 0, re, regexfree);
+	}
+}
+
+static void
+regexfree(void *re) {
+	regfree(re);
+	sqlite3_free(re);
+}
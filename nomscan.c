@@ -0,0 +1,478 @@
+/* 
+ * Copyright (c) 2019, Exile Heavy Industries
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted (subject to the limitations in the disclaimer
+ * below) provided that the following conditions are met:
+ * 
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ * 
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * 
+ * * Neither the name of the copyright holder nor the names of its contributors may be used
+ *   to endorse or promote products derived from this software without specific
+ *   prior written permission.
+ * 
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY THIS
+ * LICENSE. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+/*
+ * Parallel substring scan for key searches, see nomscan.h
+ *
+ * The needle is folded to lower case once. Within each 16 byte block of the
+ * (folded) haystack, a match can only start where the byte equals the first
+ * needle byte and the byte nlen - 1 further on equals the last one, so both
+ * are compared a whole block at a time and only the few positions passing
+ * both are compared in full. Folding only touches 'A'..'Z', as LIKE does,
+ * so every other byte, UTF-8 included, has to match exactly.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define NOMBRE_SCAN_X86
+#include <emmintrin.h>
+#endif
+
+#ifndef NOMBRE_H
+#include "nombre.h"
+#endif
+#ifndef NOMBRE_INITDB_H
+#include "initdb.h"
+#endif
+#ifndef NOMBRE_NOMSCAN_H
+#include "nomscan.h"
+#endif
+#ifndef NOMBRE_NOMTRACE_H
+#include "nomtrace.h"
+#endif
+
+extern char *__progname;
+extern bool dbg;
+
+/* One rowid range, and its matches formatted and waiting their turn to be printed */
+struct scanpart {
+	sqlite3_int64 lo, hi;
+	char *buf;
+	size_t len;
+	int64_t rows;
+	int retc;
+	bool done;
+};
+
+/* State shared between the coordinator and the workers */
+struct scanctx {
+	const char *dbname;
+	const char *needle;
+	struct scanpart *parts;
+	size_t nparts;
+	atomic_size_t next; /* Next unclaimed range */
+	pthread_mutex_t lock;
+	pthread_cond_t ready; /* Signalled as workers start, finish a range and exit */
+	unsigned int pending; /* Workers still opening their read transaction */
+	unsigned int running;
+	int retc;
+};
+
+/* The folded needle, cached on the statement between calls */
+struct scanneedle {
+	size_t len;
+	unsigned char str[];
+};
+
+static void *scanworker(void *arg);
+static int scanpart(sqlite3_stmt * restrict stmt, struct scanpart * restrict part, const char * restrict needle);
+static void findfunc(sqlite3_context *ctx, int argc, sqlite3_value **argv);
+#ifdef NOMBRE_SCAN_X86
+static size_t findsse2(const unsigned char * restrict hay, size_t hlen, const unsigned char * restrict needle, size_t nlen, bool * restrict found);
+#endif
+
+static inline unsigned char
+foldc(unsigned char c) {
+	return((c >= 'A' && c <= 'Z') ? c | 0x20 : c);
+}
+
+/* Compare len bytes of hay against the already folded needle */
+static inline bool
+foldeq(const unsigned char * restrict hay, const unsigned char * restrict needle, size_t len) {
+	for (size_t i = 0; i < len; i++) {
+		if (foldc(hay[i]) != needle[i]) {
+			return(false);
+		}
+	}
+	return(true);
+}
+
+/*
+ * Print every definition whose meaning holds the search term, in the same
+ * format and order as the LIKE query run by runcmd()
+ */
+int
+nomdb_scan(nomcmd * restrict cmdbuf) {
+	int retc;
+	int64_t rows;
+	rows = 0;
+
+	if (dbg) {
+		NOMDBG("Entering with cmdbuf = %p\n", (void *)cmdbuf);
+	}
+	if (cmdbuf == NULL || cmdbuf->dbcon == NULL) {
+		NOMERR("%s", "Given invalid input!\n");
+		return(BADARGS);
+	}
+	fprintf(stdout, "Found the following matches:\n");
+	retc = nom_scan(cmdbuf, stdout, &rows);
+	if (dbg) {
+		NOMDBG("Returning %d to caller after %lld matches\n", retc, (long long)rows);
+	}
+	return(retc);
+}
+
+/*
+ * Scan the definitions for cmdbuf->defdata[NOMBRE_DBTERM], writing a line per
+ * match to out and the number of matches to rows. Ranges are written as soon
+ * as they and every range before them are done, so output starts early and
+ * only the ranges finished out of order are ever held in memory.
+ */
+int
+nom_scan(nomcmd * restrict cmdbuf, FILE * restrict out, int64_t * restrict rows) {
+	int retc;
+	long ncpu;
+	bool done;
+	unsigned int nthreads, started;
+	sqlite3_int64 lo, hi;
+	sqlite3_stmt *stmt;
+	pthread_t *threads;
+	struct scanctx ctx;
+	retc = 0; nthreads = 0; started = 0; lo = 0; hi = 0;
+	stmt = NULL; threads = NULL;
+	memset(&ctx, 0, sizeof(ctx));
+
+	if (cmdbuf == NULL || cmdbuf->dbcon == NULL || out == NULL || rows == NULL) {
+		NOMERR("%s", "Given invalid input!\n");
+		return(BADARGS);
+	}
+	*rows = 0;
+	if (sqlite3_threadsafe() == 0) {
+		NOMERR("%s\n", "The SQLite3 library was built without thread support!");
+		return(NOM_FAIL);
+	}
+
+	/* Nothing may commit from here until every worker holds its snapshot */
+	if ((retc = sqlite3_exec(cmdbuf->dbcon, "BEGIN IMMEDIATE;", NULL, NULL, NULL)) != SQLITE_OK) {
+		NOMERR("Unable to lock the database (%s)!\n", sqlite3_errmsg(cmdbuf->dbcon));
+		return(retc);
+	}
+	if ((retc = sqlite3_prepare_v2(cmdbuf->dbcon, NOMBRE_SCAN_BOUNDS, -1, &stmt, NULL)) == SQLITE_OK) {
+		if ((retc = sqlite3_step(stmt)) == SQLITE_ROW && sqlite3_column_type(stmt, 0) != SQLITE_NULL) {
+			lo = sqlite3_column_int64(stmt, 0);
+			hi = sqlite3_column_int64(stmt, 1);
+			ctx.nparts = (size_t)((hi - lo) / NOMBRE_SCAN_SPLIT) + 1;
+		}
+		retc = (retc == SQLITE_ROW) ? SQLITE_OK : retc;
+	}
+	sqlite3_finalize(stmt);
+	if (retc != SQLITE_OK) {
+		NOMERR("Unable to size the definitions (%s)!\n", sqlite3_errmsg(cmdbuf->dbcon));
+	}
+	if (retc != SQLITE_OK || ctx.nparts == 0) {
+		sqlite3_exec(cmdbuf->dbcon, "ROLLBACK;", NULL, NULL, NULL);
+		return(retc);
+	}
+
+	ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	nthreads = (cmdbuf->jobs > 0) ? cmdbuf->jobs : (ncpu > 0) ? (unsigned int)ncpu : 1;
+	nthreads = (nthreads > ctx.nparts) ? (unsigned int)ctx.nparts : nthreads;
+	if ((ctx.parts = calloc(ctx.nparts, sizeof(struct scanpart))) == NULL ||
+			(threads = calloc(nthreads, sizeof(pthread_t))) == NULL) {
+		sqlite3_exec(cmdbuf->dbcon, "ROLLBACK;", NULL, NULL, NULL);
+		retc = NOM_FAIL;
+		goto SCAN_EXIT;
+	}
+	for (size_t i = 0; i < ctx.nparts; i++) {
+		ctx.parts[i].lo = lo + (sqlite3_int64)i * NOMBRE_SCAN_SPLIT;
+		ctx.parts[i].hi = (i + 1 < ctx.nparts) ? ctx.parts[i].lo + NOMBRE_SCAN_SPLIT - 1 : hi;
+		ctx.parts[i].retc = NOM_INCOMPLETE;
+	}
+	ctx.dbname = cmdbuf->filedata[NOMBRE_DBFILE];
+	ctx.needle = cmdbuf->defdata[NOMBRE_DBTERM];
+	atomic_init(&ctx.next, 0);
+	pthread_mutex_init(&ctx.lock, NULL);
+	pthread_cond_init(&ctx.ready, NULL);
+
+	pthread_mutex_lock(&ctx.lock);
+	for (; started < nthreads; started++) {
+		if ((retc = pthread_create(&threads[started], NULL, scanworker, &ctx)) != 0) {
+			NOMERR("Unable to start worker #%u (%s)\n", started, strerror(retc));
+			break;
+		}
+		ctx.pending++;
+		ctx.running++;
+	}
+	while (ctx.pending > 0) {
+		pthread_cond_wait(&ctx.ready, &ctx.lock);
+	}
+	pthread_mutex_unlock(&ctx.lock);
+	/* Nothing was written, the transaction only ever held the lock */
+	sqlite3_exec(cmdbuf->dbcon, "ROLLBACK;", NULL, NULL, NULL);
+
+	retc = (started > 0) ? NOM_OK : NOM_FAIL;
+	for (size_t i = 0; i < ctx.nparts && retc == NOM_OK; i++) {
+		pthread_mutex_lock(&ctx.lock);
+		while (! ctx.parts[i].done && ctx.running > 0) {
+			pthread_cond_wait(&ctx.ready, &ctx.lock);
+		}
+		done = ctx.parts[i].done;
+		pthread_mutex_unlock(&ctx.lock);
+
+		/* A range left unclaimed by failed workers is never done */
+		if (! done || ctx.parts[i].retc != NOM_OK) {
+			NOMERR("Scan of rowids %lld to %lld failed!\n", (long long)ctx.parts[i].lo, (long long)ctx.parts[i].hi);
+			retc = NOM_FAIL;
+		} else if (ctx.parts[i].len > 0 && fwrite(ctx.parts[i].buf, 1, ctx.parts[i].len, out) != ctx.parts[i].len) {
+			NOMERR("Unable to write matches! (%s)\n", strerror(errno));
+			retc = NOM_FIO_FAIL;
+		} else {
+			*rows += ctx.parts[i].rows;
+		}
+		free(ctx.parts[i].buf);
+		ctx.parts[i].buf = NULL;
+	}
+	/* Stop the workers from claiming anything more after a failure */
+	atomic_store(&ctx.next, ctx.nparts);
+
+	for (unsigned int i = 0; i < started; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	pthread_cond_destroy(&ctx.ready);
+	pthread_mutex_destroy(&ctx.lock);
+	retc = (retc == NOM_OK) ? ctx.retc : retc;
+	if (dbg) {
+		NOMDBG("Scanned %zu ranges of rowids %lld to %lld on %u threads\n", ctx.nparts, (long long)lo, (long long)hi, started);
+	}
+
+SCAN_EXIT:
+	if (ctx.parts != NULL) {
+		for (size_t i = 0; i < ctx.nparts; i++) {
+			free(ctx.parts[i].buf);
+		}
+	}
+	free(ctx.parts);
+	free(threads);
+	return(retc);
+}
+
+/*
+ * Substring test of hay against a needle already folded to lower case,
+ * ignoring the case of ASCII letters in hay
+ */
+bool
+nom_scanfind(const unsigned char * restrict hay, size_t hlen, const unsigned char * restrict needle, size_t nlen) {
+	size_t i, last;
+	i = 0;
+
+	if (nlen == 0) {
+		return(true);
+	} else if (nlen > hlen) {
+		return(false);
+	}
+	last = hlen - nlen; /* The last offset a match can start at */
+#ifdef NOMBRE_SCAN_X86
+	bool found;
+	if ((i = findsse2(hay, hlen, needle, nlen, &found)) > last || found) {
+		return(found);
+	}
+#endif
+	for (; i <= last; i++) {
+		if (foldc(hay[i]) == needle[0] && foldeq(hay + i + 1, needle + 1, nlen - 1)) {
+			return(true);
+		}
+	}
+	return(false);
+}
+
+/*
+ * Register nomfind(haystack, needle) on a connection. Like LIKE, it is NULL
+ * when either argument is.
+ */
+int
+nom_scanreg(sqlite3 * restrict db) {
+	return(sqlite3_create_function_v2(db, NOMBRE_SCAN_FUNC, 2, SQLITE_UTF8|SQLITE_DETERMINISTIC|SQLITE_INNOCUOUS,
+				NULL, findfunc, NULL, NULL, NULL));
+}
+
+/*
+ * Open a read-only connection, pin the snapshot and let the coordinator know,
+ * then keep claiming ranges until there are none left.
+ */
+static void *
+scanworker(void *arg) {
+	int retc;
+	size_t i;
+	sqlite3 *db;
+	sqlite3_stmt *stmt;
+	struct scanctx *ctx;
+	ctx = arg;
+	db = NULL; stmt = NULL;
+
+	/* The read transaction only starts once something is actually read */
+	if ((retc = nom_dbconn_ro(ctx->dbname, &db)) == SQLITE_OK && (retc = nom_scanreg(db)) == SQLITE_OK &&
+			(retc = sqlite3_exec(db, "BEGIN; SELECT 1 FROM definitions LIMIT 1;", NULL, NULL, NULL)) == SQLITE_OK) {
+		retc = sqlite3_prepare_v2(db, NOMBRE_SCAN_PART, -1, &stmt, NULL);
+	}
+	pthread_mutex_lock(&ctx->lock);
+	if (retc != SQLITE_OK) {
+		NOMERR("Worker failed to start (%s)!\n", (db != NULL) ? sqlite3_errmsg(db) : sqlite3_errstr(retc));
+		ctx->retc = NOM_FAIL;
+	}
+	ctx->pending--;
+	pthread_cond_signal(&ctx->ready);
+	pthread_mutex_unlock(&ctx->lock);
+
+	while (retc == SQLITE_OK && (i = atomic_fetch_add(&ctx->next, 1)) < ctx->nparts) {
+		retc = scanpart(stmt, &ctx->parts[i], ctx->needle);
+		NOMTRACE("range/matches", ctx->parts[i].lo, ctx->parts[i].rows);
+		pthread_mutex_lock(&ctx->lock);
+		ctx->parts[i].retc = retc;
+		ctx->parts[i].done = true;
+		pthread_cond_signal(&ctx->ready);
+		pthread_mutex_unlock(&ctx->lock);
+	}
+
+	sqlite3_finalize(stmt);
+	if (db != NULL) {
+		sqlite3_exec(db, "COMMIT;", NULL, NULL, NULL);
+		sqlite3_close_v2(db);
+	}
+	pthread_mutex_lock(&ctx->lock);
+	ctx->running--;
+	pthread_cond_signal(&ctx->ready);
+	pthread_mutex_unlock(&ctx->lock);
+	return(NULL);
+}
+
+/* Format the matches in one range into its buffer */
+static int
+scanpart(sqlite3_stmt * restrict stmt, struct scanpart * restrict part, const char * restrict needle) {
+	int retc;
+	FILE *mem;
+
+	if ((mem = open_memstream(&part->buf, &part->len)) == NULL) {
+		NOMERR("Unable to buffer matches! (%s)\n", strerror(errno));
+		return(NOM_FAIL);
+	}
+	if ((retc = sqlite3_bind_int64(stmt, 1, part->lo)) == SQLITE_OK && (retc = sqlite3_bind_int64(stmt, 2, part->hi)) == SQLITE_OK &&
+			(retc = sqlite3_bind_text(stmt, 3, needle, -1, SQLITE_STATIC)) == SQLITE_OK) {
+		while ((retc = sqlite3_step(stmt)) == SQLITE_ROW) {
+			fprintf(mem, "  %s: %s\n", sqlite3_column_text(stmt, 0), sqlite3_column_text(stmt, 1));
+			part->rows++;
+		}
+		retc = (retc == SQLITE_DONE) ? SQLITE_OK : retc;
+	}
+	if (retc != SQLITE_OK) {
+		NOMERR("Error scanning definitions (%s)!\n", sqlite3_errstr(retc));
+	}
+	sqlite3_reset(stmt);
+	if (fclose(mem) != 0 && retc == SQLITE_OK) {
+		NOMERR("Unable to buffer matches! (%s)\n", strerror(errno));
+		retc = NOM_FAIL;
+	}
+	return((retc == SQLITE_OK) ? NOM_OK : NOM_FAIL);
+}
+
+/* nomfind(haystack, needle), the needle is folded once and kept for the rest of the statement */
+static void
+findfunc(sqlite3_context *ctx, int argc, sqlite3_value **argv) {
+	const unsigned char *hay, *str;
+	struct scanneedle *needle;
+	bool fresh;
+	(void)argc;
+	fresh = false;
+
+	if (sqlite3_value_type(argv[0]) == SQLITE_NULL || sqlite3_value_type(argv[1]) == SQLITE_NULL) {
+		sqlite3_result_null(ctx);
+		return;
+	}
+	if ((needle = sqlite3_get_auxdata(ctx, 1)) == NULL) {
+		if ((str = sqlite3_value_text(argv[1])) == NULL ||
+				(needle = sqlite3_malloc64(sizeof(struct scanneedle) + (sqlite3_uint64)sqlite3_value_bytes(argv[1]))) == NULL) {
+			sqlite3_result_error_nomem(ctx);
+			return;
+		}
+		needle->len = (size_t)sqlite3_value_bytes(argv[1]);
+		for (size_t i = 0; i < needle->len; i++) {
+			needle->str[i] = foldc(str[i]);
+		}
+		fresh = true;
+	}
+	if ((hay = sqlite3_value_text(argv[0])) == NULL) {
+		sqlite3_result_error_nomem(ctx);
+	} else {
+		sqlite3_result_int(ctx, nom_scanfind(hay, (size_t)sqlite3_value_bytes(argv[0]), needle->str, needle->len));
+	}
+	/* Handed over last, SQLite may free it straight away */
+	if (fresh) {
+		sqlite3_set_auxdata(ctx, 1, needle, sqlite3_free);
+	}
+}
+
+#ifdef NOMBRE_SCAN_X86
+/*
+ * Test 16 starting offsets at a time, folding both blocks the same way
+ * nomnorm.c upper-cases: 'A'..'Z' are shifted down to the bottom of the
+ * signed range so a single compare finds them. Returns the first offset left
+ * for the caller, or stops early with *found set.
+ */
+static size_t
+findsse2(const unsigned char * restrict hay, size_t hlen, const unsigned char * restrict needle, size_t nlen, bool * restrict found) {
+	size_t i;
+	unsigned int mask, bit;
+	__m128i head, tail;
+	const __m128i shift = _mm_set1_epi8((char)(0x80 - 'A'));
+	const __m128i range = _mm_set1_epi8((char)(0x80 + 26));
+	const __m128i flip = _mm_set1_epi8(0x20);
+	const __m128i first = _mm_set1_epi8((char)needle[0]);
+	const __m128i last = _mm_set1_epi8((char)needle[nlen - 1]);
+	*found = false;
+
+	for (i = 0; i + nlen - 1 + 16 <= hlen; i += 16) {
+		head = _mm_loadu_si128((const __m128i *)(hay + i));
+		tail = _mm_loadu_si128((const __m128i *)(hay + i + nlen - 1));
+		head = _mm_or_si128(head, _mm_and_si128(_mm_cmplt_epi8(_mm_add_epi8(head, shift), range), flip));
+		tail = _mm_or_si128(tail, _mm_and_si128(_mm_cmplt_epi8(_mm_add_epi8(tail, shift), range), flip));
+		mask = (unsigned int)_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(head, first), _mm_cmpeq_epi8(tail, last)));
+		for (; mask != 0; mask &= mask - 1) {
+			bit = (unsigned int)__builtin_ctz(mask);
+			/* The first and last bytes already match */
+			if (nlen < 3 || foldeq(hay + i + bit + 1, needle + 1, nlen - 2)) {
+				*found = true;
+				return(i + bit);
+			}
+		}
+	}
+	return(i);
+}
+#endif /* NOMBRE_SCAN_X86 */
@@ -0,0 +1,69 @@
+/* 
+ * Copyright (c) 2019, Exile Heavy Industries
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted (subject to the limitations in the disclaimer
+ * below) provided that the following conditions are met:
+ * 
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ * 
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * 
+ * * Neither the name of the copyright holder nor the names of its contributors may be used
+ *   to endorse or promote products derived from this software without specific
+ *   prior written permission.
+ * 
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY THIS
+ * LICENSE. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#define NOMBRE_NOMSCAN_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#ifndef NOMBRE_H
+#include "nombre.h"
+#endif
+
+/*
+ * A plain key search is a LIKE '%term%' over every definition, which no
+ * index can help with. Rather than carry a full text index, the definitions
+ * are split into rowid ranges that worker threads scan on their own read
+ * connections, matching with nomfind(meaning, term): an ASCII
+ * case-insensitive substring test, the same comparison LIKE makes, with a
+ * vectorized search for candidate positions. The ranges are printed back in
+ * rowid order, so the output is exactly that of the single LIKE scan.
+ *
+ * Terms holding a LIKE wildcard, and searches within a group (which have
+ * defcat_idx to narrow them), still go through the LIKE query.
+ */
+
+/* Name of the SQL function registered by nom_scanreg() */
+#define NOMBRE_SCAN_FUNC "nomfind"
+/* Rowids per range, small enough that the ranges spread evenly over the workers */
+#define NOMBRE_SCAN_SPLIT 32768
+
+/* Each on its own, as SQLite only reads min() or max() straight off the b-tree when it is alone */
+#define NOMBRE_SCAN_BOUNDS "SELECT (SELECT min(rowid) FROM definitions), (SELECT max(rowid) FROM definitions);"
+#define NOMBRE_SCAN_PART "SELECT term, meaning FROM definitions WHERE rowid BETWEEN ?1 AND ?2 AND " NOMBRE_SCAN_FUNC "(meaning, ?3);"
+
+int nomdb_scan(nomcmd * restrict cmdbuf);
+int nom_scan(nomcmd * restrict cmdbuf, FILE * restrict out, int64_t * restrict rows);
+bool nom_scanfind(const unsigned char * restrict hay, size_t hlen, const unsigned char * restrict needle, size_t nlen);
+int nom_scanreg(sqlite3 * restrict db);
@@ -0,0 +1,171 @@
+/* 
+ * Copyright (c) 2019, Exile Heavy Industries
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted (subject to the limitations in the disclaimer
+ * below) provided that the following conditions are met:
+ * 
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ * 
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * 
+ * * Neither the name of the copyright holder nor the names of its contributors may be used
+ *   to endorse or promote products derived from this software without specific
+ *   prior written permission.
+ * 
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY THIS
+ * LICENSE. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+/*
+ * Per-category summaries, see nomstats.h
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef NOMBRE_H
+#include "nombre.h"
+#endif
+#ifndef NOMBRE_NOMSTATS_H
+#include "nomstats.h"
+#endif
+
+extern char *__progname;
+extern bool dbg;
+
+/* List the counts of every category, recounting them first for --rebuild */
+int
+nomdb_sum(nomcmd * restrict cmdbuf) {
+	int retc;
+	sqlite3_stmt *stmt;
+	retc = SQLITE_OK;
+	stmt = NULL;
+
+	if (dbg) {
+		NOMDBG("Entering with cmdbuf = %p, sumop = %u\n", (void *)cmdbuf, (cmdbuf != NULL) ? cmdbuf->sumop : 0);
+	}
+	if (cmdbuf == NULL || cmdbuf->dbcon == NULL) {
+		NOMERR("%s", "Given invalid input!\n");
+		return(BADARGS);
+	}
+	if (cmdbuf->sumop == NOMBRE_SUM_REBUILD) {
+		if ((retc = sqlite3_exec(cmdbuf->dbcon, "BEGIN IMMEDIATE;" NOMBRE_SUM_ZERO NOMBRE_SUM_TERMS("NULL") NOMBRE_SUM_ALTS("NULL") "COMMIT;",
+						NULL, NULL, NULL)) != SQLITE_OK) {
+			NOMERR("Error recounting categories (%s)!\n", sqlite3_errmsg(cmdbuf->dbcon));
+			sqlite3_exec(cmdbuf->dbcon, "ROLLBACK;", NULL, NULL, NULL);
+			return(retc);
+		}
+	}
+
+	if ((retc = sqlite3_prepare_v2(cmdbuf->dbcon, NOMBRE_SUM_LIST, -1, &stmt, NULL)) != SQLITE_OK) {
+		NOMERR("Error compiling SQL (%s)!\n", sqlite3_errmsg(cmdbuf->dbcon));
+		return(retc);
+	}
+	fprintf(stdout, "Terms per category:\n  %8s  %8s  %-19s  %s\n", "TERMS", "ALTS", "LAST CHANGED", "CATEGORY");
+	while ((retc = sqlite3_step(stmt)) == SQLITE_ROW) {
+		fprintf(stdout, "  %8lld  %8lld  %-19s  %s\n", (long long)sqlite3_column_int64(stmt, 1), (long long)sqlite3_column_int64(stmt, 2),
+				sqlite3_column_text(stmt, 3), sqlite3_column_text(stmt, 0));
+	}
+	if (retc != SQLITE_DONE) {
+		NOMERR("Error processing command! (%s)\n", sqlite3_errmsg(cmdbuf->dbcon));
+	} else {
+		retc = NOM_OK;
+	}
+	sqlite3_finalize(stmt);
+	if (dbg) {
+		NOMDBG("Returning %d to caller\n", retc);
+	}
+	return(retc);
+}
+
+/*
+ * Hold the insert triggers off for the rest of the open transaction, a
+ * rollback lets them go by itself. Only rows change, so the schema and
+ * every other connection's statements are left alone.
+ */
+int
+nom_sumhold(sqlite3 * restrict db) {
+	int retc;
+
+	if ((retc = sqlite3_exec(db, NOMBRE_SUM_HOLD, NULL, NULL, NULL)) != SQLITE_OK) {
+		NOMERR("Unable to hold category counts (%s)!\n", sqlite3_errmsg(db));
+	}
+	return(retc);
+}
+
+/* Tally one term, or alternate, added to catid while held */
+int
+nom_sumcount(struct nomsums * restrict sums, int64_t catid, bool alt) {
+	size_t i;
+	struct nomsum *grown;
+
+	if (sums->n == 0 || sums->cats[sums->last].catid != catid) {
+		for (i = 0; i < sums->n && sums->cats[i].catid != catid; i++) {
+			continue;
+		}
+		if (i == sums->n) {
+			if (sums->n == sums->cap) {
+				if ((grown = realloc(sums->cats, (sums->cap + 8) * sizeof(*grown))) == NULL) {
+					return(SQLITE_NOMEM);
+				}
+				sums->cats = grown;
+				sums->cap += 8;
+			}
+			sums->cats[i].catid = catid;
+			sums->cats[i].terms = 0;
+			sums->cats[i].alts = 0;
+			sums->n++;
+		}
+		sums->last = i;
+	}
+	*((alt) ? &sums->cats[sums->last].alts : &sums->cats[sums->last].terms) += 1;
+	return(SQLITE_OK);
+}
+
+/* Add the tallies to the counts and let the triggers go again, freeing the tallies either way */
+int
+nom_sumrelease(sqlite3 * restrict db, struct nomsums * restrict sums) {
+	int retc;
+	sqlite3_stmt *stmt;
+	stmt = NULL;
+
+	if ((retc = sqlite3_prepare_v2(db, NOMBRE_SUM_ADD, -1, &stmt, NULL)) == SQLITE_OK) {
+		for (size_t i = 0; i < sums->n && retc == SQLITE_OK; i++) {
+			if ((retc = sqlite3_bind_int64(stmt, sqlite3_bind_parameter_index(stmt, ":catid"), sums->cats[i].catid)) == SQLITE_OK &&
+					(retc = sqlite3_bind_int64(stmt, sqlite3_bind_parameter_index(stmt, ":terms"), sums->cats[i].terms)) == SQLITE_OK &&
+					(retc = sqlite3_bind_int64(stmt, sqlite3_bind_parameter_index(stmt, ":alts"), sums->cats[i].alts)) == SQLITE_OK &&
+					(retc = sqlite3_step(stmt)) == SQLITE_DONE) {
+				retc = SQLITE_OK;
+			}
+			sqlite3_reset(stmt);
+		}
+	}
+	sqlite3_finalize(stmt);
+	if (retc == SQLITE_OK) {
+		retc = sqlite3_exec(db, NOMBRE_SUM_UNHOLD, NULL, NULL, NULL);
+	}
+	if (retc != SQLITE_OK) {
+		NOMERR("Unable to update category counts (%s)!\n", sqlite3_errmsg(db));
+	}
+	free(sums->cats);
+	memset(sums, 0, sizeof(*sums));
+	return(retc);
+}
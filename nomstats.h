@@ -0,0 +1,92 @@
+/* 
+ * Copyright (c) 2019, Exile Heavy Industries
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted (subject to the limitations in the disclaimer
+ * below) provided that the following conditions are met:
+ * 
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ * 
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * 
+ * * Neither the name of the copyright holder nor the names of its contributors may be used
+ *   to endorse or promote products derived from this software without specific
+ *   prior written permission.
+ * 
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY THIS
+ * LICENSE. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#define NOMBRE_NOMSTATS_H
+
+#include <stdbool.h>
+
+#ifndef NOMBRE_H
+#include "nombre.h"
+#endif
+
+/*
+ * Term and alternate counts per category, kept in category_stats by the
+ * *_sum_* triggers on definitions and altdefs, so a summary reads one row
+ * per category however many terms there are. --rebuild recounts them from
+ * the tables themselves, for databases that were changed with the triggers
+ * missing, and keeps the last modified times it already has.
+ *
+ * A trigger per row roughly doubles the cost of a bulk insert, so imports
+ * hold the insert triggers off for their transaction with nom_sumhold(),
+ * which puts a row in category_stats_hold that nothing outside the
+ * transaction ever sees. They tally what they add per category with
+ * nom_sumcount() and nom_sumrelease() applies it, one upsert per category,
+ * before committing.
+ */
+#define NOMBRE_SUM_REPORT 0x00
+#define NOMBRE_SUM_REBUILD 0x01
+#define NOMBRE_SUM_NOW "CAST(strftime('%s', 'now') AS INTEGER)"
+
+#define NOMBRE_SUM_LIST "SELECT c.name, COALESCE(s.terms, 0), COALESCE(s.alts, 0), COALESCE(datetime(s.modified, 'unixepoch'), '-')" \
+	" FROM categories AS c LEFT JOIN category_stats AS s ON s.category = c.id ORDER BY c.id;"
+#define NOMBRE_SUM_ZERO "UPDATE category_stats SET terms = 0, alts = 0;"
+/* Only counts that changed are written, stamped with m (NULL keeps the old time), also run by the upgrade in initdb.c */
+#define NOMBRE_SUM_TERMS(m) "INSERT INTO category_stats (category, terms, modified) SELECT category, count(*), " m \
+	" FROM definitions WHERE true GROUP BY category" \
+	" ON CONFLICT (category) DO UPDATE SET terms = excluded.terms, modified = COALESCE(excluded.modified, modified) WHERE terms IS NOT excluded.terms;"
+#define NOMBRE_SUM_ALTS(m) "INSERT INTO category_stats (category, alts, modified) SELECT category, count(*), " m \
+	" FROM altdefs WHERE true GROUP BY category" \
+	" ON CONFLICT (category) DO UPDATE SET alts = excluded.alts, modified = COALESCE(excluded.modified, modified) WHERE alts IS NOT excluded.alts;"
+#define NOMBRE_SUM_HOLD "INSERT OR IGNORE INTO category_stats_hold VALUES (0);"
+#define NOMBRE_SUM_UNHOLD "DELETE FROM category_stats_hold;"
+#define NOMBRE_SUM_ADD "INSERT INTO category_stats (category, terms, alts, modified) VALUES (:catid, :terms, :alts, " NOMBRE_SUM_NOW ")" \
+	" ON CONFLICT (category) DO UPDATE SET terms = terms + excluded.terms, alts = alts + excluded.alts, modified = excluded.modified;"
+
+/* What a held transaction added to one category */
+struct nomsum {
+	int64_t catid;
+	int64_t terms;
+	int64_t alts;
+};
+
+/* The tally for every category, a handful at most, so it is searched in order */
+struct nomsums {
+	struct nomsum *cats;
+	size_t n, cap;
+	size_t last; /* Records mostly come in runs of one category */
+};
+
+int nomdb_sum(nomcmd * restrict cmdbuf);
+int nom_sumhold(sqlite3 * restrict db);
+int nom_sumcount(struct nomsums * restrict sums, int64_t catid, bool alt);
+int nom_sumrelease(sqlite3 * restrict db, struct nomsums * restrict sums);
@@ -0,0 +1,675 @@
+/* 
+ * Copyright (c) 2019, Exile Heavy Industries
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted (subject to the limitations in the disclaimer
+ * below) provided that the following conditions are met:
+ * 
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ * 
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * 
+ * * Neither the name of the copyright holder nor the names of its contributors may be used
+ *   to endorse or promote products derived from this software without specific
+ *   prior written permission.
+ * 
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY THIS
+ * LICENSE. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+/*
+ * Multi-category tags and the roaring bitmaps behind grp tag, see nomtags.h
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef NOMBRE_H
+#include "nombre.h"
+#endif
+#ifndef NOMBRE_NOMTAGS_H
+#include "nomtags.h"
+#endif
+#ifndef NOMBRE_CATMAP_H
+#include "catmap.h"
+#endif
+#ifndef NOMBRE_NOMTRACE_H
+#include "nomtrace.h"
+#endif
+
+#define TAG_AND 0x00
+#define TAG_OR 0x01
+#define TAG_ANDNOT 0x02
+
+extern char *__progname;
+extern bool dbg;
+
+/* One container, vals while it is an array and bits once it is a bitmap */
+struct tagbox {
+	int64_t key; /* rowid >> NOMBRE_TAG_CHUNK */
+	uint32_t card;
+	uint16_t *vals;
+	uint64_t *bits;
+};
+
+/* Containers in key order */
+struct tagset {
+	size_t n;
+	size_t cap;
+	struct tagbox *box;
+};
+
+/* A category named in a query, groups are the comma separated names of one argument */
+struct tagterm {
+	int64_t id;
+	bool neg;
+	bool group; /* First name of its argument */
+};
+
+static int tagparse(nomcmd * restrict cmdbuf, const char ** restrict args, struct tagterm ** restrict terms, size_t * restrict nterms);
+static int tagfresh(sqlite3 * restrict db, const struct tagterm * restrict terms, size_t nterms);
+static int tagbuild(sqlite3 * restrict db, int64_t catid);
+static int tagflush(sqlite3_stmt * restrict store, int64_t catid, int64_t key, const uint64_t * restrict words);
+static int tagload(sqlite3 * restrict db, int64_t catid, struct tagset * restrict set);
+static int tagput(struct tagset * restrict set, int64_t key, const uint64_t * restrict words, const uint16_t * restrict vals, uint32_t card);
+static void tagwords(const struct tagbox * restrict box, uint64_t * restrict words);
+static int tagop(struct tagset * restrict a, const struct tagset * restrict b, int op);
+static int tagemit(sqlite3 * restrict db, const struct tagset * restrict set, int64_t limit, int64_t * restrict rows);
+static int tagrow(sqlite3_stmt * restrict stmt, int64_t rowid, int64_t * restrict rows);
+static void tagfree(struct tagset * restrict set);
+
+/*
+ * tag TERM [CATEGORY | -CATEGORY]...
+ * Add the term to each named category and drop it from each one prefixed
+ * with '-', then show every category it now belongs to. The term's own
+ * category can't be dropped this way, upd moves it.
+ */
+int
+nomdb_tag(nomcmd * restrict cmdbuf, const char ** restrict args) {
+	int retc, drop;
+	int64_t primary, id, termid;
+	const char *name;
+	sqlite3_stmt *stmt[3];
+	retc = NOM_OK; drop = 0; primary = id = termid = 0;
+	memset(stmt, 0, sizeof(stmt));
+
+	if (dbg) {
+		NOMDBG("Entering with cmdbuf = %p, args = %p\n", (void *)cmdbuf, (const void *)args);
+	}
+	if (cmdbuf == NULL || cmdbuf->dbcon == NULL || args == NULL || *args == NULL) {
+		NOMERR("%s\n", "Expected a term and the categories to tag it with!");
+		return(BADARGS);
+	}
+	if ((retc = sqlite3_prepare_v2(cmdbuf->dbcon, NOMBRE_TAG_TERM, -1, &stmt[0], NULL)) != SQLITE_OK ||
+			(retc = sqlite3_bind_text(stmt[0], 1, *args, -1, SQLITE_STATIC)) != SQLITE_OK) {
+		NOMERR("Error preparing tag lookup (%s)!\n", sqlite3_errmsg(cmdbuf->dbcon));
+		goto TAG_EXIT;
+	}
+	if ((retc = sqlite3_step(stmt[0])) != SQLITE_ROW) {
+		if (retc == SQLITE_DONE) {
+			NOMERR("No definition for %s to tag!\n", *args);
+			retc = NOM_INVALID;
+		} else {
+			NOMERR("Error looking up %s (%s)!\n", *args, sqlite3_errmsg(cmdbuf->dbcon));
+		}
+		goto TAG_EXIT;
+	}
+	/* The stored spelling for messages, the statements below go by the id */
+	memccpy(cmdbuf->defdata[NOMBRE_DBTERM], sqlite3_column_text(stmt[0], 0), 0, (size_t)DEFLEN);
+	cmdbuf->defdata[NOMBRE_DBTERM][DEFLEN - 1] = 0;
+	primary = sqlite3_column_int64(stmt[0], 1);
+	termid = sqlite3_column_int64(stmt[0], 2);
+	retc = SQLITE_OK;
+
+	if (*++args != NULL) {
+		if ((retc = sqlite3_prepare_v2(cmdbuf->dbcon, NOMBRE_TAG_ADD, -1, &stmt[1], NULL)) != SQLITE_OK ||
+				(retc = sqlite3_prepare_v2(cmdbuf->dbcon, NOMBRE_TAG_DEL, -1, &stmt[2], NULL)) != SQLITE_OK ||
+				(retc = sqlite3_exec(cmdbuf->dbcon, "BEGIN IMMEDIATE;", NULL, NULL, NULL)) != SQLITE_OK) {
+			NOMERR("Error preparing tag changes (%s)!\n", sqlite3_errmsg(cmdbuf->dbcon));
+			goto TAG_EXIT;
+		}
+		for (; *args != NULL && retc == SQLITE_OK; args++) {
+			drop = (**args == '-');
+			name = (drop) ? *args + 1 : *args;
+			if ((retc = nom_catid(cmdbuf, name, &id)) != NOM_OK) {
+				NOMERR("Unknown category \"%s\"!\n", name);
+				break;
+			}
+			if (id == primary) {
+				if (drop) {
+					NOMERR("%s is %s's own category, use upd to move it instead!\n", name, cmdbuf->defdata[NOMBRE_DBTERM]);
+					retc = NOM_INVALID;
+				}
+				continue;
+			}
+			sqlite3_bind_int64(stmt[1 + drop], 1, termid);
+			sqlite3_bind_int64(stmt[1 + drop], 2, id);
+			if ((retc = sqlite3_step(stmt[1 + drop])) == SQLITE_DONE) {
+				retc = SQLITE_OK;
+			} else {
+				NOMERR("Error tagging %s with %s (%s)!\n", cmdbuf->defdata[NOMBRE_DBTERM], name, sqlite3_errmsg(cmdbuf->dbcon));
+			}
+			sqlite3_reset(stmt[1 + drop]);
+		}
+		if (retc == SQLITE_OK && (retc = sqlite3_exec(cmdbuf->dbcon, "COMMIT;", NULL, NULL, NULL)) == SQLITE_OK) {
+			sqlite3_finalize(stmt[1]); stmt[1] = NULL;
+		} else {
+			sqlite3_exec(cmdbuf->dbcon, "ROLLBACK;", NULL, NULL, NULL);
+			goto TAG_EXIT;
+		}
+	}
+
+	/* Every category the term is in now, its own first */
+	if ((retc = sqlite3_prepare_v2(cmdbuf->dbcon, NOMBRE_TAG_LIST, -1, &stmt[1], NULL)) != SQLITE_OK) {
+		NOMERR("Error listing tags (%s)!\n", sqlite3_errmsg(cmdbuf->dbcon));
+		goto TAG_EXIT;
+	}
+	sqlite3_bind_int64(stmt[1], 1, termid);
+	sqlite3_bind_int64(stmt[1], 2, primary);
+	fprintf(stdout, "%s:", cmdbuf->defdata[NOMBRE_DBTERM]);
+	for (retc = sqlite3_step(stmt[1]); retc == SQLITE_ROW; retc = sqlite3_step(stmt[1])) {
+		fprintf(stdout, " %s", sqlite3_column_text(stmt[1], 0));
+	}
+	fprintf(stdout, "\n");
+	if (retc == SQLITE_DONE) {
+		retc = NOM_OK;
+	} else {
+		NOMERR("Error listing tags (%s)!\n", sqlite3_errmsg(cmdbuf->dbcon));
+	}
+
+TAG_EXIT:
+	for (size_t i = 0; i < (sizeof(stmt) / sizeof(stmt[0])); i++) {
+		sqlite3_finalize(stmt[i]);
+	}
+	if (dbg) {
+		NOMDBG("Returning %d to caller\n", retc);
+	}
+	return(retc);
+}
+
+/*
+ * grp tag CATEGORY[,CATEGORY]... [-CATEGORY[,CATEGORY]...]...
+ * Terms in every plain argument and none of the '-' ones, where the names
+ * in one argument are alternatives. NET,APPS SEC -DEVEL is (NET or APPS)
+ * and SEC but not DEVEL. Terms are listed in the order they were added.
+ */
+int
+nomdb_tagquery(nomcmd * restrict cmdbuf, const char ** restrict args) {
+	int retc;
+	size_t nterms;
+	int64_t rows;
+	bool first;
+	struct tagterm *terms;
+	struct tagset result, group, excl, one;
+	retc = NOM_OK; nterms = 0; rows = 0; first = true;
+	terms = NULL;
+	memset(&result, 0, sizeof(result)); memset(&group, 0, sizeof(group));
+	memset(&excl, 0, sizeof(excl)); memset(&one, 0, sizeof(one));
+
+	if (dbg) {
+		NOMDBG("Entering with cmdbuf = %p, args = %p\n", (void *)cmdbuf, (const void *)args);
+	}
+	if (cmdbuf == NULL || cmdbuf->dbcon == NULL || args == NULL) {
+		NOMERR("%s", "Given invalid input!\n");
+		return(BADARGS);
+	}
+	if ((retc = tagparse(cmdbuf, args, &terms, &nterms)) != NOM_OK || (retc = tagfresh(cmdbuf->dbcon, terms, nterms)) != NOM_OK) {
+		free(terms);
+		return(retc);
+	}
+
+	/* Each argument ORs its names into group, which is then folded into result or excl */
+	for (size_t i = 0; i < nterms && retc == NOM_OK; i++) {
+		if ((retc = tagload(cmdbuf->dbcon, terms[i].id, &one)) != NOM_OK || (retc = tagop(&group, &one, TAG_OR)) != NOM_OK) {
+			break;
+		}
+		tagfree(&one);
+		if (i + 1 < nterms && ! terms[i + 1].group) {
+			continue;
+		}
+		if (terms[i].neg) {
+			retc = tagop(&excl, &group, TAG_OR);
+		} else if (first) {
+			retc = tagop(&result, &group, TAG_OR);
+			first = false;
+		} else {
+			retc = tagop(&result, &group, TAG_AND);
+		}
+		tagfree(&group);
+	}
+	if (retc == NOM_OK && (retc = tagop(&result, &excl, TAG_ANDNOT)) == NOM_OK) {
+		fprintf(stdout, "Found the following matches:\n");
+		retc = tagemit(cmdbuf->dbcon, &result, cmdbuf->limit, &rows);
+	}
+	sqlite3_exec(cmdbuf->dbcon, "COMMIT;", NULL, NULL, NULL);
+
+	tagfree(&one); tagfree(&group); tagfree(&excl); tagfree(&result);
+	free(terms);
+	if (dbg) {
+		NOMDBG("Returning %d to caller after %lld rows\n", retc, (long long)rows);
+	}
+	return(retc);
+}
+
+/* Resolve every name, at least one argument has to be a plain one */
+static int
+tagparse(nomcmd * restrict cmdbuf, const char ** restrict args, struct tagterm ** restrict terms, size_t * restrict nterms) {
+	size_t count;
+	bool pos;
+	char name[DEFLEN], *next, *cur;
+	count = 0; pos = false;
+
+	for (const char **arg = args; *arg != NULL; arg++) {
+		count++;
+		for (const char *c = *arg; (c = strchr(c, ',')) != NULL; c++) {
+			count++;
+		}
+	}
+	if (count == 0 || (*terms = calloc(count, sizeof(**terms))) == NULL) {
+		NOMERR("%s\n", (count == 0) ? "Expected at least one category to list!" : "Unable to allocate memory!");
+		return((count == 0) ? BADARGS : NOM_FAIL);
+	}
+	for (*nterms = 0; *args != NULL; args++) {
+		memccpy(name, (**args == '-') ? *args + 1 : *args, 0, sizeof(name));
+		name[DEFLEN - 1] = 0;
+		pos = pos || (**args != '-');
+		for (cur = name; cur != NULL; cur = next) {
+			if ((next = strchr(cur, ',')) != NULL) {
+				*next++ = 0;
+			}
+			if (nom_catid(cmdbuf, cur, &(*terms)[*nterms].id) != NOM_OK) {
+				NOMERR("Unknown category \"%s\"!\n", cur);
+				return(NOM_INVALID);
+			}
+			(*terms)[*nterms].neg = (**args == '-');
+			(*terms)[*nterms].group = (cur == name);
+			(*nterms)++;
+		}
+	}
+	if (! pos) {
+		NOMERR("%s\n", "Expected at least one category the terms are in!");
+		return(BADARGS);
+	}
+	return(NOM_OK);
+}
+
+/*
+ * Open the transaction the query reads in. Normally that is a plain read,
+ * but if any category it names is stale the bitmaps are rebuilt first under
+ * a write lock, which the query then keeps until it is done.
+ */
+static int
+tagfresh(sqlite3 * restrict db, const struct tagterm * restrict terms, size_t nterms) {
+	int retc;
+	bool stale;
+	sqlite3_stmt *stmt;
+	stale = false; stmt = NULL;
+
+	if ((retc = sqlite3_exec(db, "BEGIN;", NULL, NULL, NULL)) != SQLITE_OK ||
+			(retc = sqlite3_prepare_v2(db, NOMBRE_TAG_ISSTALE, -1, &stmt, NULL)) != SQLITE_OK) {
+		NOMERR("Error reading tag bitmaps (%s)!\n", sqlite3_errmsg(db));
+		goto FRESH_EXIT;
+	}
+	for (int pass = 0; pass < 2 && retc == SQLITE_OK; pass++) {
+		for (size_t i = 0; i < nterms && retc == SQLITE_OK; i++) {
+			sqlite3_bind_int64(stmt, 1, terms[i].id);
+			if ((retc = sqlite3_step(stmt)) == SQLITE_ROW) {
+				stale = true;
+				retc = (pass == 0) ? SQLITE_OK : tagbuild(db, terms[i].id);
+			} else if (retc == SQLITE_DONE) {
+				retc = SQLITE_OK;
+			}
+			sqlite3_reset(stmt);
+			/* Found one, so start over holding the write lock */
+			if (pass == 0 && stale) {
+				sqlite3_exec(db, "ROLLBACK;", NULL, NULL, NULL);
+				retc = sqlite3_exec(db, "BEGIN IMMEDIATE;", NULL, NULL, NULL);
+				break;
+			}
+		}
+		if (! stale) {
+			break;
+		}
+	}
+	if (retc != SQLITE_OK) {
+		NOMERR("Error refreshing tag bitmaps (%s)!\n", sqlite3_errmsg(db));
+		sqlite3_exec(db, "ROLLBACK;", NULL, NULL, NULL);
+	}
+
+FRESH_EXIT:
+	sqlite3_finalize(stmt);
+	return((retc == SQLITE_OK) ? NOM_OK : NOM_FAIL);
+}
+
+/* Replace a category's containers with ones made from its current members */
+static int
+tagbuild(sqlite3 * restrict db, int64_t catid) {
+	int retc;
+	int64_t rowid, key, count;
+	uint64_t words[NOMBRE_TAG_WORDS];
+	sqlite3_stmt *stmt[4];
+	key = -1; count = 0;
+	memset(stmt, 0, sizeof(stmt));
+	memset(words, 0, sizeof(words));
+
+	if ((retc = sqlite3_prepare_v2(db, NOMBRE_TAG_MEMBERS, -1, &stmt[0], NULL)) != SQLITE_OK ||
+			(retc = sqlite3_prepare_v2(db, NOMBRE_TAG_CLEAR, -1, &stmt[1], NULL)) != SQLITE_OK ||
+			(retc = sqlite3_prepare_v2(db, NOMBRE_TAG_STORE, -1, &stmt[2], NULL)) != SQLITE_OK ||
+			(retc = sqlite3_prepare_v2(db, NOMBRE_TAG_FRESH, -1, &stmt[3], NULL)) != SQLITE_OK) {
+		goto BUILD_EXIT;
+	}
+	for (size_t i = 0; i < (sizeof(stmt) / sizeof(stmt[0])); i++) {
+		sqlite3_bind_int64(stmt[i], 1, catid);
+	}
+	if ((retc = sqlite3_step(stmt[1])) != SQLITE_DONE) {
+		goto BUILD_EXIT;
+	}
+	for (retc = sqlite3_step(stmt[0]); retc == SQLITE_ROW; retc = sqlite3_step(stmt[0])) {
+		rowid = sqlite3_column_int64(stmt[0], 0);
+		if ((rowid >> NOMBRE_TAG_CHUNK) != key) {
+			if (key >= 0 && (retc = tagflush(stmt[2], catid, key, words)) != SQLITE_OK) {
+				goto BUILD_EXIT;
+			}
+			memset(words, 0, sizeof(words));
+			key = rowid >> NOMBRE_TAG_CHUNK;
+		}
+		words[(rowid & 0xffff) >> 6] |= (uint64_t)1 << (rowid & 0x3f);
+		count++;
+	}
+	if (retc == SQLITE_DONE && (key < 0 || (retc = tagflush(stmt[2], catid, key, words)) == SQLITE_OK)) {
+		retc = sqlite3_step(stmt[3]);
+	}
+	retc = (retc == SQLITE_DONE) ? SQLITE_OK : retc;
+
+BUILD_EXIT:
+	for (size_t i = 0; i < (sizeof(stmt) / sizeof(stmt[0])); i++) {
+		sqlite3_finalize(stmt[i]);
+	}
+	NOMTRACE("category/members", catid, count);
+	return(retc);
+}
+
+/* Store one container, as an array or a bitmap depending on which is smaller */
+static int
+tagflush(sqlite3_stmt * restrict store, int64_t catid, int64_t key, const uint64_t * restrict words) {
+	int retc;
+	uint32_t card;
+	uint16_t vals[NOMBRE_TAG_ARRAYMAX];
+	card = 0;
+
+	for (size_t i = 0; i < NOMBRE_TAG_WORDS; i++) {
+		card += (uint32_t)__builtin_popcountll(words[i]);
+	}
+	sqlite3_bind_int64(store, 1, catid);
+	sqlite3_bind_int64(store, 2, key);
+	sqlite3_bind_int64(store, 3, card);
+	if (card <= NOMBRE_TAG_ARRAYMAX) {
+		card = 0;
+		for (size_t i = 0; i < NOMBRE_TAG_WORDS; i++) {
+			for (uint64_t w = words[i]; w != 0; w &= w - 1) {
+				vals[card++] = (uint16_t)((i << 6) | (size_t)__builtin_ctzll(w));
+			}
+		}
+		sqlite3_bind_blob(store, 4, vals, (int)(card * sizeof(vals[0])), SQLITE_STATIC);
+	} else {
+		sqlite3_bind_blob(store, 4, words, (int)(NOMBRE_TAG_WORDS * sizeof(words[0])), SQLITE_STATIC);
+	}
+	retc = sqlite3_step(store);
+	sqlite3_reset(store);
+	return((retc == SQLITE_DONE) ? SQLITE_OK : retc);
+}
+
+static int
+tagload(sqlite3 * restrict db, int64_t catid, struct tagset * restrict set) {
+	int retc, len;
+	uint32_t card;
+	const void *blob;
+	sqlite3_stmt *stmt;
+	stmt = NULL;
+
+	if ((retc = sqlite3_prepare_v2(db, NOMBRE_TAG_LOAD, -1, &stmt, NULL)) != SQLITE_OK) {
+		NOMERR("Error reading tag bitmaps (%s)!\n", sqlite3_errmsg(db));
+		return(NOM_FAIL);
+	}
+	sqlite3_bind_int64(stmt, 1, catid);
+	for (retc = sqlite3_step(stmt); retc == SQLITE_ROW; retc = sqlite3_step(stmt)) {
+		card = (uint32_t)sqlite3_column_int64(stmt, 1);
+		blob = sqlite3_column_blob(stmt, 2);
+		len = sqlite3_column_bytes(stmt, 2);
+		if (len != (int)((card <= NOMBRE_TAG_ARRAYMAX) ? card * sizeof(uint16_t) : NOMBRE_TAG_WORDS * sizeof(uint64_t)) ||
+				card > (1 << NOMBRE_TAG_CHUNK)) {
+			NOMERR("Malformed bitmap for category %lld, delete its tag_bitmaps rows and add it to tag_stale!\n", (long long)catid);
+			break;
+		}
+		/* Copied out of the row, the blob isn't necessarily aligned */
+		if (card <= NOMBRE_TAG_ARRAYMAX) {
+			uint16_t vals[NOMBRE_TAG_ARRAYMAX];
+			memcpy(vals, blob, (size_t)len);
+			retc = tagput(set, sqlite3_column_int64(stmt, 0), NULL, vals, card);
+		} else {
+			uint64_t words[NOMBRE_TAG_WORDS];
+			memcpy(words, blob, (size_t)len);
+			retc = tagput(set, sqlite3_column_int64(stmt, 0), words, NULL, card);
+		}
+		if (retc != NOM_OK) {
+			break;
+		}
+	}
+	if (retc != SQLITE_DONE && retc != SQLITE_ROW && retc != NOM_FAIL) {
+		NOMERR("Error reading tag bitmaps (%s)!\n", sqlite3_errmsg(db));
+	}
+	sqlite3_finalize(stmt);
+	return((retc == SQLITE_DONE) ? NOM_OK : NOM_FAIL);
+}
+
+/*
+ * Append a container given either as a bitmap (words) or as sorted values,
+ * packing it as an array when it is small enough. Empty ones are dropped.
+ */
+static int
+tagput(struct tagset * restrict set, int64_t key, const uint64_t * restrict words, const uint16_t * restrict vals, uint32_t card) {
+	struct tagbox *box, *grown;
+
+	if (words != NULL) {
+		card = 0;
+		for (size_t i = 0; i < NOMBRE_TAG_WORDS; i++) {
+			card += (uint32_t)__builtin_popcountll(words[i]);
+		}
+	}
+	if (card == 0) {
+		return(NOM_OK);
+	}
+	if (set->n == set->cap) {
+		if ((grown = realloc(set->box, sizeof(*grown) * ((set->cap > 0) ? set->cap * 2 : 8))) == NULL) {
+			NOMERR("%s\n", "Unable to allocate memory!");
+			return(NOM_FAIL);
+		}
+		set->box = grown;
+		set->cap = (set->cap > 0) ? set->cap * 2 : 8;
+	}
+	box = &set->box[set->n];
+	memset(box, 0, sizeof(*box));
+	box->key = key;
+	box->card = card;
+	if (card <= NOMBRE_TAG_ARRAYMAX) {
+		if ((box->vals = malloc(card * sizeof(*box->vals))) == NULL) {
+			NOMERR("%s\n", "Unable to allocate memory!");
+			return(NOM_FAIL);
+		}
+		if (vals != NULL) {
+			memcpy(box->vals, vals, card * sizeof(*box->vals));
+		} else {
+			card = 0;
+			for (size_t i = 0; i < NOMBRE_TAG_WORDS; i++) {
+				for (uint64_t w = words[i]; w != 0; w &= w - 1) {
+					box->vals[card++] = (uint16_t)((i << 6) | (size_t)__builtin_ctzll(w));
+				}
+			}
+		}
+	} else {
+		if ((box->bits = malloc(NOMBRE_TAG_WORDS * sizeof(*box->bits))) == NULL) {
+			NOMERR("%s\n", "Unable to allocate memory!");
+			return(NOM_FAIL);
+		}
+		if (words != NULL) {
+			memcpy(box->bits, words, NOMBRE_TAG_WORDS * sizeof(*box->bits));
+		} else {
+			memset(box->bits, 0, NOMBRE_TAG_WORDS * sizeof(*box->bits));
+			for (uint32_t i = 0; i < card; i++) {
+				box->bits[vals[i] >> 6] |= (uint64_t)1 << (vals[i] & 0x3f);
+			}
+		}
+	}
+	set->n++;
+	return(NOM_OK);
+}
+
+static void
+tagwords(const struct tagbox * restrict box, uint64_t * restrict words) {
+	if (box->bits != NULL) {
+		memcpy(words, box->bits, NOMBRE_TAG_WORDS * sizeof(*words));
+	} else {
+		memset(words, 0, NOMBRE_TAG_WORDS * sizeof(*words));
+		for (uint32_t i = 0; i < box->card; i++) {
+			words[box->vals[i] >> 6] |= (uint64_t)1 << (box->vals[i] & 0x3f);
+		}
+	}
+}
+
+/*
+ * a = a op b, walking both sets in key order. Two arrays are merged
+ * directly, anything involving a bitmap is done a word at a time.
+ */
+static int
+tagop(struct tagset * restrict a, const struct tagset * restrict b, int op) {
+	int retc;
+	size_t i, j;
+	uint32_t n;
+	bool ina, inb;
+	int64_t key;
+	struct tagset out;
+	uint64_t wa[NOMBRE_TAG_WORDS], wb[NOMBRE_TAG_WORDS];
+	uint16_t vals[NOMBRE_TAG_ARRAYMAX * 2];
+	retc = NOM_OK; i = j = 0;
+	memset(&out, 0, sizeof(out));
+
+	while (retc == NOM_OK && (i < a->n || j < b->n)) {
+		key = (j >= b->n || (i < a->n && a->box[i].key < b->box[j].key)) ? a->box[i].key : b->box[j].key;
+		ina = (i < a->n && a->box[i].key == key);
+		inb = (j < b->n && b->box[j].key == key);
+		if (ina && inb) {
+			const struct tagbox *x = &a->box[i], *y = &b->box[j];
+			if (x->vals != NULL && y->vals != NULL) {
+				n = 0;
+				for (uint32_t p = 0, q = 0; p < x->card || q < y->card; ) {
+					if (q >= y->card || (p < x->card && x->vals[p] < y->vals[q])) {
+						if (op != TAG_AND) {
+							vals[n++] = x->vals[p];
+						}
+						p++;
+					} else if (p >= x->card || y->vals[q] < x->vals[p]) {
+						if (op == TAG_OR) {
+							vals[n++] = y->vals[q];
+						}
+						q++;
+					} else {
+						if (op != TAG_ANDNOT) {
+							vals[n++] = x->vals[p];
+						}
+						p++; q++;
+					}
+				}
+				retc = tagput(&out, key, NULL, vals, n);
+			} else {
+				tagwords(x, wa);
+				tagwords(y, wb);
+				for (size_t w = 0; w < NOMBRE_TAG_WORDS; w++) {
+					wa[w] = (op == TAG_AND) ? wa[w] & wb[w] : ((op == TAG_OR) ? wa[w] | wb[w] : wa[w] & ~wb[w]);
+				}
+				retc = tagput(&out, key, wa, NULL, 0);
+			}
+		} else if (ina && op != TAG_AND) {
+			retc = tagput(&out, key, a->box[i].bits, a->box[i].vals, a->box[i].card);
+		} else if (inb && op == TAG_OR) {
+			retc = tagput(&out, key, b->box[j].bits, b->box[j].vals, b->box[j].card);
+		}
+		i += ina;
+		j += inb;
+	}
+	tagfree(a);
+	*a = out;
+	return(retc);
+}
+
+/* Print the definition behind each member, stopping at the limit when there is one */
+static int
+tagemit(sqlite3 * restrict db, const struct tagset * restrict set, int64_t limit, int64_t * restrict rows) {
+	int retc;
+	sqlite3_stmt *stmt;
+	stmt = NULL;
+
+	if ((retc = sqlite3_prepare_v2(db, NOMBRE_TAG_ROW, -1, &stmt, NULL)) != SQLITE_OK) {
+		NOMERR("Error preparing listing (%s)!\n", sqlite3_errmsg(db));
+		return(NOM_FAIL);
+	}
+	for (size_t i = 0; i < set->n && retc == SQLITE_OK; i++) {
+		const struct tagbox *box = &set->box[i];
+		if (box->vals != NULL) {
+			for (uint32_t v = 0; v < box->card && retc == SQLITE_OK && (limit <= 0 || *rows < limit); v++) {
+				retc = tagrow(stmt, (box->key << NOMBRE_TAG_CHUNK) | box->vals[v], rows);
+			}
+		} else {
+			for (size_t w = 0; w < NOMBRE_TAG_WORDS; w++) {
+				for (uint64_t bits = box->bits[w]; bits != 0 && retc == SQLITE_OK && (limit <= 0 || *rows < limit); bits &= bits - 1) {
+					retc = tagrow(stmt, (box->key << NOMBRE_TAG_CHUNK) | (int64_t)((w << 6) | (size_t)__builtin_ctzll(bits)), rows);
+				}
+			}
+		}
+	}
+	if (retc != SQLITE_OK) {
+		NOMERR("Error processing command! (%s)\n", sqlite3_errmsg(db));
+	}
+	sqlite3_finalize(stmt);
+	return((retc == SQLITE_OK) ? NOM_OK : NOM_FAIL);
+}
+
+/* Every member has a row, deleting one marks its categories stale */
+static int
+tagrow(sqlite3_stmt * restrict stmt, int64_t rowid, int64_t * restrict rows) {
+	int retc;
+
+	sqlite3_bind_int64(stmt, 1, rowid);
+	if ((retc = sqlite3_step(stmt)) == SQLITE_ROW) {
+		fprintf(stdout, "  %s: %s\n", sqlite3_column_text(stmt, 0), sqlite3_column_text(stmt, 1));
+		(*rows)++;
+	}
+	sqlite3_reset(stmt);
+	return((retc == SQLITE_ROW || retc == SQLITE_DONE) ? SQLITE_OK : retc);
+}
+
+static void
+tagfree(struct tagset * restrict set) {
+	for (size_t i = 0; i < set->n; i++) {
+		free(set->box[i].vals);
+		free(set->box[i].bits);
+	}
+	free(set->box);
+	memset(set, 0, sizeof(*set));
+}
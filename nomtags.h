@@ -0,0 +1,72 @@
+/* 
+ * Copyright (c) 2019, Exile Heavy Industries
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted (subject to the limitations in the disclaimer
+ * below) provided that the following conditions are met:
+ * 
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ * 
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * 
+ * * Neither the name of the copyright holder nor the names of its contributors may be used
+ *   to endorse or promote products derived from this software without specific
+ *   prior written permission.
+ * 
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY THIS
+ * LICENSE. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#define NOMBRE_NOMTAGS_H
+
+#ifndef NOMBRE_H
+#include "nombre.h"
+#endif
+
+/*
+ * A term belongs to its own category and to any number of others listed in
+ * term_tags. Every category's members are also kept as a roaring bitmap of
+ * definitions ids in tag_bitmaps, so "NET and SEC but not DEVEL" is a few
+ * container operations instead of a join per category. Each container holds
+ * the members sharing the upper bits of their id (chunk), as a sorted
+ * array of the lower 16 bits while that is smaller than a bitmap of all 2^16.
+ *
+ * Triggers don't touch the bitmaps themselves, they only note the category
+ * in tag_stale. A query rebuilds the stale categories it reads first.
+ */
+#define NOMBRE_TAG_CHUNK 16
+#define NOMBRE_TAG_WORDS ((1 << NOMBRE_TAG_CHUNK) / 64)
+/* Past this many members a bitmap is the smaller container */
+#define NOMBRE_TAG_ARRAYMAX 4096
+
+#define NOMBRE_TAG_TERM "SELECT term, category, id FROM definitions WHERE term = nomnorm(?1);"
+#define NOMBRE_TAG_ADD "INSERT INTO term_tags (termid, category) VALUES (?1, ?2) ON CONFLICT DO NOTHING;"
+#define NOMBRE_TAG_DEL "DELETE FROM term_tags WHERE termid = ?1 AND category = ?2;"
+#define NOMBRE_TAG_LIST "SELECT name FROM categories WHERE id = ?2" \
+	" UNION ALL SELECT g.name FROM term_tags AS t CROSS JOIN categories AS g ON g.id = t.category WHERE t.termid = ?1 AND t.category != ?2;"
+#define NOMBRE_TAG_ISSTALE "SELECT 1 FROM tag_stale WHERE category = ?1;"
+/* Primary members and tagged ones in id order, the rebuild packs them as they come */
+#define NOMBRE_TAG_MEMBERS "SELECT id FROM definitions WHERE category = ?1" \
+	" UNION SELECT termid FROM term_tags WHERE category = ?1 ORDER BY 1;"
+#define NOMBRE_TAG_CLEAR "DELETE FROM tag_bitmaps WHERE category = ?1;"
+#define NOMBRE_TAG_STORE "INSERT INTO tag_bitmaps (category, chunk, card, bits) VALUES (?1, ?2, ?3, ?4);"
+#define NOMBRE_TAG_FRESH "DELETE FROM tag_stale WHERE category = ?1;"
+#define NOMBRE_TAG_LOAD "SELECT chunk, card, bits FROM tag_bitmaps WHERE category = ?1 ORDER BY chunk;"
+#define NOMBRE_TAG_ROW "SELECT term, meaning FROM definitions WHERE id = ?1;"
+
+int nomdb_tag(nomcmd * restrict cmdbuf, const char ** restrict args);
+int nomdb_tagquery(nomcmd * restrict cmdbuf, const char ** restrict args);
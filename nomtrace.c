@@ -0,0 +1,228 @@
+/* 
+ * Copyright (c) 2019, Exile Heavy Industries
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted (subject to the limitations in the disclaimer
+ * below) provided that the following conditions are met:
+ * 
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ * 
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * 
+ * * Neither the name of the copyright holder nor the names of its contributors may be used
+ *   to endorse or promote products derived from this software without specific
+ *   prior written permission.
+ * 
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY THIS
+ * LICENSE. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+/*
+ * Binary event ring behind NOMTRACE(), see nomtrace.h
+ */
+
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifndef NOMBRE_H
+#include "nombre.h"
+#endif
+#ifndef NOMBRE_NOMTRACE_H
+#include "nomtrace.h"
+#endif
+
+extern char *__progname;
+
+#ifdef NOMBRE_TRACE
+struct nomtrace_ev {
+	uint64_t ns; /* CLOCK_MONOTONIC */
+	_Atomic(const struct nomtrace_site *) site; /* NULL while the slot is still being written */
+	int64_t arg[2];
+	uint32_t thread; /* Order in which threads first traced, the main thread is usually 0 */
+};
+
+static struct nomtrace_ev ring[NOMBRE_TRACE_EVENTS];
+static atomic_uint_fast64_t head;
+static atomic_uint threads;
+static _Thread_local uint32_t thread = UINT32_MAX;
+static uint64_t start;
+
+static const int fatal[] = { SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT };
+
+static inline uint64_t tracenow(void);
+static size_t tracestr(char * restrict line, size_t len, const char * restrict str);
+static size_t tracenum(char * restrict line, size_t len, uint64_t val, bool neg);
+static void tracesig(int sig);
+#endif
+
+/*
+ * Claim the next slot and fill it in. The site is stored last, so a dump
+ * that races the write sees an empty slot rather than half an event.
+ */
+void
+nom_trace(const struct nomtrace_site * restrict site, int64_t a, int64_t b) {
+#ifdef NOMBRE_TRACE
+	struct nomtrace_ev *ev;
+
+	if (thread == UINT32_MAX) {
+		thread = atomic_fetch_add_explicit(&threads, 1, memory_order_relaxed);
+	}
+	ev = &ring[atomic_fetch_add_explicit(&head, 1, memory_order_relaxed) & (NOMBRE_TRACE_EVENTS - 1)];
+	atomic_store_explicit(&ev->site, NULL, memory_order_relaxed);
+	ev->ns = tracenow();
+	ev->arg[0] = a;
+	ev->arg[1] = b;
+	ev->thread = thread;
+	atomic_store_explicit(&ev->site, site, memory_order_release);
+#else
+	(void)site; (void)a; (void)b;
+#endif
+}
+
+/* Dump the ring on fatal signals and SIGUSR1, timestamps count from here */
+int
+nom_traceinit(void) {
+#ifdef NOMBRE_TRACE
+	struct sigaction sa;
+
+	start = tracenow();
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = tracesig;
+	sigemptyset(&sa.sa_mask);
+	/* A fatal signal dumps once and then takes its default action */
+	sa.sa_flags = (int)SA_RESETHAND;
+	for (size_t i = 0; i < (sizeof(fatal) / sizeof(fatal[0])); i++) {
+		if (sigaction(fatal[i], &sa, NULL) != 0) {
+			return(NOM_FAIL);
+		}
+	}
+	sa.sa_flags = SA_RESTART;
+	if (sigaction(SIGUSR1, &sa, NULL) != 0) {
+		return(NOM_FAIL);
+	}
+#endif
+	return(NOM_OK);
+}
+
+/*
+ * Write every event still in the ring, oldest first. Lines are built in a
+ * stack buffer by hand, as snprintf(3) is not async-signal-safe, and written
+ * with write(2), so this can run from a signal handler.
+ */
+void
+nom_tracedump(int fd) {
+#ifdef NOMBRE_TRACE
+	size_t len;
+	uint64_t end, first;
+	char line[NOMBRE_TRACE_LINE];
+	const struct nomtrace_site *site;
+	const struct nomtrace_ev *ev;
+
+	end = atomic_load_explicit(&head, memory_order_acquire);
+	first = (end > NOMBRE_TRACE_EVENTS) ? end - NOMBRE_TRACE_EVENTS : 0;
+	len = tracestr(line, 0, "[TRC] ");
+	len = tracestr(line, len, __progname);
+	len = tracestr(line, len, ": ");
+	len = tracenum(line, len, end, false);
+	len = tracestr(line, len, " events, showing the last ");
+	len = tracenum(line, len, end - first, false);
+	line[len++] = '\n';
+	if (write(fd, line, len) < 0) {
+		return;
+	}
+	for (uint64_t i = first; i < end; i++) {
+		ev = &ring[i & (NOMBRE_TRACE_EVENTS - 1)];
+		if ((site = atomic_load_explicit(&ev->site, memory_order_acquire)) == NULL) {
+			continue;
+		}
+		len = tracestr(line, 0, "[TRC] +");
+		len = tracenum(line, len, (ev->ns - start) / 1000, false);
+		len = tracestr(line, len, " t");
+		len = tracenum(line, len, ev->thread, false);
+		len = tracestr(line, len, " ");
+		len = tracestr(line, len, site->file);
+		len = tracestr(line, len, ":");
+		len = tracenum(line, len, site->line, false);
+		len = tracestr(line, len, " ");
+		len = tracestr(line, len, site->func);
+		len = tracestr(line, len, ": ");
+		len = tracestr(line, len, site->label);
+		len = tracestr(line, len, " ");
+		len = tracenum(line, len, (ev->arg[0] < 0) ? 0 - (uint64_t)ev->arg[0] : (uint64_t)ev->arg[0], ev->arg[0] < 0);
+		len = tracestr(line, len, " ");
+		len = tracenum(line, len, (ev->arg[1] < 0) ? 0 - (uint64_t)ev->arg[1] : (uint64_t)ev->arg[1], ev->arg[1] < 0);
+		line[len++] = '\n';
+		if (write(fd, line, len) < 0) {
+			return;
+		}
+	}
+#else
+	(void)fd;
+#endif
+}
+
+#ifdef NOMBRE_TRACE
+static inline uint64_t
+tracenow(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return((uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec);
+}
+
+/* Append str at len, always leaving room for the newline that ends the line */
+static size_t
+tracestr(char * restrict line, size_t len, const char * restrict str) {
+	while (*str != 0 && len < NOMBRE_TRACE_LINE - 1) {
+		line[len++] = *str++;
+	}
+	return(len);
+}
+
+/* Append val in decimal, with a minus sign when neg is set */
+static size_t
+tracenum(char * restrict line, size_t len, uint64_t val, bool neg) {
+	char digits[22];
+	size_t at;
+	at = sizeof(digits) - 1;
+	digits[at] = 0;
+
+	do {
+		digits[--at] = (char)('0' + (val % 10));
+		val /= 10;
+	} while (val != 0);
+	if (neg) {
+		digits[--at] = '-';
+	}
+	return(tracestr(line, len, &digits[at]));
+}
+
+static void
+tracesig(int sig) {
+	nom_tracedump(STDERR_FILENO);
+	for (size_t i = 0; i < (sizeof(fatal) / sizeof(fatal[0])); i++) {
+		if (sig == fatal[i]) {
+			raise(sig);
+		}
+	}
+}
+#endif
@@ -0,0 +1,76 @@
+/* 
+ * Copyright (c) 2019, Exile Heavy Industries
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted (subject to the limitations in the disclaimer
+ * below) provided that the following conditions are met:
+ * 
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ * 
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * 
+ * * Neither the name of the copyright holder nor the names of its contributors may be used
+ *   to endorse or promote products derived from this software without specific
+ *   prior written permission.
+ * 
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY THIS
+ * LICENSE. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#define NOMBRE_NOMTRACE_H
+
+#include <stdint.h>
+
+#ifndef NOMBRE_H
+#include "nombre.h"
+#endif
+
+/*
+ * Binary event tracing for builds with -DNOMBRE_TRACE (TRACE in config.mk).
+ * NOMTRACE() records a timestamp, the thread, its call site and two integers
+ * into a fixed ring of the most recent events, without formatting anything
+ * or checking dbg. Each call site is a static descriptor, so an event only
+ * carries a pointer to it. The ring is written out as text when a command
+ * fails, with -D, on a fatal signal, and whenever SIGUSR1 arrives.
+ *
+ * Without NOMBRE_TRACE the macro expands to nothing that runs and the
+ * functions below do nothing, so release builds carry no trace cost.
+ *
+ * Output: [TRC] +MICROSECONDS tTHREAD FILE:LINE FUNCTION: LABEL A B
+ */
+#define NOMBRE_TRACE_EVENTS 8192 /* Must be a power of two */
+#define NOMBRE_TRACE_LINE 256
+
+struct nomtrace_site {
+	const char *file;
+	const char *func;
+	const char *label; /* What the two integers are, e.g. "part/rows" */
+	unsigned int line;
+};
+
+#ifdef NOMBRE_TRACE
+#define NOMTRACE(lbl, a, b) do { \
+	static const struct nomtrace_site nomtrace_site = { __FILE__, __func__, lbl, __LINE__ }; \
+	nom_trace(&nomtrace_site, (int64_t)(a), (int64_t)(b)); \
+} while (0)
+#else
+#define NOMTRACE(lbl, a, b) do { (void)sizeof(a); (void)sizeof(b); } while (0)
+#endif
+
+void nom_trace(const struct nomtrace_site * restrict site, int64_t a, int64_t b);
+int nom_traceinit(void);
+void nom_tracedump(int fd);
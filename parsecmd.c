@@ -31,6 +31,8 @@
  * DAMAGE.
  */
 
+#include <errno.h>
+#include <limits.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdint.h>
@@ -45,6 +47,33 @@
 #ifndef NOMBRE_H
 #include "nombre.h"
 #endif
+#ifndef NOMBRE_CATMAP_H
+#include "catmap.h"
+#endif
+#ifndef NOMBRE_NOMNORM_H
+#include "nomnorm.h"
+#endif
+#ifndef NOMBRE_NOMHITS_H
+#include "nomhits.h"
+#endif
+#ifndef NOMBRE_CHGLOG_H
+#include "chglog.h"
+#endif
+#ifndef NOMBRE_NOMCMP_H
+#include "nomcmp.h"
+#endif
+#ifndef NOMBRE_NOMREGEX_H
+#include "nomregex.h"
+#endif
+#ifndef NOMBRE_NOMSTATS_H
+#include "nomstats.h"
+#endif
+#ifndef NOMBRE_NOMDEL_H
+#include "nomdel.h"
+#endif
+#ifndef NOMBRE_NOMFOLLOW_H
+#include "nomfollow.h"
+#endif
 
 #define PARSE_SHORT 3
 
@@ -52,9 +81,10 @@ extern char *__progname;
 extern char **environ;
 extern bool dbg;
 
-static inline int extract_defstring(const char * restrict sql, char * restrict defstr);
 static inline bool isgrp(const nomcmd * restrict cmd);
-static inline void upcase(char * restrict str);
+static inline int grpcat(nomcmd * restrict cmd);
+static int optnum(const char * restrict arg, int64_t * restrict val);
+static int flatdef(char * restrict defstr, const char ** restrict args);
 
 int
 parsecmd(nomcmd * restrict cmdbuf, const char * restrict arg) {
@@ -63,8 +93,8 @@ parsecmd(nomcmd * restrict cmdbuf, const char * restrict arg) {
 
 	/* Define a list of valid command strings */
 	const char *cmd[][CMDCOUNT] = { 
-		{ "def", "add", "key", "del", "lst", "new", "imp", "exp", "src", "upd", "vqy", "cts", "grp" }, /* "Short" */
-		{ "define", "adddef", "keyword", "delete", "list", "new", "import", "export", "srcadd", "update", "vquery", "catscn", "grpcmd" } /* "Long" */
+		{ "def", "add", "key", "del", "lst", "new", "imp", "exp", "src", "upd", "vqy", "cts", "top", "chg", "cmp", "tag", "sum", "grp" }, /* "Short" */
+		{ "define", "adddef", "keyword", "delete", "list", "new", "import", "export", "srcadd", "update", "vquery", "catscn", "tophits", "change", "compare", "tagset", "summary", "grpcmd" } /* "Long" */
 	};
 
 	if (dbg) {
@@ -142,13 +172,21 @@ nombre_lookup(nomcmd * restrict cmdbuf, const char ** restrict args) {
 			/* Use group logic */
 			memccpy(cmdbuf->defdata[NOMBRE_DBCATG], *args, 0, (size_t)DEFLEN); args++;
 			memccpy(cmdbuf->defdata[NOMBRE_DBTERM], *args, 0, (size_t)DEFLEN); args++;
-			retc = snprintf(cmdbuf->gensql, (size_t)PATHMAX, "SELECT meaning FROM definitions WHERE term LIKE(\'%s\') AND category=(SELECT id FROM categories WHERE name LIKE(\'%s\'));",
-					cmdbuf->defdata[NOMBRE_DBTERM], cmdbuf->defdata[NOMBRE_DBCATG]);
+			if ((retc = grpcat(cmdbuf)) == NOM_OK) {
+				retc = snprintf(cmdbuf->gensql, (size_t)PATHMAX, "%s", "SELECT meaning, -1 FROM definitions WHERE term = nomnorm(:term) AND category = :catid"
+						" UNION ALL SELECT a.altdef, a.defno FROM definitions AS d CROSS JOIN altdefs AS a ON a.termid = d.id"
+						" WHERE d.term = nomnorm(:term) AND a.category = :catid ORDER BY 2;");
+			}
 		} else {
-			/* Expected to be normal path */
+			/* 
+			 * Expected to be normal path. Terms are stored normalized, so compare
+			 * against nomnorm(:term) rather than LIKE() to keep both sides on their indexes.
+			 * Alternates hang off the id the one term seek already found
+			 */
 			memccpy(cmdbuf->defdata[NOMBRE_DBTERM], *args, 0, (size_t)DEFLEN); args++;
-			retc = snprintf(cmdbuf->gensql, (size_t)PATHMAX, "SELECT meaning FROM definitions WHERE term LIKE(\'%s\');",
-					cmdbuf->defdata[NOMBRE_DBTERM]);
+			retc = snprintf(cmdbuf->gensql, (size_t)PATHMAX, "%s", "SELECT meaning, -1 FROM definitions WHERE term = nomnorm(:term)"
+					" UNION ALL SELECT a.altdef, a.defno FROM definitions AS d CROSS JOIN altdefs AS a ON a.termid = d.id"
+					" WHERE d.term = nomnorm(:term) ORDER BY 2;");
 		}
 	}
 	/* Assume we wrote what was intended and clear the return code. */
@@ -162,59 +200,60 @@ nombre_lookup(nomcmd * restrict cmdbuf, const char ** restrict args) {
 int
 nombre_newdef(nomcmd * restrict cmdbuf, const char ** restrict args) {
 	int retc;
-	char defstr[DEFLEN];
+	char *defstr;
 	retc = 1; /* Start with retc nonzero to enter loops properly */
+	defstr = NULL;
 
 	if (dbg) {
 		NOMDBG("Entering with cmdbuf = %p, args = %p\n", (void *)cmdbuf, (const void *)*args);
 	}
 	if ((cmdbuf == NULL) || (*args == NULL)) {
 		NOMERR("%s\n", "Invalid Arguments!");
-		retc = BADARGS;
+		return(BADARGS);
 	} else {
-		/* Explicitly zero local character array */
+		/* The flattened definition is bound straight from the command buffer */
+		defstr = cmdbuf->defdata[NOMBRE_DBDEFN];
 		memset(defstr, 0, (size_t)DEFLEN);
 	}
 
 	if (isgrp(cmdbuf)) {
 		memccpy(cmdbuf->defdata[NOMBRE_DBCATG], *args, 0, (size_t)DEFLEN); args++;
-		upcase(cmdbuf->defdata[NOMBRE_DBCATG]);
+		nom_normterm(cmdbuf->defdata[NOMBRE_DBCATG]);
 		/* Only if the new value of *args is non-null! */
-		if (*args != NULL) {
+		if (grpcat(cmdbuf) != NOM_OK) {
+			return(NOM_INVALID);
+		} else if (*args != NULL) {
 			memccpy(cmdbuf->defdata[NOMBRE_DBTERM], *args, 0, (size_t)DEFLEN); args++;
-			upcase(cmdbuf->defdata[NOMBRE_DBTERM]);
+			nom_normterm(cmdbuf->defdata[NOMBRE_DBTERM]);
 			/* Flatten the rest of the argument vector */
-			for (register int written = 0; *args != NULL && retc > 0; args++) {
-				retc = snprintf(&defstr[written], (size_t)(DEFLEN - written), (written > 0) ? " %s" : "%s", *args);
-				written += retc;
+			if (flatdef(defstr, args) != NOM_OK) {
+				NOMERR("Definition for %s is over %d bytes, give it with -f or on stdin with \"-\" instead!\n",
+						cmdbuf->defdata[NOMBRE_DBTERM], DEFLEN - 1);
+				return(BADARGS);
 			}
 			if (dbg) {
 				NOMDBG("Flattened arguments to \"%s\"\n", defstr);
 			}
-			retc = snprintf(cmdbuf->gensql, (size_t)PATHMAX, 
-					"INSERT INTO definitions VALUES (\'%s\', \'%s\', (SELECT id FROM categories WHERE name LIKE(\'%s\')));",
-					cmdbuf->defdata[NOMBRE_DBTERM], defstr, cmdbuf->defdata[NOMBRE_DBCATG]);
+			/* An existing term is filed as an alternate by the definitions_altdef trigger */
+			retc = snprintf(cmdbuf->gensql, (size_t)PATHMAX, "%s",
+					"INSERT INTO definitions (term, meaning, category) VALUES (:term, :defn, :catid) RETURNING term;");
 		} else {
 			retc = BADARGS;
 			NOMERR("Invalid number of arguments for %s!\n", __func__);
 		}
 	} else {
 		memccpy(cmdbuf->defdata[NOMBRE_DBTERM], *args, 0, (size_t)DEFLEN); args++;
-		upcase(cmdbuf->defdata[NOMBRE_DBTERM]);
-		for (register int written = 0; *args != NULL && retc > 0; args++) {
-			if (dbg) {
-				NOMDBG("written = %d, *args = %s, defstr = %s\n", written, *args, defstr);
-			}
-			retc = snprintf(&defstr[written], (size_t)(DEFLEN - written), (written > 0) ? " %s" : "%s", *args);
-			written += retc;
-			//written = (written > 0) ? written - 1 : written;
+		nom_normterm(cmdbuf->defdata[NOMBRE_DBTERM]);
+		if (flatdef(defstr, args) != NOM_OK) {
+			NOMERR("Definition for %s is over %d bytes, give it with -f or on stdin with \"-\" instead!\n",
+					cmdbuf->defdata[NOMBRE_DBTERM], DEFLEN - 1);
+			return(BADARGS);
 		}
 		if (dbg) {
 			NOMDBG("Flattened arguments to \"%s\"\n", defstr);
 		}
-		retc = snprintf(cmdbuf->gensql, (size_t)PATHMAX, 
-				"INSERT INTO definitions VALUES (\'%s\', \'%s\', \'-1\');",
-				cmdbuf->defdata[NOMBRE_DBTERM], defstr);
+		retc = snprintf(cmdbuf->gensql, (size_t)PATHMAX, "%s",
+				"INSERT INTO definitions (term, meaning, category) VALUES (:term, :defn, -1) RETURNING term;");
 	}
 	retc = (retc > 0) ? 0 : retc;
 	if (dbg) {
@@ -263,12 +302,21 @@ nombre_ksearch(nomcmd * restrict cmdbuf, const char ** restrict args) {
 			/* Copy the group info if it exists */
 			memccpy(cmdbuf->defdata[NOMBRE_DBCATG], *args, 0, (size_t)DEFLEN); args++;
 			memccpy(cmdbuf->defdata[NOMBRE_DBTERM], *args, 0, (size_t)DEFLEN); /* Should now be out of arguments */
-			retc = snprintf(cmdbuf->gensql, (size_t)PATHMAX, "SELECT term, meaning FROM definitions WHERE meaning LIKE(\'%%%s%%\') AND category=(SELECT id FROM categories WHERE name LIKE(\'%s\'));",
-					cmdbuf->defdata[NOMBRE_DBTERM], cmdbuf->defdata[NOMBRE_DBCATG]);
+			if ((retc = grpcat(cmdbuf)) == NOM_OK) {
+				retc = snprintf(cmdbuf->gensql, (size_t)PATHMAX, "%s", (cmdbuf->regex) ?
+						"SELECT term, meaning FROM definitions WHERE category = :catid AND meaning REGEXP :term;" :
+						"SELECT term, meaning FROM definitions WHERE category = :catid AND meaning LIKE(\'%\' || :term || \'%\');");
+			}
 		} else {
 			memccpy(cmdbuf->defdata[NOMBRE_DBTERM], *args, 0, (size_t)DEFLEN);
-			retc = snprintf(cmdbuf->gensql, (size_t)PATHMAX, "SELECT term, meaning FROM definitions WHERE meaning LIKE(\'%%%s%%\');",
-					cmdbuf->defdata[NOMBRE_DBTERM]);
+			retc = snprintf(cmdbuf->gensql, (size_t)PATHMAX, "%s", (cmdbuf->regex) ?
+					"SELECT term, meaning FROM definitions WHERE meaning REGEXP :term;" :
+					"SELECT term, meaning FROM definitions WHERE meaning LIKE(\'%\' || :term || \'%\');");
+		}
+		/* A pattern that does not compile is caught here, rather than failing the statement on its first row */
+		if (retc > 0 && cmdbuf->regex && nom_regexcheck(cmdbuf->defdata[NOMBRE_DBTERM]) != NOM_OK) {
+			cmdbuf->gensql[0] = 0;
+			retc = BADARGS;
 		}
 	}
 	retc = (retc > 0) ? retc ^ retc : retc;
@@ -282,6 +330,10 @@ nombre_ksearch(nomcmd * restrict cmdbuf, const char ** restrict args) {
  * The group modifier for this function depends on the presence of 
  * a group name. If no name is given, we will list the currently defined groups,
  * otherwise, we use the group id as an output filter for the database listing
+ *
+ * Listings are ordered by term so they can be paged with a keyset rather than
+ * an OFFSET: --after resumes just past the given term and --limit caps the page.
+ * Both orders come straight off an index (the term key, or defcat_idx for a group).
  */
 int
 nombre_dbdump(nomcmd * restrict cmdbuf, const char ** restrict args) {
@@ -300,14 +352,19 @@ nombre_dbdump(nomcmd * restrict cmdbuf, const char ** restrict args) {
 	if (retc == NOM_OK) {
 		if (isgrp(cmdbuf)) {
 			if (*args != NULL) {
-				retc = snprintf(cmdbuf->gensql, (size_t)DEFLEN, "SELECT c.name, d.term, d.meaning FROM categories AS c JOIN definitions AS d"
-						" ON c.id = d.category WHERE d.category = (SELECT id FROM categories WHERE name LIKE(\'%s\')) ORDER BY 2 DESC;", *args);
+				/* The name subquery is constant, so it runs once rather than joining every row */
+				memccpy(cmdbuf->defdata[NOMBRE_DBCATG], *args, 0, (size_t)DEFLEN);
+				if ((retc = grpcat(cmdbuf)) == NOM_OK) {
+					retc = snprintf(cmdbuf->gensql, (size_t)DEFLEN, "%s", "SELECT (SELECT name FROM categories WHERE id = :catid), term, meaning"
+							" FROM definitions WHERE category = :catid AND term > nomnorm(:term) ORDER BY term LIMIT :limit;");
+				}
 			} else {
 				retc = snprintf(cmdbuf->gensql, (size_t)DEFLEN, "%s", "SELECT  id, short, nlong FROM category_verbose ORDER BY 1 DESC;");
 			}
 		} else {
 			/* Precision loss is acceptable as the given write limit is well under INT_MAX */
-			retc = snprintf(cmdbuf->gensql, (size_t)DEFLEN, "%s", "SELECT c.name, d.term, d.meaning FROM categories AS c JOIN definitions AS d ON c.id = d.category ORDER BY 1,2 DESC;");
+			retc = snprintf(cmdbuf->gensql, (size_t)DEFLEN, "%s", "SELECT (SELECT name FROM categories WHERE id = d.category), d.term, d.meaning"
+					" FROM definitions AS d WHERE d.term > nomnorm(:term) ORDER BY d.term LIMIT :limit;");
 		}
 		/* Clear the counter values from string operations prior to returning */
 		retc = (retc > NOM_OK) ? retc ^ retc : retc;
@@ -319,11 +376,49 @@ nombre_dbdump(nomcmd * restrict cmdbuf, const char ** restrict args) {
 	return(retc);
 }
 
-/* 
- * Delete the given term/group from the database based on the 
- * presence of the group flag. This will require some sort of modification or 
- * check against terms using the given group. Most likely just resetting them
- * to "unknown".
+/*
+ * List the most looked up terms, walking term_stats_hits_idx from the top.
+ * The group form filters on the category of each term as it goes.
+ */
+int
+nombre_tophits(nomcmd * restrict cmdbuf, const char ** restrict args) {
+	int retc;
+	retc = 0;
+
+	if (dbg) {
+		NOMDBG("Entering with cmdbuf = %p\n", (void *)cmdbuf);
+	}
+	if (cmdbuf == NULL) {
+		NOMERR("%s\n", "Invalid arguments!\n");
+		retc = BADARGS;
+	}
+	if (retc == NOM_OK) {
+		cmdbuf->limit = (cmdbuf->limit > 0) ? cmdbuf->limit : NOMBRE_HITS_TOP;
+		if (isgrp(cmdbuf) && *args != NULL) {
+			memccpy(cmdbuf->defdata[NOMBRE_DBCATG], *args, 0, (size_t)DEFLEN);
+			if ((retc = grpcat(cmdbuf)) == NOM_OK) {
+				/* CROSS JOIN keeps term_stats outermost, so the walk stops at the limit instead of sorting the category */
+				retc = snprintf(cmdbuf->gensql, (size_t)DEFLEN, "%s", "SELECT s.term, s.hits FROM term_stats AS s"
+						" CROSS JOIN definitions AS d ON d.term = s.term WHERE d.category = :catid ORDER BY s.hits DESC, s.term LIMIT :limit;");
+			}
+		} else {
+			retc = snprintf(cmdbuf->gensql, (size_t)DEFLEN, "%s", "SELECT term, hits FROM term_stats ORDER BY hits DESC, term LIMIT :limit;");
+		}
+		/* Clear the counter values from string operations prior to returning */
+		retc = (retc > NOM_OK) ? retc ^ retc : retc;
+	}
+
+	if (dbg) {
+		NOMDBG("Returning %d to caller with cmdbuf->gensql= %s\n", retc, cmdbuf->gensql);
+	}
+	return(retc);
+}
+
+/*
+ * Delete the given term, or every term matching the --like or --glob
+ * pattern, or with the group flag retire the given category and move its
+ * terms to UNCAT. Only the arguments are checked here, nomdb_del() does
+ * the work in chunks, see nomdel.h.
  */
 int
 nombre_delete(nomcmd * restrict cmdbuf, const char ** argstr) {
@@ -334,14 +429,21 @@ nombre_delete(nomcmd * restrict cmdbuf, const char ** argstr) {
 		retc = NOM_INVALID;
 		return(retc);
 	}
-	memccpy(cmdbuf->defdata[NOMBRE_DBTERM], *argstr, 0, (size_t)DEFLEN); argstr++;
-	upcase(cmdbuf->defdata[NOMBRE_DBTERM]);
 	if (isgrp(cmdbuf)) {
-		/* TODO: Add group logic */
+		memccpy(cmdbuf->defdata[NOMBRE_DBCATG], *argstr, 0, (size_t)DEFLEN); argstr++;
+		nom_normterm(cmdbuf->defdata[NOMBRE_DBCATG]);
+		if ((retc = grpcat(cmdbuf)) == NOM_OK && cmdbuf->catid == -1) {
+			NOMERR("%s\n", "UNCAT holds whatever is left over and can't be removed!");
+			retc = NOM_INVALID;
+		}
 	} else {
-		/* XXX: Will not handle the altdefs table in this state */
-		retc = snprintf(cmdbuf->gensql, (size_t)DEFLEN, "DELETE FROM definitions WHERE term=\'%s\';", cmdbuf->defdata[NOMBRE_DBTERM]);
-		retc = (retc > 0) ? retc ^ retc: retc; /* Set to 0 for assumed success */
+		/* Patterns are normalized too, they match against stored terms */
+		memccpy(cmdbuf->defdata[NOMBRE_DBTERM], *argstr, 0, (size_t)DEFLEN); argstr++;
+		nom_normterm(cmdbuf->defdata[NOMBRE_DBTERM]);
+	}
+	if (retc == NOM_OK && *argstr != NULL) {
+		NOMERR("Invalid number of arguments for %s!\n", __func__);
+		retc = BADARGS;
 	}
 	return(retc);
 }
@@ -434,91 +536,175 @@ nombre_newgrp(nomcmd * restrict cmdbuf, const char ** restrict args) {
 	return(retc);
 }
 
-/* 
- * Generate the appropriate SQL for inserting an alternate definition
+/*
+ * Correct an existing entry in place. The primary definition is updated
+ * unless --alt picked an alternate, and the group form also moves the entry
+ * into the named category. With no new text the meaning is left alone, so
+ * "grp upd NET tcp" only recategorizes the term.
  */
 int
-nombre_altdef(nomcmd * restrict cmdbuf) {
+nombre_update(nomcmd * restrict cmdbuf, const char ** restrict args) {
 	int retc;
-	char defstr[DEFLEN];
-	retc = 0;
+	char *defstr;
+	retc = 1;
+	defstr = NULL;
 
 	if (dbg) {
-		NOMDBG("Entering with cmbduf = %p\n", (void *)cmdbuf);
+		NOMDBG("Entering with cmdbuf = %p, args = %p\n", (void *)cmdbuf, (const void *)args);
+	}
+	if ((cmdbuf == NULL) || (*args == NULL)) {
+		NOMERR("%s\n", "Invalid Arguments!");
+		return(BADARGS);
 	}
+	defstr = cmdbuf->defdata[NOMBRE_DBDEFN];
+	memset(defstr, 0, (size_t)DEFLEN);
+	cmdbuf->defdata[NOMBRE_DBCATG][0] = 0;
 
-	/* This should not be possible! */
-	if (cmdbuf == NULL) {
-		retc = NOM_INVALID;
-		NOMERR("%s","Invalid arguments! Bailing out...");
-	} else {
-		/* Obviously, we're here due to a constraint issue, so we can optimize out a few other checks */
-		if (extract_defstring(cmdbuf->gensql, defstr) < 0) {
-			NOMERR("%s","Something went wrong extracting the definition!\n");
-			return(NOM_FAIL);
-		} else {
-			if (dbg) {
-				NOMDBG("Deleting invalid SQL at %p\n", (void *)cmdbuf->gensql);
-			}
-			memset(cmdbuf->gensql, 0, (size_t)PATHMAX);
-		}
-		if (isgrp(cmdbuf)) {
-			retc = snprintf(cmdbuf->gensql, (size_t)PATHMAX, "INSERT INTO altdefs VALUES (\'%s\',"
-						 "(SELECT (SELECT MAX(defno) FROM altdefs WHERE term like \'%s\' + 1) IS NOT NULL OR 1),"
-						 "\'%s\', (SELECT id FROM categories WHERE name ilike \'%s\');",
-						 cmdbuf->defdata[NOMBRE_DBTERM], cmdbuf->defdata[NOMBRE_DBTERM], cmdbuf->defdata[NOMBRE_DBCATG], defstr);
-		} else {
-			retc = snprintf(cmdbuf->gensql, (size_t)PATHMAX, "INSERT INTO altdefs VALUES (\'%s\',"
-					"(SELECT SELECT MAX(defno) FROM altdefs WHERE term like \'%s\') + 1 or 1) IS NOT NULL OR 1),"
-					"\'%s\', -1);", cmdbuf->defdata[NOMBRE_DBTERM], cmdbuf->defdata[NOMBRE_DBTERM], defstr);
+	if (isgrp(cmdbuf)) {
+		memccpy(cmdbuf->defdata[NOMBRE_DBCATG], *args, 0, (size_t)DEFLEN); args++;
+		nom_normterm(cmdbuf->defdata[NOMBRE_DBCATG]);
+		if (*args == NULL) {
+			NOMERR("Invalid number of arguments for %s!\n", __func__);
+			return(BADARGS);
+		} else if (grpcat(cmdbuf) != NOM_OK) {
+			return(NOM_INVALID);
 		}
 	}
+	memccpy(cmdbuf->defdata[NOMBRE_DBTERM], *args, 0, (size_t)DEFLEN); args++;
+	nom_normterm(cmdbuf->defdata[NOMBRE_DBTERM]);
+	if (flatdef(defstr, args) != NOM_OK) {
+		NOMERR("Definition for %s is over %d bytes!\n", cmdbuf->defdata[NOMBRE_DBTERM], DEFLEN - 1);
+		return(BADARGS);
+	}
+	if (*defstr == 0 && cmdbuf->defdata[NOMBRE_DBCATG][0] == 0) {
+		NOMERR("Nothing to update for %s!\n", cmdbuf->defdata[NOMBRE_DBTERM]);
+		return(BADARGS);
+	}
+
+	retc = snprintf(cmdbuf->gensql, (size_t)PATHMAX, "%s", (cmdbuf->defno > 0) ? NOMBRE_UPD_ALTDEF : NOMBRE_UPD_PRIMARY);
+	retc = (retc > 0) ? 0 : retc;
 	if (dbg) {
-		NOMDBG("Returning %d to caller with regenerated SQL: %s\n", retc, cmdbuf->gensql);
+		NOMDBG("Returning %d to caller with gensql = %s\n", retc, cmdbuf->gensql);
 	}
-	retc = (retc > 0) ? retc ^ retc : retc;
 	return(retc);
 }
 
 /*
- * This function is meant explicitly to grab the definition string from an already generated query 
+ * Split one line of an update file into the command buffer.
+ * Records are tab separated as: term, defno, category, meaning
+ * where an empty (or 0) defno targets the primary definition and
+ * empty category/meaning fields are left unchanged.
  */
-static inline int
-extract_defstring(const char * restrict sql, char * restrict defstr) {
-	register char *i, *j, *defstart;
-	register int_fast8_t retc;
-	/* XXX: I don't remember why I allocated j, so this will need to be refactored a bit later */
-	i = NULL; j = NULL; defstart = NULL;
-	retc = 0;
-
-	if (dbg) {
-		NOMDBG("Entering with sql = %s, defstr = %p\n", sql, (void *)defstr);
+int
+nombre_updrec(nomcmd * restrict cmdbuf, char * restrict line) {
+	char *field[4], *end;
+	register int_fast8_t i;
+
+	if (cmdbuf == NULL || line == NULL) {
+		return(BADARGS);
+	}
+	/* Drop the line terminator, including any CR from DOS-style files */
+	line[strcspn(line, "\r\n")] = 0;
+	for (i = 0, field[0] = line; i < 3 && field[i] != NULL; i++) {
+		if ((end = strchr(field[i], '\t')) != NULL) {
+			*end++ = 0;
+		}
+		field[i + 1] = end;
 	}
-	/* This should not be possible as both are arrays with static allocation */
-	if (sql == NULL || defstr == NULL) {
-		NOMERR("%s","This should not be possible, passed invalid arguments!");
+	if (field[3] == NULL || *field[0] == 0) {
 		return(NOM_INVALID);
 	}
-	for (i = (char *)&sql[33], defstart = defstr; *i != 0; i++) {
-		if (*i == ',') {
-			j = i+2; /* Should be the start of the definition string */
-			i = j;
-		} else if (j != NULL) {
-			if (*i == 0x27) { break; } /* Exit loop after hitting the next apostrophe */
-			*defstr = *i; defstr++;
-			retc++; /* Keep count of how many bytes have been copied */
-		}
+	/* Rather than cut a field short, and leave it unterminated in defdata */
+	if (strlen(field[0]) >= DEFLEN || strlen(field[2]) >= DEFLEN || strlen(field[3]) >= DEFLEN) {
+		NOMERR("Fields of an update record must be shorter than %d bytes!\n", DEFLEN);
+		return(NOM_INVALID);
 	}
-	*defstr = 0; /* Ensure NUL termination */
-	defstr = defstart;
-	if (retc > 0 && dbg) {
-		/* Success, hopefully */
-		NOMDBG("Copied %d characters: %s\n", retc, defstart);
-	} else {
-		NOMINF("Extracted definition as: %s\n", defstr);
-		retc ^= retc;
+
+	memccpy(cmdbuf->defdata[NOMBRE_DBTERM], field[0], 0, (size_t)DEFLEN);
+	memccpy(cmdbuf->defdata[NOMBRE_DBCATG], field[2], 0, (size_t)DEFLEN);
+	memccpy(cmdbuf->defdata[NOMBRE_DBDEFN], field[3], 0, (size_t)DEFLEN);
+	nom_normterm(cmdbuf->defdata[NOMBRE_DBTERM]);
+	nom_normterm(cmdbuf->defdata[NOMBRE_DBCATG]);
+	if (*field[2] != 0 && grpcat(cmdbuf) != NOM_OK) {
+		return(NOM_INVALID);
+	}
+	cmdbuf->defno = strtoll(field[1], &end, 10);
+	return((*end == 0 && cmdbuf->defno >= 0) ? NOM_OK : NOM_INVALID);
+}
+
+/*
+ * Pull any --options out of the subcommand arguments, compacting the
+ * remaining arguments in place so the builders never see them.
+ * A bare "--" ends option processing.
+ */
+int
+nombre_opts(nomcmd * restrict cmdbuf, const char ** restrict args) {
+	int retc;
+	int64_t num;
+	const char **keep;
+	retc = NOM_OK;
+
+	if (cmdbuf == NULL || args == NULL) {
+		return(BADARGS);
 	}
+	for (keep = args; *args != NULL; args++) {
+		if (strncmp(*args, "--", 2) != 0) {
+			*keep++ = *args;
+		} else if ((*args)[2] == 0) {
+			for (args++; *args != NULL; args++) {
+				*keep++ = *args;
+			}
+			break;
+		} else if (strcmp(*args, "--alt") == 0 && *(args + 1) != NULL) {
+			retc = (optnum(*++args, &cmdbuf->defno) == NOM_OK) ? retc : BADARGS;
+		} else if (strcmp(*args, "--limit") == 0 && *(args + 1) != NULL) {
+			retc = (optnum(*++args, &cmdbuf->limit) == NOM_OK) ? retc : BADARGS;
+		} else if (strcmp(*args, "--after") == 0 && *(args + 1) != NULL) {
+			/* Listings never take a term of their own, so the keyset cursor lives there */
+			memccpy(cmdbuf->defdata[NOMBRE_DBTERM], *++args, 0, (size_t)DEFLEN);
+		} else if (strcmp(*args, "--jobs") == 0 && *(args + 1) != NULL) {
+			if (optnum(*++args, &num) == NOM_OK && num <= UINT_MAX) {
+				cmdbuf->jobs = (unsigned int)num;
+			} else {
+				BADFLAG(*args);
+				retc = BADARGS;
+			}
+		} else if (strcmp(*args, "--regex") == 0) {
+			cmdbuf->regex = 1;
+		} else if (strcmp(*args, "--merge") == 0) {
+			cmdbuf->merge = 1;
+		} else if (strcmp(*args, "--since") == 0 && *(args + 1) != NULL) {
+			retc = (optnum(*++args, &cmdbuf->since) == NOM_OK) ? retc : BADARGS;
+		} else if (strcmp(*args, "--upto") == 0 && *(args + 1) != NULL) {
+			retc = (optnum(*++args, &cmdbuf->upto) == NOM_OK) ? retc : BADARGS;
+		} else if (strcmp(*args, "--apply") == 0) {
+			cmdbuf->chgop = NOMBRE_CHG_APPLY;
+		} else if (strcmp(*args, "--compact") == 0) {
+			cmdbuf->chgop = NOMBRE_CHG_COMPACT;
+		} else if (strcmp(*args, "--pull") == 0) {
+			cmdbuf->cmpop = NOMBRE_CMP_PULL;
+		} else if (strcmp(*args, "--digest") == 0) {
+			cmdbuf->cmpop = NOMBRE_CMP_DIGEST;
+		} else if (strcmp(*args, "--rebuild") == 0) {
+			cmdbuf->sumop = NOMBRE_SUM_REBUILD;
+		} else if (strcmp(*args, "--like") == 0) {
+			cmdbuf->delop = NOMBRE_DEL_LIKE;
+		} else if (strcmp(*args, "--glob") == 0) {
+			cmdbuf->delop = NOMBRE_DEL_GLOB;
+		} else if (strcmp(*args, "--follow") == 0) {
+			cmdbuf->impop = NOMBRE_IMP_FOLLOW;
+		} else if (strcmp(*args, "--chunk") == 0 && *(args + 1) != NULL) {
+			retc = (optnum(*++args, &cmdbuf->chunk) == NOM_OK) ? retc : BADARGS;
+		} else {
+			BADFLAG(*args);
+			retc = BADARGS;
+		}
+	}
+	*keep = NULL;
 
+	if (dbg) {
+		NOMDBG("Returning %d to caller with defno = %lld, limit = %lld\n", retc, (long long)cmdbuf->defno, (long long)cmdbuf->limit);
+	}
 	return(retc);
 }
 
@@ -531,17 +717,53 @@ isgrp(const nomcmd * restrict cmd) {
 	return(((cmd->command & grpcmd) == grpcmd) ? true : false);
 }
 
-/* 
- * Simple in-place modification of a string 
- * capitalize all letters detected
- * Simply unset the 6th bit if we find a letter.
- * NOTE: This method only works for ASCII text, will need 
- * to be refactored to support UTF-8 in the future
+/*
+ * Resolve the category named in defdata[NOMBRE_DBCATG] into cmd->catid
+ * using the per-connection category map
  */
-static inline void
-upcase(char * restrict str) {
-	register uint_fast16_t i = 0;
-	for (; str[i] != 0; i++) {
-		str[i] = (str[i] >= 'a' && str[i] <= 'z') ? str[i] ^ 0x20 : str[i];
+static inline int
+grpcat(nomcmd * restrict cmd) {
+	int retc;
+	if ((retc = nom_catid(cmd, cmd->defdata[NOMBRE_DBCATG], &cmd->catid)) == NOM_INVALID) {
+		NOMERR("Unknown category \"%s\"!\n", cmd->defdata[NOMBRE_DBCATG]);
+	}
+	return(retc);
+}
+
+/* The value of a numeric --option: digits only, and not negative */
+static int
+optnum(const char * restrict arg, int64_t * restrict val) {
+	long long num;
+	char *end;
+
+	if (*arg < '0' || *arg > '9') {
+		BADFLAG(arg);
+		return(BADARGS);
+	}
+	errno = 0;
+	num = strtoll(arg, &end, 10);
+	if (*end != 0 || errno != 0) {
+		BADFLAG(arg);
+		return(BADARGS);
+	}
+	*val = (int64_t)num;
+	return(NOM_OK);
+}
+
+/* Join the remaining arguments with single spaces, BADARGS if they don't fit in DEFLEN */
+static int
+flatdef(char * restrict defstr, const char ** restrict args) {
+	int len;
+	size_t written;
+	written = 0;
+
+	for (; *args != NULL; args++) {
+		len = snprintf(&defstr[written], (size_t)DEFLEN - written, (written > 0) ? " %s" : "%s", *args);
+		if (len < 0 || (size_t)len >= (size_t)DEFLEN - written) {
+			defstr[0] = 0;
+			return(BADARGS);
+		}
+		written += (size_t)len;
 	}
+	return(NOM_OK);
 }
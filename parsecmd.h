@@ -38,10 +38,24 @@
 int parsecmd(nomcmd * restrict cmdbuf, const char * restrict arg);
 int nombre_lookup(nomcmd * restrict cmdbuf, const char ** restrict args);
 int nombre_newdef(nomcmd * restrict cmdbuf, const char ** restrict args);
-int nombre_altdef(nomcmd * restrict cmdbuf);
 int nombre_delete(nomcmd * restrict cmdbuf, const char ** restrict args);
 int nombre_addsrc(nomcmd * restrict cmdbuf, const char ** restrict args);
 int nombre_vquery(nomcmd * restrict cmdbuf, const char ** restrict args);
 int nombre_ksearch(nomcmd * restrict cmdbuf, const char ** restrict args);
 int nombre_dbdump(nomcmd * restrict cmdbuf, const char ** restrict args);
+int nombre_tophits(nomcmd * restrict cmdbuf, const char ** restrict args);
 int nombre_newgrp(nomcmd * restrict cmdbuf, const char ** restrict args);
+int nombre_update(nomcmd * restrict cmdbuf, const char ** restrict args);
+int nombre_updrec(nomcmd * restrict cmdbuf, char * restrict line);
+int nombre_opts(nomcmd * restrict cmdbuf, const char ** restrict args);
+
+/* 
+ * In-place corrections, shared by the command line and batch file paths.
+ * An empty :defn keeps the current meaning and a NULL :catid keeps the category.
+ */
+#define NOMBRE_UPD_PRIMARY "UPDATE definitions SET meaning = COALESCE(NULLIF(:defn, ''), meaning)," \
+	" category = COALESCE(:catid, category)" \
+	" WHERE term = :term;"
+#define NOMBRE_UPD_ALTDEF "UPDATE altdefs SET altdef = COALESCE(NULLIF(:defn, ''), altdef)," \
+	" category = COALESCE(:catid, category)" \
+	" WHERE termid = (SELECT id FROM definitions WHERE term = :term) AND defno = :defno;"
@@ -34,6 +34,7 @@
 
 #include <err.h>
 #include <errno.h>
+#include <signal.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdint.h>
@@ -51,6 +52,45 @@
 #ifndef NOMBRE_SUBNOM_H
 #include "subnom.h"
 #endif
+#ifndef NOMBRE_EXPORT_H
+#include "export.h"
+#endif
+#ifndef NOMBRE_IMPORT_H
+#include "import.h"
+#endif
+#ifndef NOMBRE_NOMHITS_H
+#include "nomhits.h"
+#endif
+#ifndef NOMBRE_CHGLOG_H
+#include "chglog.h"
+#endif
+#ifndef NOMBRE_NOMCMP_H
+#include "nomcmp.h"
+#endif
+#ifndef NOMBRE_NOMBLOOM_H
+#include "nombloom.h"
+#endif
+#ifndef NOMBRE_NOMSCAN_H
+#include "nomscan.h"
+#endif
+#ifndef NOMBRE_NOMTAGS_H
+#include "nomtags.h"
+#endif
+#ifndef NOMBRE_NOMBLOB_H
+#include "nomblob.h"
+#endif
+#ifndef NOMBRE_NOMSTATS_H
+#include "nomstats.h"
+#endif
+#ifndef NOMBRE_NOMDEL_H
+#include "nomdel.h"
+#endif
+#ifndef NOMBRE_NOMFOLLOW_H
+#include "nomfollow.h"
+#endif
+#ifndef NOMBRE_NOMTRACE_H
+#include "nomtrace.h"
+#endif
 
 extern char *__progname;
 extern char **environ;
@@ -72,15 +112,7 @@ buildcmd(nomcmd * restrict cmdbuf, const char ** restrict argstr) {
 		NOMDBG("Entering with cmdbuf = %p, argstr = %p, andmask = %X\n", (void *)cmdbuf, (const void *)argstr, andmask);
 	}
 	if ((cmdbuf == NULL) || (argstr == NULL)) {
-		retc = BADARGS;
-	} else {
-		/* Since we can't be sure we have a valid  database connection at this time, open one */
-		if (cmdbuf->dbcon == NULL) {
-			/* Likely use the functions in initdb.h to connect */
-			if ((retc = nom_getdbn(cmdbuf->filedata[NOMBRE_DBFILE])) == NOM_OK) {
-				retc = nom_dbconn(cmdbuf);
-			}
-		}
+		return(BADARGS);
 	}
 
 	retc = parsecmd(cmdbuf, *argstr++);
@@ -91,6 +123,38 @@ buildcmd(nomcmd * restrict cmdbuf, const char ** restrict argstr) {
 			argstr++;
 		}
 	}
+	/* Strip out any subcommand --options before the arguments are handed off */
+	if (nombre_opts(cmdbuf, argstr) != NOM_OK) {
+		return(BADARGS);
+	}
+	/* Since we can't be sure we have a valid  database connection at this time, open one */
+	if (cmdbuf->dbcon == NULL) {
+		/* Likely use the functions in initdb.h to connect */
+		if ((retc = nom_getdbn(cmdbuf->filedata[NOMBRE_DBFILE])) == NOM_OK) {
+			/* A term the filter has never seen is unknown without asking the database */
+			switch (cmdbuf->command) {
+				case (lookup):
+					nom_bloomprobe(cmdbuf, *argstr);
+					if (cmdbuf->bloom == NOMBRE_BLOOM_ABSENT) {
+						fprintf(stdout, "%s: unknown\n", *argstr);
+						return(NOM_OK);
+					}
+					break;
+				case (define):
+				case (delete):
+				case (update):
+					nom_bloomprobe(cmdbuf, NULL);
+					break;
+				default:
+					break;
+			}
+			retc = nom_dbconn(cmdbuf);
+		}
+		/* A bad config file or a failed migration stops here, not somewhere down the line */
+		if (retc != NOM_OK) {
+			return(retc);
+		}
+	}
 	/* 
 	 * Set our andmask to unset the 30th bit 
 	 * called functions will be able to check for this bit at entry
@@ -104,6 +168,11 @@ buildcmd(nomcmd * restrict cmdbuf, const char ** restrict argstr) {
 	switch (cmdbuf->command & andmask) {
 		case (lookup):
 			retc = nombre_lookup(cmdbuf, argstr);
+			/* Streamed out row by row, leaving nothing for runcmd() */
+			if (retc == NOM_OK) {
+				cmdbuf->gensql[0] = 0;
+				retc = nomdb_blobdef(cmdbuf);
+			}
 			break;
 		/*
 		 * This may be a bit deceptively named, but I'm sticking with it for now. 
@@ -112,19 +181,37 @@ buildcmd(nomcmd * restrict cmdbuf, const char ** restrict argstr) {
 		 */
 		case (define):
 			retc = nombre_newdef(cmdbuf, argstr);
+			/* A body from -f, or from stdin for "-", is written in pieces, leaving nothing for runcmd() */
+			if (retc == NOM_OK && (cmdbuf->filedata[NOMBRE_IOFILE][0] != 0 || strcmp(cmdbuf->defdata[NOMBRE_DBDEFN], "-") == 0)) {
+				cmdbuf->gensql[0] = 0;
+				retc = nomdb_blobadd(cmdbuf);
+			}
 			break;
 		case (search):
 			retc = nombre_ksearch(cmdbuf, argstr);
+			/* A plain substring is scanned for in parallel, leaving nothing for runcmd() */
+			if (retc == NOM_OK && (cmdbuf->command & grpcmd) == 0 && ! cmdbuf->regex && strpbrk(cmdbuf->defdata[NOMBRE_DBTERM], "%_") == NULL) {
+				cmdbuf->gensql[0] = 0;
+				retc = nomdb_scan(cmdbuf);
+			}
 			break;
 		case (delete):
 			retc = nombre_delete(cmdbuf, argstr);
+			/* Deleted a chunk per transaction, leaving nothing for runcmd() */
+			if (retc == NOM_OK) {
+				retc = nomdb_del(cmdbuf);
+			}
 			break;
 		case (new):
 			retc = nombre_newgrp(cmdbuf, argstr);
 			break;
 		case (import):
+			/* Read straight from the -f file, leaving nothing for runcmd() */
+			retc = (cmdbuf->impop == NOMBRE_IMP_FOLLOW) ? nomdb_follow(cmdbuf) : nomdb_impt(cmdbuf);
 			break;
 		case (export):
+			/* Written straight to the -f directory, leaving nothing for runcmd() */
+			retc = nomdb_expt(cmdbuf);
 			break;
 		case (dumpdb):
 			retc = nombre_dbdump(cmdbuf, argstr);
@@ -132,22 +219,76 @@ buildcmd(nomcmd * restrict cmdbuf, const char ** restrict argstr) {
 		case (addsrc):
 			break;
 		case (update):
+			/* A batch file is applied directly, leaving nothing for runcmd() */
+			if (cmdbuf->filedata[NOMBRE_IOFILE][0] != 0) {
+				retc = nomdb_updt(cmdbuf);
+			} else {
+				retc = nombre_update(cmdbuf, argstr);
+			}
 			break;
 		case (vquery):
 			break;
 		case (catscn):
 			break;
+		case (tophit):
+			/* Fold first so the listing includes every hit logged so far, a failed fold only leaves it stale */
+			nom_hitfold(cmdbuf);
+			retc = nombre_tophits(cmdbuf, argstr);
+			break;
+		case (chglog):
+			/* Works on the -f delta file directly, leaving nothing for runcmd() */
+			retc = nomdb_chg(cmdbuf);
+			break;
+		case (dbcomp):
+			/* Reports as it walks, leaving nothing for runcmd() */
+			retc = nomdb_cmp(cmdbuf);
+			break;
+		case (tagcmd):
+			/* Both forms print as they go, leaving nothing for runcmd() */
+			if ((cmdbuf->command & grpcmd) == grpcmd) {
+				retc = nomdb_tagquery(cmdbuf, argstr);
+			} else {
+				retc = nomdb_tag(cmdbuf, argstr);
+			}
+			break;
+		case (catsum):
+			/* Read straight from category_stats, leaving nothing for runcmd() */
+			retc = nomdb_sum(cmdbuf);
+			break;
 		/* 
 		 * Assume the user just didn't type "def" 
 		 * Push the pointer back to the first argument in the string
 		 */
 		default:
 			retc = nombre_lookup(cmdbuf, --argstr);
+			if (retc == NOM_OK) {
+				cmdbuf->gensql[0] = 0;
+				retc = nomdb_blobdef(cmdbuf);
+			}
 			break;
 	}
-	if (retc == 0) {
+	if (retc == 0 && cmdbuf->gensql[0] != 0) {
 		retc = runcmd(cmdbuf, (int)strlen(cmdbuf->gensql));
 	}
+	if (retc == 0) {
+		switch (cmdbuf->command) {
+			case (lookup):
+				if (cmdbuf->bloom == NOMBRE_BLOOM_STALE) {
+					nom_bloombuild(cmdbuf);
+				}
+				break;
+			case (define):
+				nom_bloomnote(cmdbuf, cmdbuf->defdata[NOMBRE_DBTERM]);
+				break;
+			case (delete):
+			case (update):
+				nom_bloomnote(cmdbuf, NULL);
+				break;
+			default:
+				break;
+		}
+	}
+	NOMTRACE("command/retc", cmdbuf->command, retc);
 	if (dbg) {
 		NOMDBG("Returning %d to caller\n", retc);
 	}
@@ -178,79 +319,88 @@ runcmd(nomcmd * restrict cmdbuf, int genlen) {
 		NOMERR("Error compiling SQL (%s)!\n", sqlite3_errstr(sqlite3_errcode(cmdbuf->dbcon)));
     goto EXIT;
 	}
+	if ((retc = bindcmd(cmdbuf, stmt)) != SQLITE_OK) {
+		NOMERR("Error binding parameters (%s)!\n", sqlite3_errmsg(cmdbuf->dbcon));
+		sqlite3_finalize(stmt);
+		goto EXIT;
+	}
 	/* 
 	 * Determine how to best proceed with processing the statement based on
 	 * the value of cmdbuf->command
 	 */
 	switch (cmdbuf->command & (unsigned int)(~grpcmd)) {
-		case (lookup):
-			retc = sqlite3_step(stmt);
+		case (define):
+			/* 
+			 * The insert either returns the new primary term, or is turned into
+			 * the next alternate by the definitions_altdef trigger and returns nothing
+			 */
+			if ((retc = sqlite3_step(stmt)) == SQLITE_ROW) {
+				if ((retc = sqlite3_step(stmt)) == SQLITE_DONE) {
+					if ((cmdbuf->command & grpcmd) == grpcmd) {
+						fprintf(stdout,"Added definition for %s/%s\n",cmdbuf->defdata[NOMBRE_DBCATG], cmdbuf->defdata[NOMBRE_DBTERM]);
+					} else {
+						fprintf(stdout,"Added definition for %s\n", cmdbuf->defdata[NOMBRE_DBTERM]);
+					}
+				}
+			} else if (retc == SQLITE_DONE) {
+				fprintf(stdout, "Added new alternative definition for %s\n", cmdbuf->defdata[NOMBRE_DBTERM]);
+			}
 			if (retc == SQLITE_DONE) {
-				fprintf(stdout,"%s: unknown\n", cmdbuf->defdata[NOMBRE_DBTERM]);
-				return(retc ^= retc);
+				retc ^= retc;
+			} else {
+				NOMERR("Error adding definition for %s (%s)!\n", cmdbuf->defdata[NOMBRE_DBTERM], sqlite3_errmsg(cmdbuf->dbcon));
 			}
-			for (register uint_fast16_t i = 1; retc == SQLITE_ROW; i++, retc = sqlite3_step(stmt)) {
-				if (i > 1) {
-					/* Because the size here is apparently inconsistent across platforms */
-#if defined(__linux__)
-					fprintf(stdout,"  #%u: %s\n",  i, sqlite3_column_text(stmt,0));
-#else
-					fprintf(stdout," #%u: %s\n", i, sqlite3_column_text(stmt,0));
-#endif
+			sqlite3_finalize(stmt);
+			break;
+		case (update):
+			if ((retc = sqlite3_step(stmt)) == SQLITE_DONE) {
+				if (sqlite3_changes(cmdbuf->dbcon) > 0) {
+					if (cmdbuf->defno > 0) {
+						fprintf(stdout, "Updated alternate #%lld for %s\n", (long long)cmdbuf->defno, cmdbuf->defdata[NOMBRE_DBTERM]);
+					} else {
+						fprintf(stdout, "Updated definition for %s\n", cmdbuf->defdata[NOMBRE_DBTERM]);
+					}
+					retc ^= retc;
 				} else {
-					fprintf(stdout,"%s: %s\n", cmdbuf->defdata[NOMBRE_DBTERM], sqlite3_column_text(stmt,0));
+					NOMERR("No matching entry for %s!\n", cmdbuf->defdata[NOMBRE_DBTERM]);
+					retc = NOM_FAIL;
 				}
+			} else {
+				NOMERR("Error updating %s (%s)!\n", cmdbuf->defdata[NOMBRE_DBTERM], sqlite3_errmsg(cmdbuf->dbcon));
 			}
-			retc ^= retc;
+			sqlite3_finalize(stmt);
 			break;
-		case (define):
+		case (dumpdb):
+			/* 
+			 * Take a closed pipe as EPIPE instead of dying, so the statement is
+			 * finalized and no more rows are read than were actually printed
+			 */
+			signal(SIGPIPE, SIG_IGN);
+			fprintf(stdout,"Here's what I know:\n");
 			retc = sqlite3_step(stmt);
-			if (retc == SQLITE_DONE) {
-				sqlite3_finalize(stmt);
-				if ((cmdbuf->command & grpcmd) == grpcmd) {
-					fprintf(stdout,"Added definition for %s/%s\n",cmdbuf->defdata[NOMBRE_DBCATG], cmdbuf->defdata[NOMBRE_DBTERM]);
-				} else {
-					fprintf(stdout,"Added definition for %s\n", cmdbuf->defdata[NOMBRE_DBTERM]);
-				}
-				retc ^= retc;
-			} else if (retc == SQLITE_CONSTRAINT) {
-				/* Definition already exists, reset VM and run altdef function */
-				sqlite3_reset(stmt); sqlite3_finalize(stmt);
-				sqltail = NULL; stmt = NULL;
-				retc = nombre_altdef(cmdbuf);
-				if (retc != 0) {
-					NOMERR("Error creating altdef for %s: returned: %d\n", cmdbuf->defdata[NOMBRE_DBTERM], retc);
+			for (; retc == SQLITE_ROW; retc = sqlite3_step(stmt)) {
+				if (fprintf(stdout,"  (%s/%s): %s\n", sqlite3_column_text(stmt,0), sqlite3_column_text(stmt,1), sqlite3_column_text(stmt,2)) < 0) {
 					break;
 				}
-				retc = sqlite3_prepare_v2(cmdbuf->dbcon, cmdbuf->gensql, -1, &stmt, &sqltail);
-				if (retc != SQLITE_OK) { NOMERR("%s %d\n", sqlite3_errstr(retc), retc); } /* Appears to solve a potential race condition */
-				retc = sqlite3_step(stmt);
-				if (retc == SQLITE_MISUSE) { NOMERR("%s","You dun fucked up in the SQL reset\n"); }
-				if (retc == SQLITE_DONE) {
-					fprintf(stdout, "Added new alternative definition for %s\n", cmdbuf->defdata[NOMBRE_DBTERM]);
-					retc ^= retc;
-				}
 			}
-			break;
-		case (delete):
-			retc = sqlite3_step(stmt);
-			if (retc == SQLITE_DONE) {
-				sqlite3_finalize(stmt);
-				if ((cmdbuf->command & grpcmd) == grpcmd) {
-					fprintf(stdout, "This path is not yet built.\n");
-				} else {
-					fprintf(stdout, "Deleted \"definitions\" entry for %s\n", cmdbuf->defdata[NOMBRE_DBTERM]);
+			if (fflush(stdout) != 0 || (retc == SQLITE_ROW && ferror(stdout))) {
+				if (dbg) {
+					NOMDBG("Stopped listing early (%s)\n", strerror(errno));
 				}
-				retc ^= retc;
+				retc = (errno == EPIPE) ? SQLITE_DONE : NOM_FIO_FAIL;
+			}
+			if (retc != SQLITE_DONE) {
+				NOMERR("Error processing command! (%s)\n", sqlite3_errstr(sqlite3_errcode(cmdbuf->dbcon)));
 			} else {
-				NOMERR("%s", sqlite3_errstr(retc));
+				retc ^= retc;
 			}
+			sqlite3_finalize(stmt);
 			break;
-		case (dumpdb):
-			fprintf(stdout,"Here's what I know:\n");
+		case (tophit):
+			fprintf(stdout,"Most looked up terms:\n");
 			retc = sqlite3_step(stmt);
 			for (; retc == SQLITE_ROW; retc = sqlite3_step(stmt)) {
-				fprintf(stdout,"  (%s/%s): %s\n", sqlite3_column_text(stmt,0), sqlite3_column_text(stmt,1), sqlite3_column_text(stmt,2));
+				fprintf(stdout,"  %8lld  %s\n", (long long)sqlite3_column_int64(stmt,1), sqlite3_column_text(stmt,0));
 			}
 			if (retc != SQLITE_DONE) {
 				NOMERR("Error processing command! (%s)\n", sqlite3_errstr(sqlite3_errcode(cmdbuf->dbcon)));
@@ -312,17 +462,101 @@ EXIT:
 	return(retc);
 }
 
+/*
+ * Bind whichever of the named parameters :term, :catg, :defn, :defno,
+ * :limit and :catid the generated statement uses, straight out of the command buffer.
+ * Statements without parameters are left untouched.
+ */
 int
-nomdb_impt(nomcmd * restrict cmdbuf) {
-	int retc;
-	retc = 0;
+bindcmd(const nomcmd * restrict cmdbuf, sqlite3_stmt * restrict stmt) {
+	int retc, idx;
+	const char *params[] = { ":term", ":catg", ":defn" };
+	retc = SQLITE_OK;
+
+	for (register int_fast8_t i = NOMBRE_DBTERM; i <= NOMBRE_DBDEFN && retc == SQLITE_OK; i++) {
+		if ((idx = sqlite3_bind_parameter_index(stmt, params[i])) > 0) {
+			retc = sqlite3_bind_text(stmt, idx, cmdbuf->defdata[i], -1, SQLITE_STATIC);
+		}
+	}
+	if (retc == SQLITE_OK && (idx = sqlite3_bind_parameter_index(stmt, ":defno")) > 0) {
+		retc = sqlite3_bind_int64(stmt, idx, cmdbuf->defno);
+	}
+	if (retc == SQLITE_OK && (idx = sqlite3_bind_parameter_index(stmt, ":limit")) > 0) {
+		retc = sqlite3_bind_int64(stmt, idx, (cmdbuf->limit > 0) ? cmdbuf->limit : -1);
+	}
+	/* An empty category name leaves :catid NULL */
+	if (retc == SQLITE_OK && (idx = sqlite3_bind_parameter_index(stmt, ":catid")) > 0) {
+		retc = (cmdbuf->defdata[NOMBRE_DBCATG][0] != 0) ? sqlite3_bind_int64(stmt, idx, cmdbuf->catid) : sqlite3_bind_null(stmt, idx);
+	}
+	return(retc);
+}
+
+/*
+ * Apply every correction in the -f file inside a single transaction, so a
+ * bad record leaves the database untouched. See nombre_updrec() for the format,
+ * blank lines and lines starting with '#' are skipped.
+ */
+int
+nomdb_updt(nomcmd * restrict cmdbuf) {
+	int retc, changed;
+	unsigned int lineno;
+	char line[BUFSIZE];
+	FILE *updfile;
+	sqlite3_stmt *stmt[2], *cur;
+	retc = 0; changed = 0; lineno = 0;
+	updfile = NULL;
+	stmt[0] = stmt[1] = cur = NULL;
+
 	if (dbg) {
 		NOMDBG("Entering with cmdbuf = %p\n", (void *)cmdbuf);
 	}
-	if (cmdbuf == NULL) {
+	if (cmdbuf == NULL || cmdbuf->dbcon == NULL) {
 		NOMERR("%s", "Given invalid input!\n");
-		retc = BADARGS;
+		return(BADARGS);
+	}
+	if ((updfile = fopen(cmdbuf->filedata[NOMBRE_IOFILE], "r")) == NULL) {
+		NOMERR("Unable to open %s! (%s)\n", cmdbuf->filedata[NOMBRE_IOFILE], strerror(errno));
+		return(NOM_FIO_FAIL);
+	}
+	if ((retc = sqlite3_prepare_v2(cmdbuf->dbcon, NOMBRE_UPD_PRIMARY, -1, &stmt[0], NULL)) != SQLITE_OK ||
+			(retc = sqlite3_prepare_v2(cmdbuf->dbcon, NOMBRE_UPD_ALTDEF, -1, &stmt[1], NULL)) != SQLITE_OK ||
+			(retc = sqlite3_exec(cmdbuf->dbcon, "BEGIN IMMEDIATE;", NULL, NULL, NULL)) != SQLITE_OK) {
+		NOMERR("Error preparing batch update (%s)!\n", sqlite3_errmsg(cmdbuf->dbcon));
+		goto UPDT_EXIT;
+	}
+
+	while (retc == SQLITE_OK && fgets(line, BUFSIZE, updfile) != NULL) {
+		lineno++;
+		if (*line == '#' || *line == '\n' || *line == 0) {
+			continue;
+		}
+		if (nombre_updrec(cmdbuf, line) != NOM_OK) {
+			NOMERR("%s:%u: malformed record!\n", cmdbuf->filedata[NOMBRE_IOFILE], lineno);
+			retc = NOM_INVALID;
+			break;
+		}
+		cur = stmt[(cmdbuf->defno > 0)];
+		if ((retc = bindcmd(cmdbuf, cur)) == SQLITE_OK && (retc = sqlite3_step(cur)) == SQLITE_DONE) {
+			changed += sqlite3_changes(cmdbuf->dbcon);
+			retc = SQLITE_OK;
+		} else {
+			NOMERR("%s:%u: %s\n", cmdbuf->filedata[NOMBRE_IOFILE], lineno, sqlite3_errmsg(cmdbuf->dbcon));
+		}
+		sqlite3_reset(cur);
+		sqlite3_clear_bindings(cur);
 	}
+
+	if (retc == SQLITE_OK && (retc = sqlite3_exec(cmdbuf->dbcon, "COMMIT;", NULL, NULL, NULL)) == SQLITE_OK) {
+		fprintf(stdout, "Updated %d entries from %s\n", changed, cmdbuf->filedata[NOMBRE_IOFILE]);
+	} else {
+		sqlite3_exec(cmdbuf->dbcon, "ROLLBACK;", NULL, NULL, NULL);
+		NOMERR("Rolled back all updates from %s\n", cmdbuf->filedata[NOMBRE_IOFILE]);
+	}
+
+UPDT_EXIT:
+	sqlite3_finalize(stmt[0]);
+	sqlite3_finalize(stmt[1]);
+	fclose(updfile);
 	if (dbg) {
 		NOMDBG("Returning %d to caller\n", retc);
 	}
@@ -45,4 +45,5 @@
  */
 int buildcmd(nomcmd * restrict cmdbuf, const char ** restrict argstr);
 int runcmd(nomcmd * restrict cmdbuf, int genlen);
-int nomdb_impt(nomcmd * restrict cmdbuf);
+int bindcmd(const nomcmd * restrict cmdbuf, sqlite3_stmt * restrict stmt);
+int nomdb_updt(nomcmd * restrict cmdbuf);
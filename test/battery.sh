@@ -4,10 +4,30 @@ DBNAME="test/nombre.db"
 DBISQL="nombre.sql"
 LOGFILE="test/log"
 RESULTS="test/results"
-TESTS="prepare initialize add_term read_term delete_term"
+TESTS="prepare initialize add_term read_term add_altdef update_term fold_term top_terms bloom_filter key_search key_regex tag_terms cat_summary mem_budget conf_profile export_db import_db follow_feed replicate_db compare_db blob_defs long_argdef delete_term delete_pattern retire_category"
 RET=0
 ADD_TERM="test"
 ADD_DEF="garbage test data"
+## Decomposed e + U+0301 on the way in, precomposed upper case on the way out
+FOLD_TERM="$(printf 'cafe\314\201')"
+FOLD_LOOKUP="$(printf 'CAF\303\211')"
+ALT_DEF="more garbage"
+UPD_DEF="corrected test data"
+KEY_REGEX="^GARBAGE .* data$"
+MISS_TERM="nosuchterm"
+BLOOM_TERM="filtered"
+EXPDIR="test/export"
+IMPDB="test/import.db"
+REPDB="test/replica.db"
+DELTA="test/nombre.delta"
+BLOB_TERM="runbook"
+BLOBFILE="test/runbook.txt"
+LONG_TERM="LONGARGS"
+DEL_GLOB="tmpterm*"
+RETIRE_CAT="SEC"
+CONFFILE="test/nombre.conf"
+FOLDB="test/follow.db"
+FEED="test/feed.tsv"
 
 initialize() {
 	## Test the initialization capabilities of nombre
@@ -56,15 +76,416 @@ read_term() {
 	return ${RET}
 }
 
+add_altdef() {
+	## Adding an existing term should file the meaning as an alternate
+	builtin echo -n "Validating alternate definitions... "
+	nombre -d "${DBNAME}" add ${ADD_TERM} ${ALT_DEF} 2>&1 >> "${LOGFILE}"
+	RET=$?
+	if [ ${RET} -eq 0 ]
+	then
+		RES=$(nombre -d "${DBNAME}" def ${ADD_TERM} 2>> "${LOGFILE}" | tail -n 1)
+		if [ "${RES}" = "  #2: ${ALT_DEF}" ]
+		then
+			builtin echo "Pass"
+		else
+			builtin echo "Fail"
+			RET=1
+		fi
+	else
+		builtin echo "Fail"
+	fi
+	return ${RET}
+}
+
+update_term() {
+	## Correct the primary definition in place
+	builtin echo -n "Validating in-place updates... "
+	nombre -d "${DBNAME}" upd ${ADD_TERM} ${UPD_DEF} 2>&1 >> "${LOGFILE}"
+	RET=$?
+	if [ ${RET} -eq 0 ]
+	then
+		RES=$(nombre -d "${DBNAME}" def ${ADD_TERM} 2>> "${LOGFILE}" | head -n 1)
+		if [ "${UPD_DEF}" = "${RES#${ADD_TERM}: }" ]
+		then
+			builtin echo "Pass"
+		else
+			builtin echo "Fail"
+			RET=1
+		fi
+	else
+		builtin echo "Fail"
+	fi
+	return ${RET}
+}
+
+fold_term() {
+	## Non-ASCII terms should be folded the same way on the way in and out
+	builtin echo -n "Validating UTF-8 term folding... "
+	nombre -d "${DBNAME}" add "${FOLD_TERM}" "${ADD_DEF}" 2>&1 >> "${LOGFILE}"
+	RET=$?
+	if [ ${RET} -eq 0 ]
+	then
+		RES=$(nombre -d "${DBNAME}" def "${FOLD_LOOKUP}" 2>> "${LOGFILE}")
+		RET=$?
+	fi
+	if [ ${RET} -eq 0 ] && [ "${ADD_DEF}" = "${RES#${FOLD_LOOKUP}: }" ]
+	then
+		builtin echo "Pass"
+	else
+		builtin echo "Fail"
+		RET=1
+	fi
+	return ${RET}
+}
+
+top_terms() {
+	## Earlier lookups should be folded in and listed by hit count
+	builtin echo -n "Validating lookup hit tracking... "
+	RES=$(nombre -d "${DBNAME}" top 2>> "${LOGFILE}")
+	RET=$?
+	if [ ${RET} -eq 0 ] && builtin echo "${RES}" | grep -q " TEST$"
+	then
+		builtin echo "Pass"
+	else
+		builtin echo "Fail"
+		RET=1
+	fi
+	return ${RET}
+}
+
+bloom_filter() {
+	## Earlier lookups leave a filter behind that answers misses and keeps up with new terms
+	builtin echo -n "Validating the term filter... "
+	RES=$(nombre -d "${DBNAME}" def ${MISS_TERM} 2>> "${LOGFILE}")
+	RET=$?
+	nombre -d "${DBNAME}" add ${BLOOM_TERM} "${ADD_DEF}" >> "${LOGFILE}" 2>> "${LOGFILE}"
+	if [ ${RET} -eq 0 ] && [ -f "${DBNAME}-bloom" ] && [ "${RES}" = "${MISS_TERM}: unknown" ] &&
+		[ "$(nombre -d "${DBNAME}" def ${BLOOM_TERM} 2>> "${LOGFILE}")" = "${BLOOM_TERM}: ${ADD_DEF}" ]
+	then
+		builtin echo "Pass"
+	else
+		builtin echo "Fail"
+		RET=1
+	fi
+	nombre -d "${DBNAME}" del ${BLOOM_TERM} >> "${LOGFILE}" 2>> "${LOGFILE}"
+	return ${RET}
+}
+
+key_search() {
+	## A plain keyword goes through the parallel scan and has to match the LIKE query exactly,
+	## which a single character wildcard in the same spot still runs
+	builtin echo -n "Validating keyword search... "
+	RES=$(nombre -d "${DBNAME}" key --jobs 2 "GARBAGE TEST" 2>> "${LOGFILE}")
+	RET=$?
+	if [ ${RET} -eq 0 ] && builtin echo "${RES}" | grep -q ": ${ADD_DEF}$" &&
+		[ "${RES}" = "$(nombre -d "${DBNAME}" key "GARBAGE_TEST" 2>> "${LOGFILE}")" ]
+	then
+		builtin echo "Pass"
+	else
+		builtin echo "Fail"
+		RET=1
+	fi
+	return ${RET}
+}
+
+key_regex() {
+	## The same entry has to turn up through a regex, on its own and within its group,
+	## while a pattern that does not compile is refused
+	builtin echo -n "Validating regex search... "
+	RES=$(nombre -d "${DBNAME}" key --regex "${KEY_REGEX}" 2>> "${LOGFILE}")
+	RET=$?
+	if [ ${RET} -eq 0 ] && builtin echo "${RES}" | grep -q ": ${ADD_DEF}$" &&
+		nombre -d "${DBNAME}" grp key uncat --regex "${KEY_REGEX}" 2>> "${LOGFILE}" | grep -q ": ${ADD_DEF}$" &&
+		! nombre -d "${DBNAME}" key --regex "(${KEY_REGEX}" >> "${LOGFILE}" 2>&1
+	then
+		builtin echo "Pass"
+	else
+		builtin echo "Fail"
+		RET=1
+	fi
+	return ${RET}
+}
+
+tag_terms() {
+	## Tagging the term into two more categories has to put it in their intersection,
+	## dropping one tag has to take it out again, and the term's own category can't be dropped
+	builtin echo -n "Validating category tags... "
+	RES=$(nombre -d "${DBNAME}" tag ${ADD_TERM} net sec 2>> "${LOGFILE}")
+	RET=$?
+	if [ ${RET} -eq 0 ] && [ "${RES}" = "TEST: UNCAT NET SEC" ] &&
+		nombre -d "${DBNAME}" grp tag net sec 2>> "${LOGFILE}" | grep -q "^  TEST: " &&
+		! nombre -d "${DBNAME}" grp tag net -sec 2>> "${LOGFILE}" | grep -q "^  TEST: " &&
+		nombre -d "${DBNAME}" tag ${ADD_TERM} -sec >> "${LOGFILE}" 2>&1 &&
+		! nombre -d "${DBNAME}" grp tag net sec 2>> "${LOGFILE}" | grep -q "^  TEST: " &&
+		nombre -d "${DBNAME}" grp tag net,sec uncat 2>> "${LOGFILE}" | grep -q "^  TEST: " &&
+		! nombre -d "${DBNAME}" tag ${ADD_TERM} -uncat >> "${LOGFILE}" 2>&1
+	then
+		builtin echo "Pass"
+	else
+		builtin echo "Fail"
+		RET=1
+	fi
+	return ${RET}
+}
+
+cat_summary() {
+	## The counts kept by the triggers should match a recount from scratch, alternates included
+	builtin echo -n "Validating category summaries... "
+	RES=$(nombre -d "${DBNAME}" sum 2>> "${LOGFILE}")
+	RET=$?
+	if [ ${RET} -eq 0 ] && [ "$(nombre -d "${DBNAME}" sum --rebuild 2>> "${LOGFILE}")" = "${RES}" ] &&
+		[ -n "$(builtin echo "${RES}" | awk '$NF == "UNCAT" && $2 > 0')" ]
+	then
+		builtin echo "Pass"
+	else
+		builtin echo "Fail"
+		RET=1
+	fi
+	return ${RET}
+}
+
+mem_budget() {
+	## A lookup under a tight memory budget should still work and report its usage
+	builtin echo -n "Validating memory budget... "
+	RES=$(nombre -m 1M -M -d "${DBNAME}" def ${ADD_TERM} 2>&1 >> "${LOGFILE}")
+	RET=$?
+	if [ ${RET} -eq 0 ] && [ "${RES#memory: budget 1048576,}" != "${RES}" ]
+	then
+		builtin echo "Pass"
+	else
+		builtin echo "Fail"
+		RET=1
+	fi
+	return ${RET}
+}
+
+conf_profile() {
+	## Keys given with a profile override it, and a setting that makes no sense stops the command
+	builtin echo -n "Validating config profiles... "
+	printf 'profile = fast\nsynchronous = full # commits stay durable\n' > "${CONFFILE}"
+	RES=$(NOMBRECONF="${CONFFILE}" nombre -D -d "${DBNAME}" def ${ADD_TERM} 2>&1 >> "${LOGFILE}" | grep "Settings")
+	RET=$?
+	printf 'synchronous = sometimes\n' > "${CONFFILE}"
+	if [ ${RET} -eq 0 ] && [ "${RES#*profile fast}" != "${RES}" ] && [ "${RES#*mmap_size=268435456 journal_size_limit=-1 synchronous=2}" != "${RES}" ] &&
+		! NOMBRECONF="${CONFFILE}" nombre -d "${DBNAME}" def ${ADD_TERM} >> "${LOGFILE}" 2>&1
+	then
+		builtin echo "Pass"
+	else
+		builtin echo "Fail"
+		RET=1
+	fi
+	rm -f "${CONFFILE}"
+	return ${RET}
+}
+
+export_db() {
+	## The merged export should hold the primary and alternate definitions of the term
+	builtin echo -n "Validating parallel export... "
+	rm -rf "${EXPDIR}"
+	nombre -d "${DBNAME}" -f "${EXPDIR}" exp --jobs 2 --merge 2>&1 >> "${LOGFILE}"
+	RET=$?
+	if [ ${RET} -eq 0 ] && [ $(grep -c "^TEST	" "${EXPDIR}/nombre.tsv") -eq 2 ]
+	then
+		builtin echo "Pass"
+	else
+		builtin echo "Fail"
+		RET=1
+	fi
+	return ${RET}
+}
+
+import_db() {
+	## Loading the export into a fresh database should restore the term with its alternate
+	builtin echo -n "Validating pipelined import... "
+	rm -f "${IMPDB}" "${IMPDB}-hits" "${IMPDB}-bloom"
+	nombre -Ii "${DBISQL}" -d "${IMPDB}" >> "${LOGFILE}" 2>> "${LOGFILE}"
+	nombre -d "${IMPDB}" -f "${EXPDIR}/nombre.tsv" imp 2>&1 >> "${LOGFILE}"
+	RET=$?
+	if [ ${RET} -eq 0 ] && [ "$(nombre -d "${IMPDB}" def ${ADD_TERM} 2>> "${LOGFILE}" | tail -n 1)" = "  #2: ${ALT_DEF}" ]
+	then
+		builtin echo "Pass"
+	else
+		builtin echo "Fail"
+		RET=1
+	fi
+	rm -rf "${EXPDIR}" "${IMPDB}" "${IMPDB}-hits" "${IMPDB}-bloom"
+	return ${RET}
+}
+
+follow_feed() {
+	## Lines appended to a followed file should be looked up within seconds, and a restart should resume after them
+	builtin echo -n "Validating followed imports... "
+	rm -f "${FOLDB}" "${FOLDB}-hits" "${FOLDB}-bloom" "${FEED}"
+	nombre -Ii "${DBISQL}" -d "${FOLDB}" >> "${LOGFILE}" 2>> "${LOGFILE}"
+	: > "${FEED}"
+	nombre -d "${FOLDB}" -f "${FEED}" imp --follow >> "${LOGFILE}" 2>> "${LOGFILE}" &
+	FOLPID=$!
+	printf '%s\t\t%s\n' "${ADD_TERM}" "${ADD_DEF}" >> "${FEED}"
+	for i in 1 2 3 4 5
+	do
+		sleep 1
+		[ "$(nombre -d "${FOLDB}" def ${ADD_TERM} 2>> "${LOGFILE}")" = "${ADD_TERM}: ${ADD_DEF}" ] && break
+	done
+	## The unfinished line has to wait for the next follower
+	printf '%s\t\t%s' "${BLOOM_TERM}" "${ALT_DEF}" >> "${FEED}"
+	sleep 1
+	kill ${FOLPID}
+	wait ${FOLPID}
+	RET=$?
+	printf '\n' >> "${FEED}"
+	nombre -d "${FOLDB}" -f "${FEED}" imp --follow >> "${LOGFILE}" 2>> "${LOGFILE}" &
+	FOLPID=$!
+	for i in 1 2 3 4 5
+	do
+		sleep 1
+		[ "$(nombre -d "${FOLDB}" def ${BLOOM_TERM} 2>> "${LOGFILE}")" = "${BLOOM_TERM}: ${ALT_DEF}" ] && break
+	done
+	kill ${FOLPID}
+	wait ${FOLPID}
+	if [ ${RET} -eq 0 ] && [ "$(nombre -d "${FOLDB}" def ${BLOOM_TERM} 2>> "${LOGFILE}")" = "${BLOOM_TERM}: ${ALT_DEF}" ] &&
+		[ "$(nombre -d "${FOLDB}" def ${ADD_TERM} 2>> "${LOGFILE}")" = "${ADD_TERM}: ${ADD_DEF}" ]
+	then
+		builtin echo "Pass"
+	else
+		builtin echo "Fail"
+		RET=1
+	fi
+	rm -f "${FOLDB}" "${FOLDB}-hits" "${FOLDB}-bloom" "${FEED}"
+	return ${RET}
+}
+
+replicate_db() {
+	## Applying a delta of every change so far should bring a fresh database up to date, twice over
+	builtin echo -n "Validating change log deltas... "
+	rm -f "${REPDB}" "${REPDB}-hits" "${REPDB}-bloom" "${DELTA}"
+	nombre -Ii "${DBISQL}" -d "${REPDB}" >> "${LOGFILE}" 2>> "${LOGFILE}"
+	nombre -d "${DBNAME}" -f "${DELTA}" chg --since 0 2>&1 >> "${LOGFILE}" &&
+		nombre -d "${REPDB}" -f "${DELTA}" chg --apply 2>&1 >> "${LOGFILE}" &&
+		nombre -d "${REPDB}" -f "${DELTA}" chg --apply 2>&1 >> "${LOGFILE}"
+	RET=$?
+	if [ ${RET} -eq 0 ] && [ "$(nombre -d "${REPDB}" def ${ADD_TERM} 2>> "${LOGFILE}" | tail -n 1)" = "  #2: ${ALT_DEF}" ]
+	then
+		builtin echo "Pass"
+	else
+		builtin echo "Fail"
+		RET=1
+	fi
+	rm -f "${REPDB}" "${REPDB}-hits" "${REPDB}-bloom" "${DELTA}"
+	return ${RET}
+}
+
+compare_db() {
+	## A term changed on one side only should be the single difference found, and pulling it should settle it
+	builtin echo -n "Validating database comparison... "
+	rm -f "${REPDB}" "${REPDB}-hits" "${REPDB}-bloom"
+	cp "${DBNAME}" "${REPDB}"
+	nombre -d "${REPDB}" upd ${ADD_TERM} "${ALT_DEF}" >> "${LOGFILE}" 2>> "${LOGFILE}"
+	RES=$(nombre -d "${DBNAME}" -f "${REPDB}" cmp 2>> "${LOGFILE}")
+	RET=$?
+	if [ ${RET} -eq 0 ] && [ "$(builtin echo "${RES}" | head -n 1)" = "! TEST" ] &&
+		nombre -d "${DBNAME}" -f "${REPDB}" cmp --pull >> "${LOGFILE}" 2>> "${LOGFILE}" &&
+		[ "$(nombre -d "${DBNAME}" -f "${REPDB}" cmp 2>> "${LOGFILE}")" = "0 only here, 0 only in ${REPDB}, 0 changed" ]
+	then
+		builtin echo "Pass"
+	else
+		builtin echo "Fail"
+		RET=1
+	fi
+	rm -f "${REPDB}" "${REPDB}-hits" "${REPDB}-bloom"
+	return ${RET}
+}
+
+blob_defs() {
+	## A body read from a file or stdin comes back byte for byte, even when it's larger than the memory budget
+	builtin echo -n "Validating streamed definitions... "
+	seq 1 400000 > "${BLOBFILE}"
+	nombre -d "${DBNAME}" -f "${BLOBFILE}" add ${BLOB_TERM} 2>&1 >> "${LOGFILE}"
+	RET=$?
+	seq 1 10 | nombre -d "${DBNAME}" add ${BLOB_TERM} - 2>&1 >> "${LOGFILE}"
+	RET=$(( ${RET} + $? ))
+	RES=$(nombre -m 1M -d "${DBNAME}" def ${BLOB_TERM} 2>> "${LOGFILE}" | cksum)
+	EXP=$({ printf '%s: ' "${BLOB_TERM}"; cat "${BLOBFILE}"; printf '\n  #2: '; seq 1 10; echo; } | cksum)
+	if [ ${RET} -eq 0 ] && [ "${RES}" = "${EXP}" ]
+	then
+		builtin echo "Pass"
+	else
+		builtin echo "Fail"
+		RET=1
+	fi
+	rm -f "${BLOBFILE}"
+	return ${RET}
+}
+
+long_argdef() {
+	## A definition on the command line longer than DEFLEN is refused, not truncated or written past the buffer
+	builtin echo -n "Validating over-long argument definitions... "
+	LONG_DEF=$(printf 'word%.0s ' $(seq 1 300))
+	nombre -d "${DBNAME}" add ${LONG_TERM} ${LONG_DEF} >> "${LOGFILE}" 2>&1
+	RET=$?
+	nombre -d "${DBNAME}" upd ${ADD_TERM} ${LONG_DEF} >> "${LOGFILE}" 2>&1
+	UPD=$?
+	RES=$(nombre -d "${DBNAME}" def ${LONG_TERM} 2>> "${LOGFILE}")
+	## Both have to fail with BADARGS (-1), anything else could be a crash
+	if [ ${RET} -eq 255 ] && [ ${UPD} -eq 255 ] && [ "${RES}" = "${LONG_TERM}: unknown" ]
+	then
+		builtin echo "Pass"
+		RET=0
+	else
+		builtin echo "Fail"
+		RET=1
+	fi
+	return ${RET}
+}
+
 delete_term() {
-	## Verify term deletion works appropriately
+	## Verify term deletion works appropriately, taking the alternates along
 	builtin echo -n "Validating deletion code... "
 	RES=$(nombre -d "${DBNAME}" del "${ADD_TERM}" 2>&1 >> "${LOGFILE}")
-	if [ ${RET} -eq 0 ]
+	RET=$?
+	if [ ${RET} -eq 0 ] && [ "$(nombre -d "${DBNAME}" def "${ADD_TERM}" 2>> "${LOGFILE}")" = "${ADD_TERM}: unknown" ]
+	then
+		builtin echo "Pass"
+	else
+		builtin echo "Fail"
+		RET=1
+	fi
+	return ${RET}
+}
+
+delete_pattern() {
+	## Every matching term should go, a couple of chunks at a time, and nothing else
+	builtin echo -n "Validating chunked pattern deletion... "
+	for i in 1 2 3 4 5; do nombre -d "${DBNAME}" add "tmpterm${i}" scratch ${i} 2>&1 >> "${LOGFILE}"; done
+	RES=$(nombre -d "${DBNAME}" del --glob "${DEL_GLOB}" --chunk 2 2>> "${LOGFILE}")
+	RET=$?
+	if [ ${RET} -eq 0 ] && [ "${RES#Deleted 5 terms matching}" != "${RES}" ] &&
+		[ "$(nombre -d "${DBNAME}" def tmpterm3 2>> "${LOGFILE}")" = "tmpterm3: unknown" ] &&
+		nombre -d "${DBNAME}" def "${BLOB_TERM}" 2>&1 >> "${LOGFILE}"
+	then
+		builtin echo "Pass"
+	else
+		builtin echo "Fail"
+		RET=1
+	fi
+	return ${RET}
+}
+
+retire_category() {
+	## A retired category should be gone from the summary with its terms kept under UNCAT
+	builtin echo -n "Validating category retirement... "
+	UNCAT=$(nombre -d "${DBNAME}" sum 2>> "${LOGFILE}" | awk '$NF == "UNCAT" { print $1 }')
+	MOVED=$(nombre -d "${DBNAME}" sum 2>> "${LOGFILE}" | awk -v cat="${RETIRE_CAT}" '$NF == cat { print $1 }')
+	nombre -d "${DBNAME}" grp del "${RETIRE_CAT}" 2>&1 >> "${LOGFILE}"
+	RET=$?
+	RES=$(nombre -d "${DBNAME}" sum 2>> "${LOGFILE}")
+	if [ ${RET} -eq 0 ] && [ -n "${MOVED}" ] && [ -z "$(builtin echo "${RES}" | awk -v cat="${RETIRE_CAT}" '$NF == cat')" ] &&
+		[ "$(builtin echo "${RES}" | awk '$NF == "UNCAT" { print $1 }')" -eq $((UNCAT + MOVED)) ] &&
+		! nombre -d "${DBNAME}" grp del UNCAT 2>> "${LOGFILE}" >> "${LOGFILE}"
 	then
 		builtin echo "Pass"
 	else
 		builtin echo "Fail"
+		RET=1
 	fi
 	return ${RET}
 }
@@ -74,7 +495,7 @@ prepare() {
 	builtin echo -n "Verifying working POSIX-y shell... "
 	: > ${LOGFILE}
 	: > ${RESULTS}
-	rm -f ${DBNAME}
+	rm -f ${DBNAME} ${DBNAME}-hits ${DBNAME}-hits.fold ${DBNAME}-bloom
 	if [ $? -eq 0 ]; then builtin echo "Pass"; else builtin echo "Fail"; fi
 	return 0
 }
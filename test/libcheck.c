@@ -0,0 +1,248 @@
+/* 
+ * Copyright (c) 2019, Exile Heavy Industries
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted (subject to the limitations in the disclaimer
+ * below) provided that the following conditions are met:
+ * 
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ * 
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * 
+ * * Neither the name of the copyright holder nor the names of its contributors may be used
+ *   to endorse or promote products derived from this software without specific
+ *   prior written permission.
+ * 
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY THIS
+ * LICENSE. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+/*
+ * Exercise libnombre the way an embedding program would: several threads
+ * share one handle, with fewer connections in its pool than there are
+ * threads, each adding its own terms and reading them back through every
+ * call while the others write. Any mismatch is reported and fails the run.
+ *
+ * Usage: libcheck init.sql
+ */
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifndef NOMBRE_H
+#include "../nombre.h"
+#endif
+#ifndef NOMBRE_LIBNOMBRE_H
+#include "../libnombre.h"
+#endif
+
+#define CHECK_DB "test/libcheck.db"
+#define CHECK_THREADS 8
+#define CHECK_POOL 3
+#define CHECK_TERMS 50
+
+extern char *__progname;
+
+struct worker {
+	pthread_t thread;
+	nomlib *lib;
+	unsigned int id;
+	int fails;
+};
+
+/* What a callback saw, and when it should ask to stop */
+struct seen {
+	int64_t rows;
+	int64_t stopat;
+	int64_t lastdefno;
+	char meaning[DEFLEN];
+	char catg[DEFLEN];
+};
+
+static int mkcheckdb(const char *initsql);
+static void *work(void *arg);
+static int collect(void *arg, const char *catg, const char *term, const char *meaning, int64_t defno);
+
+int
+main(int ac, char **av) {
+	int retc, fails;
+	nomlib *lib;
+	struct worker workers[CHECK_THREADS];
+	struct seen seen;
+	fails = 0; lib = NULL;
+
+	if (ac != 2) {
+		fprintf(stderr, "usage: %s initsql\n", __progname);
+		return(BADARGS);
+	}
+	if (mkcheckdb(av[1]) != SQLITE_OK || (retc = nomlib_open(CHECK_DB, CHECK_POOL, &lib)) != NOM_OK) {
+		unlink(CHECK_DB);
+		return(NOM_FAIL);
+	}
+	memset(workers, 0, sizeof(workers));
+	for (unsigned int i = 0; i < CHECK_THREADS; i++) {
+		workers[i].lib = lib;
+		workers[i].id = i;
+		if (pthread_create(&workers[i].thread, NULL, work, &workers[i]) != 0) {
+			fprintf(stderr, "Unable to start thread #%u\n", i);
+			return(NOM_FAIL);
+		}
+	}
+	for (unsigned int i = 0; i < CHECK_THREADS; i++) {
+		pthread_join(workers[i].thread, NULL);
+		fails += workers[i].fails;
+	}
+
+	/* Every term every thread added, and nothing else with that prefix */
+	memset(&seen, 0, sizeof(seen));
+	if (nomlib_search(lib, NULL, "^libcheck [0-9]+ [0-9]+$", NOMLIB_REGEX, collect, &seen) != NOM_OK ||
+			seen.rows != CHECK_THREADS * CHECK_TERMS) {
+		fprintf(stderr, "regex search found %lld of %d terms\n", (long long)seen.rows, CHECK_THREADS * CHECK_TERMS);
+		fails++;
+	}
+	/* An unknown category is an error, not an empty result */
+	if (nomlib_lookup(lib, "NOSUCHCAT", "L0T0", collect, &seen) != NOM_INVALID) {
+		fprintf(stderr, "%s\n", "lookup in an unknown category did not fail");
+		fails++;
+	}
+
+	nomlib_close(lib);
+	unlink(CHECK_DB);
+	if (fails > 0) {
+		fprintf(stderr, "%d check(s) failed\n", fails);
+	} else {
+		fprintf(stdout, "[libcheck]: %d threads on %d connections passed\n", CHECK_THREADS, CHECK_POOL);
+	}
+	return((fails > 0) ? NOM_FAIL : NOM_OK);
+}
+
+static int
+mkcheckdb(const char *initsql) {
+	int retc;
+	FILE *in;
+	char *sql, *errmsg;
+	long len;
+	sqlite3 *db;
+	retc = SQLITE_ERROR; in = NULL; sql = errmsg = NULL; len = 0; db = NULL;
+
+	unlink(CHECK_DB);
+	if ((in = fopen(initsql, "r")) == NULL || fseek(in, 0, SEEK_END) != 0 || (len = ftell(in)) < 0 ||
+			fseek(in, 0, SEEK_SET) != 0 || (sql = calloc(1, (size_t)len + 1)) == NULL ||
+			fread(sql, 1, (size_t)len, in) != (size_t)len) {
+		perror(initsql);
+		goto MKCHECKDB_EXIT;
+	}
+	if ((retc = sqlite3_open(CHECK_DB, &db)) != SQLITE_OK || (retc = sqlite3_exec(db, sql, NULL, NULL, &errmsg)) != SQLITE_OK) {
+		fprintf(stderr, "%s: %s\n", initsql, (errmsg != NULL) ? errmsg : sqlite3_errstr(retc));
+	}
+
+MKCHECKDB_EXIT:
+	sqlite3_free(errmsg);
+	sqlite3_close(db);
+	free(sql);
+	if (in != NULL) {
+		fclose(in);
+	}
+	return(retc);
+}
+
+/*
+ * Add CHECK_TERMS terms, every other one in NET and each with an alternate,
+ * then read them back by lookup, search and listing
+ */
+static void *
+work(void *arg) {
+	struct worker *w;
+	struct seen seen;
+	char term[32], meaning[64], want[64], longarg[DEFLEN + 1];
+	w = arg;
+
+	for (unsigned int i = 0; i < CHECK_TERMS; i++) {
+		snprintf(term, sizeof(term), "l%ut%u", w->id, i);
+		snprintf(meaning, sizeof(meaning), "libcheck %u %u", w->id, i);
+		if (nomlib_add(w->lib, (i % 2) ? "net" : NULL, term, meaning) != NOM_OK ||
+				nomlib_add(w->lib, (i % 2) ? "NET" : NULL, term, "alternate") != NOM_OK) {
+			fprintf(stderr, "add of %s failed\n", term);
+			w->fails++;
+		}
+	}
+	for (unsigned int i = 0; i < CHECK_TERMS; i++) {
+		snprintf(term, sizeof(term), "L%uT%u", w->id, i);
+		snprintf(want, sizeof(want), "libcheck %u %u", w->id, i);
+		memset(&seen, 0, sizeof(seen));
+		if (nomlib_lookup(w->lib, (i % 2) ? "NET" : NULL, term, collect, &seen) != NOM_OK || seen.rows != 2 ||
+				seen.lastdefno != 1 || strcmp(seen.meaning, "alternate") != 0) {
+			fprintf(stderr, "lookup of %s returned %lld rows\n", term, (long long)seen.rows);
+			w->fails++;
+		}
+		/* Stopping after the first row leaves the primary behind */
+		memset(&seen, 0, sizeof(seen));
+		seen.stopat = 1;
+		if (nomlib_lookup(w->lib, NULL, term, collect, &seen) != NOM_OK || seen.rows != 1 || strcmp(seen.meaning, want) != 0) {
+			fprintf(stderr, "lookup of %s found \"%s\"\n", term, seen.meaning);
+			w->fails++;
+		}
+	}
+
+	snprintf(want, sizeof(want), "libcheck %u ", w->id);
+	memset(&seen, 0, sizeof(seen));
+	if (nomlib_search(w->lib, NULL, want, 0, collect, &seen) != NOM_OK || seen.rows != CHECK_TERMS) {
+		fprintf(stderr, "search for \"%s\" found %lld rows\n", want, (long long)seen.rows);
+		w->fails++;
+	}
+	memset(&seen, 0, sizeof(seen));
+	if (nomlib_search(w->lib, "net", want, 0, collect, &seen) != NOM_OK || seen.rows != CHECK_TERMS / 2) {
+		fprintf(stderr, "search for \"%s\" in NET found %lld rows\n", want, (long long)seen.rows);
+		w->fails++;
+	}
+	/* A page of the listing, which has to include at least this thread's own terms */
+	snprintf(term, sizeof(term), "L%uT", w->id);
+	memset(&seen, 0, sizeof(seen));
+	if (nomlib_iterate(w->lib, NULL, term, CHECK_TERMS, collect, &seen) != NOM_OK || seen.rows != CHECK_TERMS ||
+			(strcmp(seen.catg, "NET") != 0 && strcmp(seen.catg, "UNCAT") != 0)) {
+		fprintf(stderr, "listing after %s returned %lld rows\n", term, (long long)seen.rows);
+		w->fails++;
+	}
+	/* Strings that can't fit a DEFLEN buffer with their terminator are refused before anything runs */
+	memset(longarg, 'A', sizeof(longarg) - 1);
+	longarg[sizeof(longarg) - 1] = 0;
+	if (nomlib_add(w->lib, NULL, longarg, "too long") != BADARGS || nomlib_add(w->lib, NULL, term, longarg) != BADARGS ||
+			nomlib_lookup(w->lib, NULL, longarg, collect, &seen) != BADARGS ||
+			nomlib_search(w->lib, NULL, longarg, 0, collect, &seen) != BADARGS ||
+			nomlib_iterate(w->lib, longarg, NULL, 1, collect, &seen) != BADARGS) {
+		fprintf(stderr, "%s\n", "an argument of DEFLEN bytes was taken");
+		w->fails++;
+	}
+	return(NULL);
+}
+
+static int
+collect(void *arg, const char *catg, const char *term, const char *meaning, int64_t defno) {
+	struct seen *seen;
+	seen = arg;
+	(void)term;
+
+	seen->rows++;
+	seen->lastdefno = defno;
+	snprintf(seen->meaning, sizeof(seen->meaning), "%s", meaning);
+	snprintf(seen->catg, sizeof(seen->catg), "%s", (catg != NULL) ? catg : "");
+	return(seen->stopat > 0 && seen->rows >= seen->stopat);
+}
@@ -0,0 +1,197 @@
+/* 
+ * Copyright (c) 2019, Exile Heavy Industries
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted (subject to the limitations in the disclaimer
+ * below) provided that the following conditions are met:
+ * 
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ * 
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * 
+ * * Neither the name of the copyright holder nor the names of its contributors may be used
+ *   to endorse or promote products derived from this software without specific
+ *   prior written permission.
+ * 
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY THIS
+ * LICENSE. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+/*
+ * Allocator microbenchmark, the system allocator against the arena
+ *
+ * Builds a small database from the given init script, then times a run of
+ * one-shot "commands" under each allocator: open the database, look a term
+ * up, run a keyword search and close again, which is what a typical nombre
+ * invocation does. Blocks a command frees are reused from the free lists
+ * by the next one. Reports the time and the number of trips to malloc(3)
+ * per command.
+ *
+ * Usage: membench init.sql [commands]
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifndef NOMBRE_NOMMEM_H
+#include "../nommem.h"
+#endif
+
+#define BENCH_DB "test/membench.db"
+#define BENCH_TERMS 2000
+
+bool dbg = false;
+
+static sqlite3_mem_methods sysmem;
+static uint64_t syscalls;
+
+static int mkbenchdb(const char *initsql);
+static int command(void);
+static double run(const char *name, unsigned int ncmds, bool arena);
+static void *countmalloc(int n);
+static void *countrealloc(void *p, int n);
+
+int
+main(int argc, char *argv[]) {
+	unsigned int ncmds = 2000;
+	sqlite3_mem_methods counting;
+
+	if (argc < 2 || (argc > 2 && (ncmds = (unsigned int)strtoul(argv[2], NULL, 10)) == 0)) {
+		fprintf(stderr, "usage: %s init.sql [commands]\n", argv[0]);
+		return(1);
+	}
+	/* Wrap the default allocator so its malloc(3) calls can be counted too */
+	sqlite3_config(SQLITE_CONFIG_GETMALLOC, &sysmem);
+	counting = sysmem;
+	counting.xMalloc = countmalloc;
+	counting.xRealloc = countrealloc;
+	sqlite3_config(SQLITE_CONFIG_MALLOC, &counting);
+	if (mkbenchdb(argv[1]) != SQLITE_OK) {
+		return(1);
+	}
+
+	printf("%-16s %12s %16s\n", "allocator", "us/command", "mallocs/command");
+	run("system", ncmds, false);
+	sqlite3_shutdown();
+	nom_arenaconf(NOMBRE_ARENA_SIZE);
+	run("arena", ncmds, true);
+	sqlite3_shutdown();
+	unlink(BENCH_DB);
+	return(0);
+}
+
+static int
+mkbenchdb(const char *initsql) {
+	int retc;
+	FILE *in;
+	char *sql, *errmsg;
+	long len;
+	sqlite3 *db;
+	retc = SQLITE_ERROR; in = NULL; sql = errmsg = NULL; len = 0; db = NULL;
+
+	unlink(BENCH_DB);
+	if ((in = fopen(initsql, "r")) == NULL || fseek(in, 0, SEEK_END) != 0 || (len = ftell(in)) < 0 ||
+			fseek(in, 0, SEEK_SET) != 0 || (sql = calloc(1, (size_t)len + 1)) == NULL ||
+			fread(sql, 1, (size_t)len, in) != (size_t)len) {
+		perror(initsql);
+		goto MKBENCHDB_EXIT;
+	}
+	if ((retc = sqlite3_open(BENCH_DB, &db)) != SQLITE_OK ||
+			(retc = sqlite3_exec(db, sql, NULL, NULL, &errmsg)) != SQLITE_OK ||
+			(retc = sqlite3_exec(db,
+				"WITH RECURSIVE n(i) AS (SELECT 1 UNION ALL SELECT i + 1 FROM n WHERE i < 2000) "
+				"INSERT OR IGNORE INTO definitions (term, meaning, category) SELECT printf('TERM%05d', i), printf('security definition %d', i), -1 FROM n;",
+				NULL, NULL, &errmsg)) != SQLITE_OK) {
+		fprintf(stderr, "%s: %s\n", initsql, (errmsg != NULL) ? errmsg : sqlite3_errstr(retc));
+	}
+
+MKBENCHDB_EXIT:
+	sqlite3_free(errmsg);
+	sqlite3_close(db);
+	free(sql);
+	if (in != NULL) {
+		fclose(in);
+	}
+	return(retc);
+}
+
+/* One invocation's worth of work: connect, lookup, keyword search, disconnect */
+static int
+command(void) {
+	int retc;
+	sqlite3 *db;
+	sqlite3_stmt *stmt;
+	retc = SQLITE_OK; db = NULL; stmt = NULL;
+
+	if ((retc = sqlite3_open_v2(BENCH_DB, &db, SQLITE_OPEN_READWRITE|SQLITE_OPEN_NOMUTEX, NULL)) == SQLITE_OK &&
+			(retc = sqlite3_prepare_v2(db, "SELECT meaning FROM definitions WHERE term = 'TERM01234';", -1, &stmt, NULL)) == SQLITE_OK) {
+		while ((retc = sqlite3_step(stmt)) == SQLITE_ROW);
+		sqlite3_finalize(stmt);
+		stmt = NULL;
+		if ((retc = sqlite3_prepare_v2(db, "SELECT term FROM definitions WHERE meaning LIKE '%definition 12%';", -1, &stmt, NULL)) == SQLITE_OK) {
+			while ((retc = sqlite3_step(stmt)) == SQLITE_ROW);
+		}
+	}
+	sqlite3_finalize(stmt);
+	sqlite3_close(db);
+	return((retc == SQLITE_DONE) ? SQLITE_OK : retc);
+}
+
+static double
+run(const char *name, unsigned int ncmds, bool arena) {
+	struct timespec start, end;
+	struct nomarena_count_t count;
+	uint64_t calls;
+	unsigned int i;
+	double secs;
+	calls = 0; secs = 0;
+
+	sqlite3_initialize();
+	/* Warm the page cache of the OS and the allocator before timing */
+	command();
+	syscalls = 0;
+	nom_arenacount(&count);
+	calls = count.sysallocs;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < ncmds; i++) {
+		if (command() != SQLITE_OK) {
+			fprintf(stderr, "%s: command %u failed\n", name, i);
+			break;
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	nom_arenacount(&count);
+	calls = arena ? count.sysallocs - calls : syscalls;
+	secs = (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+	printf("%-16s %12.1f %16.1f\n", name, secs * 1e6 / ncmds, (double)calls / ncmds);
+	return(secs);
+}
+
+static void *
+countmalloc(int n) {
+	syscalls++;
+	return(sysmem.xMalloc(n));
+}
+
+static void *
+countrealloc(void *p, int n) {
+	syscalls++;
+	return(sysmem.xRealloc(p, n));
+}
@@ -0,0 +1,162 @@
+/* 
+ * Copyright (c) 2019, Exile Heavy Industries
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted (subject to the limitations in the disclaimer
+ * below) provided that the following conditions are met:
+ * 
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ * 
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * 
+ * * Neither the name of the copyright holder nor the names of its contributors may be used
+ *   to endorse or promote products derived from this software without specific
+ *   prior written permission.
+ * 
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY THIS
+ * LICENSE. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+/*
+ * Throughput microbenchmark for term normalization
+ *
+ * Normalizes the same corpus of terms repeatedly and reports MiB/s for the
+ * old byte-at-a-time ASCII upcase, the vectorized ASCII run alone and the
+ * full nom_normterm(), first over pure ASCII input and then over input where
+ * roughly one term in four carries accented or non-Latin letters. Every pass
+ * starts by copying the pristine corpus back, so all rows pay the same copy.
+ *
+ * Usage: normbench [MiB per row]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifndef NOMBRE_NOMNORM_H
+#include "../nomnorm.h"
+#endif
+
+#define BENCH_TERMS 4096
+#define BENCH_TERMLEN 64
+
+static const char *mixed[] = {
+	"café", "naïve", "straße", "Ελλάδα", "москва", "déjà vu", "ｆｕｌｌ", "jalapen\xcc\x83o"
+};
+
+static char corpus[BENCH_TERMS][BENCH_TERMLEN];
+static char work[BENCH_TERMS][BENCH_TERMLEN];
+static size_t lens[BENCH_TERMS];
+
+static void mkcorpus(unsigned int everymixed);
+static double run(const char *name, size_t (*fn)(char *, size_t), size_t total);
+static size_t upscalar(char *str, size_t len);
+static size_t upvector(char *str, size_t len);
+static size_t upterm(char *str, size_t len);
+
+int
+main(int argc, char *argv[]) {
+	size_t total = 256;
+
+	if (argc > 1 && (total = strtoul(argv[1], NULL, 10)) == 0) {
+		fprintf(stderr, "usage: %s [MiB per row]\n", argv[0]);
+		return(1);
+	}
+	total <<= 20;
+
+	printf("%-28s %10s\n", "ascii", "MiB/s");
+	mkcorpus(0);
+	run("scalar upcase", upscalar, total);
+	run("nom_normascii", upvector, total);
+	run("nom_normterm", upterm, total);
+
+	printf("\n%-28s %10s\n", "mixed (1 in 4 non-ascii)", "MiB/s");
+	mkcorpus(4);
+	run("scalar upcase (ascii only)", upscalar, total);
+	run("nom_normterm", upterm, total);
+	return(0);
+}
+
+/* Fill the corpus with pseudo-random terms, splicing in a UTF-8 word every so often */
+static void
+mkcorpus(unsigned int everymixed) {
+	unsigned int seed = 42;
+	size_t i = 0, j = 0, n = 0;
+
+	for (i = 0; i < BENCH_TERMS; i++) {
+		seed = seed * 1103515245 + 12345;
+		n = 2 + (seed >> 16) % (BENCH_TERMLEN / 2);
+		for (j = 0; j < n; j++) {
+			seed = seed * 1103515245 + 12345;
+			corpus[i][j] = "abcdefghijklmnopqrstuvwxyz0123456789-_ ."[(seed >> 16) % 40];
+		}
+		corpus[i][n] = 0;
+		if (everymixed > 0 && i % everymixed == 0) {
+			snprintf(corpus[i] + n / 2, BENCH_TERMLEN - n / 2, "%s", mixed[(i / everymixed) % (sizeof(mixed) / sizeof(mixed[0]))]);
+		}
+		lens[i] = strlen(corpus[i]);
+	}
+}
+
+static double
+run(const char *name, size_t (*fn)(char *, size_t), size_t total) {
+	struct timespec start, end;
+	size_t done = 0, sink = 0, i = 0;
+	double secs = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	while (done < total) {
+		memcpy(work, corpus, sizeof(work));
+		for (i = 0; i < BENCH_TERMS; i++) {
+			sink += fn(work[i], lens[i]);
+			done += lens[i];
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	secs = (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+	printf("%-28s %10.1f\n", name, (double)done / (1 << 20) / secs);
+	/* Keep the compiler from discarding the work */
+	if (sink == 0) {
+		fputs("", stderr);
+	}
+	return(secs);
+}
+
+/* The upcase() this module replaced, kept as the baseline */
+static size_t
+upscalar(char *str, size_t len) {
+	size_t i = 0;
+
+	for (i = 0; i < len; i++) {
+		if (str[i] >= 'a' && str[i] <= 'z') {
+			str[i] ^= 0x20;
+		}
+	}
+	return(i);
+}
+
+static size_t
+upvector(char *str, size_t len) {
+	return(nom_normascii(str, len));
+}
+
+static size_t
+upterm(char *str, size_t len) {
+	(void)len;
+	return(nom_normterm(str));
+}
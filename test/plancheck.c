@@ -0,0 +1,362 @@
+/* 
+ * Copyright (c) 2019, Exile Heavy Industries
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted (subject to the limitations in the disclaimer
+ * below) provided that the following conditions are met:
+ * 
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ * 
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * 
+ * * Neither the name of the copyright holder nor the names of its contributors may be used
+ *   to endorse or promote products derived from this software without specific
+ *   prior written permission.
+ * 
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY THIS
+ * LICENSE. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+/*
+ * Query plan regression check for the SQL generated by parsecmd.c
+ *
+ * Builds a populated in-memory database from the given init script, runs
+ * every builder and prints the EXPLAIN QUERY PLAN output of each generated
+ * statement. The output is compared against test/plans.expected by
+ * `make plancheck`, and the harness itself exits nonzero when a statement
+ * scans one of the large tables or sorts through a temporary B-tree
+ * without being marked as allowed to. Regenerate the expected plans with:
+ *   test/plancheck nombre.sql > test/plans.expected
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef NOMBRE_H
+#include "../nombre.h"
+#endif
+#ifndef NOMBRE_PARSECMD_H
+#include "../parsecmd.h"
+#endif
+#ifndef NOMBRE_CATMAP_H
+#include "../catmap.h"
+#endif
+#ifndef NOMBRE_EXPORT_H
+#include "../export.h"
+#endif
+#ifndef NOMBRE_IMPORT_H
+#include "../import.h"
+#endif
+#ifndef NOMBRE_NOMNORM_H
+#include "../nomnorm.h"
+#endif
+#ifndef NOMBRE_NOMHITS_H
+#include "../nomhits.h"
+#endif
+#ifndef NOMBRE_CHGLOG_H
+#include "../chglog.h"
+#endif
+#ifndef NOMBRE_NOMCMP_H
+#include "../nomcmp.h"
+#endif
+#ifndef NOMBRE_NOMBLOOM_H
+#include "../nombloom.h"
+#endif
+#ifndef NOMBRE_NOMSCAN_H
+#include "../nomscan.h"
+#endif
+#ifndef NOMBRE_NOMREGEX_H
+#include "../nomregex.h"
+#endif
+#ifndef NOMBRE_NOMTAGS_H
+#include "../nomtags.h"
+#endif
+#ifndef NOMBRE_NOMBLOB_H
+#include "../nomblob.h"
+#endif
+#ifndef NOMBRE_NOMSTATS_H
+#include "../nomstats.h"
+#endif
+#ifndef NOMBRE_NOMDEL_H
+#include "../nomdel.h"
+#endif
+
+#define EQP_PREFIX "EXPLAIN QUERY PLAN "
+
+/* Plans that are allowed to break the rules */
+#define PLAN_SCAN 0x01 /* May scan a large table */
+#define PLAN_SORT 0x02 /* May sort with a temporary B-tree */
+
+extern char *__progname;
+bool dbg = false;
+
+struct plancase {
+	const char *name;
+	int (*build)(nomcmd * restrict, const char ** restrict);
+	unsigned int command;
+	int64_t defno;
+	const char *args[5];
+	const char *sql; /* Used as-is when there is no builder */
+	unsigned int allow;
+};
+
+static int ksearchre(nomcmd * restrict cmdbuf, const char ** restrict args);
+
+static const struct plancase cases[] = {
+	{ "lookup", nombre_lookup, lookup, 0, { "tcp", NULL }, NULL, 0 },
+	{ "lookup/grp", nombre_lookup, lookup|grpcmd, 0, { "net", "tcp", NULL }, NULL, 0 },
+	{ "newdef", nombre_newdef, define, 0, { "tcp", "some", "text", NULL }, NULL, 0 },
+	{ "newdef/grp", nombre_newdef, define|grpcmd, 0, { "net", "tcp", "some", "text", NULL }, NULL, 0 },
+	/* Mirrors the body of the definitions_altdef trigger, which EXPLAIN does not descend into */
+	{ "altdef", NULL, define, 0, { NULL }, 
+		"SELECT 1 FROM definitions WHERE term = 'T10';"
+		"SELECT id, COALESCE((SELECT MAX(defno) FROM altdefs WHERE termid = definitions.id), 0) + 1 FROM definitions WHERE term = 'T10';", 0 },
+	/* Likewise definitions_children and the altdefs_log_* lookup of the term an alternate belongs to */
+	{ "children", NULL, delete, 0, { NULL },
+		"DELETE FROM altdefs WHERE termid = 10; DELETE FROM defrefs WHERE termid = 10;"
+		"SELECT 'altdefs', term, 1 FROM definitions WHERE id = 10;", 0 },
+	{ "ksearch", nombre_ksearch, search, 0, { "proto", NULL }, NULL, PLAN_SCAN },
+	{ "ksearch/grp", nombre_ksearch, search|grpcmd, 0, { "net", "proto", NULL }, NULL, 0 },
+	{ "ksearch/regex", ksearchre, search, 0, { "^trans.*proto", NULL }, NULL, PLAN_SCAN },
+	{ "ksearch/grp-regex", ksearchre, search|grpcmd, 0, { "net", "^trans.*proto", NULL }, NULL, 0 },
+	{ "dbdump", nombre_dbdump, dumpdb, 0, { NULL }, NULL, 0 },
+	{ "dbdump/grp", nombre_dbdump, dumpdb|grpcmd, 0, { "net", NULL }, NULL, 0 },
+	{ "dbdump/grp-list", nombre_dbdump, dumpdb|grpcmd, 0, { NULL }, NULL, 0 },
+	/*
+	 * Deletes walk the term index (altdefs by rowid, tags by id) from one chunk to the next.
+	 * The altdefs scan in del/grp is the foreign key check of dropping the category, which
+	 * SQLite only compiles because this connection inherits foreign_keys=1 from nombre.sql,
+	 * nombre itself never turns foreign keys on
+	 */
+	{ "del/term", NULL, delete, 0, { NULL }, NOMBRE_DEL_PICK(NOMBRE_DEL_EXACT) NOMBRE_DEL_ALTS(NOMBRE_DEL_EXACT)
+		NOMBRE_DEL_REFS(NOMBRE_DEL_EXACT) NOMBRE_DEL_DEFS(NOMBRE_DEL_EXACT), 0 },
+	{ "del/like", NULL, delete, 0, { NULL }, NOMBRE_DEL_PICK(NOMBRE_DEL_LIKES) NOMBRE_DEL_ALTS(NOMBRE_DEL_LIKES)
+		NOMBRE_DEL_REFS(NOMBRE_DEL_LIKES) NOMBRE_DEL_DEFS(NOMBRE_DEL_LIKES), 0 },
+	{ "del/glob", NULL, delete, 0, { NULL }, NOMBRE_DEL_PICK(NOMBRE_DEL_GLOBS) NOMBRE_DEL_ALTS(NOMBRE_DEL_GLOBS)
+		NOMBRE_DEL_REFS(NOMBRE_DEL_GLOBS) NOMBRE_DEL_DEFS(NOMBRE_DEL_GLOBS), 0 },
+	{ "del/grp", NULL, delete|grpcmd, 0, { NULL }, NOMBRE_DEL_CATPICK NOMBRE_DEL_CATMOVE NOMBRE_DEL_ALTPICK NOMBRE_DEL_ALTMOVE
+		NOMBRE_DEL_TAGPICK NOMBRE_DEL_TAGDROP NOMBRE_DEL_CATDROP, PLAN_SCAN },
+	/*
+	 * categories_log_ins makes SQLite compile the foreign key child scans for
+	 * the insert, they only run while a violation is outstanding (FkIfZero)
+	 */
+	{ "newgrp", nombre_newgrp, new|grpcmd, 0, { "TST.Testing", NULL }, NULL, PLAN_SCAN },
+	{ "update", nombre_update, update, 0, { "tcp", "new", "text", NULL }, NULL, 0 },
+	{ "update/alt", nombre_update, update, 1, { "tcp", "new", "text", NULL }, NULL, 0 },
+	{ "update/grp", nombre_update, update|grpcmd, 0, { "sec", "tcp", NULL }, NULL, 0 },
+	{ "import", NULL, import, 0, { NULL }, NOMBRE_IMP_INSERT, 0 },
+	{ "export/plan", NULL, export, 0, { NULL }, NOMBRE_EXP_PLAN, 0 },
+	{ "export/bounds", NULL, export, 0, { NULL }, NOMBRE_EXP_BOUNDS, 0 },
+	/* Only the alternates of a single term are ever sorted */
+	{ "export/part", NULL, export, 0, { NULL }, NOMBRE_EXP_PART, 0 },
+	/* Both walk term_stats_hits_idx in order and stop at the limit */
+	{ "tophits", nombre_tophits, tophit, 0, { NULL }, NULL, PLAN_SCAN },
+	{ "tophits/grp", nombre_tophits, tophit|grpcmd, 0, { "net", NULL }, NULL, PLAN_SCAN },
+	{ "hitfold", NULL, tophit, 0, { NULL }, NOMBRE_HITS_UPSERT, 0 },
+	/* sqlite_sequence holds one row per AUTOINCREMENT table */
+	{ "chg/head", NULL, chglog, 0, { NULL }, NOMBRE_CHG_HEAD, PLAN_SCAN },
+	/* c holds only the keys changed in the seq range, each looked up in its table */
+	{ "chg/defs", NULL, chglog, 0, { NULL }, NOMBRE_CHG_DEFS, 0 },
+	{ "chg/alts", NULL, chglog, 0, { NULL }, NOMBRE_CHG_ALTS, 0 },
+	{ "chg/refs", NULL, chglog, 0, { NULL }, NOMBRE_CHG_REFS, 0 },
+	{ "chg/cats", NULL, chglog, 0, { NULL }, NOMBRE_CHG_CATS, 0 },
+	/* Compaction reads the whole log by design */
+	{ "chg/dedup", NULL, chglog, 0, { NULL }, NOMBRE_CHG_DEDUP, PLAN_SCAN },
+	{ "chg/trunc", NULL, chglog, 0, { NULL }, NOMBRE_CHG_TRUNC, 0 },
+	/* The root pass reads everything once, the walk below it only index ranges */
+	{ "cmp/top", NULL, dbcomp, 0, { NULL }, NOMBRE_CMP_TOPDEFS("main") NOMBRE_CMP_TOPALTS("main"), PLAN_SCAN },
+	{ "cmp/range", NULL, dbcomp, 0, { NULL }, NOMBRE_CMP_DEFS("main") NOMBRE_CMP_ALTS("main"), 0 },
+	/* Rebuilding the filter reads every term, off the smallest index that has them */
+	{ "bloom", NULL, lookup, 0, { NULL }, NOMBRE_BLOOM_COUNT NOMBRE_BLOOM_TERMS, PLAN_SCAN },
+	/* The bounds come off either end of the rowid b-tree, each worker then reads only its range */
+	{ "scan/bounds", NULL, search, 0, { NULL }, NOMBRE_SCAN_BOUNDS, 0 },
+	{ "scan/part", NULL, search, 0, { NULL }, NOMBRE_SCAN_PART, 0 },
+	/* Tag edits touch one term, and a query reads containers and then rows by id */
+	{ "tag/term", NULL, tagcmd, 0, { NULL }, NOMBRE_TAG_TERM NOMBRE_TAG_ADD NOMBRE_TAG_DEL NOMBRE_TAG_LIST, 0 },
+	/* A rebuild reads one category off its indexes, only its own terms need sorting into id order */
+	{ "tag/build", NULL, tagcmd|grpcmd, 0, { NULL }, NOMBRE_TAG_ISSTALE NOMBRE_TAG_MEMBERS NOMBRE_TAG_CLEAR NOMBRE_TAG_STORE NOMBRE_TAG_FRESH, PLAN_SORT },
+	{ "tag/query", NULL, tagcmd|grpcmd, 0, { NULL }, NOMBRE_TAG_LOAD NOMBRE_TAG_ROW, 0 },
+	/* Streamed lookups only read row locators, and a streamed add finds its alternate off altdata_idx */
+	{ "blob/lookup", NULL, lookup, 0, { NULL }, NOMBRE_BLOB_LOOKUP NOMBRE_BLOB_GRPLOOKUP, 0 },
+	{ "blob/add", NULL, define, 0, { NULL }, NOMBRE_BLOB_INSERT NOMBRE_BLOB_LASTALT, 0 },
+	/* A summary reads every category once, a recount groups definitions off defcat_idx but has to sort altdefs */
+	{ "sum/list", NULL, catsum, 0, { NULL }, NOMBRE_SUM_LIST, PLAN_SCAN },
+	{ "sum/rebuild", NULL, catsum, 0, { NULL }, NOMBRE_SUM_ZERO NOMBRE_SUM_TERMS("NULL") NOMBRE_SUM_ALTS("NULL"), PLAN_SCAN|PLAN_SORT }
+};
+
+static int mkplandb(sqlite3 **db, const char *initsql);
+static int showplan(sqlite3 *db, const struct plancase *pc, const char *sql);
+
+int
+main(int ac, char **av) {
+	int retc, fails;
+	nomcmd cmd;
+	const char *args[5];
+	fails = 0;
+
+	if (ac != 2) {
+		fprintf(stderr, "usage: %s initsql\n", __progname);
+		return(BADARGS);
+	}
+	memset(&cmd, 0, sizeof(cmd));
+	if ((retc = mkplandb(&cmd.dbcon, av[1])) != SQLITE_OK) {
+		return(retc);
+	}
+
+	for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+		cmd.command = (subcom)cases[i].command;
+		cmd.defno = cases[i].defno;
+		memset(cmd.gensql, 0, sizeof(cmd.gensql));
+		memcpy(args, cases[i].args, sizeof(args));
+		if (cases[i].build != NULL && (retc = cases[i].build(&cmd, args)) != NOM_OK) {
+			fprintf(stderr, "%s: builder failed with %d\n", cases[i].name, retc);
+			fails++;
+			continue;
+		}
+		fails += showplan(cmd.dbcon, &cases[i], (cases[i].build != NULL) ? cmd.gensql : cases[i].sql);
+	}
+
+	nom_catfree(&cmd);
+	sqlite3_close(cmd.dbcon);
+	if (fails > 0) {
+		fprintf(stderr, "%d statement(s) failed the plan check\n", fails);
+	}
+	return((fails > 0) ? NOM_FAIL : NOM_OK);
+}
+
+/*
+ * Create the schema from the init script, then fill the term tables with
+ * enough rows (20000 terms, every tenth with an alternate) that the planner
+ * treats them as the large tables they are in practice
+ */
+static int
+mkplandb(sqlite3 **db, const char *initsql) {
+	int retc;
+	long sqllen;
+	char *sql, *errmsg;
+	FILE *sqlfile;
+	sql = NULL; errmsg = NULL;
+
+	if ((sqlfile = fopen(initsql, "r")) == NULL) {
+		perror(initsql);
+		return(NOM_FIO_FAIL);
+	}
+	fseek(sqlfile, 0, SEEK_END);
+	sqllen = ftell(sqlfile);
+	rewind(sqlfile);
+	if (sqllen <= 0 || (sql = calloc(1, (size_t)sqllen + 1)) == NULL ||
+			fread(sql, 1, (size_t)sqllen, sqlfile) != (size_t)sqllen) {
+		fclose(sqlfile);
+		free(sql);
+		return(NOM_FIO_FAIL);
+	}
+	fclose(sqlfile);
+
+	if ((retc = sqlite3_open(":memory:", db)) == SQLITE_OK &&
+			(retc = nom_normreg(*db)) == SQLITE_OK &&
+			(retc = nom_scanreg(*db)) == SQLITE_OK &&
+			(retc = nom_regexreg(*db)) == SQLITE_OK &&
+			(retc = sqlite3_exec(*db, sql, NULL, NULL, &errmsg)) == SQLITE_OK) {
+		retc = sqlite3_exec(*db, 
+				"WITH RECURSIVE n(i) AS (SELECT 1 UNION ALL SELECT i + 1 FROM n WHERE i < 20000)"
+				" INSERT INTO definitions (term, meaning, category) SELECT 'T' || i, 'meaning ' || i, i % 5 FROM n;"
+				"WITH RECURSIVE n(i) AS (SELECT 10 UNION ALL SELECT i + 10 FROM n WHERE i < 20000)"
+				" INSERT INTO definitions (term, meaning, category) SELECT 'T' || i, 'alternate ' || i, -1 FROM n;",
+				NULL, NULL, &errmsg);
+	}
+	if (retc != SQLITE_OK) {
+		fprintf(stderr, "Unable to build the plan database: %s\n", (errmsg != NULL) ? errmsg : sqlite3_errstr(retc));
+		sqlite3_free(errmsg);
+	}
+	free(sql);
+	return(retc);
+}
+
+/*
+ * Print the plan of every statement in sql, indented by depth,
+ * and return how many rules were broken
+ */
+static int
+showplan(sqlite3 *db, const struct plancase *pc, const char *sql) {
+	int fails, depth, levels, ids[64];
+	char eqp[BUFSIZE];
+	const char *next, *detail;
+	sqlite3_stmt *stmt;
+	fails = 0;
+	stmt = NULL;
+
+	fprintf(stdout, "== %s\n", pc->name);
+	for (; sql != NULL && *sql != 0; sql = next) {
+		/* Compile the statement on its own first, only to find where it ends */
+		if (sqlite3_prepare_v2(db, sql, -1, &stmt, &next) != SQLITE_OK) {
+			fprintf(stderr, "%s: %s\n", pc->name, sqlite3_errmsg(db));
+			return(fails + 1);
+		}
+		if (stmt == NULL) {
+			break; /* Only whitespace or comments remained */
+		}
+		sqlite3_finalize(stmt);
+		snprintf(eqp, sizeof(eqp), EQP_PREFIX "%.*s", (int)(next - sql), sql);
+		if (sqlite3_prepare_v2(db, eqp, -1, &stmt, NULL) != SQLITE_OK) {
+			fprintf(stderr, "%s: %s\n", pc->name, sqlite3_errmsg(db));
+			return(fails + 1);
+		}
+		fprintf(stdout, "%s\n", &eqp[sizeof(EQP_PREFIX) - 1]);
+		for (levels = 0; sqlite3_step(stmt) == SQLITE_ROW; ) {
+			detail = (const char *)sqlite3_column_text(stmt, 3);
+			/* Rows only name their parent, so walk back up to find the depth */
+			for (depth = levels - 1; depth >= 0 && ids[depth] != sqlite3_column_int(stmt, 1); depth--) { ; }
+			depth++;
+			if (depth < 64) {
+				ids[depth] = sqlite3_column_int(stmt, 0);
+				levels = depth + 1;
+			}
+			fprintf(stdout, "%*s%s\n", (depth + 1) * 2, "", detail);
+			/*
+			 * A coroutine scan only reads back the rows its own SEARCH produced,
+			 * c is the DISTINCT changelog subquery of the chg statements
+			 */
+			if ((pc->allow & PLAN_SCAN) == 0 && strncmp(detail, "SCAN ", 5) == 0 &&
+					strncmp(&detail[5], "categories", 10) != 0 && strncmp(&detail[5], "category_verbose", 16) != 0 &&
+					strncmp(&detail[5], "CONSTANT ROW", 12) != 0 && strncmp(&detail[5], "(subquery-", 10) != 0 &&
+					strcmp(&detail[5], "c") != 0) {
+				fprintf(stderr, "%s: unexpected scan: %s\n", pc->name, detail);
+				fails++;
+			}
+			if ((pc->allow & PLAN_SORT) == 0 && strstr(detail, "USE TEMP B-TREE FOR ORDER BY") != NULL) {
+				fprintf(stderr, "%s: unexpected sort: %s\n", pc->name, detail);
+				fails++;
+			}
+		}
+		sqlite3_finalize(stmt);
+	}
+	return(fails);
+}
+
+/* nombre_ksearch() as key --regex runs it */
+static int
+ksearchre(nomcmd * restrict cmdbuf, const char ** restrict args) {
+	int retc;
+
+	cmdbuf->regex = 1;
+	retc = nombre_ksearch(cmdbuf, args);
+	cmdbuf->regex = 0;
+	return(retc);
+}
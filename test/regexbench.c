@@ -0,0 +1,191 @@
+/* 
+ * Copyright (c) 2019, Exile Heavy Industries
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted (subject to the limitations in the disclaimer
+ * below) provided that the following conditions are met:
+ * 
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ * 
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * 
+ * * Neither the name of the copyright holder nor the names of its contributors may be used
+ *   to endorse or promote products derived from this software without specific
+ *   prior written permission.
+ * 
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY THIS
+ * LICENSE. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+/*
+ * REGEXP benchmark, compiled once per statement against once per row
+ *
+ * Builds a database of generated definitions from the given init script,
+ * spread over the stock categories, then counts the matches of a few
+ * patterns three ways: through the REGEXP registered by nom_regexreg(),
+ * which keeps the compiled pattern between rows, through a function that
+ * compiles the pattern again for every row, and through REGEXP limited to
+ * one category the way grp key runs it. The counts have to agree.
+ *
+ * Usage: regexbench init.sql [rows]
+ */
+
+#include <regex.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifndef NOMBRE_NOMREGEX_H
+#include "../nomregex.h"
+#endif
+
+#define BENCH_DB "test/regexbench.db"
+#define BENCH_ROWS 1000000
+#define BENCH_CATID 1
+
+bool dbg = false;
+
+static const char *patterns[] = { "^entry [0-9]*2, the layer", "(network|layer) session of the routing", "revision 9[0-6],", "^Transport .* Protocol$" };
+static const char *queries[] = {
+	"SELECT count(*) FROM definitions WHERE meaning REGEXP ?1;",
+	"SELECT count(*) FROM definitions WHERE percall(?1, meaning);",
+	"SELECT count(*) FROM definitions WHERE category = ?2 AND meaning REGEXP ?1;"
+};
+static const char *names[] = { "cached", "per-row", "grp" };
+
+static int mkbenchdb(const char *initsql, unsigned int rows);
+static double run(sqlite3 *db, const char *query, const char *pattern, int64_t *matches);
+static void percall(sqlite3_context *ctx, int argc, sqlite3_value **argv);
+
+int
+main(int argc, char *argv[]) {
+	unsigned int rows = BENCH_ROWS;
+	int64_t matches[3];
+	double secs[3];
+	sqlite3 *db;
+	db = NULL;
+
+	if (argc < 2 || (argc > 2 && (rows = (unsigned int)strtoul(argv[2], NULL, 10)) == 0)) {
+		fprintf(stderr, "usage: %s init.sql [rows]\n", argv[0]);
+		return(1);
+	}
+	if (mkbenchdb(argv[1], rows) != SQLITE_OK) {
+		return(1);
+	}
+	if (sqlite3_open(BENCH_DB, &db) != SQLITE_OK || nom_regexreg(db) != SQLITE_OK ||
+			sqlite3_create_function_v2(db, "percall", 2, SQLITE_UTF8, NULL, percall, NULL, NULL, NULL) != SQLITE_OK) {
+		fprintf(stderr, "%s: %s\n", BENCH_DB, sqlite3_errmsg(db));
+		sqlite3_close(db);
+		return(1);
+	}
+
+	printf("%u rows\n%-40s %-8s %10s %10s %8s\n", rows, "pattern", "regexp", "ms", "matches", "speedup");
+	for (size_t p = 0; p < sizeof(patterns) / sizeof(patterns[0]); p++) {
+		/* Once untimed, so every run finds the pages in the OS cache */
+		run(db, queries[0], patterns[p], &matches[0]);
+		for (size_t q = 0; q < 3; q++) {
+			secs[q] = run(db, queries[q], patterns[p], &matches[q]);
+		}
+		if (matches[0] != matches[1]) {
+			fprintf(stderr, "%s: cached and per-row REGEXP disagree!\n", patterns[p]);
+			break;
+		}
+		printf("%-40s %-8s %10.1f %10lld %8s\n", patterns[p], names[1], secs[1] * 1e3, (long long)matches[1], "-");
+		printf("%-40s %-8s %10.1f %10lld %7.1fx\n", patterns[p], names[0], secs[0] * 1e3, (long long)matches[0], secs[1] / secs[0]);
+		printf("%-40s %-8s %10.1f %10lld %7.1fx\n", patterns[p], names[2], secs[2] * 1e3, (long long)matches[2], secs[1] / secs[2]);
+	}
+
+	sqlite3_close(db);
+	unlink(BENCH_DB);
+	return(0);
+}
+
+static int
+mkbenchdb(const char *initsql, unsigned int rows) {
+	int retc;
+	FILE *in;
+	char *sql, *errmsg;
+	char fill[512];
+	long len;
+	sqlite3 *db;
+	retc = SQLITE_ERROR; in = NULL; sql = errmsg = NULL; len = 0; db = NULL;
+
+	unlink(BENCH_DB);
+	if ((in = fopen(initsql, "r")) == NULL || fseek(in, 0, SEEK_END) != 0 || (len = ftell(in)) < 0 ||
+			fseek(in, 0, SEEK_SET) != 0 || (sql = calloc(1, (size_t)len + 1)) == NULL ||
+			fread(sql, 1, (size_t)len, in) != (size_t)len) {
+		perror(initsql);
+		goto MKBENCHDB_EXIT;
+	}
+	/* The same meanings scanbench uses, over categories -1 to 4 */
+	snprintf(fill, sizeof(fill),
+			"WITH RECURSIVE n(i) AS (SELECT 1 UNION ALL SELECT i + 1 FROM n WHERE i < %u) "
+			"INSERT OR IGNORE INTO definitions (term, meaning, category) SELECT printf('TERM%%07d', i), "
+			"printf('Entry %%d, the %%s%%s of the %%s suite, revision %%d, see also %%d', i, "
+			"rtrim(substr('Secure  Layer   layer   Network network Session ', 1 + (i %% 6) * 8, 8)), "
+			"rtrim(substr(' Layer   layer   Session session', 1 + (i %% 4) * 8, 8)), "
+			"rtrim(substr('TransportRouting  Naming   ', 1 + (i %% 3) * 9, 9)), i %% 97, i * 7), i %% 6 - 1 FROM n;", rows);
+	if ((retc = sqlite3_open(BENCH_DB, &db)) != SQLITE_OK ||
+			(retc = sqlite3_exec(db, sql, NULL, NULL, &errmsg)) != SQLITE_OK ||
+			(retc = sqlite3_exec(db, fill, NULL, NULL, &errmsg)) != SQLITE_OK) {
+		fprintf(stderr, "%s: %s\n", initsql, (errmsg != NULL) ? errmsg : sqlite3_errstr(retc));
+	}
+
+MKBENCHDB_EXIT:
+	sqlite3_free(errmsg);
+	sqlite3_close(db);
+	free(sql);
+	if (in != NULL) {
+		fclose(in);
+	}
+	return(retc);
+}
+
+static double
+run(sqlite3 *db, const char *query, const char *pattern, int64_t *matches) {
+	struct timespec start, end;
+	sqlite3_stmt *stmt;
+	stmt = NULL; *matches = -1;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if (sqlite3_prepare_v2(db, query, -1, &stmt, NULL) == SQLITE_OK && sqlite3_bind_text(stmt, 1, pattern, -1, SQLITE_STATIC) == SQLITE_OK &&
+			(sqlite3_bind_parameter_count(stmt) < 2 || sqlite3_bind_int64(stmt, 2, BENCH_CATID) == SQLITE_OK) && sqlite3_step(stmt) == SQLITE_ROW) {
+		*matches = sqlite3_column_int64(stmt, 0);
+	} else {
+		fprintf(stderr, "%s: %s\n", query, sqlite3_errmsg(db));
+	}
+	sqlite3_finalize(stmt);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	return((double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1e9);
+}
+
+/* What REGEXP would cost without the cache: compile, match and free on every row */
+static void
+percall(sqlite3_context *ctx, int argc, sqlite3_value **argv) {
+	regex_t re;
+	(void)argc;
+
+	if (regcomp(&re, (const char *)sqlite3_value_text(argv[0]), NOMBRE_REGEX_FLAGS) != 0) {
+		sqlite3_result_error(ctx, "bad pattern", -1);
+		return;
+	}
+	sqlite3_result_int(ctx, regexec(&re, (const char *)sqlite3_value_text(argv[1]), 0, NULL, 0) == 0);
+	regfree(&re);
+}
@@ -0,0 +1,217 @@
+/* 
+ * Copyright (c) 2019, Exile Heavy Industries
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted (subject to the limitations in the disclaimer
+ * below) provided that the following conditions are met:
+ * 
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ * 
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * 
+ * * Neither the name of the copyright holder nor the names of its contributors may be used
+ *   to endorse or promote products derived from this software without specific
+ *   prior written permission.
+ * 
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY THIS
+ * LICENSE. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+/*
+ * Key search benchmark, the LIKE query against the parallel scan
+ *
+ * Builds a database of generated definitions from the given init script,
+ * then runs the same keyword searches through the LIKE statement that
+ * nombre_ksearch() generates and through nom_scan() with a growing number of
+ * workers. Every run writes its matches to memory, and each scan's output is
+ * checked byte for byte against the LIKE query's before its time is
+ * reported along with the speedup over LIKE.
+ *
+ * Usage: scanbench init.sql [rows]
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifndef NOMBRE_INITDB_H
+#include "../initdb.h"
+#endif
+#ifndef NOMBRE_NOMSCAN_H
+#include "../nomscan.h"
+#endif
+
+#define BENCH_DB "test/scanbench.db"
+#define BENCH_ROWS 500000
+#define BENCH_LIKE "SELECT term, meaning FROM definitions WHERE meaning LIKE('%' || ?1 || '%');"
+
+bool dbg = false;
+
+static const char *terms[] = { "layer", "NETWORK session", "revision 96,", "nosuchthing" };
+
+static int mkbenchdb(const char *initsql, unsigned int rows);
+static double like(sqlite3 *db, const char *term, char **buf, size_t *len, int64_t *rows);
+static double scan(nomcmd *cmdbuf, unsigned int jobs, char **buf, size_t *len, int64_t *rows);
+static double elapsed(const struct timespec *start);
+
+int
+main(int argc, char *argv[]) {
+	unsigned int rows = BENCH_ROWS;
+	unsigned int jobs[] = { 1, 2, 4, 0 };
+	long ncpu;
+	char *want, *got;
+	size_t wantlen, gotlen;
+	int64_t wantrows, gotrows;
+	double base, secs;
+	static nomcmd cmdbuf;
+
+	if (argc < 2 || (argc > 2 && (rows = (unsigned int)strtoul(argv[2], NULL, 10)) == 0)) {
+		fprintf(stderr, "usage: %s init.sql [rows]\n", argv[0]);
+		return(1);
+	}
+	if (mkbenchdb(argv[1], rows) != SQLITE_OK) {
+		return(1);
+	}
+	ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	jobs[3] = (ncpu > 4) ? (unsigned int)ncpu : 8;
+	memccpy(cmdbuf.filedata[NOMBRE_DBFILE], BENCH_DB, 0, (size_t)PATHMAX);
+	if (nom_dbconn(&cmdbuf) != SQLITE_OK) {
+		return(1);
+	}
+
+	printf("%u rows, %ld CPUs\n%-20s %-8s %10s %10s %8s\n", rows, ncpu, "term", "engine", "ms", "matches", "speedup");
+	for (size_t t = 0; t < sizeof(terms) / sizeof(terms[0]); t++) {
+		memccpy(cmdbuf.defdata[NOMBRE_DBTERM], terms[t], 0, (size_t)DEFLEN);
+		/* Once untimed, so every run finds the pages in the OS cache */
+		like(cmdbuf.dbcon, terms[t], &want, &wantlen, &wantrows);
+		free(want);
+		base = like(cmdbuf.dbcon, terms[t], &want, &wantlen, &wantrows);
+		printf("%-20s %-8s %10.1f %10lld %8s\n", terms[t], "like", base * 1e3, (long long)wantrows, "-");
+		for (size_t j = 0; j < sizeof(jobs) / sizeof(jobs[0]); j++) {
+			secs = scan(&cmdbuf, jobs[j], &got, &gotlen, &gotrows);
+			if (gotlen != wantlen || gotrows != wantrows || (wantlen > 0 && memcmp(got, want, wantlen) != 0)) {
+				fprintf(stderr, "%s: scan with %u workers differs from LIKE!\n", terms[t], jobs[j]);
+				free(got);
+				free(want);
+				goto MAIN_EXIT;
+			}
+			printf("%-20s scan/%-3u %10.1f %10lld %7.2fx\n", terms[t], jobs[j], secs * 1e3, (long long)gotrows, base / secs);
+			free(got);
+		}
+		free(want);
+	}
+
+MAIN_EXIT:
+	sqlite3_close_v2(cmdbuf.dbcon);
+	unlink(BENCH_DB);
+	return(0);
+}
+
+static int
+mkbenchdb(const char *initsql, unsigned int rows) {
+	int retc;
+	FILE *in;
+	char *sql, *errmsg;
+	char fill[512];
+	long len;
+	sqlite3 *db;
+	retc = SQLITE_ERROR; in = NULL; sql = errmsg = NULL; len = 0; db = NULL;
+
+	unlink(BENCH_DB);
+	if ((in = fopen(initsql, "r")) == NULL || fseek(in, 0, SEEK_END) != 0 || (len = ftell(in)) < 0 ||
+			fseek(in, 0, SEEK_SET) != 0 || (sql = calloc(1, (size_t)len + 1)) == NULL ||
+			fread(sql, 1, (size_t)len, in) != (size_t)len) {
+		perror(initsql);
+		goto MKBENCHDB_EXIT;
+	}
+	/* Meanings of 50 to 90 bytes, mixing the case of the words searched for */
+	snprintf(fill, sizeof(fill),
+			"WITH RECURSIVE n(i) AS (SELECT 1 UNION ALL SELECT i + 1 FROM n WHERE i < %u) "
+			"INSERT OR IGNORE INTO definitions (term, meaning, category) SELECT printf('TERM%%07d', i), "
+			"printf('Entry %%d, the %%s%%s of the %%s suite, revision %%d, see also %%d', i, "
+			"rtrim(substr('Secure  Layer   layer   Network network Session ', 1 + (i %% 6) * 8, 8)), "
+			"rtrim(substr(' Layer   layer   Session session', 1 + (i %% 4) * 8, 8)), "
+			"rtrim(substr('TransportRouting  Naming   ', 1 + (i %% 3) * 9, 9)), i %% 97, i * 7), -1 FROM n;", rows);
+	if ((retc = sqlite3_open(BENCH_DB, &db)) != SQLITE_OK ||
+			(retc = sqlite3_exec(db, sql, NULL, NULL, &errmsg)) != SQLITE_OK ||
+			(retc = sqlite3_exec(db, fill, NULL, NULL, &errmsg)) != SQLITE_OK) {
+		fprintf(stderr, "%s: %s\n", initsql, (errmsg != NULL) ? errmsg : sqlite3_errstr(retc));
+	}
+
+MKBENCHDB_EXIT:
+	sqlite3_free(errmsg);
+	sqlite3_close(db);
+	free(sql);
+	if (in != NULL) {
+		fclose(in);
+	}
+	return(retc);
+}
+
+/* The query nombre_ksearch() generates, formatted the way runcmd() prints it */
+static double
+like(sqlite3 *db, const char *term, char **buf, size_t *len, int64_t *rows) {
+	struct timespec start;
+	sqlite3_stmt *stmt;
+	FILE *mem;
+	stmt = NULL; *buf = NULL; *len = 0; *rows = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if ((mem = open_memstream(buf, len)) == NULL) {
+		perror("open_memstream");
+		exit(1);
+	}
+	if (sqlite3_prepare_v2(db, BENCH_LIKE, -1, &stmt, NULL) == SQLITE_OK && sqlite3_bind_text(stmt, 1, term, -1, SQLITE_STATIC) == SQLITE_OK) {
+		while (sqlite3_step(stmt) == SQLITE_ROW) {
+			fprintf(mem, "  %s: %s\n", sqlite3_column_text(stmt, 0), sqlite3_column_text(stmt, 1));
+			(*rows)++;
+		}
+	}
+	sqlite3_finalize(stmt);
+	fclose(mem);
+	return(elapsed(&start));
+}
+
+static double
+scan(nomcmd *cmdbuf, unsigned int jobs, char **buf, size_t *len, int64_t *rows) {
+	struct timespec start;
+	FILE *mem;
+	*buf = NULL; *len = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if ((mem = open_memstream(buf, len)) == NULL) {
+		perror("open_memstream");
+		exit(1);
+	}
+	cmdbuf->jobs = jobs;
+	if (nom_scan(cmdbuf, mem, rows) != NOM_OK) {
+		fprintf(stderr, "nom_scan failed with %u workers\n", jobs);
+	}
+	fclose(mem);
+	return(elapsed(&start));
+}
+
+static double
+elapsed(const struct timespec *start) {
+	struct timespec end;
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	return((double)(end.tv_sec - start->tv_sec) + (double)(end.tv_nsec - start->tv_nsec) / 1e9);
+}